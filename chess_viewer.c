@@ -4,16 +4,34 @@
 // Compile (Linux/Mac): gcc chess_viewer.c -o chess_viewer -lSDL2 -lSDL2_image
 // Windows: Use a setup like MinGW or Visual Studio with SDL2 libs
 
+#ifndef _WIN32
+#define _FILE_OFFSET_BITS 64  // fseeko, ftello and stat past 2 GB on 32-bit systems
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <sys/stat.h>
 #ifdef _WIN32
 #include <windows.h>
+#include <conio.h>
+#include <io.h>
 #else
 #include <dirent.h>
 #include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <termios.h>
+#include <poll.h>
+#include <signal.h>
 #endif
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
@@ -28,25 +46,206 @@
 #define MOVE_DELAY_MAX_MS 20000
 #define MOVE_DELAY_STEP_MS 500
 #define MOVE_ANIM_MS 300
+#define TURBO_DELAY_MS 50
+#define TURBO_DELAY_MIN_MS 10
+#define TURBO_DELAY_MAX_MS 400
+#define TURBO_DELAY_STEP_MS 10
+#define TURBO_GAME_OVER_PAUSE_MS 1000
+#define INDEX_FILE_NAME "chess_viewer.idx"
+#define INDEX_MAGIC 0x58495643u
+#define INDEX_VERSION 15
+#define INDEX_SHARD_DIR "chess_viewer.idx.d"
+#define INDEX_SHARD_MAGIC 0x44534943u
+#define INDEX_SLICE_MAGIC 0x4C535643u
+#define INDEX_SHARD_BUDGET (64u << 20)
+#define INDEX_WATCH_MS 5000
+#define POSTING_BLOCK 128
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_HASHES 7
+#define MAX_SEGMENTS 8
+#define HIGHLIGHT_LEAD_PLIES 4
+#define HIGHLIGHT_TAIL_PLIES 2
+#define HIGHLIGHT_FINAL_PLIES 12
+#define HIGHLIGHT_SWING 2
+#define PLY_CAPTURE 1
+#define PLY_CHECK 2
+#define PLY_PROMOTION 4
+#define PLY_SWING 8
+#define PLY_TACTIC 16
+#define POSITION_MIN_PLY 8
+#define PUZZLE_FILE_NAME "chess_viewer.pzl"
+#define PUZZLE_MAGIC 0x4C5A5043u
+#define PUZZLE_VERSION 2
+#define PUZZLE_CHECKPOINT_VERSION 3
+#define PUZZLE_CHECKPOINT_GAMES 64
+#define PUZZLE_DEPTH 4
+#define PUZZLE_MIN_PLY 10
+#define PUZZLES_PER_GAME 3
+#define PUZZLE_WIN_CP 250
+#define PUZZLE_ALT_CP 60
+#define PUZZLE_MAX_WORKERS 64
+#define PUZZLE_PAUSE_MS 2500
+#define TOP_SKETCH_SIZE 8192
+#define TOP_MAX_WORKERS 16
+#define POSITION_MAX_PLY 40
+#define NOVELTY_MAX_PLY 80
+#define VISIT_LISTED 0x80  // above every ply up to NOVELTY_MAX_PLY
+#define NO_NOVELTY 0xFFFF
+#define INTEREST_FLOOR 0.1f
+#define INTEREST_FULL_PLIES 120
+#define INTEREST_FULL_SWINGS 6
+#define INTEREST_RATING_LOW 2000
+#define INTEREST_RATING_HIGH 2800
+#define DIVERGENCE_LEAD_PLIES 4
+#define DIVERGENCE_MAX_CANDIDATES 64
 #define NAME_LEN 128
 #define YEAR_LEN 5
 #define RESULT_LEN 16
 #define GAME_OVER_PAUSE_MS 10000
 #define KING_FLIP_MS 800
 #define SPEED_MESSAGE_MS 1500
+#define STATUS_MESSAGE_MS 2500
+#define STATUS_TEXT_LEN 48
 #define CURSOR_IDLE_MS 2500
 #define GAME_NAV_PREV -1
 #define GAME_NAV_NONE 0
 #define GAME_NAV_NEXT 1
 #define GAME_NAV_RESTART 2
 #define GAME_NAV_SELECT 3
+#define CATALOG_SNAPSHOT_LINES 64
+#define CATALOG_LABEL_LEN 96
+#define SNAPSHOT_FRESH 4
+#define TEXT_CACHE_SIZE 96
+#define TEXT_CACHE_KEY_LEN 128
+#define SPRITE_ATLAS_COLS 6
+#define MAX_VIEWERS 8
+#define INPUT_QUEUE_SIZE 256
+#define PREFETCH_SLOTS 8
+#define PGN_SOURCE_FILE 0
+#define ARCHIVE_STORED 1
+#define ARCHIVE_DEFLATED 2
+#define INFLATE_WINDOW 32768
+#define INFLATE_FAST_BITS 9
+#define INFLATE_INPUT_BUF 16384
+#define INFLATE_CHECKPOINT_SPAN (8 * 1024 * 1024)
+#define PGN_STREAM_BUF 16384
+#define SCID_SOURCE 3
+#define SCID_INDEX_HEADER 182
+#define SCID_INDEX_ENTRY 47
+#define SCID_NAME_HEADER 36
+#define SCID_FLAG_DELETE 0x0008
+#define SCID_NAG 11
+#define SCID_COMMENT 12
+#define SCID_START_VARIATION 13
+#define SCID_END_VARIATION 14
+#define SCID_END_GAME 15
+#define SCID_MAX_DEPTH 64
+#define SCID_CACHE_SLOTS 4
+#define SCID_RANDOM_TRIES 16
+#define SCID_TEXT_LEN 65536
+#define MAX_LEGAL_MOVES 256
+#define SEARCH_MAX_PLY 64
+#define SEARCH_MATE 30000
+#define SEARCH_INFINITE 32000
+#define CASTLE_WHITE_SHORT 1
+#define CASTLE_WHITE_LONG 2
+#define CASTLE_BLACK_SHORT 4
+#define CASTLE_BLACK_LONG 8
+#define EVAL_DEPTH 4
+#define EVAL_TEXT_LEN 64  // room for every field at full int width
+#define EVAL_BOUND_EXACT 0
+#define EVAL_BOUND_LOWER 1
+#define EVAL_BOUND_UPPER 2
+#define EVAL_CACHE_FILE_NAME "chess_viewer.evc"
+#define EVAL_CACHE_MAGIC 0x43455643u
+#define EVAL_CACHE_VERSION 2
+#define EVAL_CACHE_BUCKETS (1 << 18)
+#define EVAL_CACHE_WAYS 4
+#define TB_MAX_PIECES 5
+#define TB_MAX_TABLES 512
+#define TB_CACHE_SIZE 4096
+#define TB_TEXT_LEN 40
+#define TB_WDL 0
+#define TB_DTZ 1
+#define TB_FAIL 0
+#define TB_OK 1
+#define TB_CHANGE_STM 2
+#define TB_ZEROING_BEST_MOVE 3
+#define TB_FLAG_STM 1
+#define TB_FLAG_MAPPED 2
+#define TB_FLAG_WIN_PLIES 4
+#define TB_FLAG_LOSS_PLIES 8
+#define TB_FLAG_WIDE 16
+#define TB_FLAG_SINGLE_VALUE 128
+#define CONTROL_MAX_CLIENTS 8
+#define CONTROL_MAX_COMMANDS 32
+#define CONTROL_ARG_LEN 256
+#define CONTROL_BUFFER_LEN 4096
+#define CONTROL_CMD_PAUSE 1
+#define CONTROL_CMD_RESUME 2
+#define CONTROL_CMD_NAV 3
+#define CONTROL_CMD_SPEED 4
+#define CONTROL_CMD_TURBO 5
+#define CONTROL_CMD_HIGHLIGHTS 6
+#define CONTROL_CMD_LOAD 7
+#define CONTROL_CMD_PLAYLIST 8
+#define CONTROL_CMD_QUIT 9
+#define CONTROL_FX_END_GAME 1
+#define CONTROL_FX_PAUSE 2
+#define CONTROL_FX_RESUME 4
+#define SHM_MAGIC 0x4D485643u
+#define SHM_VERSION 2
+#define SHM_NAME_LEN 128
+#define SHM_PATH_LEN 256
+#define SHM_FEN_LEN 96
+#define SHM_FRAME_SLOTS 3
+#define SHM_CLIENT_POLL_MS 5
+#define SHM_FLAG_PAUSED 1
+#define SHM_FLAG_TURBO 2
+#define SHM_FLAG_HIGHLIGHTS 4
+#define SHM_FLAG_SPLIT 8
+#define SHM_FLAG_ANALYSIS 16
+#define SHM_FLAG_GUESS 32
+#define TERM_ROWS 14
+#define TERM_COLS 64
+#define TERM_SPLIT_COL 30
+#define TERM_OUT_LEN 8192
+#define TERM_TICK_MS 20
+#define TERM_DEFAULT_COLOR 256
+#define TERM_LIGHT_BG 180
+#define TERM_DARK_BG 137
+#define TERM_DIM_LIGHT_BG 248
+#define TERM_DIM_DARK_BG 243
+#define TERM_MARK_BG 208
+#define TERM_WHITE_FG 231
+#define TERM_BLACK_FG 16
+#define TERM_TEXT_FG 255
+#define TERM_LABEL_FG 245
 
 #ifdef _WIN32
 #define PATH_SEP '\\'
 #define PATH_SEP_STR "\\"
+#define TB_PATH_SEP ";"
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
 #else
 #define PATH_SEP '/'
 #define PATH_SEP_STR "/"
+#define TB_PATH_SEP ":"
+#endif
+
+// 64-bit file sizes and offsets: long is 32 bits on Windows, and archives run past 2 GB.
+#ifdef _WIN32
+typedef struct _stat64 FileStat;
+#define file_stat(path, st) _stat64((path), (st))
+#define file_seek(fp, offset, whence) _fseeki64((fp), (__int64)(offset), (whence))
+#define file_tell(fp) ((Sint64)_ftelli64(fp))
+#else
+typedef struct stat FileStat;
+#define file_stat(path, st) stat((path), (st))
+#define file_seek(fp, offset, whence) fseeko((fp), (off_t)(offset), (whence))
+#define file_tell(fp) ((Sint64)ftello(fp))
 #endif
 
 typedef struct {
@@ -54,50 +253,11 @@ typedef struct {
     int type;
 } CatalogEntry;
 
-char board[BOARD_SIZE][BOARD_SIZE];
-SDL_Window *window = NULL;
-SDL_Renderer *renderer = NULL;
-SDL_Texture *piece_textures[256] = {NULL};
-char current_white_name[NAME_LEN] = "White";
-char current_black_name[NAME_LEN] = "Black";
-char current_game_year[YEAR_LEN] = "";
 const char *games_dir_root = DEFAULT_GAMES_DIR;
-int show_loser_king = 0;
-int loser_is_white = 0;
-float loser_king_angle = 180.0f;
-int show_draw_kings = 0;
-float draw_king_angle = 90.0f;
-int view_from_white = 1;
-int dim_board = 0;
-int pause_buffered = 0;
-int move_delay_ms = MOVE_DELAY_MS;
-Uint32 speed_message_until = 0;
-int analysis_mode = 0;
-int show_help = 0;
-int guess_mode = 0;
-int guess_score = 0;
-int turn_is_white = 1;
-int game_nav_request = GAME_NAV_NONE;
-int catalog_active = 0;
-int catalog_selection_made = 0;
-CatalogEntry *catalog_entries = NULL;
-int catalog_entry_count = 0;
-int catalog_index = 0;
-int catalog_scroll = 0;
-char *forced_pgn_path = NULL;
-char catalog_dir[1024] = "";
-int analysis_saved_dim = 0;
-int analysis_saved_show_loser_king = 0;
-int analysis_saved_show_draw_kings = 0;
-char analysis_saved_board[BOARD_SIZE][BOARD_SIZE];
-unsigned char analysis_marks[BOARD_SIZE][BOARD_SIZE];
+int start_in_turbo = 0;
+int start_in_highlights = 0;
 SDL_Cursor *analysis_cursor = NULL;
-int mark_dragging = 0;
-int mark_drag_value = 1;
-int mark_last_r = -1;
-int mark_last_f = -1;
-int cursor_visible = 1;
-Uint32 last_mouse_activity = 0;
+SDL_Surface *piece_surfaces[256] = {NULL};
 
 typedef struct {
     int square;
@@ -106,6 +266,7 @@ typedef struct {
     int screen_w;
     int screen_h;
     int board_px;
+    int from_white;
 } BoardView;
 
 typedef struct {
@@ -116,43 +277,491 @@ typedef struct {
     int skip_r1, skip_f1;
 } Overlay;
 
-int is_in_check(int is_white);
+// A move slide in board coordinates; the renderer interpolates it against the clock.
+typedef struct {
+    int active;
+    char piece;
+    int from_r, from_f;
+    int to_r, to_f;
+    Uint32 start;
+    Uint32 duration;
+} MoveAnim;
+
+// Position before every ply of the game being played, plus what each ply did. Built
+// once when the game starts so stepping and highlight jumps are a copy, not a replay.
+typedef struct {
+    char (*boards)[BOARD_SIZE][BOARD_SIZE];
+    unsigned char *flags;
+    int ply_count;
+    int capacity;
+} PlyCache;
+
+// Everything the renderer needs for one frame. The logic thread fills one of these
+// and hands it over; the renderer never reads the logic globals directly.
+typedef struct {
+    char board[BOARD_SIZE][BOARD_SIZE];
+    unsigned char marks[BOARD_SIZE][BOARD_SIZE];
+    Overlay overlay;
+    MoveAnim anim;
+    int view_from_white;
+    int analysis_mode;
+    int guess_mode;
+    int dim_board;
+    int show_loser_king;
+    int loser_is_white;
+    int show_draw_kings;
+    Uint32 king_anim_start;
+    int white_in_check;
+    int black_in_check;
+    int show_help;
+    Uint32 speed_message_until;
+    int move_delay_ms;
+    int turbo_mode;
+    int highlights_mode;
+    Uint32 status_until;
+    char status_text[STATUS_TEXT_LEN];
+    int split_active;
+    int split_diverged;
+    int split_move_number;
+    char split_board[BOARD_SIZE][BOARD_SIZE];
+    signed char split_squares[2][4];
+    char split_white_name[NAME_LEN];
+    char split_black_name[NAME_LEN];
+    char split_year[YEAR_LEN];
+    int guess_score;
+    int turn_is_white;
+    char white_name[NAME_LEN];
+    char black_name[NAME_LEN];
+    char year[YEAR_LEN];
+    char tb_text[TB_TEXT_LEN];
+    char eval_text[EVAL_TEXT_LEN];
+    int catalog_active;
+    int catalog_highlight;
+    int catalog_line_count;
+    int catalog_max_len;
+    char catalog_lines[CATALOG_SNAPSHOT_LINES][CATALOG_LABEL_LEN];
+} FrameSnapshot;
+
+// Lock-free triple buffer: the producer owns `back`, the consumer owns `front`, and the
+// most recently published slot sits in `middle` with SNAPSHOT_FRESH set until taken.
+typedef struct {
+    FrameSnapshot slots[3];
+    SDL_atomic_t middle;
+    int back;
+    int front;
+} SnapshotBuffer;
+
+typedef struct {
+    SDL_Texture *texture;
+    char text[TEXT_CACHE_KEY_LEN];
+    int scale;
+    SDL_Color color;
+    int w, h;
+    Uint32 last_used;
+} TextCacheEntry;
+
+// Render-thread caches derived from the output size. Everything here is rebuilt lazily
+// after a window size, display, or render target reset marks the layout dirty.
+typedef struct {
+    int valid;
+    int can_target;
+    BoardView view;
+    SDL_Texture *board_tex;
+    int board_tex_px;
+    SDL_Color board_light;
+    SDL_Color board_dark;
+    SDL_Texture *sprite_atlas;
+    int sprite_square;
+    TextCacheEntry text[TEXT_CACHE_SIZE];
+    Uint32 text_clock;
+} RenderCache;
+
+// Input handed from the main thread to one logic thread. Single producer, single consumer.
+typedef struct {
+    SDL_Event events[INPUT_QUEUE_SIZE];
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+} InputQueue;
+
+// One window and the game stream playing in it. The render fields belong to the main
+// thread, the playback fields to the viewer's logic thread, and the two only meet
+// through the snapshot buffer, the input queue, and the atomics.
+typedef struct {
+    int index;
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    Uint32 window_id;
+    SDL_Thread *logic_thread;
+    SDL_Texture *piece_textures[256];
+    RenderCache render_cache;
+    SnapshotBuffer frame_buffer;
+    InputQueue input;
+    int has_vsync;
+    int refresh_ms;
+    Uint32 next_frame_due;
+    int have_frame;
+    int needs_redraw;
+    int was_animating;
+
+    // output_size packs the renderer output as (w << 16) | h so both halves change together.
+    SDL_atomic_t output_size;
+    SDL_atomic_t layout_dirty;
+    SDL_atomic_t cursor_wanted;
+    SDL_atomic_t logic_finished;
+    // Display refresh interval, published by the render loop for turbo pacing.
+    SDL_atomic_t frame_ms;
+
+    unsigned int rng_state;
+    int view_size_cached;
+    BoardView view_cached;
+    char board[BOARD_SIZE][BOARD_SIZE];
+    char current_white_name[NAME_LEN];
+    char current_black_name[NAME_LEN];
+    char current_game_year[YEAR_LEN];
+    int show_loser_king;
+    int loser_is_white;
+    int show_draw_kings;
+    Uint32 king_anim_start;
+    int view_from_white;
+    int dim_board;
+    int pause_buffered;
+    int move_delay_ms;
+    int turbo_mode;
+    int turbo_delay_ms;
+    int highlights_mode;
+    PlyCache ply_cache;
+    const char *current_game_path;
+    int current_game_ordinal;
+    int game_serial;
+    Uint32 speed_message_until;
+    Uint32 status_until;
+    char status_text[STATUS_TEXT_LEN];
+    // Divergence view: the partner game's board, its names, and the from/to squares of
+    // the first differing move on each side ([0] current game, [1] partner).
+    int split_active;
+    int split_diverged;
+    int split_move_number;
+    char split_board[BOARD_SIZE][BOARD_SIZE];
+    signed char split_squares[2][4];
+    char split_white_name[NAME_LEN];
+    char split_black_name[NAME_LEN];
+    char split_year[YEAR_LEN];
+    int analysis_mode;
+    int show_help;
+    int guess_mode;
+    int guess_score;
+    int turn_is_white;
+    int puzzle;
+    int novelty_ply;       // from the index; -1 when not known
+    int novelty_seen_ply;  // last ply novelty_update looked at
+    int tb_serial;
+    int tb_ply;
+    char tb_text[TB_TEXT_LEN];
+    int eval_serial;
+    int eval_ply;
+    char eval_text[EVAL_TEXT_LEN];
+    int index_notice_serial;  // last index watcher notice shown
+    int game_nav_request;
+    int catalog_active;
+    int catalog_selection_made;
+    CatalogEntry *catalog_entries;
+    int catalog_entry_count;
+    int catalog_index;
+    int catalog_scroll;
+    char *forced_pgn_path;
+    char **playlist;
+    int playlist_count;
+    int playlist_pos;
+    int playlist_failures;
+    char catalog_dir[1024];
+    int analysis_saved_dim;
+    int analysis_saved_show_loser_king;
+    int analysis_saved_show_draw_kings;
+    char analysis_saved_board[BOARD_SIZE][BOARD_SIZE];
+    unsigned char analysis_marks[BOARD_SIZE][BOARD_SIZE];
+    int mark_dragging;
+    int mark_drag_value;
+    int mark_last_r;
+    int mark_last_f;
+    int cursor_visible;
+    Uint32 last_mouse_activity;
+    MoveAnim move_anim;
+} Viewer;
+
+Viewer viewers[MAX_VIEWERS];
+int viewer_count = 0;
+
+// One parsed control command. `value` is the navigation, the delay in ms, or the
+// on/off state (-1 toggles); `relative` marks a speed change given as +/-ms.
+typedef struct {
+    int type;
+    int value;
+    int relative;
+    char arg[CONTROL_ARG_LEN];
+} ControlCommand;
+
+// The commands of one batch meant for one viewer, applied together between frames.
+typedef struct {
+    int count;
+    ControlCommand commands[CONTROL_MAX_COMMANDS];
+} ControlBatch;
+
+// Local control channel: a Unix-domain socket, or a named pipe on Windows that takes
+// one client at a time (slot 0). Polled from the main loop and never waited on.
+typedef struct {
+    int active;
+#ifdef _WIN32
+    HANDLE pipe;
+    int connected;
+#else
+    int listen_fd;
+    int fds[CONTROL_MAX_CLIENTS];
+#endif
+    char path[CONTROL_ARG_LEN];
+    char buffers[CONTROL_MAX_CLIENTS][CONTROL_BUFFER_LEN];
+    int lengths[CONTROL_MAX_CLIENTS];
+} ControlServer;
+
+ControlServer control;
+Uint32 control_event_type = (Uint32)-1;
+
+// One file inside a zip or tar archive. Zip members only know their local header
+// until opened; data_offset stays -1 until then.
+typedef struct {
+    char *name;
+    int method;
+    Sint64 header_offset;
+    Sint64 data_offset;
+    Sint64 packed_size;
+    Sint64 size;
+} ArchiveMember;
+
+// A canonical Huffman code. Codes of up to INFLATE_FAST_BITS bits decode with one
+// lookup in `fast`, indexed by the next input bits (symbol << 4 | length, 0 for a
+// longer code); only the rare longer ones walk counts and symbols bit by bit.
+typedef struct {
+    short counts[16];
+    short symbols[288];
+    unsigned short fast[1 << INFLATE_FAST_BITS];
+} Huffman;
+
+// Where inflating a member can resume without starting over: a block boundary `bits`
+// into the packed data, with `out` bytes produced before it and the window as it was
+// then. Recorded every INFLATE_CHECKPOINT_SPAN bytes while indexing; window_checksum
+// lets a reader check the one it uses without reading the others.
+typedef struct {
+    Sint64 out;
+    Sint64 bits;
+    Uint64 window_checksum;
+    unsigned char window[INFLATE_WINDOW];
+} InflateCheckpoint;
+
+// Streaming inflate (RFC 1951). State is kept between symbols so the reader can stop
+// whenever the caller's buffer is full and resume on the next call. Input is read in
+// blocks of INFLATE_INPUT_BUF and kept a few bytes ahead in bit_buf.
+typedef struct {
+    FILE *fp;
+    Sint64 packed_size;
+    Sint64 packed_left;  // not yet read from the file
+    int in_pos;
+    int in_len;
+    Uint32 bit_buf;
+    int bit_count;
+    int block_type;
+    int final_block;
+    Uint32 stored_left;
+    int copy_len;
+    int copy_dist;
+    int error;
+    Sint64 total_out;
+    InflateCheckpoint *checkpoints;  // recorded when checkpoint_next > 0
+    int checkpoint_count;
+    int checkpoint_cap;
+    Sint64 checkpoint_next;
+    Huffman lit;
+    Huffman dist;
+    unsigned char window[INFLATE_WINDOW];
+    unsigned char in[INFLATE_INPUT_BUF];
+} Inflater;
+
+// A PGN being read: a plain file, or one archive member decoded on the fly. Offsets
+// are always positions in the uncompressed PGN text. `resume`, if set, is a
+// checkpoint pgn_seek may jump to instead of inflating from the member's start.
+typedef struct {
+    FILE *fp;
+    int method;
+    ArchiveMember member;
+    Inflater *inflater;
+    const InflateCheckpoint *resume;
+    Sint64 filled;
+    int buf_len;
+    int buf_pos;
+    unsigned char buf[PGN_STREAM_BUF];
+} PgnStream;
+
+// A file mapped read-only in full. Empty files map to data == NULL.
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} MappedFile;
+
+// An open Scid 4 database: the .si4 index, .sn4 names and .sg4 games, all mapped.
+// Bases are shared between threads through a small cache and counted by refs.
+typedef struct {
+    char *path;
+    Sint64 mtime;
+    int refs;
+    int cached;
+    MappedFile index;
+    MappedFile names;
+    MappedFile games;
+    Uint32 game_count;
+    Uint32 player_count;
+    Uint32 *player_offsets;  // player id -> offset into player_names
+    char *player_names;
+} ScidBase;
+
+// Board as Scid sees it while decoding: squares a1 = 0 .. h8 = 63, and per side a
+// list of piece squares whose order the move bytes refer to.
+typedef struct {
+    char board[64];
+    unsigned char list[2][16];
+    unsigned char list_pos[64];
+    int count[2];
+    int side;
+} ScidPosition;
+
+typedef struct {
+    const unsigned char *data;
+    size_t pos;
+    size_t end;
+} ScidReader;
+
+
+// A position as the search and the tablebase code see it: the board plus what the
+// board alone can't say.
+typedef struct {
+    char b[BOARD_SIZE][BOARD_SIZE];
+    int white;
+    int ep_file;  // file a pawn may capture en passant on, or -1
+    int castle;   // CASTLE_* rights still held
+} Position;
+
+// One compressed sub-table of a Syzygy file, for one side to move and, in pawn
+// tables, one file of the leading pawn. The pointers go into the mapped file.
+typedef struct {
+    const unsigned char *data;
+    const unsigned char *sparse_index;
+    const unsigned char *block_lengths;
+    const unsigned char *lowest_sym;
+    const unsigned char *btree;
+    Uint64 *base64;
+    unsigned char *symlen;
+    int symlen_count;
+    Uint64 group_idx[TB_MAX_PIECES + 1];
+    int group_len[TB_MAX_PIECES + 1];
+    int pieces[TB_MAX_PIECES];
+    Uint64 block_size;
+    Uint64 span;
+    size_t sparse_index_size;
+    Uint32 blocks_num;
+    Uint32 block_length_size;
+    int flags;
+    int min_sym_len;
+    int max_sym_len;
+    Uint16 map_idx[4];
+} TbPairs;
+
+// The WDL (.rtbw) and DTZ (.rtbz) tables of one material balance, named like KQvKR.
+// Each file is mapped whole the first time it is needed; pages fault in on demand.
+typedef struct {
+    char name[16];
+    int piece_count;
+    int has_pawns;
+    int has_unique;
+    int symmetric;
+    int pawn_count[2];
+    int ready[2];  // per kind: 0 not tried, 1 loaded, -1 missing or unreadable
+    MappedFile file[2];
+    const unsigned char *dtz_map;
+    TbPairs pairs[2][2][4];  // kind, side, leading pawn file
+} TbTable;
+
+typedef struct {
+    Uint64 key;
+    int found;
+    int wdl;
+    int dtz;
+} TbCacheEntry;
+
+typedef struct {
+    int active;
+    SDL_mutex *lock;
+    char **dirs;
+    int dir_count;
+    TbTable *tables[TB_MAX_TABLES];
+    int table_count;
+    SDL_SpinLock cache_lock;
+    TbCacheEntry cache[TB_CACHE_SIZE];
+} Tablebase;
+
+int is_in_check(char b[BOARD_SIZE][BOARD_SIZE], int is_white);
 void board_to_screen(const BoardView *view, int board_r, int board_f, int *out_x, int *out_y);
 int screen_to_board(const BoardView *view, int x, int y, int *out_r, int *out_f);
-void enter_analysis_mode(void);
-void exit_analysis_mode(void);
+void enter_analysis_mode(Viewer *v);
+void exit_analysis_mode(Viewer *v);
 SDL_Cursor *create_analysis_cursor(void);
-void clear_analysis_marks(void);
-int begin_mark_drag(const BoardView *view, int x, int y);
-int update_mark_drag(const BoardView *view, int x, int y);
-void end_mark_drag(void);
-int adjust_move_delay(int delta_ms, Uint32 now);
-void render_speed_label(const BoardView *view);
-void render_help_overlay(const BoardView *view);
-void render_guess_score(const BoardView *view);
-void render_catalog_overlay(const BoardView *view);
-void catalog_free(void);
-void catalog_open(const char *games_dir);
-void catalog_select(const char *games_dir);
-int handle_catalog_event(const SDL_Event *e, const char *games_dir);
-int catalog_total_entries(void);
+void clear_analysis_marks(Viewer *v);
+int begin_mark_drag(Viewer *v, const BoardView *view, int x, int y);
+int update_mark_drag(Viewer *v, const BoardView *view, int x, int y);
+void end_mark_drag(Viewer *v);
+int adjust_move_delay(Viewer *v, int delta_ms, Uint32 now);
+void render_speed_label(Viewer *v, const BoardView *view, const FrameSnapshot *snap);
+void render_help_overlay(Viewer *v, const BoardView *view, const FrameSnapshot *snap);
+void render_guess_score(Viewer *v, const BoardView *view, const FrameSnapshot *snap);
+void render_position_labels(Viewer *v, const BoardView *view, const FrameSnapshot *snap);
+void render_catalog_overlay(Viewer *v, const BoardView *view, const FrameSnapshot *snap);
+void catalog_free(Viewer *v);
+void catalog_open(Viewer *v, const char *games_dir);
+void catalog_select(Viewer *v, const char *games_dir);
+int handle_catalog_event(Viewer *v, const SDL_Event *e, const char *games_dir);
+int catalog_total_entries(Viewer *v);
 char *copy_string(const char *s);
 int has_pgn_extension(const char *name);
+int has_archive_extension(const char *name);
+int split_archive_path(const char *path, char *archive, size_t archive_size, char *member, size_t member_size);
+int archive_list(const char *path, ArchiveMember **out_members);
+void free_archive_members(ArchiveMember *members, int count);
+int pgn_open(PgnStream *s, const char *path);
+int pgn_readable(const char *path);
+int has_scid_extension(const char *name);
+void unmap_file(MappedFile *m);
+ScidBase *scid_acquire(const char *path);
+void scid_release(ScidBase *db);
+void pgn_close(PgnStream *s);
 void free_string_list(char **items, int count);
+int push_string(char ***items, int *count, int *cap, const char *value);
 char *join_path(const char *dir, const char *name);
+static Uint64 checksum64(const void *data, size_t size, Uint64 seed);
 int list_pgn_files(const char *dir, char ***out_files);
 static int list_pgn_files_recursive(const char *dir, const char *base,
                                     char ***out_files, int *count, int *cap);
-void set_cursor_visible(int visible);
-void note_mouse_activity(Uint32 now);
-void update_cursor_auto_hide(Uint32 now);
-void note_mouse_activity_event(const SDL_Event *e);
+void set_cursor_visible(Viewer *v, int visible);
+void note_mouse_activity(Viewer *v, Uint32 now);
+void update_cursor_auto_hide(Viewer *v, Uint32 now);
+void note_mouse_activity_event(Viewer *v, const SDL_Event *e);
+void prefetch_stop(void);
+void index_notice_update(Viewer *v);
 
 static int is_white_piece(char piece) {
     return (piece >= 'A' && piece <= 'Z');
 }
 
-int find_king_pos(char king, int *out_r, int *out_f) {
+int find_king_pos(const char board[BOARD_SIZE][BOARD_SIZE], char king, int *out_r, int *out_f) {
     for (int r = 0; r < BOARD_SIZE; r++) {
         for (int f = 0; f < BOARD_SIZE; f++) {
             if (board[r][f] == king) {
@@ -233,8 +842,8 @@ int text_width_px(const char *text, int scale) {
     return (len * 6 - 1) * scale;
 }
 
-void draw_text(int x, int y, int scale, const char *text, SDL_Color color) {
-    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+static void draw_text_rects(Viewer *v, int x, int y, int scale, const char *text, SDL_Color color) {
+    SDL_SetRenderDrawColor(v->renderer, color.r, color.g, color.b, color.a);
     int pen_x = x;
     for (const char *p = text; *p; p++) {
         const unsigned char *rows = get_glyph_rows(*p);
@@ -242,28 +851,117 @@ void draw_text(int x, int y, int scale, const char *text, SDL_Color color) {
             for (int c = 0; c < 5; c++) {
                 if (rows[r] & (1 << (4 - c))) {
                     SDL_Rect rect = {pen_x + c * scale, y + r * scale, scale, scale};
-                    SDL_RenderFillRect(renderer, &rect);
+                    SDL_RenderFillRect(v->renderer, &rect);
+                }
+            }
+        }
+        pen_x += 6 * scale;
+    }
+}
+
+static SDL_Texture *build_text_texture(Viewer *v, const char *text, int scale, SDL_Color color, int *out_w, int *out_h) {
+    int w = text_width_px(text, scale);
+    int h = 7 * scale;
+    if (w <= 0) return NULL;
+    SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_RGBA32);
+    if (!surface) return NULL;
+    if (SDL_LockSurface(surface) != 0) {
+        SDL_FreeSurface(surface);
+        return NULL;
+    }
+    Uint32 ink = SDL_MapRGBA(surface->format, color.r, color.g, color.b, color.a);
+    Uint32 clear = SDL_MapRGBA(surface->format, 0, 0, 0, 0);
+    int pitch = surface->pitch / 4;
+    Uint32 *pixels = (Uint32 *)surface->pixels;
+    for (int py = 0; py < h; py++) {
+        for (int px = 0; px < w; px++) pixels[py * pitch + px] = clear;
+    }
+    int pen_x = 0;
+    for (const char *p = text; *p; p++) {
+        const unsigned char *rows = get_glyph_rows(*p);
+        for (int r = 0; r < 7; r++) {
+            for (int c = 0; c < 5; c++) {
+                if (!(rows[r] & (1 << (4 - c)))) continue;
+                for (int dy = 0; dy < scale; dy++) {
+                    for (int dx = 0; dx < scale; dx++) {
+                        pixels[(r * scale + dy) * pitch + pen_x + c * scale + dx] = ink;
+                    }
                 }
             }
         }
         pen_x += 6 * scale;
     }
+    SDL_UnlockSurface(surface);
+    SDL_Texture *tex = SDL_CreateTextureFromSurface(v->renderer, surface);
+    SDL_FreeSurface(surface);
+    if (!tex) return NULL;
+    SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+    *out_w = w;
+    *out_h = h;
+    return tex;
+}
+
+// Looks up a rendered label, building it on a miss and evicting the least recently used.
+static TextCacheEntry *get_text_entry(Viewer *v, const char *text, int scale, SDL_Color color) {
+    if (strlen(text) >= TEXT_CACHE_KEY_LEN) return NULL;
+    RenderCache *cache = &v->render_cache;
+    cache->text_clock++;
+    TextCacheEntry *victim = &cache->text[0];
+    for (int i = 0; i < TEXT_CACHE_SIZE; i++) {
+        TextCacheEntry *entry = &cache->text[i];
+        if (entry->texture && entry->scale == scale &&
+            entry->color.r == color.r && entry->color.g == color.g &&
+            entry->color.b == color.b && entry->color.a == color.a &&
+            strcmp(entry->text, text) == 0) {
+            entry->last_used = cache->text_clock;
+            return entry;
+        }
+        if (!entry->texture) {
+            if (victim->texture) victim = entry;
+        } else if (victim->texture && entry->last_used < victim->last_used) {
+            victim = entry;
+        }
+    }
+    int w = 0;
+    int h = 0;
+    SDL_Texture *tex = build_text_texture(v, text, scale, color, &w, &h);
+    if (!tex) return NULL;
+    if (victim->texture) SDL_DestroyTexture(victim->texture);
+    victim->texture = tex;
+    strcpy(victim->text, text);
+    victim->scale = scale;
+    victim->color = color;
+    victim->w = w;
+    victim->h = h;
+    victim->last_used = cache->text_clock;
+    return victim;
+}
+
+void draw_text(Viewer *v, int x, int y, int scale, const char *text, SDL_Color color) {
+    if (text[0] == '\0') return;
+    TextCacheEntry *entry = get_text_entry(v, text, scale, color);
+    if (!entry) {
+        draw_text_rects(v, x, y, scale, text, color);
+        return;
+    }
+    SDL_Rect dst = {x, y, entry->w, entry->h};
+    SDL_RenderCopy(v->renderer, entry->texture, NULL, &dst);
 }
 
-void draw_color_swatch(int x, int y, int size, SDL_Color fill, SDL_Color outline) {
+void draw_color_swatch(Viewer *v, int x, int y, int size, SDL_Color fill, SDL_Color outline) {
     SDL_Rect rect = {x, y, size, size};
-    SDL_SetRenderDrawColor(renderer, fill.r, fill.g, fill.b, fill.a);
-    SDL_RenderFillRect(renderer, &rect);
-    SDL_SetRenderDrawColor(renderer, outline.r, outline.g, outline.b, outline.a);
-    SDL_RenderDrawRect(renderer, &rect);
+    SDL_SetRenderDrawColor(v->renderer, fill.r, fill.g, fill.b, fill.a);
+    SDL_RenderFillRect(v->renderer, &rect);
+    SDL_SetRenderDrawColor(v->renderer, outline.r, outline.g, outline.b, outline.a);
+    SDL_RenderDrawRect(v->renderer, &rect);
 }
 
-void render_year_label(const BoardView *view) {
-    if (current_game_year[0] == '\0') return;
+void render_year_label(Viewer *v, const BoardView *view, const FrameSnapshot *snap) {
+    if (snap->year[0] == '\0') return;
 
     int scale = (view->square >= 60) ? 3 : 2;
     int margin = (view->square >= 60) ? 16 : 8;
-    int text_w = text_width_px(current_game_year, scale);
+    int text_w = text_width_px(snap->year, scale);
     int text_h = 7 * scale;
 
     int x = view->offset_x + margin;
@@ -277,31 +975,110 @@ void render_year_label(const BoardView *view) {
     }
 
     SDL_Color text_color = {255, 255, 255, 255};
-    draw_text(x, y, scale, current_game_year, text_color);
+    draw_text(v, x, y, scale, snap->year, text_color);
 }
 
-int adjust_move_delay(int delta_ms, Uint32 now) {
-    int new_delay = move_delay_ms + delta_ms;
-    if (new_delay < MOVE_DELAY_MIN_MS) new_delay = MOVE_DELAY_MIN_MS;
-    if (new_delay > MOVE_DELAY_MAX_MS) new_delay = MOVE_DELAY_MAX_MS;
-    if (new_delay == move_delay_ms) return 0;
-    move_delay_ms = new_delay;
-    speed_message_until = now + SPEED_MESSAGE_MS;
-    return 1;
+// Top-right tag naming the playback modes that change what is shown.
+void render_mode_label(Viewer *v, const BoardView *view, const FrameSnapshot *snap) {
+    const char *label = NULL;
+    if (snap->turbo_mode && snap->highlights_mode) {
+        label = "TURBO HIGHLIGHTS";
+    } else if (snap->turbo_mode) {
+        label = "TURBO";
+    } else if (snap->highlights_mode) {
+        label = "HIGHLIGHTS";
+    }
+    if (!label) return;
+
+    int scale = (view->square >= 60) ? 3 : 2;
+    int margin = (view->square >= 60) ? 16 : 8;
+    int text_w = text_width_px(label, scale);
+    int text_h = 7 * scale;
+
+    int x = view->offset_x + view->board_px - margin - text_w;
+    int y = view->offset_y + margin;
+    if (view->offset_y >= text_h + 2 * margin) {
+        y = view->offset_y - margin - text_h;
+    } else if (view->screen_w - (view->offset_x + view->board_px) >= text_w + 2 * margin) {
+        x = view->offset_x + view->board_px + margin;
+    }
+
+    SDL_Color text_color = {255, 255, 255, 255};
+    draw_text(v, x, y, scale, label, text_color);
 }
 
-void render_speed_label(const BoardView *view) {
-    if (speed_message_until == 0) return;
-    Uint32 now = SDL_GetTicks();
-    if (now >= speed_message_until) {
-        speed_message_until = 0;
-        return;
+// Tablebase verdict and engine evaluation for the current position, bottom-right like
+// the score is bottom-left. The tablebase line is the lower one when both are shown.
+void render_position_labels(Viewer *v, const BoardView *view, const FrameSnapshot *snap) {
+    if (snap->split_active) return;
+    const char *lines[2] = {snap->tb_text, snap->eval_text};
+    int scale = (view->square >= 60) ? 3 : 2;
+    int margin = (view->square >= 60) ? 16 : 8;
+    int text_h = 7 * scale;
+    int below = (view->screen_h - (view->offset_y + view->board_px) >= 2 * text_h + 3 * margin);
+    int row = 0;
+    for (int i = 0; i < 2; i++) {
+        if (lines[i][0] == '\0') continue;
+        int text_w = text_width_px(lines[i], scale);
+        int x = view->offset_x + view->board_px - margin - text_w;
+        int y = view->offset_y + view->board_px - margin - text_h - row * (text_h + margin);
+        if (below) {
+            y = view->offset_y + view->board_px + margin + row * (text_h + margin);
+        } else if (view->screen_w - (view->offset_x + view->board_px) >= text_w + 2 * margin) {
+            x = view->offset_x + view->board_px + margin;
+        }
+        SDL_Color text_color = {255, 255, 255, 255};
+        draw_text(v, x, y, scale, lines[i], text_color);
+        row++;
+    }
+}
+
+int current_move_delay(const Viewer *v) {
+    return v->turbo_mode ? v->turbo_delay_ms : v->move_delay_ms;
+}
+
+// Turbo keeps its own delay so toggling it never loses the normal playback speed.
+int adjust_move_delay(Viewer *v, int delta_ms, Uint32 now) {
+    int *delay = &v->move_delay_ms;
+    int min_ms = MOVE_DELAY_MIN_MS;
+    int max_ms = MOVE_DELAY_MAX_MS;
+    if (v->turbo_mode) {
+        delay = &v->turbo_delay_ms;
+        min_ms = TURBO_DELAY_MIN_MS;
+        max_ms = TURBO_DELAY_MAX_MS;
+        delta_ms = delta_ms / MOVE_DELAY_STEP_MS * TURBO_DELAY_STEP_MS;
     }
+    int new_delay = *delay + delta_ms;
+    if (new_delay < min_ms) new_delay = min_ms;
+    if (new_delay > max_ms) new_delay = max_ms;
+    if (new_delay == *delay) return 0;
+    *delay = new_delay;
+    v->speed_message_until = now + SPEED_MESSAGE_MS;
+    return 1;
+}
+
+void toggle_turbo(Viewer *v, Uint32 now) {
+    v->turbo_mode = !v->turbo_mode;
+    v->speed_message_until = now + SPEED_MESSAGE_MS;
+}
+
+// Shows a short notice under the board for STATUS_MESSAGE_MS.
+void show_status(Viewer *v, const char *text) {
+    strncpy(v->status_text, text, STATUS_TEXT_LEN - 1);
+    v->status_text[STATUS_TEXT_LEN - 1] = '\0';
+    v->status_until = SDL_GetTicks() + STATUS_MESSAGE_MS;
+}
+
+void render_speed_label(Viewer *v, const BoardView *view, const FrameSnapshot *snap) {
+    if (snap->speed_message_until == 0) return;
+    if (SDL_GetTicks() >= snap->speed_message_until) return;
 
     char buf[32];
-    int whole = move_delay_ms / 1000;
-    int rem = move_delay_ms % 1000;
-    if (rem == 0) {
+    int whole = snap->move_delay_ms / 1000;
+    int rem = snap->move_delay_ms % 1000;
+    if (snap->turbo_mode) {
+        snprintf(buf, sizeof(buf), "Turbo: %d moves/second", 1000 / snap->move_delay_ms);
+    } else if (rem == 0) {
         const char *unit = (whole == 1) ? "second" : "seconds";
         snprintf(buf, sizeof(buf), "%d %s/move", whole, unit);
     } else {
@@ -318,19 +1095,41 @@ void render_speed_label(const BoardView *view) {
 
     int pad = (scale >= 3) ? 4 : 3;
     SDL_Rect bg = {x - pad, y - pad, text_w + pad * 2, text_h + pad * 2};
-    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-    SDL_SetRenderDrawColor(renderer, 80, 80, 80, 180);
-    SDL_RenderFillRect(renderer, &bg);
+    SDL_SetRenderDrawBlendMode(v->renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(v->renderer, 80, 80, 80, 180);
+    SDL_RenderFillRect(v->renderer, &bg);
+
+    SDL_Color text_color = {255, 255, 255, 255};
+    draw_text(v, x, y, scale, buf, text_color);
+}
+
+void render_status_label(Viewer *v, const BoardView *view, const FrameSnapshot *snap) {
+    if (snap->status_until == 0 || snap->status_text[0] == '\0') return;
+    if (SDL_GetTicks() >= snap->status_until) return;
+
+    int scale = (view->square >= 60) ? 3 : 2;
+    int margin = (view->square >= 60) ? 16 : 8;
+    int text_w = text_width_px(snap->status_text, scale);
+    int text_h = 7 * scale;
+    int x = (view->screen_w - text_w) / 2;
+    if (x < margin) x = margin;
+    int y = view->offset_y + view->board_px - margin - text_h;
+
+    int pad = (scale >= 3) ? 4 : 3;
+    SDL_Rect bg = {x - pad, y - pad, text_w + pad * 2, text_h + pad * 2};
+    SDL_SetRenderDrawBlendMode(v->renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(v->renderer, 80, 80, 80, 180);
+    SDL_RenderFillRect(v->renderer, &bg);
 
     SDL_Color text_color = {255, 255, 255, 255};
-    draw_text(x, y, scale, buf, text_color);
+    draw_text(v, x, y, scale, snap->status_text, text_color);
 }
 
-void render_guess_score(const BoardView *view) {
-    if (!guess_mode) return;
+void render_guess_score(Viewer *v, const BoardView *view, const FrameSnapshot *snap) {
+    if (!snap->guess_mode) return;
 
     char buf[32];
-    snprintf(buf, sizeof(buf), "Score: %d", guess_score);
+    snprintf(buf, sizeof(buf), "Score: %d", snap->guess_score);
 
     int scale = (view->square >= 60) ? 3 : 2;
     int margin = (view->square >= 60) ? 16 : 8;
@@ -365,16 +1164,16 @@ void render_guess_score(const BoardView *view) {
         y = view->offset_y + margin;
     }
 
-    SDL_Color fill = turn_is_white ? (SDL_Color){235, 235, 235, 255} : (SDL_Color){25, 25, 25, 255};
-    SDL_Color outline = turn_is_white ? (SDL_Color){30, 30, 30, 255} : (SDL_Color){235, 235, 235, 255};
-    draw_color_swatch(swatch_x, y + (text_h - swatch_size) / 2, swatch_size, fill, outline);
+    SDL_Color fill = snap->turn_is_white ? (SDL_Color){235, 235, 235, 255} : (SDL_Color){25, 25, 25, 255};
+    SDL_Color outline = snap->turn_is_white ? (SDL_Color){30, 30, 30, 255} : (SDL_Color){235, 235, 235, 255};
+    draw_color_swatch(v, swatch_x, y + (text_h - swatch_size) / 2, swatch_size, fill, outline);
 
     SDL_Color text_color = {255, 255, 255, 255};
-    draw_text(x, y, scale, buf, text_color);
+    draw_text(v, x, y, scale, buf, text_color);
 }
 
-void render_help_overlay(const BoardView *view) {
-    if (!show_help) return;
+void render_help_overlay(Viewer *v, const BoardView *view, const FrameSnapshot *snap) {
+    if (!snap->show_help) return;
 
     const char *lines[] = {
         "HELP",
@@ -387,12 +1186,15 @@ void render_help_overlay(const BoardView *view) {
         "  ESC: TOGGLE HELP",
         "  F: FLIP VIEW",
         "  UP/DOWN: SPEED",
+        "  T: TOGGLE TURBO",
+        "  H: TOGGLE HIGHLIGHTS",
         "  RIGHT DRAG: MARK SQUARES",
         "  MIDDLE CLICK: CLEAR MARKS",
         "PLAYBACK:",
         "  SPACE: PAUSE/RESUME",
         "  A: TOGGLE ANALYSIS",
         "  G: TOGGLE GUESS MODE",
+        "  D: COMPARE DIVERGING GAME",
         "PAUSED (SPACE):",
         "  LEFT/RIGHT: STEP MOVES",
         "ANALYSIS (A):",
@@ -424,15 +1226,15 @@ void render_help_overlay(const BoardView *view) {
     int y = (view->screen_h - box_h) / 2;
 
     SDL_Rect bg = {x, y, box_w, box_h};
-    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-    SDL_SetRenderDrawColor(renderer, 80, 80, 80, 180);
-    SDL_RenderFillRect(renderer, &bg);
+    SDL_SetRenderDrawBlendMode(v->renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(v->renderer, 80, 80, 80, 180);
+    SDL_RenderFillRect(v->renderer, &bg);
 
     SDL_Color text_color = {255, 255, 255, 255};
     int text_x = x + pad;
     int text_y = y + pad;
     for (int i = 0; i < line_count; i++) {
-        draw_text(text_x, text_y, scale, lines[i], text_color);
+        draw_text(v, text_x, text_y, scale, lines[i], text_color);
         text_y += text_h + line_gap;
     }
 }
@@ -473,39 +1275,84 @@ static int push_catalog_entry(CatalogEntry **items, int *count, int *cap, const
     return 1;
 }
 
-static void catalog_set_dir(const char *new_dir) {
+static void catalog_set_dir(Viewer *v, const char *new_dir) {
     if (!new_dir) {
-        catalog_dir[0] = '\0';
+        v->catalog_dir[0] = '\0';
         return;
     }
-    strncpy(catalog_dir, new_dir, sizeof(catalog_dir) - 1);
-    catalog_dir[sizeof(catalog_dir) - 1] = '\0';
+    strncpy(v->catalog_dir, new_dir, sizeof(v->catalog_dir) - 1);
+    v->catalog_dir[sizeof(v->catalog_dir) - 1] = '\0';
 }
 
-static void catalog_dir_up(void) {
-    size_t len = strlen(catalog_dir);
+static void catalog_dir_up(Viewer *v) {
+    size_t len = strlen(v->catalog_dir);
     if (len == 0) return;
     for (size_t i = len; i > 0; i--) {
-        if (catalog_dir[i - 1] == '/' || catalog_dir[i - 1] == '\\') {
-            catalog_dir[i - 1] = '\0';
+        if (v->catalog_dir[i - 1] == '/' || v->catalog_dir[i - 1] == '\\') {
+            v->catalog_dir[i - 1] = '\0';
             return;
         }
     }
-    catalog_dir[0] = '\0';
+    v->catalog_dir[0] = '\0';
+}
+
+// Lists one level of an archive as catalog entries: the PGN members directly under
+// `prefix` and the folders that lead further in.
+static int catalog_list_archive(const char *archive, const char *prefix,
+                                CatalogEntry **entries, int *count, int *cap) {
+    ArchiveMember *members = NULL;
+    int member_count = archive_list(archive, &members);
+    if (member_count < 0) return 0;
+    size_t prefix_len = strlen(prefix);
+    int ok = 1;
+    for (int i = 0; i < member_count && ok; i++) {
+        const char *name = members[i].name;
+        if (prefix_len > 0) {
+            if (strncmp(name, prefix, prefix_len) != 0 || name[prefix_len] != '/') continue;
+            name += prefix_len + 1;
+        }
+        const char *slash = strchr(name, '/');
+        if (slash) {
+            char folder[256];
+            size_t len = (size_t)(slash - name);
+            if (len == 0 || len >= sizeof(folder)) continue;
+            memcpy(folder, name, len);
+            folder[len] = '\0';
+            int seen = 0;
+            for (int k = 0; k < *count && !seen; k++) {
+                seen = ((*entries)[k].type == 1 && strcmp((*entries)[k].name, folder) == 0);
+            }
+            if (!seen) ok = push_catalog_entry(entries, count, cap, folder, 1);
+        } else if (has_pgn_extension(name)) {
+            ok = push_catalog_entry(entries, count, cap, name, 0);
+        }
+    }
+    free_archive_members(members, member_count);
+    return ok;
 }
 
-static int catalog_load_entries(const char *games_dir) {
+static int catalog_load_entries(Viewer *v, const char *games_dir) {
     CatalogEntry *entries = NULL;
     int count = 0;
     int cap = 0;
     char *dir_path = NULL;
-    if (catalog_dir[0] == '\0') {
+    if (v->catalog_dir[0] == '\0') {
         dir_path = copy_string(games_dir);
     } else {
-        dir_path = join_path(games_dir, catalog_dir);
+        dir_path = join_path(games_dir, v->catalog_dir);
     }
     if (!dir_path) return 0;
 
+    char archive[1024];
+    char prefix[1024];
+    if (split_archive_path(dir_path, archive, sizeof(archive), prefix, sizeof(prefix))) {
+        if (!catalog_list_archive(archive, prefix, &entries, &count, &cap)) {
+            free(dir_path);
+            return 0;
+        }
+        goto listed;
+    }
+
 #ifdef _WIN32
     char *search = join_path(dir_path, "*");
     if (!search) {
@@ -521,20 +1368,20 @@ static int catalog_load_entries(const char *games_dir) {
     }
     do {
         if (strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0) continue;
-        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+        if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || has_archive_extension(data.cFileName)) {
             if (!push_catalog_entry(&entries, &count, &cap, data.cFileName, 1)) {
                 FindClose(h);
                 free(dir_path);
-                catalog_entries = entries;
-                catalog_entry_count = count;
+                v->catalog_entries = entries;
+                v->catalog_entry_count = count;
                 return 0;
             }
-        } else if (has_pgn_extension(data.cFileName)) {
+        } else if (has_pgn_extension(data.cFileName) || has_scid_extension(data.cFileName)) {
             if (!push_catalog_entry(&entries, &count, &cap, data.cFileName, 0)) {
                 FindClose(h);
                 free(dir_path);
-                catalog_entries = entries;
-                catalog_entry_count = count;
+                v->catalog_entries = entries;
+                v->catalog_entry_count = count;
                 return 0;
             }
         }
@@ -567,14 +1414,14 @@ static int catalog_load_entries(const char *games_dir) {
                 closedir(probe);
             }
         }
-        if (is_dir) {
+        if (is_dir || has_archive_extension(ent->d_name)) {
             if (!push_catalog_entry(&entries, &count, &cap, ent->d_name, 1)) {
                 free(full);
                 closedir(d);
                 free(dir_path);
                 return 0;
             }
-        } else if (has_pgn_extension(ent->d_name)) {
+        } else if (has_pgn_extension(ent->d_name) || has_scid_extension(ent->d_name)) {
             if (!push_catalog_entry(&entries, &count, &cap, ent->d_name, 0)) {
                 free(full);
                 closedir(d);
@@ -587,7 +1434,8 @@ static int catalog_load_entries(const char *games_dir) {
     closedir(d);
 #endif
 
-    if (catalog_dir[0] != '\0') {
+listed:
+    if (v->catalog_dir[0] != '\0') {
         push_catalog_entry(&entries, &count, &cap, "..", 2);
     }
 
@@ -595,219 +1443,244 @@ static int catalog_load_entries(const char *games_dir) {
         qsort(entries, (size_t)count, sizeof(entries[0]), catalog_entry_cmp);
     }
 
-    for (int i = 0; i < catalog_entry_count; i++) {
-        free(catalog_entries[i].name);
+    for (int i = 0; i < v->catalog_entry_count; i++) {
+        free(v->catalog_entries[i].name);
     }
-    free(catalog_entries);
-    catalog_entries = entries;
-    catalog_entry_count = count;
+    free(v->catalog_entries);
+    v->catalog_entries = entries;
+    v->catalog_entry_count = count;
     free(dir_path);
     return 1;
 }
 
-void catalog_free(void) {
-    if (catalog_entries) {
-        for (int i = 0; i < catalog_entry_count; i++) {
-            free(catalog_entries[i].name);
+void catalog_free(Viewer *v) {
+    if (v->catalog_entries) {
+        for (int i = 0; i < v->catalog_entry_count; i++) {
+            free(v->catalog_entries[i].name);
         }
-        free(catalog_entries);
+        free(v->catalog_entries);
     }
-    catalog_entries = NULL;
-    catalog_entry_count = 0;
-    catalog_index = 0;
-    catalog_scroll = 0;
-    catalog_active = 0;
+    v->catalog_entries = NULL;
+    v->catalog_entry_count = 0;
+    v->catalog_index = 0;
+    v->catalog_scroll = 0;
+    v->catalog_active = 0;
 }
 
-void catalog_open(const char *games_dir) {
-    if (catalog_active) return;
-    catalog_free();
-    catalog_set_dir("");
-    if (!catalog_load_entries(games_dir)) {
-        catalog_entries = NULL;
-        catalog_entry_count = 0;
+void catalog_open(Viewer *v, const char *games_dir) {
+    if (v->catalog_active) return;
+    catalog_free(v);
+    catalog_set_dir(v, "");
+    if (!catalog_load_entries(v, games_dir)) {
+        v->catalog_entries = NULL;
+        v->catalog_entry_count = 0;
         return;
     }
-    catalog_active = 1;
-    catalog_selection_made = 0;
-    catalog_index = 0;
-    catalog_scroll = 0;
+    v->catalog_active = 1;
+    v->catalog_selection_made = 0;
+    v->catalog_index = 0;
+    v->catalog_scroll = 0;
 }
 
-void catalog_select(const char *games_dir) {
-    if (!catalog_active) return;
-    if (catalog_index == 0) {
-        free(forced_pgn_path);
-        forced_pgn_path = NULL;
+void catalog_select(Viewer *v, const char *games_dir) {
+    if (!v->catalog_active) return;
+    if (v->catalog_index == 0) {
+        free(v->forced_pgn_path);
+        v->forced_pgn_path = NULL;
     } else {
-        int entry_index = catalog_index - 1;
-        if (entry_index >= 0 && entry_index < catalog_entry_count) {
-            CatalogEntry *entry = &catalog_entries[entry_index];
+        int entry_index = v->catalog_index - 1;
+        if (entry_index >= 0 && entry_index < v->catalog_entry_count) {
+            CatalogEntry *entry = &v->catalog_entries[entry_index];
             if (entry->type == 2) {
-                catalog_dir_up();
-                catalog_load_entries(games_dir);
-                catalog_index = 0;
-                catalog_scroll = 0;
+                catalog_dir_up(v);
+                catalog_load_entries(v, games_dir);
+                v->catalog_index = 0;
+                v->catalog_scroll = 0;
                 return;
             }
             if (entry->type == 1) {
                 char next_dir[1024];
-                if (catalog_dir[0] == '\0') {
+                if (v->catalog_dir[0] == '\0') {
                     snprintf(next_dir, sizeof(next_dir), "%s", entry->name);
                 } else {
-                    snprintf(next_dir, sizeof(next_dir), "%s%c%s", catalog_dir, PATH_SEP, entry->name);
+                    snprintf(next_dir, sizeof(next_dir), "%s%c%s", v->catalog_dir, PATH_SEP, entry->name);
                 }
-                catalog_set_dir(next_dir);
-                catalog_load_entries(games_dir);
-                catalog_index = 0;
-                catalog_scroll = 0;
+                catalog_set_dir(v, next_dir);
+                catalog_load_entries(v, games_dir);
+                v->catalog_index = 0;
+                v->catalog_scroll = 0;
                 return;
             }
             char *dir_path = NULL;
-            if (catalog_dir[0] == '\0') {
+            if (v->catalog_dir[0] == '\0') {
                 dir_path = copy_string(games_dir);
             } else {
-                dir_path = join_path(games_dir, catalog_dir);
+                dir_path = join_path(games_dir, v->catalog_dir);
             }
             if (dir_path) {
                 char *path = join_path(dir_path, entry->name);
                 free(dir_path);
                 if (path) {
-                    free(forced_pgn_path);
-                    forced_pgn_path = path;
+                    free(v->forced_pgn_path);
+                    v->forced_pgn_path = path;
                 }
             }
         }
     }
-    catalog_selection_made = 1;
-    catalog_active = 0;
+    v->catalog_selection_made = 1;
+    v->catalog_active = 0;
 }
 
-int catalog_total_entries(void) {
-    return 1 + catalog_entry_count;
+int catalog_total_entries(Viewer *v) {
+    return 1 + v->catalog_entry_count;
 }
 
-void render_catalog_overlay(const BoardView *view) {
-    if (!catalog_active) return;
-
-    const char *title = "CATALOG";
-    const char *random_label = "[RANDOM FILE]";
-    int total_entries = catalog_total_entries();
+static void catalog_entry_label(Viewer *v, int idx, char *label, size_t label_size) {
+    if (idx == 0) {
+        snprintf(label, label_size, "[RANDOM FILE]");
+        return;
+    }
+    const CatalogEntry *entry = &v->catalog_entries[idx - 1];
+    if (entry->type == 1) {
+        snprintf(label, label_size, "[DIR] %s", entry->name);
+    } else if (entry->type == 2) {
+        snprintf(label, label_size, "[..]");
+    } else {
+        snprintf(label, label_size, "%s", entry->name);
+    }
+}
 
+static int catalog_layout(const BoardView *view, int *out_scale, int *out_line_gap, int *out_pad,
+                          int *out_header_gap) {
     int scale = (view->square >= 60) ? 3 : 2;
     int line_gap = (scale >= 3) ? 4 : 3;
     int text_h = 7 * scale;
     int pad = (scale >= 3) ? 10 : 8;
     int header_gap = line_gap + (scale >= 3 ? 4 : 2);
-
-    int max_w = text_width_px(title, scale);
-    int random_w = text_width_px(random_label, scale);
-    if (random_w > max_w) max_w = random_w;
-    for (int i = 0; i < catalog_entry_count; i++) {
-        char label[1024];
-        const CatalogEntry *entry = &catalog_entries[i];
-        if (entry->type == 1) {
-            snprintf(label, sizeof(label), "[DIR] %s", entry->name);
-        } else if (entry->type == 2) {
-            snprintf(label, sizeof(label), "[..]");
-        } else {
-            snprintf(label, sizeof(label), "%s", entry->name);
-        }
-        int w = text_width_px(label, scale);
-        if (w > max_w) max_w = w;
-    }
+    if (out_scale) *out_scale = scale;
+    if (out_line_gap) *out_line_gap = line_gap;
+    if (out_pad) *out_pad = pad;
+    if (out_header_gap) *out_header_gap = header_gap;
 
     int available_h = view->screen_h - pad * 4 - text_h - header_gap;
     int line_h = text_h + line_gap;
     int max_lines = (available_h > 0) ? (available_h / line_h) : 0;
     if (max_lines < 4) max_lines = 4;
+    if (max_lines > CATALOG_SNAPSHOT_LINES) max_lines = CATALOG_SNAPSHOT_LINES;
+    return max_lines;
+}
+
+// Logic side: scrolls the list for the current layout and copies the visible labels.
+void catalog_fill_snapshot(Viewer *v, FrameSnapshot *snap, const BoardView *view) {
+    snap->catalog_active = v->catalog_active;
+    snap->catalog_line_count = 0;
+    if (!v->catalog_active) return;
+
+    int total_entries = catalog_total_entries(v);
+    int max_len = (int)strlen("CATALOG");
+    for (int i = 0; i < total_entries; i++) {
+        char label[1024];
+        catalog_entry_label(v, i, label, sizeof(label));
+        int len = (int)strlen(label);
+        if (len > max_len) max_len = len;
+    }
+    if (max_len > CATALOG_LABEL_LEN - 1) max_len = CATALOG_LABEL_LEN - 1;
+
+    int max_lines = catalog_layout(view, NULL, NULL, NULL, NULL);
     if (max_lines > total_entries) max_lines = total_entries;
+    if (v->catalog_index < v->catalog_scroll) v->catalog_scroll = v->catalog_index;
+    if (v->catalog_index >= v->catalog_scroll + max_lines) {
+        v->catalog_scroll = v->catalog_index - max_lines + 1;
+    }
 
-    if (catalog_index < catalog_scroll) catalog_scroll = catalog_index;
-    if (catalog_index >= catalog_scroll + max_lines) {
-        catalog_scroll = catalog_index - max_lines + 1;
+    for (int i = 0; i < max_lines; i++) {
+        int idx = v->catalog_scroll + i;
+        if (idx >= total_entries) break;
+        catalog_entry_label(v, idx, snap->catalog_lines[i], CATALOG_LABEL_LEN);
+        snap->catalog_line_count++;
     }
+    snap->catalog_highlight = v->catalog_index - v->catalog_scroll;
+    snap->catalog_max_len = max_len;
+}
+
+void render_catalog_overlay(Viewer *v, const BoardView *view, const FrameSnapshot *snap) {
+    if (!snap->catalog_active) return;
 
-    int list_h = max_lines * line_h - line_gap;
+    const char *title = "CATALOG";
+    int scale = 2;
+    int line_gap = 3;
+    int pad = 8;
+    int header_gap = 5;
+    catalog_layout(view, &scale, &line_gap, &pad, &header_gap);
+    int text_h = 7 * scale;
+    int line_h = text_h + line_gap;
+    int max_w = (snap->catalog_max_len * 6 - 1) * scale;
+    int lines = snap->catalog_line_count;
+
+    int list_h = lines * line_h - line_gap;
     int box_w = max_w + pad * 2;
     int box_h = text_h + header_gap + list_h + pad * 2;
     int x = (view->screen_w - box_w) / 2;
     int y = (view->screen_h - box_h) / 2;
 
     SDL_Rect bg = {x, y, box_w, box_h};
-    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-    SDL_SetRenderDrawColor(renderer, 80, 80, 80, 190);
-    SDL_RenderFillRect(renderer, &bg);
+    SDL_SetRenderDrawBlendMode(v->renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(v->renderer, 80, 80, 80, 190);
+    SDL_RenderFillRect(v->renderer, &bg);
 
     SDL_Color text_color = {255, 255, 255, 255};
     int text_x = x + pad;
     int text_y = y + pad;
-    draw_text(text_x, text_y, scale, title, text_color);
+    draw_text(v, text_x, text_y, scale, title, text_color);
     text_y += text_h + header_gap;
 
-    for (int i = 0; i < max_lines; i++) {
-        int idx = catalog_scroll + i;
-        if (idx >= total_entries) break;
-        char label[1024];
-        if (idx == 0) {
-            strncpy(label, random_label, sizeof(label) - 1);
-            label[sizeof(label) - 1] = '\0';
-        } else {
-            const CatalogEntry *entry = &catalog_entries[idx - 1];
-            if (entry->type == 1) {
-                snprintf(label, sizeof(label), "[DIR] %s", entry->name);
-            } else if (entry->type == 2) {
-                snprintf(label, sizeof(label), "[..]");
-            } else {
-                snprintf(label, sizeof(label), "%s", entry->name);
-            }
-        }
-        if (idx == catalog_index) {
+    for (int i = 0; i < lines; i++) {
+        if (i == snap->catalog_highlight) {
             SDL_Rect hi = {text_x - 3, text_y - 3, max_w + 6, text_h + 6};
-            SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-            SDL_SetRenderDrawColor(renderer, 40, 120, 255, 190);
-            SDL_RenderFillRect(renderer, &hi);
+            SDL_SetRenderDrawBlendMode(v->renderer, SDL_BLENDMODE_BLEND);
+            SDL_SetRenderDrawColor(v->renderer, 40, 120, 255, 190);
+            SDL_RenderFillRect(v->renderer, &hi);
         }
-        draw_text(text_x, text_y, scale, label, text_color);
+        draw_text(v, text_x, text_y, scale, snap->catalog_lines[i], text_color);
         text_y += line_h;
     }
 }
 
-int handle_catalog_event(const SDL_Event *e, const char *games_dir) {
-    if (!catalog_active) return 0;
+int handle_catalog_event(Viewer *v, const SDL_Event *e, const char *games_dir) {
+    if (!v->catalog_active) return 0;
     if (e->type == SDL_KEYDOWN) {
         SDL_Keycode key = e->key.keysym.sym;
         if (key == SDLK_ESCAPE || key == SDLK_c) {
-            catalog_active = 0;
+            v->catalog_active = 0;
             return 1;
         } else if (key == SDLK_UP) {
-            if (catalog_index > 0) catalog_index--;
+            if (v->catalog_index > 0) v->catalog_index--;
             return 1;
         } else if (key == SDLK_DOWN) {
-            int total = catalog_total_entries();
-            if (catalog_index < total - 1) catalog_index++;
+            int total = catalog_total_entries(v);
+            if (v->catalog_index < total - 1) v->catalog_index++;
             return 1;
         } else if (key == SDLK_PAGEUP) {
             int step = 6;
-            catalog_index -= step;
-            if (catalog_index < 0) catalog_index = 0;
+            v->catalog_index -= step;
+            if (v->catalog_index < 0) v->catalog_index = 0;
             return 1;
         } else if (key == SDLK_PAGEDOWN) {
             int step = 6;
-            int total = catalog_total_entries();
-            catalog_index += step;
-            if (catalog_index > total - 1) catalog_index = total - 1;
+            int total = catalog_total_entries(v);
+            v->catalog_index += step;
+            if (v->catalog_index > total - 1) v->catalog_index = total - 1;
             return 1;
         } else if (key == SDLK_RETURN || key == SDLK_KP_ENTER) {
-            catalog_select(games_dir);
-            game_nav_request = GAME_NAV_SELECT;
+            catalog_select(v, games_dir);
+            v->game_nav_request = GAME_NAV_SELECT;
             return 1;
         }
     }
     return 1;
 }
 
-void render_player_labels(const BoardView *view) {
+void render_player_labels(Viewer *v, const BoardView *view, const FrameSnapshot *snap) {
     int margin = (view->square >= 60) ? 16 : 8;
     int right_x0 = view->offset_x + view->board_px + margin;
     int right_x1 = view->screen_w - margin;
@@ -818,9 +1691,9 @@ void render_player_labels(const BoardView *view) {
     int avail_text_w = right_x1 - right_x0 - swatch_size - gap;
     if (avail_text_w <= 0) return;
 
-    const char *white_name = (current_white_name[0] != '\0') ? current_white_name : "White";
-    const char *black_name = (current_black_name[0] != '\0') ? current_black_name : "Black";
-    int top_is_white = view_from_white ? 0 : 1;
+    const char *white_name = (snap->white_name[0] != '\0') ? snap->white_name : "White";
+    const char *black_name = (snap->black_name[0] != '\0') ? snap->black_name : "Black";
+    int top_is_white = snap->view_from_white ? 0 : 1;
     const char *top_name = top_is_white ? white_name : black_name;
     const char *bottom_name = top_is_white ? black_name : white_name;
     int max_len = (int)strlen(white_name);
@@ -854,21 +1727,21 @@ void render_player_labels(const BoardView *view) {
     int swatch_y_bottom = bottom_y + (text_h - swatch_size) / 2;
 
     if (top_is_white) {
-        draw_color_swatch(right_x0, swatch_y_top, swatch_size, white_fill, outline);
+        draw_color_swatch(v, right_x0, swatch_y_top, swatch_size, white_fill, outline);
     } else {
-        draw_color_swatch(right_x0, swatch_y_top, swatch_size, black_fill, white_fill);
+        draw_color_swatch(v, right_x0, swatch_y_top, swatch_size, black_fill, white_fill);
     }
-    draw_text(right_x0 + swatch_size + gap, top_y, scale, top_name, text_color);
+    draw_text(v, right_x0 + swatch_size + gap, top_y, scale, top_name, text_color);
 
     if (top_is_white) {
-        draw_color_swatch(right_x0, swatch_y_bottom, swatch_size, black_fill, white_fill);
+        draw_color_swatch(v, right_x0, swatch_y_bottom, swatch_size, black_fill, white_fill);
     } else {
-        draw_color_swatch(right_x0, swatch_y_bottom, swatch_size, white_fill, outline);
+        draw_color_swatch(v, right_x0, swatch_y_bottom, swatch_size, white_fill, outline);
     }
-    draw_text(right_x0 + swatch_size + gap, bottom_y, scale, bottom_name, text_color);
+    draw_text(v, right_x0 + swatch_size + gap, bottom_y, scale, bottom_name, text_color);
 }
 
-void init_board() {
+void init_board(char b[BOARD_SIZE][BOARD_SIZE]) {
     const char *initial[] = {
         "rnbqkbnr",
         "pppppppp",
@@ -880,43 +1753,134 @@ void init_board() {
         "RNBQKBNR"
     };
     for (int i = 0; i < BOARD_SIZE; i++) {
-        strcpy(board[i], initial[i]);
+        memcpy(b[i], initial[i], BOARD_SIZE);
     }
 }
 
-SDL_Texture *get_piece_texture(char piece) {
-    if (piece == '.') return NULL;
+// Decoded piece images, shared by every window. Textures belong to one renderer, so
+// each viewer uploads its own copies from these.
+SDL_Surface *get_piece_surface(char piece) {
     unsigned char idx = (unsigned char)piece;
-    if (piece_textures[idx]) return piece_textures[idx];
+    if (piece_surfaces[idx]) return piece_surfaces[idx];
 
     char letter = tolower(piece);
     const char *color = isupper(piece) ? "lt" : "dt";
     char path[64];
     snprintf(path, sizeof(path), "pieces/Chess_%c%s.png", letter, color);
 
-    SDL_Texture *tex = IMG_LoadTexture(renderer, path);
-    if (!tex) {
+    SDL_Surface *surface = IMG_Load(path);
+    if (!surface) {
         printf("Failed to load %s: %s\n", path, IMG_GetError());
     }
-    piece_textures[idx] = tex;
+    piece_surfaces[idx] = surface;
+    return surface;
+}
+
+SDL_Texture *get_piece_texture(Viewer *v, char piece) {
+    if (piece == '.') return NULL;
+    unsigned char idx = (unsigned char)piece;
+    if (v->piece_textures[idx]) return v->piece_textures[idx];
+
+    SDL_Surface *surface = get_piece_surface(piece);
+    if (!surface) return NULL;
+
+    // Sources are only sampled when building the sprite atlas, so filter them smoothly.
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
+    SDL_Texture *tex = SDL_CreateTextureFromSurface(v->renderer, surface);
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+    if (!tex) {
+        printf("Failed to create piece texture: %s\n", SDL_GetError());
+    }
+    v->piece_textures[idx] = tex;
     return tex;
 }
 
-void render_rotated_king(const BoardView *view, char king, float angle) {
+static int sprite_index(char piece) {
+    static const char order[] = "KQRBNPkqrbnp";
+    if (piece == '\0') return -1;
+    const char *p = strchr(order, piece);
+    return p ? (int)(p - order) : -1;
+}
+
+// Pre-scales all twelve pieces into one atlas at the current square size, so a frame
+// samples a single small texture instead of downscaling the full PNGs every draw.
+static SDL_Texture *get_sprite_atlas(Viewer *v) {
+    static const char order[] = "KQRBNPkqrbnp";
+    RenderCache *cache = &v->render_cache;
+    int square = cache->view.square;
+    if (cache->sprite_atlas && cache->sprite_square == square) return cache->sprite_atlas;
+    if (!cache->can_target) return NULL;
+    if (cache->sprite_atlas) {
+        SDL_DestroyTexture(cache->sprite_atlas);
+        cache->sprite_atlas = NULL;
+    }
+    int rows = (12 + SPRITE_ATLAS_COLS - 1) / SPRITE_ATLAS_COLS;
+    SDL_Texture *atlas = SDL_CreateTexture(v->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
+                                           square * SPRITE_ATLAS_COLS, square * rows);
+    if (!atlas) {
+        cache->can_target = 0;
+        return NULL;
+    }
+    SDL_SetTextureBlendMode(atlas, SDL_BLENDMODE_BLEND);
+    if (SDL_SetRenderTarget(v->renderer, atlas) != 0) {
+        SDL_DestroyTexture(atlas);
+        cache->can_target = 0;
+        return NULL;
+    }
+    SDL_SetRenderDrawColor(v->renderer, 0, 0, 0, 0);
+    SDL_RenderClear(v->renderer);
+    for (int i = 0; i < 12; i++) {
+        SDL_Texture *tex = get_piece_texture(v, order[i]);
+        if (!tex) continue;
+        SDL_Rect cell = {(i % SPRITE_ATLAS_COLS) * square, (i / SPRITE_ATLAS_COLS) * square, square, square};
+        // Copy the RGBA as-is; blending here would premultiply the edges twice.
+        SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_NONE);
+        SDL_RenderCopy(v->renderer, tex, NULL, &cell);
+        SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+    }
+    SDL_SetRenderTarget(v->renderer, NULL);
+    cache->sprite_atlas = atlas;
+    cache->sprite_square = square;
+    return atlas;
+}
+
+void draw_piece(Viewer *v, char piece, const SDL_Rect *dst, double angle) {
+    int idx = sprite_index(piece);
+    if (idx < 0) return;
+    SDL_Texture *tex = get_sprite_atlas(v);
+    SDL_Rect src = {0, 0, 0, 0};
+    const SDL_Rect *src_rect = NULL;
+    if (tex) {
+        int square = v->render_cache.sprite_square;
+        src.x = (idx % SPRITE_ATLAS_COLS) * square;
+        src.y = (idx / SPRITE_ATLAS_COLS) * square;
+        src.w = square;
+        src.h = square;
+        src_rect = &src;
+    } else {
+        tex = get_piece_texture(v, piece);
+        if (!tex) return;
+    }
+    if (angle != 0.0) {
+        SDL_RenderCopyEx(v->renderer, tex, src_rect, dst, angle, NULL, SDL_FLIP_NONE);
+    } else {
+        SDL_RenderCopy(v->renderer, tex, src_rect, dst);
+    }
+}
+
+void render_rotated_king(Viewer *v, const BoardView *view, const FrameSnapshot *snap, char king, float angle) {
     int r = -1, f = -1;
-    if (!find_king_pos(king, &r, &f)) return;
-    SDL_Texture *tex = get_piece_texture(king);
-    if (!tex) return;
+    if (!find_king_pos(snap->board, king, &r, &f)) return;
     int x = 0;
     int y = 0;
     board_to_screen(view, r, f, &x, &y);
     SDL_Rect rect = {x, y, view->square, view->square};
-    SDL_RenderCopyEx(renderer, tex, NULL, &rect, angle, NULL, SDL_FLIP_NONE);
+    draw_piece(v, king, &rect, angle);
 }
 
 void board_to_screen(const BoardView *view, int board_r, int board_f, int *out_x, int *out_y) {
-    int draw_r = view_from_white ? board_r : (BOARD_SIZE - 1 - board_r);
-    int draw_f = view_from_white ? board_f : (BOARD_SIZE - 1 - board_f);
+    int draw_r = view->from_white ? board_r : (BOARD_SIZE - 1 - board_r);
+    int draw_f = view->from_white ? board_f : (BOARD_SIZE - 1 - board_f);
     if (out_x) *out_x = view->offset_x + draw_f * view->square;
     if (out_y) *out_y = view->offset_y + draw_r * view->square;
 }
@@ -936,8 +1900,8 @@ int screen_to_board(const BoardView *view, int x, int y, int *out_r, int *out_f)
     if (local_x < inset || local_x >= view->square - inset) return 0;
     if (local_y < inset || local_y >= view->square - inset) return 0;
 
-    if (out_r) *out_r = view_from_white ? draw_r : (BOARD_SIZE - 1 - draw_r);
-    if (out_f) *out_f = view_from_white ? draw_f : (BOARD_SIZE - 1 - draw_f);
+    if (out_r) *out_r = view->from_white ? draw_r : (BOARD_SIZE - 1 - draw_r);
+    if (out_f) *out_f = view->from_white ? draw_f : (BOARD_SIZE - 1 - draw_f);
     return 1;
 }
 
@@ -1005,110 +1969,103 @@ SDL_Cursor *create_analysis_cursor(void) {
     return cursor;
 }
 
-int begin_mark_drag(const BoardView *view, int x, int y) {
+int begin_mark_drag(Viewer *v, const BoardView *view, int x, int y) {
     int r = -1;
     int f = -1;
     if (!screen_to_board(view, x, y, &r, &f)) return 0;
-    mark_dragging = 1;
-    mark_drag_value = analysis_marks[r][f] ? 0 : 1;
-    analysis_marks[r][f] = (unsigned char)mark_drag_value;
-    mark_last_r = r;
-    mark_last_f = f;
+    v->mark_dragging = 1;
+    v->mark_drag_value = v->analysis_marks[r][f] ? 0 : 1;
+    v->analysis_marks[r][f] = (unsigned char)v->mark_drag_value;
+    v->mark_last_r = r;
+    v->mark_last_f = f;
     return 1;
 }
 
-int update_mark_drag(const BoardView *view, int x, int y) {
-    if (!mark_dragging) return 0;
+int update_mark_drag(Viewer *v, const BoardView *view, int x, int y) {
+    if (!v->mark_dragging) return 0;
     int r = -1;
     int f = -1;
     if (!screen_to_board(view, x, y, &r, &f)) return 0;
-    if (r == mark_last_r && f == mark_last_f) return 0;
-    mark_last_r = r;
-    mark_last_f = f;
-    if (analysis_marks[r][f] == (unsigned char)mark_drag_value) return 0;
-    analysis_marks[r][f] = (unsigned char)mark_drag_value;
+    if (r == v->mark_last_r && f == v->mark_last_f) return 0;
+    v->mark_last_r = r;
+    v->mark_last_f = f;
+    if (v->analysis_marks[r][f] == (unsigned char)v->mark_drag_value) return 0;
+    v->analysis_marks[r][f] = (unsigned char)v->mark_drag_value;
     return 1;
 }
 
-void end_mark_drag(void) {
-    mark_dragging = 0;
-    mark_last_r = -1;
-    mark_last_f = -1;
+void end_mark_drag(Viewer *v) {
+    v->mark_dragging = 0;
+    v->mark_last_r = -1;
+    v->mark_last_f = -1;
+}
+
+// Cursor calls must happen on the main thread, so the logic side only records the wish.
+void set_cursor_visible(Viewer *v, int visible) {
+    v->cursor_visible = visible;
+    SDL_AtomicSet(&v->cursor_wanted, visible);
 }
 
-void set_cursor_visible(int visible) {
+static void apply_cursor_visible(int visible) {
     if (visible && analysis_cursor) {
         SDL_SetCursor(analysis_cursor);
     }
     SDL_ShowCursor(visible ? SDL_ENABLE : SDL_DISABLE);
-    cursor_visible = visible;
 }
 
-void note_mouse_activity(Uint32 now) {
-    last_mouse_activity = now;
-    if (!cursor_visible) set_cursor_visible(1);
+void note_mouse_activity(Viewer *v, Uint32 now) {
+    v->last_mouse_activity = now;
+    if (!v->cursor_visible) set_cursor_visible(v, 1);
 }
 
-void update_cursor_auto_hide(Uint32 now) {
-    if (analysis_mode || guess_mode || mark_dragging) {
-        if (!cursor_visible) set_cursor_visible(1);
+void update_cursor_auto_hide(Viewer *v, Uint32 now) {
+    if (v->analysis_mode || v->guess_mode || v->mark_dragging) {
+        if (!v->cursor_visible) set_cursor_visible(v, 1);
         return;
     }
-    if (cursor_visible && now - last_mouse_activity >= CURSOR_IDLE_MS) {
-        set_cursor_visible(0);
+    if (v->cursor_visible && now - v->last_mouse_activity >= CURSOR_IDLE_MS) {
+        set_cursor_visible(v, 0);
     }
 }
 
-void note_mouse_activity_event(const SDL_Event *e) {
+void note_mouse_activity_event(Viewer *v, const SDL_Event *e) {
     if (e->type == SDL_MOUSEMOTION ||
         e->type == SDL_MOUSEBUTTONDOWN ||
         e->type == SDL_MOUSEBUTTONUP ||
         e->type == SDL_MOUSEWHEEL) {
-        note_mouse_activity(SDL_GetTicks());
+        note_mouse_activity(v, SDL_GetTicks());
     }
 }
 
-void clear_analysis_marks(void) {
-    memset(analysis_marks, 0, sizeof(analysis_marks));
-    end_mark_drag();
+void clear_analysis_marks(Viewer *v) {
+    memset(v->analysis_marks, 0, sizeof(v->analysis_marks));
+    end_mark_drag(v);
 }
 
-void enter_analysis_mode(void) {
-    if (analysis_mode) return;
-    analysis_mode = 1;
-    memcpy(analysis_saved_board, board, sizeof(board));
-    analysis_saved_dim = dim_board;
-    analysis_saved_show_loser_king = show_loser_king;
-    analysis_saved_show_draw_kings = show_draw_kings;
-    show_loser_king = 0;
-    show_draw_kings = 0;
-    dim_board = 0;
-    if (!analysis_cursor) {
-        analysis_cursor = create_analysis_cursor();
-        if (!analysis_cursor) {
-            analysis_cursor = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_CROSSHAIR);
-        }
-    }
-    note_mouse_activity(SDL_GetTicks());
+void enter_analysis_mode(Viewer *v) {
+    if (v->analysis_mode) return;
+    v->analysis_mode = 1;
+    memcpy(v->analysis_saved_board, v->board, sizeof(v->board));
+    v->analysis_saved_dim = v->dim_board;
+    v->analysis_saved_show_loser_king = v->show_loser_king;
+    v->analysis_saved_show_draw_kings = v->show_draw_kings;
+    v->show_loser_king = 0;
+    v->show_draw_kings = 0;
+    v->dim_board = 0;
+    note_mouse_activity(v, SDL_GetTicks());
 }
 
-void exit_analysis_mode(void) {
-    if (!analysis_mode) return;
-    analysis_mode = 0;
-    memcpy(board, analysis_saved_board, sizeof(board));
-    dim_board = analysis_saved_dim;
-    show_loser_king = analysis_saved_show_loser_king;
-    show_draw_kings = analysis_saved_show_draw_kings;
-    note_mouse_activity(SDL_GetTicks());
+void exit_analysis_mode(Viewer *v) {
+    if (!v->analysis_mode) return;
+    v->analysis_mode = 0;
+    memcpy(v->board, v->analysis_saved_board, sizeof(v->board));
+    v->dim_board = v->analysis_saved_dim;
+    v->show_loser_king = v->analysis_saved_show_loser_king;
+    v->show_draw_kings = v->analysis_saved_show_draw_kings;
+    note_mouse_activity(v, SDL_GetTicks());
 }
 
-void get_board_view(BoardView *view) {
-    int screen_w = SCREEN_SIZE;
-    int screen_h = SCREEN_SIZE;
-    if (SDL_GetRendererOutputSize(renderer, &screen_w, &screen_h) != 0) {
-        screen_w = SCREEN_SIZE;
-        screen_h = SCREEN_SIZE;
-    }
+void compute_board_view(BoardView *view, int screen_w, int screen_h, int from_white) {
     int min_dim = (screen_w < screen_h) ? screen_w : screen_h;
     view->square = min_dim / BOARD_SIZE;
     if (view->square < 1) view->square = 1;
@@ -1117,150 +2074,961 @@ void get_board_view(BoardView *view) {
     view->offset_y = (screen_h - view->board_px) / 2;
     view->screen_w = screen_w;
     view->screen_h = screen_h;
+    view->from_white = from_white;
 }
 
-void render_board(const BoardView *view, const Overlay *overlay) {
-    SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
-    SDL_RenderClear(renderer);
+// Logic side: geometry for the output size last published by the render loop. The
+// arithmetic only reruns when that size changes.
+void get_board_view(Viewer *v, BoardView *view) {
+    int packed = SDL_AtomicGet(&v->output_size);
+    if (packed != v->view_size_cached) {
+        int screen_w = (packed >> 16) & 0xFFFF;
+        int screen_h = packed & 0xFFFF;
+        if (screen_w <= 0 || screen_h <= 0) {
+            screen_w = SCREEN_SIZE;
+            screen_h = SCREEN_SIZE;
+        }
+        compute_board_view(&v->view_cached, screen_w, screen_h, 1);
+        v->view_size_cached = packed;
+    }
+    *view = v->view_cached;
+    view->from_white = v->view_from_white;
+}
 
-    SDL_Color light = analysis_mode ? (SDL_Color){215, 210, 200, 255} : (SDL_Color){210, 210, 210, 255};
-    SDL_Color dark  = analysis_mode ? (SDL_Color){155, 150, 140, 255} : (SDL_Color){150, 150, 150, 255};
-    if (guess_mode && !analysis_mode) {
-        light = (SDL_Color){200, 220, 200, 255};
-        dark = (SDL_Color){140, 160, 140, 255};
+static int same_color(SDL_Color a, SDL_Color b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+// The checkerboard only depends on the square size and palette, so it is drawn once
+// into a texture instead of 64 fills per frame.
+static SDL_Texture *get_board_texture(Viewer *v, const BoardView *view, SDL_Color light, SDL_Color dark) {
+    RenderCache *cache = &v->render_cache;
+    if (cache->board_tex && cache->board_tex_px == view->board_px &&
+        same_color(cache->board_light, light) && same_color(cache->board_dark, dark)) {
+        return cache->board_tex;
     }
-    if (dim_board) {
-        light.r = (Uint8)(light.r * 2 / 3);
-        light.g = (Uint8)(light.g * 2 / 3);
-        light.b = (Uint8)(light.b * 2 / 3);
-        dark.r = (Uint8)(dark.r * 2 / 3);
-        dark.g = (Uint8)(dark.g * 2 / 3);
-        dark.b = (Uint8)(dark.b * 2 / 3);
+    if (cache->board_tex) {
+        SDL_DestroyTexture(cache->board_tex);
+        cache->board_tex = NULL;
     }
+    SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, view->board_px, view->board_px, 32,
+                                                          SDL_PIXELFORMAT_RGBA32);
+    if (!surface) return NULL;
+    if (SDL_LockSurface(surface) != 0) {
+        SDL_FreeSurface(surface);
+        return NULL;
+    }
+    Uint32 light_px = SDL_MapRGBA(surface->format, light.r, light.g, light.b, light.a);
+    Uint32 dark_px = SDL_MapRGBA(surface->format, dark.r, dark.g, dark.b, dark.a);
+    int pitch = surface->pitch / 4;
+    Uint32 *pixels = (Uint32 *)surface->pixels;
+    for (int y = 0; y < view->board_px; y++) {
+        int row = y / view->square;
+        for (int x = 0; x < view->board_px; x++) {
+            int col = x / view->square;
+            pixels[y * pitch + x] = ((row + col) % 2 == 0) ? light_px : dark_px;
+        }
+    }
+    SDL_UnlockSurface(surface);
+    cache->board_tex = SDL_CreateTextureFromSurface(v->renderer, surface);
+    SDL_FreeSurface(surface);
+    cache->board_tex_px = view->board_px;
+    cache->board_light = light;
+    cache->board_dark = dark;
+    return cache->board_tex;
+}
 
-    for (int row = 0; row < BOARD_SIZE; row++) {  // row 0 = rank 8
-        for (int col = 0; col < BOARD_SIZE; col++) {
-            SDL_Color colr = ((row + col) % 2 == 0) ? light : dark;
-            SDL_SetRenderDrawColor(renderer, colr.r, colr.g, colr.b, colr.a);
-            int x = 0;
-            int y = 0;
-            board_to_screen(view, row, col, &x, &y);
-            SDL_Rect rect = {x, y, view->square, view->square};
-            SDL_RenderFillRect(renderer, &rect);
-
-    if (analysis_marks[row][col]) {
-        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-        SDL_SetRenderDrawColor(renderer, 40, 120, 255, 110);
-        SDL_RenderFillRect(renderer, &rect);
+// Drops every texture derived from the layout. With reload_sources the piece PNGs go
+// too, which is needed after the render device itself was reset.
+static void invalidate_render_cache(Viewer *v, int reload_sources) {
+    RenderCache *cache = &v->render_cache;
+    if (cache->board_tex) SDL_DestroyTexture(cache->board_tex);
+    if (cache->sprite_atlas) SDL_DestroyTexture(cache->sprite_atlas);
+    cache->board_tex = NULL;
+    cache->sprite_atlas = NULL;
+    cache->sprite_square = 0;
+    for (int i = 0; i < TEXT_CACHE_SIZE; i++) {
+        if (cache->text[i].texture) SDL_DestroyTexture(cache->text[i].texture);
+        cache->text[i].texture = NULL;
+    }
+    cache->valid = 0;
+    if (reload_sources) {
+        for (int i = 0; i < 256; i++) {
+            if (v->piece_textures[i]) SDL_DestroyTexture(v->piece_textures[i]);
+            v->piece_textures[i] = NULL;
+        }
     }
+}
 
-            int skip = 0;
-            if (overlay && overlay->active) {
-                if (row == overlay->skip_r1 && col == overlay->skip_f1) {
-                    skip = 1;
+static void refresh_layout_cache(Viewer *v) {
+    int screen_w = SCREEN_SIZE;
+    int screen_h = SCREEN_SIZE;
+    if (SDL_GetRendererOutputSize(v->renderer, &screen_w, &screen_h) != 0) {
+        screen_w = SCREEN_SIZE;
+        screen_h = SCREEN_SIZE;
+    }
+    compute_board_view(&v->render_cache.view, screen_w, screen_h, 1);
+    SDL_AtomicSet(&v->output_size, (screen_w << 16) | (screen_h & 0xFFFF));
+    v->render_cache.valid = 1;
+}
+
+static void render_check_frame(Viewer *v, const BoardView *view, const char board[BOARD_SIZE][BOARD_SIZE], char king) {
+    int thickness = (view->square >= 60) ? 4 : 2;
+    int r = -1, f = -1;
+    if (!find_king_pos(board, king, &r, &f)) return;
+    int x = 0;
+    int y = 0;
+    board_to_screen(view, r, f, &x, &y);
+    SDL_Rect rect = {x, y, view->square, view->square};
+    SDL_SetRenderDrawColor(v->renderer, 200, 20, 20, 255);
+    for (int i = 0; i < thickness; i++) {
+        SDL_Rect r2 = {rect.x + i, rect.y + i, rect.w - 2 * i, rect.h - 2 * i};
+        if (r2.w <= 0 || r2.h <= 0) break;
+        SDL_RenderDrawRect(v->renderer, &r2);
+    }
+}
+
+// Divergence view: the current game on the left and its partner on the right, both in
+// this one frame. The halves use the same square size, so they share the board texture
+// and the sprite atlas.
+static void render_split_frame(Viewer *v, const BoardView *view, const FrameSnapshot *snap,
+                               SDL_Color light, SDL_Color dark) {
+    int half_w = view->screen_w / 2;
+    BoardView halves[2];
+    compute_board_view(&halves[0], half_w, view->screen_h, view->from_white);
+    halves[1] = halves[0];
+    halves[1].offset_x += half_w;
+    SDL_Texture *board_tex = get_board_texture(v, &halves[0], light, dark);
+    int scale = (halves[0].square >= 60) ? 3 : 2;
+    int margin = (halves[0].square >= 60) ? 16 : 8;
+    SDL_Color text_color = {230, 230, 230, 255};
+
+    for (int side = 0; side < 2; side++) {
+        const BoardView *half = &halves[side];
+        const char (*board)[BOARD_SIZE] = side ? snap->split_board : snap->board;
+        if (board_tex) {
+            SDL_Rect board_rect = {half->offset_x, half->offset_y, half->board_px, half->board_px};
+            SDL_RenderCopy(v->renderer, board_tex, NULL, &board_rect);
+        }
+        const signed char *sq = snap->split_squares[side];
+        for (int row = 0; row < BOARD_SIZE; row++) {
+            for (int col = 0; col < BOARD_SIZE; col++) {
+                int x = 0;
+                int y = 0;
+                board_to_screen(half, row, col, &x, &y);
+                SDL_Rect rect = {x, y, half->square, half->square};
+                if (!board_tex) {
+                    SDL_Color colr = ((row + col) % 2 == 0) ? light : dark;
+                    SDL_SetRenderDrawColor(v->renderer, colr.r, colr.g, colr.b, colr.a);
+                    SDL_RenderFillRect(v->renderer, &rect);
+                }
+                if (snap->split_diverged && sq[0] >= 0 &&
+                    ((row == sq[0] && col == sq[1]) || (row == sq[2] && col == sq[3]))) {
+                    SDL_SetRenderDrawBlendMode(v->renderer, SDL_BLENDMODE_BLEND);
+                    SDL_SetRenderDrawColor(v->renderer, 255, 150, 30, 120);
+                    SDL_RenderFillRect(v->renderer, &rect);
                 }
+                draw_piece(v, board[row][col], &rect, 0.0);
+            }
+        }
+
+        char label[2 * NAME_LEN + 16];
+        const char *white = side ? snap->split_white_name : snap->white_name;
+        const char *black = side ? snap->split_black_name : snap->black_name;
+        const char *year = side ? snap->split_year : snap->year;
+        if (year[0] != '\0') {
+            snprintf(label, sizeof(label), "%s - %s %s", white, black, year);
+        } else {
+            snprintf(label, sizeof(label), "%s - %s", white, black);
+        }
+        int label_scale = scale;
+        while (label_scale > 1 && text_width_px(label, label_scale) > half->board_px) label_scale--;
+        int text_h = 7 * label_scale;
+        int x = half->offset_x + (half->board_px - text_width_px(label, label_scale)) / 2;
+        if (x < half->offset_x) x = half->offset_x;
+        int y = half->offset_y - margin - text_h;
+        if (y < margin) y = margin;
+        draw_text(v, x, y, label_scale, label, text_color);
+    }
+
+    char note[48];
+    snprintf(note, sizeof(note), "SAME POSITION UNTIL MOVE %d", snap->split_move_number);
+    int text_h = 7 * scale;
+    int y = halves[0].offset_y + halves[0].board_px + margin;
+    if (y + text_h > view->screen_h) y = view->screen_h - margin - text_h;
+    SDL_Color note_color = snap->split_diverged ? (SDL_Color){255, 170, 60, 255} : text_color;
+    draw_text(v, (view->screen_w - text_width_px(note, scale)) / 2, y, scale, note, note_color);
+}
+
+// Render side: draws one snapshot. Time-based effects (move slide, king flip) are
+// evaluated here so they keep moving even if the logic thread is busy.
+void render_frame(Viewer *v, const BoardView *view, const FrameSnapshot *snap) {
+    Uint32 now = SDL_GetTicks();
+    SDL_SetRenderDrawColor(v->renderer, 50, 50, 50, 255);
+    SDL_RenderClear(v->renderer);
+
+    SDL_Color light = snap->analysis_mode ? (SDL_Color){215, 210, 200, 255} : (SDL_Color){210, 210, 210, 255};
+    SDL_Color dark  = snap->analysis_mode ? (SDL_Color){155, 150, 140, 255} : (SDL_Color){150, 150, 150, 255};
+    if (snap->guess_mode && !snap->analysis_mode) {
+        light = (SDL_Color){200, 220, 200, 255};
+        dark = (SDL_Color){140, 160, 140, 255};
+    }
+    if (snap->dim_board) {
+        light.r = (Uint8)(light.r * 2 / 3);
+        light.g = (Uint8)(light.g * 2 / 3);
+        light.b = (Uint8)(light.b * 2 / 3);
+        dark.r = (Uint8)(dark.r * 2 / 3);
+        dark.g = (Uint8)(dark.g * 2 / 3);
+        dark.b = (Uint8)(dark.b * 2 / 3);
+    }
+
+    if (snap->split_active) {
+        render_split_frame(v, view, snap, light, dark);
+        render_speed_label(v, view, snap);
+        render_status_label(v, view, snap);
+        render_help_overlay(v, view, snap);
+        return;
+    }
+
+    Overlay overlay = snap->overlay;
+    if (snap->anim.active) {
+        int start_x = 0;
+        int start_y = 0;
+        int end_x = 0;
+        int end_y = 0;
+        board_to_screen(view, snap->anim.from_r, snap->anim.from_f, &start_x, &start_y);
+        board_to_screen(view, snap->anim.to_r, snap->anim.to_f, &end_x, &end_y);
+        float t = (snap->anim.duration > 0) ? (float)(now - snap->anim.start) / (float)snap->anim.duration : 1.0f;
+        if (t > 1.0f) t = 1.0f;
+        overlay.active = 1;
+        overlay.piece = snap->anim.piece;
+        overlay.x = start_x + (end_x - start_x) * t;
+        overlay.y = start_y + (end_y - start_y) * t;
+        overlay.skip_r1 = snap->anim.from_r;
+        overlay.skip_f1 = snap->anim.from_f;
+    }
+
+    SDL_Texture *board_tex = get_board_texture(v, view, light, dark);
+    if (board_tex) {
+        SDL_Rect board_rect = {view->offset_x, view->offset_y, view->board_px, view->board_px};
+        SDL_RenderCopy(v->renderer, board_tex, NULL, &board_rect);
+    }
+
+    for (int row = 0; row < BOARD_SIZE; row++) {  // row 0 = rank 8
+        for (int col = 0; col < BOARD_SIZE; col++) {
+            int x = 0;
+            int y = 0;
+            board_to_screen(view, row, col, &x, &y);
+            SDL_Rect rect = {x, y, view->square, view->square};
+            if (!board_tex) {
+                SDL_Color colr = ((row + col) % 2 == 0) ? light : dark;
+                SDL_SetRenderDrawColor(v->renderer, colr.r, colr.g, colr.b, colr.a);
+                SDL_RenderFillRect(v->renderer, &rect);
             }
-            if (!skip && show_loser_king) {
-                char losing_piece = loser_is_white ? 'K' : 'k';
-                if (board[row][col] == losing_piece) {
+
+            if (snap->marks[row][col]) {
+                SDL_SetRenderDrawBlendMode(v->renderer, SDL_BLENDMODE_BLEND);
+                SDL_SetRenderDrawColor(v->renderer, 40, 120, 255, 110);
+                SDL_RenderFillRect(v->renderer, &rect);
+            }
+
+            int skip = 0;
+            if (overlay.active) {
+                if (row == overlay.skip_r1 && col == overlay.skip_f1) {
                     skip = 1;
                 }
             }
-            if (!skip && show_draw_kings) {
-                if (board[row][col] == 'K' || board[row][col] == 'k') {
+            if (!skip && snap->show_loser_king) {
+                char losing_piece = snap->loser_is_white ? 'K' : 'k';
+                if (snap->board[row][col] == losing_piece) {
                     skip = 1;
                 }
             }
-            char piece = skip ? '.' : board[row][col];
-            SDL_Texture *tex = get_piece_texture(piece);
-            if (tex) {
-                SDL_RenderCopy(renderer, tex, NULL, &rect);
+            if (!skip && snap->show_draw_kings) {
+                if (snap->board[row][col] == 'K' || snap->board[row][col] == 'k') {
+                    skip = 1;
+                }
             }
+            if (!skip) draw_piece(v, snap->board[row][col], &rect, 0.0);
         }
     }
 
+    if (overlay.active) {
+        SDL_Rect rect = {(int)(overlay.x + 0.5f), (int)(overlay.y + 0.5f),
+                         view->square, view->square};
+        draw_piece(v, overlay.piece, &rect, 0.0);
+    }
+
+    float king_t = (KING_FLIP_MS > 0) ? (float)(now - snap->king_anim_start) / (float)KING_FLIP_MS : 1.0f;
+    if (king_t > 1.0f) king_t = 1.0f;
+    if (snap->show_draw_kings) {
+        render_rotated_king(v, view, snap, 'K', 90.0f * king_t);
+        render_rotated_king(v, view, snap, 'k', 90.0f * king_t);
+    } else if (snap->show_loser_king) {
+        char losing_piece = snap->loser_is_white ? 'K' : 'k';
+        render_rotated_king(v, view, snap, losing_piece, 180.0f * king_t);
+    }
+
+    if (snap->white_in_check) render_check_frame(v, view, snap->board, 'K');
+    if (snap->black_in_check) render_check_frame(v, view, snap->board, 'k');
+
+    render_year_label(v, view, snap);
+    render_mode_label(v, view, snap);
+    render_speed_label(v, view, snap);
+    render_status_label(v, view, snap);
+    render_player_labels(v, view, snap);
+    render_guess_score(v, view, snap);
+    render_position_labels(v, view, snap);
+    render_help_overlay(v, view, snap);
+    render_catalog_overlay(v, view, snap);
+}
+
+// Logic side: captures the current state into the back slot and publishes it.
+void publish_frame(Viewer *v, const Overlay *overlay) {
+    SnapshotBuffer *buf = &v->frame_buffer;
+    FrameSnapshot *snap = &buf->slots[buf->back];
+    BoardView view;
+    get_board_view(v, &view);
+
+    memcpy(snap->board, v->board, sizeof(v->board));
+    memcpy(snap->marks, v->analysis_marks, sizeof(v->analysis_marks));
     if (overlay && overlay->active) {
-        SDL_Texture *tex = get_piece_texture(overlay->piece);
-        if (tex) {
-            SDL_Rect rect = {(int)(overlay->x + 0.5f), (int)(overlay->y + 0.5f),
-                             view->square, view->square};
-            SDL_RenderCopy(renderer, tex, NULL, &rect);
+        snap->overlay = *overlay;
+    } else {
+        memset(&snap->overlay, 0, sizeof(snap->overlay));
+    }
+    snap->anim = v->move_anim;
+    snap->view_from_white = v->view_from_white;
+    snap->analysis_mode = v->analysis_mode;
+    snap->guess_mode = v->guess_mode;
+    snap->dim_board = v->dim_board;
+    snap->show_loser_king = v->show_loser_king;
+    snap->loser_is_white = v->loser_is_white;
+    snap->show_draw_kings = v->show_draw_kings;
+    snap->king_anim_start = v->king_anim_start;
+    snap->white_in_check = is_in_check(v->board, 1);
+    snap->black_in_check = is_in_check(v->board, 0);
+    snap->show_help = v->show_help;
+    snap->speed_message_until = v->speed_message_until;
+    snap->move_delay_ms = current_move_delay(v);
+    snap->turbo_mode = v->turbo_mode;
+    snap->highlights_mode = v->highlights_mode;
+    index_notice_update(v);
+    snap->status_until = v->status_until;
+    memcpy(snap->status_text, v->status_text, sizeof(snap->status_text));
+    snap->split_active = v->split_active;
+    if (v->split_active) {
+        snap->split_diverged = v->split_diverged;
+        snap->split_move_number = v->split_move_number;
+        memcpy(snap->split_board, v->split_board, sizeof(snap->split_board));
+        memcpy(snap->split_squares, v->split_squares, sizeof(snap->split_squares));
+        memcpy(snap->split_white_name, v->split_white_name, sizeof(snap->split_white_name));
+        memcpy(snap->split_black_name, v->split_black_name, sizeof(snap->split_black_name));
+        memcpy(snap->split_year, v->split_year, sizeof(snap->split_year));
+    }
+    snap->guess_score = v->guess_score;
+    snap->turn_is_white = v->turn_is_white;
+    memcpy(snap->white_name, v->current_white_name, sizeof(snap->white_name));
+    memcpy(snap->black_name, v->current_black_name, sizeof(snap->black_name));
+    memcpy(snap->year, v->current_game_year, sizeof(snap->year));
+    memcpy(snap->tb_text, v->tb_text, sizeof(snap->tb_text));
+    memcpy(snap->eval_text, v->eval_text, sizeof(snap->eval_text));
+    catalog_fill_snapshot(v, snap, &view);
+
+    // SDL_AtomicSet is only an acquire exchange on GCC: the barriers make the finished
+    // slot visible before its index, and the slot taken back free before it is reused.
+    SDL_MemoryBarrierRelease();
+    int prev = SDL_AtomicSet(&buf->middle, buf->back | SNAPSHOT_FRESH);
+    SDL_MemoryBarrierAcquire();
+    buf->back = prev & (SNAPSHOT_FRESH - 1);
+}
+
+// Render side: swaps in the newest published slot, if any. Returns 1 when it changed.
+int take_latest_snapshot(SnapshotBuffer *buf) {
+    if (!(SDL_AtomicGet(&buf->middle) & SNAPSHOT_FRESH)) return 0;
+    SDL_MemoryBarrierRelease();
+    int prev = SDL_AtomicSet(&buf->middle, buf->front);
+    SDL_MemoryBarrierAcquire();
+    buf->front = prev & (SNAPSHOT_FRESH - 1);
+    return 1;
+}
+
+// Render side: whether the snapshot still changes with the clock alone.
+static int snapshot_is_animating(const FrameSnapshot *snap, Uint32 now) {
+    if (snap->anim.active) return 1;
+    if ((snap->show_loser_king || snap->show_draw_kings) && now - snap->king_anim_start < (Uint32)KING_FLIP_MS) return 1;
+    if (snap->speed_message_until != 0 && now < snap->speed_message_until) return 1;
+    if (snap->status_until != 0 && now < snap->status_until) return 1;
+    return 0;
+}
+
+void draw_board(Viewer *v) {
+    publish_frame(v, NULL);
+}
+
+// Events are pumped by the main thread and routed to the viewer whose window they hit;
+// each logic thread only drains its own queue.
+int poll_input_event(Viewer *v, SDL_Event *e) {
+    InputQueue *q = &v->input;
+    unsigned int tail = (unsigned int)SDL_AtomicGet(&q->tail);
+    if (tail == (unsigned int)SDL_AtomicGet(&q->head)) return 0;
+    SDL_MemoryBarrierAcquire();
+    *e = q->events[tail % INPUT_QUEUE_SIZE];
+    SDL_AtomicSet(&q->tail, (int)(tail + 1));
+    return 1;
+}
+
+static int push_input_event(Viewer *v, const SDL_Event *e) {
+    InputQueue *q = &v->input;
+    unsigned int head = (unsigned int)SDL_AtomicGet(&q->head);
+    if (head - (unsigned int)SDL_AtomicGet(&q->tail) >= INPUT_QUEUE_SIZE) return 0;  // Logic thread is stalled
+    q->events[head % INPUT_QUEUE_SIZE] = *e;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&q->head, (int)(head + 1));
+    return 1;
+}
+
+static Viewer *find_viewer(Uint32 window_id) {
+    for (int i = 0; i < viewer_count; i++) {
+        if (viewers[i].window_id == window_id) return &viewers[i];
+    }
+    return NULL;
+}
+
+static Uint32 event_window_id(const SDL_Event *e) {
+    switch (e->type) {
+    case SDL_WINDOWEVENT:
+        return e->window.windowID;
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+        return e->key.windowID;
+    case SDL_MOUSEMOTION:
+        return e->motion.windowID;
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+        return e->button.windowID;
+    case SDL_MOUSEWHEEL:
+        return e->wheel.windowID;
+    default:
+        return 0;
+    }
+}
+
+// Asks every logic thread to stop and wakes any of them waiting on the prefetch queue.
+static void request_quit_all(void) {
+    SDL_Event quit_event;
+    memset(&quit_event, 0, sizeof(quit_event));
+    quit_event.type = SDL_QUIT;
+    for (int i = 0; i < viewer_count; i++) {
+        if (!SDL_AtomicGet(&viewers[i].logic_finished)) push_input_event(&viewers[i], &quit_event);
+    }
+    prefetch_stop();
+}
+
+// Main thread: window and render events only touch render state; input goes to the
+// viewer whose window it hit.
+static void route_event(const SDL_Event *e) {
+    if (e->type == SDL_QUIT) {
+        request_quit_all();
+        return;
+    }
+    if (e->type == SDL_RENDER_TARGETS_RESET || e->type == SDL_RENDER_DEVICE_RESET) {
+        for (int i = 0; i < viewer_count; i++) {
+            if (e->type == SDL_RENDER_DEVICE_RESET) {
+                SDL_AtomicSet(&viewers[i].layout_dirty, 2);
+            } else {
+                SDL_AtomicCAS(&viewers[i].layout_dirty, 0, 1);
+            }
+        }
+        return;
+    }
+    Viewer *v = find_viewer(event_window_id(e));
+    if (!v) return;
+    if (e->type == SDL_WINDOWEVENT) {
+        if (e->window.event == SDL_WINDOWEVENT_SIZE_CHANGED
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+            || e->window.event == SDL_WINDOWEVENT_DISPLAY_CHANGED
+#endif
+            ) {
+            SDL_AtomicCAS(&v->layout_dirty, 0, 1);
+        } else if (e->window.event == SDL_WINDOWEVENT_EXPOSED) {
+            v->needs_redraw = 1;
+        } else if (e->window.event == SDL_WINDOWEVENT_CLOSE) {
+            request_quit_all();
         }
+        return;
     }
+    push_input_event(v, e);
+}
+
+// Reads a playlist: one PGN path per line, optionally ending in @N to pick game N.
+// Blank lines and lines starting with # are skipped.
+static int load_playlist(Viewer *v, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 0;
+    char **items = NULL;
+    int count = 0;
+    int cap = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *start = line;
+        while (isspace((unsigned char)*start)) start++;
+        if (*start == '\0' || *start == '#') continue;
+        if (!push_string(&items, &count, &cap, start)) break;
+    }
+    fclose(fp);
+    if (count == 0) {
+        free(items);
+        return 0;
+    }
+    free_string_list(v->playlist, v->playlist_count);
+    v->playlist = items;
+    v->playlist_count = count;
+    v->playlist_pos = 0;
+    v->playlist_failures = 0;
+    return 1;
+}
 
-    if (show_draw_kings) {
-        render_rotated_king(view, 'K', draw_king_angle);
-        render_rotated_king(view, 'k', draw_king_angle);
-    } else if (show_loser_king) {
-        char losing_piece = loser_is_white ? 'K' : 'k';
-        render_rotated_king(view, losing_piece, loser_king_angle);
+// A forced file or a playlist whose entries all fail would be retried forever, so the
+// viewer falls back to random games instead.
+static void drop_failed_source(Viewer *v) {
+    if (v->forced_pgn_path) {
+        free(v->forced_pgn_path);
+        v->forced_pgn_path = NULL;
+        show_status(v, "FILE NOT PLAYABLE");
+    } else if (v->playlist_count > 0 && ++v->playlist_failures >= v->playlist_count) {
+        free_string_list(v->playlist, v->playlist_count);
+        v->playlist = NULL;
+        v->playlist_count = 0;
+        show_status(v, "PLAYLIST NOT PLAYABLE");
     }
+}
 
-    int thickness = (view->square >= 60) ? 4 : 2;
-    SDL_SetRenderDrawColor(renderer, 200, 20, 20, 255);
-    if (is_in_check(1)) {
-        int r = -1, f = -1;
-        if (find_king_pos('K', &r, &f)) {
-            int x = 0;
-            int y = 0;
-            board_to_screen(view, r, f, &x, &y);
-            SDL_Rect rect = {x, y, view->square, view->square};
-            for (int i = 0; i < thickness; i++) {
-                SDL_Rect r2 = {rect.x + i, rect.y + i, rect.w - 2 * i, rect.h - 2 * i};
-                if (r2.w <= 0 || r2.h <= 0) break;
-                SDL_RenderDrawRect(renderer, &r2);
+// Resolves a playlist entry to a file path (as given, else under the games folder)
+// and the 0-based game it names, or -1 for a random game from the file.
+static char *playlist_entry_path(const char *entry, int *out_game) {
+    char *path = copy_string(entry);
+    if (!path) return NULL;
+    *out_game = -1;
+    char *at = strrchr(path, '@');
+    if (at && at[1] != '\0' && strspn(at + 1, "0123456789") == strlen(at + 1)) {
+        *out_game = atoi(at + 1) - 1;
+        *at = '\0';
+    }
+    if (pgn_readable(path)) return path;
+    char *joined = join_path(games_dir_root, path);
+    free(path);
+    return joined;
+}
+
+// Logic side: applies one control batch to the viewer in order, before the next frame
+// is published. Returns CONTROL_FX_* flags for state the calling loop keeps itself.
+int apply_control_batch(Viewer *v, const SDL_Event *e) {
+    ControlBatch *batch = (ControlBatch *)e->user.data1;
+    Uint32 now = SDL_GetTicks();
+    int fx = 0;
+    for (int i = 0; i < batch->count; i++) {
+        const ControlCommand *cmd = &batch->commands[i];
+        switch (cmd->type) {
+        case CONTROL_CMD_PAUSE:
+            fx = (fx & ~CONTROL_FX_RESUME) | CONTROL_FX_PAUSE;
+            break;
+        case CONTROL_CMD_RESUME:
+            fx = (fx & ~CONTROL_FX_PAUSE) | CONTROL_FX_RESUME;
+            break;
+        case CONTROL_CMD_NAV:
+            v->game_nav_request = cmd->value;
+            fx |= CONTROL_FX_END_GAME;
+            break;
+        case CONTROL_CMD_SPEED: {
+            int delta = cmd->value;
+            if (!cmd->relative) {
+                delta = v->turbo_mode
+                    ? (cmd->value - v->turbo_delay_ms) / TURBO_DELAY_STEP_MS * MOVE_DELAY_STEP_MS
+                    : cmd->value - v->move_delay_ms;
+            }
+            adjust_move_delay(v, delta, now);
+            break;
+        }
+        case CONTROL_CMD_TURBO:
+            if (cmd->value < 0 || cmd->value != v->turbo_mode) toggle_turbo(v, now);
+            break;
+        case CONTROL_CMD_HIGHLIGHTS:
+            v->highlights_mode = (cmd->value < 0) ? !v->highlights_mode : cmd->value;
+            break;
+        case CONTROL_CMD_LOAD:
+            free(v->forced_pgn_path);
+            v->forced_pgn_path = copy_string(cmd->arg);
+            free_string_list(v->playlist, v->playlist_count);
+            v->playlist = NULL;
+            v->playlist_count = 0;
+            v->game_nav_request = GAME_NAV_SELECT;
+            fx |= CONTROL_FX_END_GAME;
+            break;
+        case CONTROL_CMD_PLAYLIST:
+            if (load_playlist(v, cmd->arg)) {
+                free(v->forced_pgn_path);
+                v->forced_pgn_path = NULL;
+                v->game_nav_request = GAME_NAV_SELECT;
+                fx |= CONTROL_FX_END_GAME;
+            } else {
+                show_status(v, "PLAYLIST NOT LOADED");
             }
+            break;
+        default:
+            break;
         }
     }
-    if (is_in_check(0)) {
-        int r = -1, f = -1;
-        if (find_king_pos('k', &r, &f)) {
-            int x = 0;
-            int y = 0;
-            board_to_screen(view, r, f, &x, &y);
-            SDL_Rect rect = {x, y, view->square, view->square};
-            for (int i = 0; i < thickness; i++) {
-                SDL_Rect r2 = {rect.x + i, rect.y + i, rect.w - 2 * i, rect.h - 2 * i};
-                if (r2.w <= 0 || r2.h <= 0) break;
-                SDL_RenderDrawRect(renderer, &r2);
+    free(batch);
+    return fx;
+}
+
+static int parse_switch(const char *arg, int *out) {
+    if (arg[0] == '\0' || strcmp(arg, "toggle") == 0) {
+        *out = -1;
+    } else if (strcmp(arg, "on") == 0) {
+        *out = 1;
+    } else if (strcmp(arg, "off") == 0) {
+        *out = 0;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Parses one command line, optionally prefixed with @N to address window N only.
+// Returns 1 for a command, 0 for a blank line, and -1 with *error set otherwise.
+static int parse_control_command(char *line, ControlCommand *cmd, unsigned int *targets, const char **error) {
+    char *p = line;
+    while (isspace((unsigned char)*p)) p++;
+    char *end = p + strlen(p);
+    while (end > p && isspace((unsigned char)end[-1])) *--end = '\0';
+    if (*p == '\0' || *p == '#') return 0;
+
+    *targets = (1u << viewer_count) - 1;
+    if (*p == '@') {
+        char *after = NULL;
+        long n = strtol(p + 1, &after, 10);
+        if (after == p + 1 || n < 1 || n > viewer_count) {
+            *error = "no such window";
+            return -1;
+        }
+        *targets = 1u << (n - 1);
+        p = after;
+        while (isspace((unsigned char)*p)) p++;
+    }
+    char *verb = p;
+    while (*p && !isspace((unsigned char)*p)) p++;
+    if (*p) *p++ = '\0';
+    while (isspace((unsigned char)*p)) p++;
+    const char *arg = p;
+
+    memset(cmd, 0, sizeof(*cmd));
+    if (strcmp(verb, "pause") == 0) {
+        cmd->type = CONTROL_CMD_PAUSE;
+    } else if (strcmp(verb, "resume") == 0) {
+        cmd->type = CONTROL_CMD_RESUME;
+    } else if (strcmp(verb, "next") == 0 || strcmp(verb, "skip") == 0) {
+        cmd->type = CONTROL_CMD_NAV;
+        cmd->value = GAME_NAV_NEXT;
+    } else if (strcmp(verb, "prev") == 0) {
+        cmd->type = CONTROL_CMD_NAV;
+        cmd->value = GAME_NAV_PREV;
+    } else if (strcmp(verb, "restart") == 0) {
+        cmd->type = CONTROL_CMD_NAV;
+        cmd->value = GAME_NAV_RESTART;
+    } else if (strcmp(verb, "faster") == 0 || strcmp(verb, "slower") == 0) {
+        cmd->type = CONTROL_CMD_SPEED;
+        cmd->relative = 1;
+        cmd->value = (verb[0] == 'f') ? -MOVE_DELAY_STEP_MS : MOVE_DELAY_STEP_MS;
+    } else if (strcmp(verb, "speed") == 0) {
+        char *after = NULL;
+        long ms = strtol(arg, &after, 10);
+        if (after == arg || *after != '\0') {
+            *error = "speed needs a delay in ms";
+            return -1;
+        }
+        cmd->type = CONTROL_CMD_SPEED;
+        cmd->relative = (arg[0] == '+' || arg[0] == '-');
+        cmd->value = (int)ms;
+    } else if (strcmp(verb, "turbo") == 0 || strcmp(verb, "highlights") == 0) {
+        cmd->type = (verb[0] == 't') ? CONTROL_CMD_TURBO : CONTROL_CMD_HIGHLIGHTS;
+        if (!parse_switch(arg, &cmd->value)) {
+            *error = "expected on, off, or toggle";
+            return -1;
+        }
+    } else if (strcmp(verb, "load") == 0 || strcmp(verb, "playlist") == 0) {
+        if (arg[0] == '\0' || strlen(arg) >= CONTROL_ARG_LEN) {
+            *error = "missing or overlong path";
+            return -1;
+        }
+        // The file is opened by the viewer, off the main thread; one that can't be read
+        // shows up there as FILE NOT PLAYABLE or PLAYLIST NOT LOADED.
+        cmd->type = (verb[0] == 'l') ? CONTROL_CMD_LOAD : CONTROL_CMD_PLAYLIST;
+        strcpy(cmd->arg, arg);
+    } else if (strcmp(verb, "quit") == 0) {
+        cmd->type = CONTROL_CMD_QUIT;
+    } else {
+        *error = "unknown command";
+        return -1;
+    }
+    return 1;
+}
+
+// Hands each viewer its share of a batch as a single input event.
+static void control_dispatch(const ControlBatch *batch, const unsigned int *targets) {
+    int quit = 0;
+    for (int c = 0; c < batch->count; c++) {
+        if (batch->commands[c].type == CONTROL_CMD_QUIT) quit = 1;
+    }
+    for (int i = 0; i < viewer_count; i++) {
+        if (SDL_AtomicGet(&viewers[i].logic_finished)) continue;
+        ControlBatch *mine = NULL;
+        for (int c = 0; c < batch->count; c++) {
+            if (!(targets[c] & (1u << i)) || batch->commands[c].type == CONTROL_CMD_QUIT) continue;
+            if (!mine) mine = (ControlBatch *)calloc(1, sizeof(ControlBatch));
+            if (!mine) break;
+            mine->commands[mine->count++] = batch->commands[c];
+        }
+        if (!mine) continue;
+        SDL_Event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.type = control_event_type;
+        ev.user.windowID = viewers[i].window_id;
+        ev.user.data1 = mine;
+        if (!push_input_event(&viewers[i], &ev)) free(mine);
+    }
+    if (quit) request_quit_all();
+}
+
+static void control_reply(int slot, const char *text) {
+#ifdef _WIN32
+    (void)slot;
+    DWORD written = 0;
+    WriteFile(control.pipe, text, (DWORD)strlen(text), &written, NULL);
+#else
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags = MSG_NOSIGNAL;
+#endif
+    if (send(control.fds[slot], text, strlen(text), flags) < 0) {
+        // The client went away; the next read notices and closes the slot.
+    }
+#endif
+}
+
+// Reads whatever is pending without waiting. Returns the byte count, 0 if nothing is
+// pending, or -1 once the client has gone.
+static int control_read(int slot, char *dst, int cap) {
+#ifdef _WIN32
+    (void)slot;
+    DWORD got = 0;
+    if (!ReadFile(control.pipe, dst, (DWORD)cap, &got, NULL)) {
+        return (GetLastError() == ERROR_NO_DATA) ? 0 : -1;
+    }
+    return (int)got;
+#else
+    ssize_t got = recv(control.fds[slot], dst, (size_t)cap, 0);
+    if (got > 0) return (int)got;
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+    return -1;
+#endif
+}
+
+static void control_drop(int slot) {
+#ifdef _WIN32
+    DisconnectNamedPipe(control.pipe);
+    control.connected = 0;
+#else
+    close(control.fds[slot]);
+    control.fds[slot] = -1;
+#endif
+    control.lengths[slot] = 0;
+}
+
+// Drains one client. All complete lines that arrived since the last poll form a batch;
+// a batch with any bad line is rejected whole, so a client never sees half of it applied.
+static void control_service(int slot) {
+    int closed = 0;
+    for (;;) {
+        int room = CONTROL_BUFFER_LEN - 1 - control.lengths[slot];
+        if (room <= 0) {
+            control_reply(slot, "error: line too long\n");
+            control.lengths[slot] = 0;
+            room = CONTROL_BUFFER_LEN - 1;
+        }
+        int got = control_read(slot, control.buffers[slot] + control.lengths[slot], room);
+        if (got < 0) closed = 1;
+        if (got <= 0) break;
+        control.lengths[slot] += got;
+    }
+
+    char *buf = control.buffers[slot];
+    buf[control.lengths[slot]] = '\0';
+    char *last_newline = strrchr(buf, '\n');
+    if (last_newline) {
+        *last_newline = '\0';
+        ControlBatch batch;
+        unsigned int targets[CONTROL_MAX_COMMANDS];
+        batch.count = 0;
+        const char *error = NULL;
+        char *line = buf;
+        while (line && !error) {
+            char *next = strchr(line, '\n');
+            if (next) *next++ = '\0';
+            ControlCommand cmd;
+            unsigned int mask = 0;
+            int status = parse_control_command(line, &cmd, &mask, &error);
+            if (status > 0) {
+                if (batch.count >= CONTROL_MAX_COMMANDS) {
+                    error = "too many commands in one batch";
+                } else {
+                    targets[batch.count] = mask;
+                    batch.commands[batch.count++] = cmd;
+                }
             }
+            line = next;
         }
+        if (error) {
+            char reply[96];
+            snprintf(reply, sizeof(reply), "error: %s\n", error);
+            control_reply(slot, reply);
+        } else if (batch.count > 0) {
+            control_dispatch(&batch, targets);
+            control_reply(slot, "ok\n");
+        }
+        int rest = control.lengths[slot] - (int)(last_newline + 1 - buf);
+        memmove(buf, last_newline + 1, (size_t)rest);
+        control.lengths[slot] = rest;
     }
+    if (closed) control_drop(slot);
+}
 
-    render_year_label(view);
-    render_speed_label(view);
-    render_player_labels(view);
-    render_guess_score(view);
-    render_help_overlay(view);
-    render_catalog_overlay(view);
+int control_open(const char *path) {
+    control_event_type = SDL_RegisterEvents(1);
+    if (control_event_type == (Uint32)-1) return 0;
+#ifdef _WIN32
+    if (strncmp(path, "\\\\.\\pipe\\", 9) == 0) {
+        snprintf(control.path, sizeof(control.path), "%s", path);
+    } else {
+        snprintf(control.path, sizeof(control.path), "\\\\.\\pipe\\%s", path);
+    }
+    control.pipe = CreateNamedPipeA(control.path, PIPE_ACCESS_DUPLEX,
+                                    PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_NOWAIT,
+                                    1, CONTROL_BUFFER_LEN, CONTROL_BUFFER_LEN, 0, NULL);
+    if (control.pipe == INVALID_HANDLE_VALUE) {
+        printf("Failed to create control pipe %s\n", control.path);
+        return 0;
+    }
+#else
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Control socket path too long: %s\n", path);
+        return 0;
+    }
+    strcpy(addr.sun_path, path);
+    snprintf(control.path, sizeof(control.path), "%s", path);
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) control.fds[i] = -1;
+    control.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (control.listen_fd < 0) {
+        printf("Failed to create control socket\n");
+        return 0;
+    }
+    // Only a socket left by an earlier run is replaced; any other file is the user's.
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            printf("%s exists and is not a socket; not using it for --control\n", path);
+            close(control.listen_fd);
+            return 0;
+        }
+        unlink(path);
+    }
+    if (bind(control.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(control.listen_fd, CONTROL_MAX_CLIENTS) != 0) {
+        printf("Failed to listen on %s\n", path);
+        close(control.listen_fd);
+        return 0;
+    }
+    fcntl(control.listen_fd, F_SETFL, fcntl(control.listen_fd, F_GETFL, 0) | O_NONBLOCK);
+#endif
+    control.active = 1;
+    return 1;
+}
 
-    SDL_RenderPresent(renderer);
+// Main thread, once per loop: accepts new clients and services pending input. Every
+// call returns immediately whether or not anything arrived.
+void control_poll(void) {
+    if (!control.active) return;
+#ifdef _WIN32
+    if (!control.connected) {
+        if (ConnectNamedPipe(control.pipe, NULL) || GetLastError() == ERROR_PIPE_CONNECTED) {
+            control.connected = 1;
+        } else if (GetLastError() == ERROR_NO_DATA) {
+            DisconnectNamedPipe(control.pipe);
+        }
+    }
+    if (control.connected) control_service(0);
+#else
+    for (;;) {
+        int fd = accept(control.listen_fd, NULL, NULL);
+        if (fd < 0) break;
+        int slot = 0;
+        while (slot < CONTROL_MAX_CLIENTS && control.fds[slot] >= 0) slot++;
+        if (slot == CONTROL_MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+        control.fds[slot] = fd;
+        control.lengths[slot] = 0;
+    }
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (control.fds[i] >= 0) control_service(i);
+    }
+#endif
 }
 
-void draw_board() {
-    BoardView view;
-    get_board_view(&view);
-    render_board(&view, NULL);
+void control_close(void) {
+    if (!control.active) return;
+#ifdef _WIN32
+    if (control.connected) DisconnectNamedPipe(control.pipe);
+    CloseHandle(control.pipe);
+#else
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (control.fds[i] >= 0) close(control.fds[i]);
+    }
+    close(control.listen_fd);
+    unlink(control.path);
+#endif
+    control.active = 0;
 }
 
 int sign(int x) { return (x > 0) ? 1 : (x < 0) ? -1 : 0; }
 
-int is_path_clear(int from_r, int from_f, int to_r, int to_f) {
+int is_path_clear(char b[BOARD_SIZE][BOARD_SIZE], int from_r, int from_f, int to_r, int to_f) {
     int dr = sign(to_r - from_r);
     int df = sign(to_f - from_f);
     int steps = (dr == 0) ? abs(to_f - from_f) : abs(to_r - from_r);
     for (int i = 1; i < steps; i++) {
-        if (board[from_r + i * dr][from_f + i * df] != '.') return 0;
+        if (b[from_r + i * dr][from_f + i * df] != '.') return 0;
     }
     return 1;
 }
 
-int is_valid_move(char piece, int from_r, int from_f, int to_r, int to_f, int is_white, int capture) {
+int is_valid_move(char b[BOARD_SIZE][BOARD_SIZE], char piece, int from_r, int from_f, int to_r, int to_f, int is_white, int capture) {
     int dr = abs(to_r - from_r);
     int df = abs(to_f - from_f);
     char p = toupper(piece);
     int dir = is_white ? -1 : 1;  // row direction (board[0] = rank 8)
-    char at_to = board[to_r][to_f];
+    char at_to = b[to_r][to_f];
     int is_empty = (at_to == '.');
     int is_enemy = !is_empty && (is_white_piece(at_to) != is_white);
 
@@ -1273,12 +3041,12 @@ int is_valid_move(char piece, int from_r, int from_f, int to_r, int to_f, int is
                 if (!is_empty) return 0;
                 if (dr == 1 && (to_r - from_r) == dir) movement_valid = 1;
                 else if (dr == 2 && ((is_white && from_r == 6) || (!is_white && from_r == 1)) && (to_r - from_r) == 2 * dir)
-                    movement_valid = is_path_clear(from_r, from_f, to_r, to_f);
+                    movement_valid = is_path_clear(b, from_r, from_f, to_r, to_f);
             } else if (df == 1 && dr == 1 && (to_r - from_r) == dir) {
                 if (capture && is_enemy) movement_valid = 1;
                 else if (capture && is_empty) {  // en passant
                     int ep_rank = is_white ? 3 : 4;  // board row for own pawn rank 5/4 (white/black)
-                    if (from_r == ep_rank && board[from_r][to_f] == (is_white ? 'p' : 'P')) movement_valid = 1;  // Check if enemy pawn is there for ep
+                    if (from_r == ep_rank && b[from_r][to_f] == (is_white ? 'p' : 'P')) movement_valid = 1;  // Check if enemy pawn is there for ep
                 }
             }
             break;
@@ -1286,13 +3054,13 @@ int is_valid_move(char piece, int from_r, int from_f, int to_r, int to_f, int is
             movement_valid = ((dr == 1 && df == 2) || (dr == 2 && df == 1));
             break;
         case 'B':
-            movement_valid = (dr == df && dr > 0 && is_path_clear(from_r, from_f, to_r, to_f));
+            movement_valid = (dr == df && dr > 0 && is_path_clear(b, from_r, from_f, to_r, to_f));
             break;
         case 'R':
-            movement_valid = ((dr == 0 || df == 0) && (dr + df > 0) && is_path_clear(from_r, from_f, to_r, to_f));
+            movement_valid = ((dr == 0 || df == 0) && (dr + df > 0) && is_path_clear(b, from_r, from_f, to_r, to_f));
             break;
         case 'Q':
-            movement_valid = (((dr == df) || (dr == 0 || df == 0)) && (dr + df > 0) && is_path_clear(from_r, from_f, to_r, to_f));
+            movement_valid = (((dr == df) || (dr == 0 || df == 0)) && (dr + df > 0) && is_path_clear(b, from_r, from_f, to_r, to_f));
             break;
         case 'K':
             movement_valid = (dr <= 1 && df <= 1 && (dr + df > 0));
@@ -1306,12 +3074,12 @@ int is_valid_move(char piece, int from_r, int from_f, int to_r, int to_f, int is
     return 0;
 }
 
-int is_in_check(int is_white) {
+int is_in_check(char b[BOARD_SIZE][BOARD_SIZE], int is_white) {
     int king_r = -1, king_f = -1;
     char king = is_white ? 'K' : 'k';
     for (int r = 0; r < BOARD_SIZE; r++) {
         for (int f = 0; f < BOARD_SIZE; f++) {
-            if (board[r][f] == king) {
+            if (b[r][f] == king) {
                 king_r = r;
                 king_f = f;
                 break;
@@ -1324,9 +3092,9 @@ int is_in_check(int is_white) {
     int opponent_is_white = !is_white;
     for (int r = 0; r < BOARD_SIZE; r++) {
         for (int f = 0; f < BOARD_SIZE; f++) {
-            char p = board[r][f];
+            char p = b[r][f];
             if (p == '.' || (is_white_piece(p) != opponent_is_white)) continue;  // Not opponent piece
-            if (is_valid_move(p, r, f, king_r, king_f, opponent_is_white, 1)) {
+            if (is_valid_move(b, p, r, f, king_r, king_f, opponent_is_white, 1)) {
                 return 1;
             }
         }
@@ -1340,9 +3108,9 @@ typedef struct {
 } Move;
 
 // Forward declaration
-void apply_move(const Move *m, int is_white);
+void apply_move(char b[BOARD_SIZE][BOARD_SIZE], const Move *m, int is_white);
 
-int parse_san(const char *san, int is_white, Move *m) {
+int parse_san(char b[BOARD_SIZE][BOARD_SIZE], const char *san, int is_white, Move *m) {
     char clean_san[16];
     strcpy(clean_san, san);
     int len = strlen(clean_san);
@@ -1422,9 +3190,9 @@ int parse_san(const char *san, int is_white, Move *m) {
 
     for (int r = 0; r < BOARD_SIZE; r++) {
         for (int f = 0; f < BOARD_SIZE; f++) {
-            if (board[r][f] == target_piece) {
+            if (b[r][f] == target_piece) {
                 if ((hint_f >= 0 && f != hint_f) || (hint_r >= 0 && r != hint_r)) continue;
-                if (is_valid_move(target_piece, r, f, to_r, to_f, is_white, capture)) {
+                if (is_valid_move(b, target_piece, r, f, to_r, to_f, is_white, capture)) {
                     candidates[num_candidates].r = r;
                     candidates[num_candidates].f = f;
                     num_candidates++;
@@ -1443,140 +3211,142 @@ int parse_san(const char *san, int is_white, Move *m) {
     // Resolve ambiguity with legality check (no self-check)
     for (int i = 0; i < num_candidates; i++) {
         char temp_board[BOARD_SIZE][BOARD_SIZE];
-        memcpy(temp_board, board, sizeof(board));
+        memcpy(temp_board, b, sizeof(temp_board));
 
         Move temp_m = *m;
         temp_m.from_r = candidates[i].r;
         temp_m.from_f = candidates[i].f;
-        apply_move(&temp_m, is_white);  // Apply on temp
-        if (!is_in_check(is_white)) {
-            memcpy(board, temp_board, sizeof(board));  // Restore original board
+        apply_move(b, &temp_m, is_white);  // Apply on temp
+        if (!is_in_check(b, is_white)) {
+            memcpy(b, temp_board, sizeof(temp_board));  // Restore original board
             m->from_r = candidates[i].r;
             m->from_f = candidates[i].f;
             return 1;
         }
-        memcpy(board, temp_board, sizeof(board));  // Restore original board
+        memcpy(b, temp_board, sizeof(temp_board));  // Restore original board
     }
 
     return 0;  // No legal move found
 }
 
-void apply_move(const Move *m, int is_white) {
-    char piece = board[m->from_r][m->from_f];
-    char captured = board[m->to_r][m->to_f];
+void apply_move(char b[BOARD_SIZE][BOARD_SIZE], const Move *m, int is_white) {
+    char piece = b[m->from_r][m->from_f];
+    char captured = b[m->to_r][m->to_f];
 
     // En passant capture
     int dir = is_white ? -1 : 1;
     if (toupper(piece) == 'P' && abs(m->from_f - m->to_f) == 1 && captured == '.') {
-        board[m->to_r - dir][m->to_f] = '.';  // Remove captured pawn
+        b[m->to_r - dir][m->to_f] = '.';  // Remove captured pawn
     }
 
     // Place the piece (with promotion if applicable)
-    board[m->to_r][m->to_f] = m->promo ? (is_white ? toupper(m->promo) : tolower(m->promo)) : piece;
-    board[m->from_r][m->from_f] = '.';
+    b[m->to_r][m->to_f] = m->promo ? (is_white ? toupper(m->promo) : tolower(m->promo)) : piece;
+    b[m->from_r][m->from_f] = '.';
 
     // Castling: move rook
     if (toupper(piece) == 'K' && abs(m->from_f - m->to_f) == 2) {
         int rook_from = (m->to_f > m->from_f) ? 7 : 0;
         int rook_to = (m->to_f > m->from_f) ? 5 : 3;
         char rook = is_white ? 'R' : 'r';
-        board[m->from_r][rook_to] = rook;
-        board[m->from_r][rook_from] = '.';
+        b[m->from_r][rook_to] = rook;
+        b[m->from_r][rook_from] = '.';
     }
 }
 
-int animate_move(const Move *m, int is_white) {
-    char piece = board[m->from_r][m->from_f];
+int animate_move(Viewer *v, const Move *m, int is_white) {
+    (void)is_white;
+    char piece = v->board[m->from_r][m->from_f];
     if (piece == '.') return 0;
 
-    BoardView view;
-    get_board_view(&view);
-
-    int start_x = 0;
-    int start_y = 0;
-    int end_x = 0;
-    int end_y = 0;
-    board_to_screen(&view, m->from_r, m->from_f, &start_x, &start_y);
-    board_to_screen(&view, m->to_r, m->to_f, &end_x, &end_y);
-    Uint32 start = SDL_GetTicks();
+    v->move_anim.active = 1;
+    v->move_anim.piece = piece;
+    v->move_anim.from_r = m->from_r;
+    v->move_anim.from_f = m->from_f;
+    v->move_anim.to_r = m->to_r;
+    v->move_anim.to_f = m->to_f;
+    v->move_anim.start = SDL_GetTicks();
+    v->move_anim.duration = MOVE_ANIM_MS;
+    if (v->turbo_mode && v->turbo_delay_ms / 2 < MOVE_ANIM_MS) {
+        // Leave half of each turbo interval for the position to rest.
+        v->move_anim.duration = (Uint32)(v->turbo_delay_ms / 2);
+    }
+    draw_board(v);
 
-    for (;;) {
+    int stop = 0;
+    while (!stop) {
         Uint32 loop_now = SDL_GetTicks();
-        update_cursor_auto_hide(loop_now);
+        update_cursor_auto_hide(v, loop_now);
+        BoardView view;
+        get_board_view(v, &view);
         SDL_Event e;
-        while (SDL_PollEvent(&e)) {
-            note_mouse_activity_event(&e);
-            if (handle_catalog_event(&e, games_dir_root)) {
-                draw_board();
-        if (game_nav_request == GAME_NAV_SELECT && catalog_selection_made) {
-            catalog_selection_made = 0;
-            return 1;
-        }
+        while (!stop && poll_input_event(v, &e)) {
+            note_mouse_activity_event(v, &e);
+            if (e.type == control_event_type) {
+                int fx = apply_control_batch(v, &e);
+                if (fx & CONTROL_FX_END_GAME) stop = 1;
+                if (fx & CONTROL_FX_PAUSE) v->pause_buffered = 1;
+                if (fx & CONTROL_FX_RESUME) v->pause_buffered = 0;
+                draw_board(v);
+                continue;
+            }
+            if (handle_catalog_event(v, &e, games_dir_root)) {
+                draw_board(v);
+                if (v->game_nav_request == GAME_NAV_SELECT && v->catalog_selection_made) {
+                    v->catalog_selection_made = 0;
+                    stop = 1;
+                }
                 continue;
             }
             if (e.type == SDL_QUIT) {
-                return 1;
+                stop = 1;
             } else if (e.type == SDL_KEYDOWN) {
                 SDL_Keycode key = e.key.keysym.sym;
                 if (key == SDLK_q) {
-                    game_nav_request = GAME_NAV_NONE;
-                    return 1;
+                    v->game_nav_request = GAME_NAV_NONE;
+                    stop = 1;
                 } else if (key == SDLK_n) {
-                    game_nav_request = GAME_NAV_NEXT;
-                    return 1;
+                    v->game_nav_request = GAME_NAV_NEXT;
+                    stop = 1;
                 } else if (key == SDLK_p) {
-                    game_nav_request = GAME_NAV_PREV;
-                    return 1;
+                    v->game_nav_request = GAME_NAV_PREV;
+                    stop = 1;
                 } else if (key == SDLK_r) {
-                    game_nav_request = GAME_NAV_RESTART;
-                    return 1;
+                    v->game_nav_request = GAME_NAV_RESTART;
+                    stop = 1;
                 } else if (key == SDLK_c) {
-                    catalog_open(games_dir_root);
-                    draw_board();
+                    catalog_open(v, games_dir_root);
                 } else if (key == SDLK_ESCAPE) {
-                    show_help = !show_help;
+                    v->show_help = !v->show_help;
                 } else if (key == SDLK_SPACE) {
-                    pause_buffered = 1;
+                    v->pause_buffered = 1;
                 } else if (key == SDLK_UP || key == SDLK_DOWN) {
                     Uint32 now = SDL_GetTicks();
                     int delta = (key == SDLK_UP) ? MOVE_DELAY_STEP_MS : -MOVE_DELAY_STEP_MS;
-                    adjust_move_delay(delta, now);
+                    adjust_move_delay(v, delta, now);
                 } else if (key == SDLK_f) {
-                    view_from_white = !view_from_white;
-                    get_board_view(&view);
-                    board_to_screen(&view, m->from_r, m->from_f, &start_x, &start_y);
-                    board_to_screen(&view, m->to_r, m->to_f, &end_x, &end_y);
+                    v->view_from_white = !v->view_from_white;
                 }
             } else if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_MIDDLE) {
-                clear_analysis_marks();
+                clear_analysis_marks(v);
             } else if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_RIGHT) {
-                begin_mark_drag(&view, e.button.x, e.button.y);
+                begin_mark_drag(v, &view, e.button.x, e.button.y);
             } else if (e.type == SDL_MOUSEMOTION) {
                 if (e.motion.state & SDL_BUTTON_RMASK) {
-                    update_mark_drag(&view, e.motion.x, e.motion.y);
+                    update_mark_drag(v, &view, e.motion.x, e.motion.y);
                 }
             } else if (e.type == SDL_MOUSEBUTTONUP && e.button.button == SDL_BUTTON_RIGHT) {
-                end_mark_drag();
+                end_mark_drag(v);
             }
+            draw_board(v);
         }
+        if (stop) break;
 
-        Uint32 now = SDL_GetTicks();
-        float t = (MOVE_ANIM_MS > 0) ? (float)(now - start) / (float)MOVE_ANIM_MS : 1.0f;
-        if (t > 1.0f) t = 1.0f;
-
-        Overlay overlay;
-        overlay.active = 1;
-        overlay.piece = piece;
-        overlay.x = start_x + (end_x - start_x) * t;
-        overlay.y = start_y + (end_y - start_y) * t;
-        overlay.skip_r1 = m->from_r;
-        overlay.skip_f1 = m->from_f;
-        render_board(&view, &overlay);
-
-        if (t >= 1.0f) break;
+        // The render loop interpolates the slide; this loop only waits it out.
+        if (SDL_GetTicks() - v->move_anim.start >= v->move_anim.duration) break;
         SDL_Delay(10);
     }
-    return 0;
+    v->move_anim.active = 0;
+    return stop;
 }
 
 void clean_line(char *line) {
@@ -1638,9 +3408,16 @@ int build_move_list(const char *move_buffer, char moves[][MOVE_TEXT_LEN], int ma
         result_out[0] = '\0';
     }
 
+    // Split by hand rather than with strtok, whose hidden state isn't safe on the
+    // prefetch and batch worker threads.
     int count = 0;
-    char *token = strtok(temp_buffer, " \t\n\r");
-    while (token) {
+    char *cursor = temp_buffer;
+    for (;;) {
+        cursor += strspn(cursor, " \t\n\r");
+        if (!*cursor) break;
+        char *token = cursor;
+        cursor += strcspn(cursor, " \t\n\r");
+        if (*cursor) *cursor++ = '\0';
         char san_buf[MOVE_TEXT_LEN];
         if (extract_san_token(token, san_buf, sizeof(san_buf))) {
             if (is_result_token(san_buf)) {
@@ -1656,7 +3433,6 @@ int build_move_list(const char *move_buffer, char moves[][MOVE_TEXT_LEN], int ma
                 count++;
             }
         }
-        token = strtok(NULL, " \t\n\r");
     }
     return count;
 }
@@ -1678,20 +3454,585 @@ int is_draw_result(const char *result) {
     return (result && strcmp(result, "1/2-1/2") == 0);
 }
 
-void replay_moves_to_index(char moves[][MOVE_TEXT_LEN], int move_count, int index) {
-    init_board();
+int material_balance(char b[BOARD_SIZE][BOARD_SIZE]) {
+    int total = 0;
+    for (int r = 0; r < BOARD_SIZE; r++) {
+        for (int f = 0; f < BOARD_SIZE; f++) {
+            int value = 0;
+            switch (toupper((unsigned char)b[r][f])) {
+                case 'P': value = 1; break;
+                case 'N': value = 3; break;
+                case 'B': value = 3; break;
+                case 'R': value = 5; break;
+                case 'Q': value = 9; break;
+                default: break;
+            }
+            total += is_white_piece(b[r][f]) ? value : -value;
+        }
+    }
+    return total;
+}
+
+static Uint64 mix64(Uint64 x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// Zobrist-style key of piece placement and side to move. The per-square values come
+// from a fixed mixer instead of a random table so every build of the index agrees.
+// Castling and en passant rights are not part of the key.
+Uint64 position_hash(char b[BOARD_SIZE][BOARD_SIZE], int white_to_move) {
+    static const char pieces[] = "PNBRQKpnbrqk";
+    Uint64 h = white_to_move ? 0 : mix64(12 * 64 + 1);
+    for (int r = 0; r < BOARD_SIZE; r++) {
+        for (int f = 0; f < BOARD_SIZE; f++) {
+            if (b[r][f] == '.') continue;
+            const char *p = strchr(pieces, b[r][f]);
+            if (!p) continue;
+            h ^= mix64((Uint64)((p - pieces) * 64 + r * BOARD_SIZE + f + 1));
+        }
+    }
+    return h;
+}
+
+// The first two FEN fields, piece placement and side to move: all a position hash
+// covers. Returns the length written; out must hold SHM_FEN_LEN bytes.
+int board_placement(char b[BOARD_SIZE][BOARD_SIZE], int white_to_move, char *fen) {
+    int len = 0;
+    for (int r = 0; r < BOARD_SIZE; r++) {
+        int empty = 0;
+        for (int f = 0; f < BOARD_SIZE; f++) {
+            if (b[r][f] == '.') {
+                empty++;
+                continue;
+            }
+            if (empty) fen[len++] = (char)('0' + empty);
+            empty = 0;
+            fen[len++] = b[r][f];
+        }
+        if (empty) fen[len++] = (char)('0' + empty);
+        if (r < BOARD_SIZE - 1) fen[len++] = '/';
+    }
+    fen[len++] = ' ';
+    fen[len++] = white_to_move ? 'w' : 'b';
+    fen[len] = '\0';
+    return len;
+}
+
+// FEN of the position on the board. The board alone does not carry castling rights or
+// an en passant square, so castling is inferred from kings and rooks still on their
+// home squares and en passant is always "-".
+void board_to_fen(char b[BOARD_SIZE][BOARD_SIZE], int ply, char *out, size_t out_size) {
+    char fen[SHM_FEN_LEN];
+    int len = board_placement(b, ply % 2 == 0, fen);
+    fen[len++] = ' ';
+    int castle_start = len;
+    if (b[7][4] == 'K' && b[7][7] == 'R') fen[len++] = 'K';
+    if (b[7][4] == 'K' && b[7][0] == 'R') fen[len++] = 'Q';
+    if (b[0][4] == 'k' && b[0][7] == 'r') fen[len++] = 'k';
+    if (b[0][4] == 'k' && b[0][0] == 'r') fen[len++] = 'q';
+    if (len == castle_start) fen[len++] = '-';
+    fen[len] = '\0';
+    snprintf(out, out_size, "%s - 0 %d", fen, ply / 2 + 1);
+}
+
+// Piece placement and side to move from a FEN; the rest is ignored, as position_hash
+// doesn't use it. Returns 0 if the placement is malformed.
+int fen_to_board(const char *fen, char b[BOARD_SIZE][BOARD_SIZE], int *white_to_move) {
+    memset(b, '.', BOARD_SIZE * BOARD_SIZE);
+    int r = 0;
+    int f = 0;
+    const char *c = fen;
+    while (*c == ' ') c++;
+    for (; *c && *c != ' '; c++) {
+        if (*c == '/') {
+            if (f != BOARD_SIZE || ++r >= BOARD_SIZE) return 0;
+            f = 0;
+        } else if (*c >= '1' && *c <= '8') {
+            f += *c - '0';
+            if (f > BOARD_SIZE) return 0;
+        } else if (strchr("PNBRQKpnbrqk", *c) && f < BOARD_SIZE) {
+            b[r][f++] = *c;
+        } else {
+            return 0;
+        }
+    }
+    if (r != BOARD_SIZE - 1 || f != BOARD_SIZE) return 0;
+    while (*c == ' ') c++;
+    *white_to_move = (*c != 'b');
+    return 1;
+}
+
+// Shared-memory status for local consumers (overlays, recorders). Every viewer has a
+// status block guarded by a seqlock: its logic thread bumps `seq` to odd, writes, and
+// bumps it back to even, and readers retry when `seq` was odd or moved under them.
+// With --shm-frames the first window's pixels also go to a small ring of slots, each
+// with its own seqlock; `frame_count` tells readers which slot is newest.
+typedef struct {
+    SDL_atomic_t seq;
+    Uint32 game_serial;
+    Uint32 ply;
+    Uint32 ply_count;
+    Uint32 flags;
+    Uint32 move_delay_ms;
+    char white[NAME_LEN];
+    char black[NAME_LEN];
+    char year[8];
+    char path[SHM_PATH_LEN];
+    char fen[SHM_FEN_LEN];
+} ShmStatus;
+
+typedef struct {
+    SDL_atomic_t seq;
+    Uint32 width;
+    Uint32 height;
+    Uint32 pitch;
+    Uint32 ticks;
+    Uint32 checksum;  // low half of checksum64 over the rows, so readers can verify the pixels
+    Uint32 reserved[2];
+} ShmFrameSlot;
+
+typedef struct {
+    Uint32 magic;
+    Uint32 version;
+    Uint32 header_size;
+    Uint32 viewer_count;
+    Uint32 frame_slots;
+    Uint32 frame_capacity;
+    Uint32 frame_format;
+    Uint32 frame_offset;
+    SDL_atomic_t frame_count;
+    SDL_atomic_t writer_alive;
+    Uint32 writer_pid;  // so a reader can tell a region left by a crashed viewer
+    Uint32 reserved[5];
+    ShmStatus status[MAX_VIEWERS];
+    ShmFrameSlot frames[SHM_FRAME_SLOTS];
+} ShmHeader;
+
+typedef struct {
+    int active;
+    ShmHeader *header;
+    size_t size;
+    char name[SHM_NAME_LEN];
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+    // Last status each viewer published, so unchanged loops skip the seqlock write.
+    ShmStatus last[MAX_VIEWERS];
+} ShmRegion;
+
+ShmRegion shm = {0};
+
+static int shm_map(const char *name, size_t size, int create) {
+    if (strlen(name) + 8 >= sizeof(shm.name) || strchr(name, '/') || strchr(name, '\\')) {
+        printf("Invalid shared memory name: %s\n", name);
+        return 0;
+    }
+#ifdef _WIN32
+    snprintf(shm.name, sizeof(shm.name), "Local\\%s", name);
+    if (create) {
+        shm.mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)size, shm.name);
+    } else {
+        shm.mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, shm.name);
+    }
+    if (!shm.mapping) {
+        printf("Could not map shared memory %s\n", shm.name);
+        return 0;
+    }
+    shm.header = (ShmHeader *)MapViewOfFile(shm.mapping, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, create ? size : 0);
+    if (!shm.header) {
+        printf("Could not map shared memory %s\n", shm.name);
+        CloseHandle(shm.mapping);
+        return 0;
+    }
+    if (!create) {
+        MEMORY_BASIC_INFORMATION info;
+        size = VirtualQuery(shm.header, &info, sizeof(info)) ? info.RegionSize : sizeof(ShmHeader);
+    }
+#else
+    snprintf(shm.name, sizeof(shm.name), "/%s", name);
+    int fd = create ? shm_open(shm.name, O_RDWR | O_CREAT | O_TRUNC, 0600) : shm_open(shm.name, O_RDONLY, 0);
+    if (fd < 0) {
+        printf("Could not open shared memory %s: %s\n", shm.name, strerror(errno));
+        return 0;
+    }
+    struct stat st;
+    if (create ? ftruncate(fd, (off_t)size) != 0 : (fstat(fd, &st) != 0 || (size = (size_t)st.st_size) < sizeof(ShmHeader))) {
+        printf("Could not size shared memory %s\n", shm.name);
+        close(fd);
+        if (create) shm_unlink(shm.name);
+        return 0;
+    }
+    void *base = mmap(NULL, size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        printf("Could not map shared memory %s: %s\n", shm.name, strerror(errno));
+        if (create) shm_unlink(shm.name);
+        return 0;
+    }
+    shm.header = (ShmHeader *)base;
+#endif
+    shm.size = size;
+    shm.active = 1;
+    return 1;
+}
+
+static void shm_unmap(int owner) {
+    if (!shm.active) return;
+#ifdef _WIN32
+    (void)owner;
+    UnmapViewOfFile(shm.header);
+    CloseHandle(shm.mapping);
+#else
+    munmap(shm.header, shm.size);
+    if (owner) shm_unlink(shm.name);
+#endif
+    shm.header = NULL;
+    shm.active = 0;
+}
+
+// Main thread, once the windows exist. The frame slots are sized for the first
+// window's current output; frames from a window grown past that are clipped.
+int shm_create(const char *name, int with_frames) {
+    Uint32 capacity = 0;
+    Uint32 offset = (Uint32)((sizeof(ShmHeader) + 63) & ~(size_t)63);
+    if (with_frames && !viewers[0].renderer) {
+        printf("--shm-frames needs a window\n");
+        return 0;
+    }
+    if (with_frames) {
+        int w = SCREEN_SIZE;
+        int h = SCREEN_SIZE;
+        SDL_GetRendererOutputSize(viewers[0].renderer, &w, &h);
+        capacity = (Uint32)w * (Uint32)h * 4;
+    }
+    if (!shm_map(name, (size_t)offset + (size_t)capacity * (with_frames ? SHM_FRAME_SLOTS : 0), 1)) return 0;
+    ShmHeader *hdr = shm.header;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = SHM_MAGIC;
+    hdr->version = SHM_VERSION;
+    hdr->header_size = (Uint32)sizeof(ShmHeader);
+    hdr->viewer_count = (Uint32)viewer_count;
+    hdr->frame_slots = with_frames ? SHM_FRAME_SLOTS : 0;
+    hdr->frame_capacity = capacity;
+    hdr->frame_format = SDL_PIXELFORMAT_RGBA32;
+    hdr->frame_offset = offset;
+#ifdef _WIN32
+    hdr->writer_pid = (Uint32)GetCurrentProcessId();
+#else
+    hdr->writer_pid = (Uint32)getpid();
+#endif
+    memset(shm.last, 0, sizeof(shm.last));
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&hdr->writer_alive, 1);
+    return 1;
+}
+
+void shm_destroy(void) {
+    if (!shm.active) return;
+    SDL_AtomicSet(&shm.header->writer_alive, 0);
+    shm_unmap(1);
+}
+
+// Logic thread, once per loop iteration with the ply on the board. Only a status that
+// differs from the last one published takes the seqlock.
+void shm_update_status(Viewer *v, int ply) {
+    if (!shm.active) return;
+    ShmStatus next;
+    memset(&next, 0, sizeof(next));
+    next.game_serial = (Uint32)v->game_serial;
+    next.ply = (Uint32)ply;
+    next.ply_count = (Uint32)v->ply_cache.ply_count;
+    next.flags = (v->dim_board ? SHM_FLAG_PAUSED : 0) |
+                 (v->turbo_mode ? SHM_FLAG_TURBO : 0) |
+                 (v->highlights_mode ? SHM_FLAG_HIGHLIGHTS : 0) |
+                 (v->split_active ? SHM_FLAG_SPLIT : 0) |
+                 (v->analysis_mode ? SHM_FLAG_ANALYSIS : 0) |
+                 (v->guess_mode ? SHM_FLAG_GUESS : 0);
+    next.move_delay_ms = (Uint32)current_move_delay(v);
+    memcpy(next.white, v->current_white_name, sizeof(next.white));
+    memcpy(next.black, v->current_black_name, sizeof(next.black));
+    memcpy(next.year, v->current_game_year, sizeof(v->current_game_year));
+    if (v->current_game_path) snprintf(next.path, sizeof(next.path), "%s", v->current_game_path);
+    board_to_fen(v->board, ply, next.fen, sizeof(next.fen));
+
+    ShmStatus *last = &shm.last[v->index];
+    if (memcmp(&next, last, sizeof(next)) == 0) return;
+    *last = next;
+
+    ShmStatus *st = &shm.header->status[v->index];
+    SDL_AtomicIncRef(&st->seq);
+    SDL_MemoryBarrierRelease();
+    memcpy((char *)st + sizeof(st->seq), (const char *)&next + sizeof(next.seq), sizeof(next) - sizeof(next.seq));
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicIncRef(&st->seq);
+}
+
+// Main thread, after a frame is drawn and before it is presented. The pixels are read
+// straight into the next ring slot.
+void shm_publish_frame(Viewer *v) {
+    ShmHeader *hdr = shm.header;
+    if (!shm.active || hdr->frame_slots == 0 || v->index != 0) return;
+    int w = 0;
+    int h = 0;
+    if (SDL_GetRendererOutputSize(v->renderer, &w, &h) != 0 || w <= 0 || h <= 0) return;
+    if ((Uint32)w * 4 > hdr->frame_capacity) w = (int)(hdr->frame_capacity / 4);
+    if ((Uint32)w * 4 * (Uint32)h > hdr->frame_capacity) h = (int)(hdr->frame_capacity / ((Uint32)w * 4));
+    int count = SDL_AtomicGet(&hdr->frame_count);
+    int slot_index = (int)((Uint32)count % hdr->frame_slots);
+    ShmFrameSlot *slot = &hdr->frames[slot_index];
+    Uint8 *pixels = (Uint8 *)hdr + hdr->frame_offset + (size_t)slot_index * hdr->frame_capacity;
+    SDL_Rect rect = {0, 0, w, h};
+
+    SDL_AtomicIncRef(&slot->seq);
+    SDL_MemoryBarrierRelease();
+    int ok = SDL_RenderReadPixels(v->renderer, &rect, hdr->frame_format, pixels, w * 4) == 0;
+    slot->width = ok ? (Uint32)w : 0;
+    slot->height = ok ? (Uint32)h : 0;
+    slot->pitch = (Uint32)w * 4;
+    slot->ticks = SDL_GetTicks();
+    slot->checksum = ok ? (Uint32)checksum64(pixels, (size_t)slot->pitch * slot->height, 0) : 0;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicIncRef(&slot->seq);
+    if (ok) SDL_AtomicSet(&hdr->frame_count, count + 1);
+}
+
+// Readers map the region read-only, so they load the sequence numbers with plain
+// volatile reads rather than SDL atomics that may be implemented as writes.
+static int shm_load(const SDL_atomic_t *a) {
+    int value = *(const volatile int *)&a->value;
+    SDL_MemoryBarrierAcquire();
+    return value;
+}
+
+// Copies a seqlock-protected block into `out`; returns the number of retries it took.
+static int shm_read_block(const SDL_atomic_t *seq, const void *src, void *out, size_t size) {
+    int retries = 0;
+    for (;;) {
+        int before = shm_load(seq);
+        if ((before & 1) == 0) {
+            memcpy(out, src, size);
+            SDL_MemoryBarrierAcquire();
+            if (shm_load(seq) == before) return retries;
+        }
+        retries++;
+        if (retries % 64 == 0) SDL_Delay(0);
+    }
+}
+
+// A viewer that crashed leaves writer_alive set, so readers also check its process.
+static int shm_writer_running(const ShmHeader *hdr) {
+#ifdef _WIN32
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)hdr->writer_pid);
+    if (!process) return 0;
+    int running = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return running;
+#else
+    return hdr->writer_pid != 0 && (kill((pid_t)hdr->writer_pid, 0) == 0 || errno == EPERM);
+#endif
+}
+
+// Copies the newest frame slot and its pixels under the slot's seqlock into `slot` and
+// `pixels` (frame_capacity bytes). Returns 1 if the pixels match the slot's checksum.
+static int shm_read_frame(const ShmHeader *hdr, int slot_index, ShmFrameSlot *slot, Uint8 *pixels, int *torn) {
+    const ShmFrameSlot *src = &hdr->frames[slot_index];
+    const Uint8 *src_pixels = (const Uint8 *)hdr + hdr->frame_offset + (size_t)slot_index * hdr->frame_capacity;
+    for (;;) {
+        int before = shm_load(&src->seq);
+        if ((before & 1) == 0) {
+            memcpy(slot, src, sizeof(*slot));
+            size_t size = (size_t)slot->pitch * slot->height;
+            int sane = size <= hdr->frame_capacity && (size_t)slot->width * 4 <= slot->pitch;
+            if (sane) memcpy(pixels, src_pixels, size);
+            SDL_MemoryBarrierAcquire();
+            if (shm_load(&src->seq) == before) {
+                return sane && (slot->width == 0 || (Uint32)checksum64(pixels, size, 0) == slot->checksum);
+            }
+        }
+        (*torn)++;
+        SDL_Delay(0);
+    }
+}
+
+// --shm-client: attaches to a running viewer's region and reports what it sees,
+// without touching SDL video. Frame checks copy the newest frame whole and verify its
+// pixels against the slot's checksum, and count torn reads that had to be retried. A
+// region whose viewer is gone is removed rather than read.
+int run_shm_client(const char *name) {
+    if (!shm_map(name, 0, 0)) return 1;
+    ShmHeader *hdr = shm.header;
+    if (hdr->magic != SHM_MAGIC || hdr->version != SHM_VERSION || hdr->header_size != sizeof(ShmHeader) ||
+        hdr->viewer_count > MAX_VIEWERS ||
+        (size_t)hdr->frame_offset + (size_t)hdr->frame_capacity * hdr->frame_slots > shm.size) {
+        printf("%s is not a chess viewer status region\n", shm.name);
+        shm_unmap(0);
+        return 1;
+    }
+    if (!shm_writer_running(hdr)) {
+        printf("%s was left by viewer process %u, which is no longer running; removing it\n", shm.name,
+               hdr->writer_pid);
+        shm_unmap(1);
+        return 1;
+    }
+    Uint8 *pixels = (Uint8 *)malloc((size_t)hdr->frame_capacity + 1);
+    if (!pixels) {
+        shm_unmap(0);
+        return 1;
+    }
+    printf("Attached to %s: %u viewer(s), %u frame slot(s) of %u bytes\n", shm.name,
+           hdr->viewer_count, hdr->frame_slots, hdr->frame_capacity);
+
+    ShmStatus seen[MAX_VIEWERS];
+    memset(seen, 0, sizeof(seen));
+    int last_frame_count = shm_load(&hdr->frame_count);
+    Uint32 report_at = SDL_GetTicks() + 1000;
+    int status_reads = 0;
+    int torn = 0;
+    int bad_frames = 0;
+    int crashed = 0;
+    while (shm_load(&hdr->writer_alive)) {
+        for (Uint32 i = 0; i < hdr->viewer_count; i++) {
+            ShmStatus cur;
+            torn += shm_read_block(&hdr->status[i].seq, &hdr->status[i], &cur, sizeof(cur));
+            status_reads++;
+            cur.white[NAME_LEN - 1] = '\0';
+            cur.black[NAME_LEN - 1] = '\0';
+            cur.year[sizeof(cur.year) - 1] = '\0';
+            cur.fen[SHM_FEN_LEN - 1] = '\0';
+            if (cur.game_serial == seen[i].game_serial && cur.ply == seen[i].ply && cur.flags == seen[i].flags) continue;
+            if (cur.game_serial != seen[i].game_serial) {
+                printf("[%u] game %u: %s - %s %s (%u plies)\n", i + 1, cur.game_serial,
+                       cur.white, cur.black, cur.year, cur.ply_count);
+            }
+            printf("[%u] ply %u%s%s%s %s\n", i + 1, cur.ply,
+                   (cur.flags & SHM_FLAG_PAUSED) ? " paused" : "",
+                   (cur.flags & SHM_FLAG_TURBO) ? " turbo" : "",
+                   (cur.flags & SHM_FLAG_HIGHLIGHTS) ? " highlights" : "",
+                   cur.fen);
+            seen[i] = cur;
+        }
+
+        Uint32 now = SDL_GetTicks();
+        if ((Sint32)(now - report_at) >= 0) {
+            if (!shm_writer_running(hdr)) {
+                crashed = 1;
+                break;
+            }
+            int count = shm_load(&hdr->frame_count);
+            if (hdr->frame_slots > 0 && count != 0) {
+                int slot_index = (int)((Uint32)(count - 1) % hdr->frame_slots);
+                ShmFrameSlot slot;
+                if (!shm_read_frame(hdr, slot_index, &slot, pixels, &torn)) bad_frames++;
+                printf("frames: %d new, latest %ux%u; status reads: %d, torn: %d, bad: %d\n",
+                       count - last_frame_count, slot.width, slot.height, status_reads, torn, bad_frames);
+            } else {
+                printf("status reads: %d, torn: %d\n", status_reads, torn);
+            }
+            last_frame_count = count;
+            status_reads = 0;
+            torn = 0;
+            report_at = now + 1000;
+        }
+        SDL_Delay(SHM_CLIENT_POLL_MS);
+    }
+    if (crashed) {
+        printf("Viewer process %u exited without closing %s; removing it\n", hdr->writer_pid, shm.name);
+    } else {
+        printf("Viewer closed %s\n", shm.name);
+    }
+    free(pixels);
+    shm_unmap(crashed);
+    return (bad_frames || crashed) ? 1 : 0;
+}
+
+// Replays a game once, storing the position before every ply (if boards is given) and
+// flags describing each ply. There is no engine, so material balance stands in for
+// the evaluation: a ply is a swing when material moved by HIGHLIGHT_SWING or more
+// once the reply is in. Stops at an unparsable move and returns the plies replayed;
+// reporting a short count is left to the caller.
+int replay_game_plies(char moves[][MOVE_TEXT_LEN], int move_count,
+                      char (*boards)[BOARD_SIZE][BOARD_SIZE], unsigned char *flags) {
+    char b[BOARD_SIZE][BOARD_SIZE];
+    init_board(b);
+    int *material = (int *)malloc(((size_t)move_count + 1) * sizeof(int));
+    if (!material) return 0;
+    material[0] = 0;
+    int is_white = 1;
+    int count = 0;
+    for (; count < move_count; count++) {
+        if (boards) memcpy(boards[count], b, sizeof(b));
+        Move m = {0};
+        if (!parse_san(b, moves[count], is_white, &m)) break;
+        char mover = b[m.from_r][m.from_f];
+        unsigned char f = 0;
+        if (b[m.to_r][m.to_f] != '.' || (toupper((unsigned char)mover) == 'P' && m.from_f != m.to_f)) {
+            f |= PLY_CAPTURE;
+        }
+        if (m.promo) f |= PLY_PROMOTION;
+        apply_move(b, &m, is_white);
+        if (is_in_check(b, !is_white)) f |= PLY_CHECK;
+        flags[count] = f;
+        material[count + 1] = material_balance(b);
+        is_white = !is_white;
+    }
+    if (boards) memcpy(boards[count], b, sizeof(b));
+    for (int i = 0; i < count; i++) {
+        int settled = (i + 2 <= count) ? material[i + 2] : material[i + 1];
+        if (abs(settled - material[i]) >= HIGHLIGHT_SWING) flags[i] |= PLY_SWING;
+        if ((flags[i] & PLY_PROMOTION) ||
+            ((flags[i] & PLY_CAPTURE) && (flags[i] & (PLY_CHECK | PLY_SWING)))) {
+            flags[i] |= PLY_TACTIC;
+        }
+    }
+    free(material);
+    return count;
+}
+
+int build_ply_cache(PlyCache *cache, char moves[][MOVE_TEXT_LEN], int move_count) {
+    if (move_count + 1 > cache->capacity) {
+        int cap = move_count + 1;
+        char (*boards)[BOARD_SIZE][BOARD_SIZE] = realloc(cache->boards, (size_t)cap * sizeof(*boards));
+        if (!boards) return 0;
+        cache->boards = boards;
+        unsigned char *flags = (unsigned char *)realloc(cache->flags, (size_t)cap);
+        if (!flags) return 0;
+        cache->flags = flags;
+        cache->capacity = cap;
+    }
+    cache->ply_count = replay_game_plies(moves, move_count, cache->boards, cache->flags);
+    return 1;
+}
+
+void free_ply_cache(PlyCache *cache) {
+    free(cache->boards);
+    free(cache->flags);
+    memset(cache, 0, sizeof(*cache));
+}
+
+void replay_moves_to_index(Viewer *v, char moves[][MOVE_TEXT_LEN], int move_count, int index) {
+    PlyCache *cache = &v->ply_cache;
+    if (cache->boards) {
+        if (index > cache->ply_count) index = cache->ply_count;
+        memcpy(v->board, cache->boards[index], sizeof(v->board));
+        draw_board(v);
+        return;
+    }
+    init_board(v->board);
     int is_white = 1;
     int limit = (index < move_count) ? index : move_count;
     for (int i = 0; i < limit; i++) {
         Move m = {0};
-        if (!parse_san(moves[i], is_white, &m)) {
+        if (!parse_san(v->board, moves[i], is_white, &m)) {
             printf("Failed to parse move: %s\n", moves[i]);
             break;
         }
-        apply_move(&m, is_white);
+        apply_move(v->board, &m, is_white);
         is_white = !is_white;
     }
-    draw_board();
+    draw_board(v);
 }
 
 typedef struct {
@@ -1700,13 +4041,58 @@ typedef struct {
     char black[NAME_LEN];
     char year[YEAR_LEN];
     char result[RESULT_LEN];
+    int rating;   // mean Elo of the rated players, 0 if neither is rated
+    Sint64 offset;  // where the game's [Event tag starts in its file
 } Game;
 
+int mean_rating(int white_elo, int black_elo) {
+    if (white_elo <= 0) return (black_elo > 0) ? black_elo : 0;
+    if (black_elo <= 0) return white_elo;
+    return (white_elo + black_elo) / 2;
+}
+
 typedef struct {
     char *path;
     int game_index;
+    int puzzle;  // mined puzzle shown from this game, or -1
 } GameSelection;
 
+// File list shared by every viewer.
+typedef struct {
+    SDL_mutex *lock;
+    char **files;
+    int file_count;
+    int stale;
+} Corpus;
+
+Corpus corpus;
+
+// A game decoded ahead of time, ready to play. The moves string is owned.
+typedef struct {
+    char *path;
+    int game_index;
+    Game game;
+} PreparedGame;
+
+// Bounded queue of random games filled by background workers and drained by the
+// viewers' logic threads, so starting a new game never waits on a scan or a parse.
+typedef struct {
+    SDL_mutex *lock;
+    SDL_cond *not_empty;
+    SDL_cond *not_full;
+    PreparedGame slots[PREFETCH_SLOTS];
+    int head;
+    int count;
+    int pending;
+    int capacity;
+    int stop;
+    int exhausted;
+    SDL_Thread *workers[MAX_VIEWERS];
+    int worker_count;
+} PrefetchPool;
+
+PrefetchPool prefetch;
+
 char *copy_string(const char *s) {
     size_t len = strlen(s);
     char *out = (char *)malloc(len + 1);
@@ -1756,316 +4142,7119 @@ char *join_path(const char *dir, const char *name) {
     return out;
 }
 
-int list_pgn_files(const char *dir, char ***out_files) {
-    char **files = NULL;
-    int count = 0;
-    int cap = 0;
-    if (list_pgn_files_recursive(dir, dir, &files, &count, &cap) < 0) {
-        free_string_list(files, count);
-        return -1;
+static int has_extension(const char *name, const char *ext) {
+    size_t len = strlen(name);
+    size_t ext_len = strlen(ext);
+    if (len <= ext_len) return 0;
+    for (size_t i = 0; i < ext_len; i++) {
+        if (tolower((unsigned char)name[len - ext_len + i]) != ext[i]) return 0;
     }
-    *out_files = files;
-    return count;
+    return 1;
 }
 
-int push_selection(GameSelection **history, int *count, int *cap, GameSelection sel) {
+int has_archive_extension(const char *name) {
+    return has_extension(name, ".zip") || has_extension(name, ".tar");
+}
+
+// Splits "dir/bundle.zip/sub/game.pgn" into the archive file and the member path inside
+// it ('/'-separated, possibly empty). Returns 0 for paths that are not inside an archive.
+int split_archive_path(const char *path, char *archive, size_t archive_size, char *member, size_t member_size) {
+    size_t len = strlen(path);
+    for (size_t i = 5; i <= len; i++) {
+        if (path[i] != '\0' && path[i] != '/' && path[i] != '\\') continue;
+        if (i + 1 > archive_size) return 0;
+        memcpy(archive, path, i);
+        archive[i] = '\0';
+        if (!has_archive_extension(archive)) continue;
+        FileStat st;
+        if (file_stat(archive, &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG) continue;
+        const char *rest = path + i + (path[i] ? 1 : 0);
+        size_t rest_len = strlen(rest);
+        if (rest_len + 1 > member_size) return 0;
+        for (size_t j = 0; j <= rest_len; j++) {
+            member[j] = (rest[j] == '\\') ? '/' : rest[j];
+        }
+        return 1;
+    }
+    return 0;
+}
+
+static Uint32 read_le16(const unsigned char *p) {
+    return (Uint32)p[0] | ((Uint32)p[1] << 8);
+}
+
+static Uint32 read_le32(const unsigned char *p) {
+    return read_le16(p) | (read_le16(p + 2) << 16);
+}
+
+void free_archive_members(ArchiveMember *members, int count) {
+    if (!members) return;
+    for (int i = 0; i < count; i++) {
+        free(members[i].name);
+    }
+    free(members);
+}
+
+static int push_archive_member(ArchiveMember **members, int *count, int *cap, const ArchiveMember *m,
+                               const char *name, size_t name_len) {
     if (*count >= *cap) {
-        int new_cap = (*cap == 0) ? 8 : (*cap * 2);
-        GameSelection *next = (GameSelection *)realloc(*history, new_cap * sizeof(*next));
+        int new_cap = (*cap == 0) ? 16 : (*cap * 2);
+        ArchiveMember *next = (ArchiveMember *)realloc(*members, (size_t)new_cap * sizeof(*next));
         if (!next) return 0;
-        *history = next;
+        *members = next;
         *cap = new_cap;
     }
-    (*history)[*count] = sel;
+    char *copy = (char *)malloc(name_len + 1);
+    if (!copy) return 0;
+    memcpy(copy, name, name_len);
+    copy[name_len] = '\0';
+    (*members)[*count] = *m;
+    (*members)[*count].name = copy;
     (*count)++;
     return 1;
 }
 
-int choose_random_selection(const char *games_dir, GameSelection *out_sel) {
-    char **files = NULL;
-    int file_count = list_pgn_files(games_dir, &files);
-    if (file_count <= 0) {
-        if (files && file_count > 0) free_string_list(files, file_count);
+static Uint64 read_le64_bytes(const unsigned char *p) {
+    return (Uint64)read_le32(p) | ((Uint64)read_le32(p + 4) << 32);
+}
+
+// Fills in the zip64 sizes and offset a central directory entry marks 0xFFFFFFFF from
+// its zip64 extra field, which holds just the values marked, in this order.
+static int zip64_entry(const unsigned char *extra, Uint32 extra_len, ArchiveMember *m, int wide_size,
+                       int wide_packed, int wide_offset) {
+    Uint32 pos = 0;
+    while (pos + 4 <= extra_len) {
+        Uint32 id = read_le16(extra + pos);
+        Uint32 len = read_le16(extra + pos + 2);
+        if (pos + 4 + len > extra_len) return 0;
+        if (id == 0x0001) {
+            const unsigned char *p = extra + pos + 4;
+            Uint32 need = 8u * (Uint32)(wide_size + wide_packed + wide_offset);
+            if (len < need) return 0;
+            if (wide_size) m->size = (Sint64)read_le64_bytes(p), p += 8;
+            if (wide_packed) m->packed_size = (Sint64)read_le64_bytes(p), p += 8;
+            if (wide_offset) m->header_offset = (Sint64)read_le64_bytes(p);
+            return m->size >= 0 && m->packed_size >= 0 && m->header_offset >= 0;
+        }
+        pos += 4 + len;
+    }
+    return 0;
+}
+
+// Zip members come from the central directory, found through the zip64 end record
+// when the archive has one (past 4 GB or 65535 members). Encrypted members and
+// methods other than stored and deflate are skipped.
+static int list_zip_members(FILE *fp, ArchiveMember **out, int *count, int *cap) {
+    if (file_seek(fp, 0, SEEK_END) != 0) return 0;
+    Sint64 size = file_tell(fp);
+    Sint64 tail = (size < 65557) ? size : 65557;
+    if (tail < 22) return 0;
+    unsigned char *end = (unsigned char *)malloc((size_t)tail);
+    if (!end || file_seek(fp, size - tail, SEEK_SET) != 0 || fread(end, 1, (size_t)tail, fp) != (size_t)tail) {
+        free(end);
         return 0;
     }
-    int file_index = rand() % file_count;
-    char *path = join_path(games_dir, files[file_index]);
-    free_string_list(files, file_count);
-    if (!path) return 0;
-    out_sel->path = path;
-    out_sel->game_index = -1;
-    return 1;
+    Sint64 eocd = -1;
+    for (Sint64 i = tail - 22; i >= 0 && eocd < 0; i--) {
+        if (read_le32(end + i) == 0x06054b50u) eocd = i;
+    }
+    Uint64 entries = (eocd >= 0) ? read_le16(end + eocd + 10) : 0;
+    Uint64 dir_size = (eocd >= 0) ? read_le32(end + eocd + 12) : 0;
+    Uint64 dir_offset = (eocd >= 0) ? read_le32(end + eocd + 16) : 0;
+    // The zip64 locator sits just before the end record and points at the zip64 one.
+    Sint64 locator = eocd - 20;
+    int zip64 = locator >= 0 && read_le32(end + locator) == 0x07064b50u;
+    Uint64 zip64_offset = zip64 ? read_le64_bytes(end + locator + 8) : 0;
+    free(end);
+    if (eocd < 0) return 0;
+    if (zip64) {
+        unsigned char rec[56];
+        if (zip64_offset + sizeof(rec) > (Uint64)size || file_seek(fp, (Sint64)zip64_offset, SEEK_SET) != 0 ||
+            fread(rec, 1, sizeof(rec), fp) != sizeof(rec) || read_le32(rec) != 0x06064b50u) {
+            return 0;
+        }
+        entries = read_le64_bytes(rec + 32);
+        dir_size = read_le64_bytes(rec + 40);
+        dir_offset = read_le64_bytes(rec + 48);
+    }
+    if (dir_offset + dir_size > (Uint64)size || dir_size > (Uint64)(size_t)-1 / 2) return 0;
+
+    unsigned char *dir = (unsigned char *)malloc(dir_size ? (size_t)dir_size : 1);
+    if (!dir || file_seek(fp, (Sint64)dir_offset, SEEK_SET) != 0 || fread(dir, 1, (size_t)dir_size, fp) != dir_size) {
+        free(dir);
+        return 0;
+    }
+    int ok = 1;
+    Uint64 pos = 0;
+    for (Uint64 e = 0; e < entries && ok && pos + 46 <= dir_size; e++) {
+        const unsigned char *h = dir + pos;
+        if (read_le32(h) != 0x02014b50u) break;
+        Uint32 flags = read_le16(h + 8);
+        Uint32 method = read_le16(h + 10);
+        Uint32 name_len = read_le16(h + 28);
+        Uint32 extra_len = read_le16(h + 30);
+        Uint64 next = pos + 46 + name_len + extra_len + read_le16(h + 32);
+        if (pos + 46 + name_len + extra_len > dir_size) break;
+        const char *name = (const char *)(h + 46);
+        ArchiveMember m;
+        m.method = (method == 8) ? ARCHIVE_DEFLATED : ARCHIVE_STORED;
+        m.header_offset = (Sint64)read_le32(h + 42);
+        m.data_offset = -1;
+        m.packed_size = (Sint64)read_le32(h + 20);
+        m.size = (Sint64)read_le32(h + 24);
+        int wide_size = read_le32(h + 24) == 0xFFFFFFFFu;
+        int wide_packed = read_le32(h + 20) == 0xFFFFFFFFu;
+        int wide_offset = read_le32(h + 42) == 0xFFFFFFFFu;
+        int usable = !(flags & 1) && (method == 0 || method == 8) && name_len > 0 && name[name_len - 1] != '/';
+        if (usable && (wide_size || wide_packed || wide_offset)) {
+            usable = zip64_entry(h + 46 + name_len, extra_len, &m, wide_size, wide_packed, wide_offset);
+        }
+        if (usable) ok = push_archive_member(out, count, cap, &m, name, name_len);
+        pos = next;
+    }
+    free(dir);
+    return ok;
 }
 
-static int relpath_from_base(const char *base, const char *path, char *out, size_t out_size) {
-    size_t base_len = strlen(base);
-    const char *p = path;
-    if (strncmp(path, base, base_len) == 0) {
-        p = path + base_len;
-        if (*p == '\\' || *p == '/') p++;
+// Octal, or for sizes past 8 GB the GNU base-256 form flagged by the top bit.
+static Sint64 parse_tar_octal(const unsigned char *p, int len) {
+    Sint64 value = 0;
+    if (p[0] & 0x80) {
+        value = p[0] & 0x3F;
+        for (int i = 1; i < len; i++) value = (value << 8) | p[i];
+        return value;
     }
-    if (strlen(p) + 1 > out_size) return 0;
-    strcpy(out, p);
-    return 1;
+    int i = 0;
+    while (i < len && (p[i] == ' ' || p[i] == '\0')) i++;
+    for (; i < len && p[i] >= '0' && p[i] <= '7'; i++) {
+        value = value * 8 + (p[i] - '0');
+    }
+    return value;
 }
 
-static int list_pgn_files_recursive(const char *dir, const char *base,
-                                    char ***out_files, int *count, int *cap) {
-#ifdef _WIN32
-    char *search = join_path(dir, "*");
-    if (!search) return -1;
-    WIN32_FIND_DATAA data;
-    HANDLE h = FindFirstFileA(search, &data);
-    free(search);
-    if (h == INVALID_HANDLE_VALUE) return -1;
-    do {
-        if (strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0) continue;
-        char *full = join_path(dir, data.cFileName);
-        if (!full) {
-            FindClose(h);
-            return -1;
+// Tar members are found by walking the 512-byte headers. ustar prefixes and GNU long
+// names are honoured; pax extended headers are skipped.
+static int list_tar_members(FILE *fp, ArchiveMember **out, int *count, int *cap) {
+    unsigned char h[512];
+    char long_name[1024];
+    int have_long_name = 0;
+    Sint64 pos = 0;
+    int ok = 1;
+    while (ok && file_seek(fp, pos, SEEK_SET) == 0 && fread(h, 1, sizeof(h), fp) == sizeof(h)) {
+        if (h[0] == '\0') break;
+        Sint64 size = parse_tar_octal(h + 124, 12);
+        Sint64 data = pos + 512;
+        pos = data + (size + 511) / 512 * 512;
+        char type = (char)h[156];
+        if (type == 'L') {
+            size_t len = (size < (Sint64)sizeof(long_name)) ? (size_t)size : sizeof(long_name) - 1;
+            have_long_name = fread(long_name, 1, len, fp) == len;
+            long_name[have_long_name ? len : 0] = '\0';
+            continue;
         }
-        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-            if (list_pgn_files_recursive(full, base, out_files, count, cap) < 0) {
-                free(full);
-                FindClose(h);
-                return -1;
-            }
-        } else if (has_pgn_extension(data.cFileName)) {
-            char relbuf[1024];
-            if (!relpath_from_base(base, full, relbuf, sizeof(relbuf))) {
-                free(full);
-                FindClose(h);
-                return -1;
-            }
-            if (!push_string(out_files, count, cap, relbuf)) {
-                free(full);
-                FindClose(h);
-                return -1;
-            }
+        if (type != '0' && type != '\0') {
+            have_long_name = 0;
+            continue;
         }
-        free(full);
+        char name[1024];
+        if (have_long_name) {
+            snprintf(name, sizeof(name), "%s", long_name);
+        } else if (memcmp(h + 257, "ustar", 5) == 0 && h[345] != '\0') {
+            snprintf(name, sizeof(name), "%.155s/%.100s", (const char *)h + 345, (const char *)h);
+        } else {
+            snprintf(name, sizeof(name), "%.100s", (const char *)h);
+        }
+        have_long_name = 0;
+        ArchiveMember m;
+        m.method = ARCHIVE_STORED;
+        m.header_offset = data - 512;
+        m.data_offset = data;
+        m.packed_size = size;
+        m.size = size;
+        const char *trimmed = (strncmp(name, "./", 2) == 0) ? name + 2 : name;
+        ok = push_archive_member(out, count, cap, &m, trimmed, strlen(trimmed));
+    }
+    return ok;
+}
+
+// Lists the members of a .zip or .tar file; returns the count or -1.
+int archive_list(const char *path, ArchiveMember **out_members) {
+    *out_members = NULL;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return -1;
+    ArchiveMember *members = NULL;
+    int count = 0;
+    int cap = 0;
+    int ok = has_extension(path, ".zip") ? list_zip_members(fp, &members, &count, &cap)
+                                         : list_tar_members(fp, &members, &count, &cap);
+    fclose(fp);
+    if (!ok) {
+        free_archive_members(members, count);
+        return -1;
+    }
+    *out_members = members;
+    return count;
+}
+
+// The next packed byte, 0 with the error set past the member's end.
+static int inflate_byte(Inflater *z) {
+    if (z->in_pos == z->in_len) {
+        size_t want = (z->packed_left < INFLATE_INPUT_BUF) ? (size_t)z->packed_left : INFLATE_INPUT_BUF;
+        size_t got = want ? fread(z->in, 1, want, z->fp) : 0;
+        if (got == 0) {
+            z->error = 1;
+            return 0;
+        }
+        z->packed_left -= (Sint64)got;
+        z->in_pos = 0;
+        z->in_len = (int)got;
+    }
+    return z->in[z->in_pos++];
+}
+
+// Tops bit_buf up to at least 25 bits while there is input, so a code can be looked
+// up before its length is known. Running out is not an error here.
+static void inflate_refill(Inflater *z) {
+    while (z->bit_count <= 24 && (z->in_pos < z->in_len || z->packed_left > 0)) {
+        z->bit_buf |= (Uint32)inflate_byte(z) << z->bit_count;
+        z->bit_count += 8;
+    }
+}
+
+static int inflate_bits(Inflater *z, int need) {
+    Uint32 value = z->bit_buf;
+    while (z->bit_count < need) {
+        if (z->error) return 0;
+        value |= (Uint32)inflate_byte(z) << z->bit_count;
+        z->bit_count += 8;
+    }
+    z->bit_buf = (need < 32) ? value >> need : 0;
+    z->bit_count -= need;
+    return (int)(value & ((1u << need) - 1));
+}
+
+// Bits of the member consumed so far, counting from the start of its packed data.
+static Sint64 inflate_bit_position(const Inflater *z) {
+    Sint64 taken = z->packed_size - z->packed_left - (Sint64)(z->in_len - z->in_pos);
+    return taken * 8 - z->bit_count;
+}
+
+// A stored block's bytes come after the header bits, from a byte boundary; whole bytes
+// already in bit_buf come first.
+static int inflate_stored_byte(Inflater *z) {
+    if (z->bit_count >= 8) {
+        int c = (int)(z->bit_buf & 0xFF);
+        z->bit_buf >>= 8;
+        z->bit_count -= 8;
+        return c;
+    }
+    return inflate_byte(z);
+}
+
+// Canonical Huffman decode: one table lookup for short codes, bit by bit past that.
+static int inflate_decode(Inflater *z, const Huffman *h) {
+    inflate_refill(z);
+    unsigned int entry = h->fast[z->bit_buf & ((1u << INFLATE_FAST_BITS) - 1)];
+    int fast_len = (int)(entry & 15);
+    if (entry != 0 && fast_len <= z->bit_count) {
+        z->bit_buf >>= fast_len;
+        z->bit_count -= fast_len;
+        return (int)(entry >> 4);
+    }
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int len = 1; len < 16; len++) {
+        code |= inflate_bits(z, 1);
+        int count = h->counts[len];
+        if (code - count < first) return h->symbols[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    z->error = 1;
+    return 0;
+}
+
+static int inflate_build(Huffman *h, const short *lengths, int n) {
+    short offsets[16];
+    memset(h->counts, 0, sizeof(h->counts));
+    memset(h->fast, 0, sizeof(h->fast));
+    for (int i = 0; i < n; i++) h->counts[lengths[i]]++;
+    if (h->counts[0] == n) return 1;
+    int left = 1;
+    for (int len = 1; len < 16; len++) {
+        left = (left << 1) - h->counts[len];
+        if (left < 0) return 0;
+    }
+    offsets[1] = 0;
+    for (int len = 1; len < 15; len++) offsets[len + 1] = (short)(offsets[len] + h->counts[len]);
+    for (int i = 0; i < n; i++) {
+        if (lengths[i] != 0) h->symbols[offsets[lengths[i]]++] = (short)i;
+    }
+    // Deflate sends codes high bit first, so the table is indexed by the code reversed,
+    // repeated over every value of the bits that follow it.
+    int code = 0;
+    int index = 0;
+    for (int len = 1; len <= INFLATE_FAST_BITS; len++) {
+        for (int k = 0; k < h->counts[len]; k++, index++, code++) {
+            int reversed = 0;
+            for (int b = 0; b < len; b++) reversed |= ((code >> b) & 1) << (len - 1 - b);
+            unsigned short entry = (unsigned short)((h->symbols[index] << 4) | len);
+            for (int fill = reversed; fill < (1 << INFLATE_FAST_BITS); fill += 1 << len) h->fast[fill] = entry;
+        }
+        code <<= 1;
+    }
+    return 1;
+}
+
+static void inflate_fixed(Inflater *z) {
+    short lengths[288];
+    for (int i = 0; i < 288; i++) lengths[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+    inflate_build(&z->lit, lengths, 288);
+    for (int i = 0; i < 30; i++) lengths[i] = 5;
+    inflate_build(&z->dist, lengths, 30);
+}
+
+static void inflate_dynamic(Inflater *z) {
+    static const short order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    short lengths[320];
+    int nlen = inflate_bits(z, 5) + 257;
+    int ndist = inflate_bits(z, 5) + 1;
+    int ncode = inflate_bits(z, 4) + 4;
+    if (nlen > 286 || ndist > 30) {
+        z->error = 1;
+        return;
+    }
+    memset(lengths, 0, sizeof(lengths));
+    for (int i = 0; i < ncode; i++) lengths[order[i]] = (short)inflate_bits(z, 3);
+    Huffman lencode;
+    if (!inflate_build(&lencode, lengths, 19)) {
+        z->error = 1;
+        return;
+    }
+    int index = 0;
+    while (index < nlen + ndist && !z->error) {
+        int symbol = inflate_decode(z, &lencode);
+        if (symbol < 16) {
+            lengths[index++] = (short)symbol;
+            continue;
+        }
+        short len = 0;
+        int repeat;
+        if (symbol == 16) {
+            if (index == 0) {
+                z->error = 1;
+                return;
+            }
+            len = lengths[index - 1];
+            repeat = 3 + inflate_bits(z, 2);
+        } else if (symbol == 17) {
+            repeat = 3 + inflate_bits(z, 3);
+        } else {
+            repeat = 11 + inflate_bits(z, 7);
+        }
+        if (index + repeat > nlen + ndist) {
+            z->error = 1;
+            return;
+        }
+        while (repeat--) lengths[index++] = len;
+    }
+    if (z->error || lengths[256] == 0 || !inflate_build(&z->lit, lengths, nlen) ||
+        !inflate_build(&z->dist, lengths + nlen, ndist)) {
+        z->error = 1;
+    }
+}
+
+// Starts decoding `packed_size` bytes at fp's position; recorded checkpoints are kept.
+static void inflate_reset(Inflater *z, FILE *fp, Sint64 packed_size) {
+    z->fp = fp;
+    z->packed_size = packed_size;
+    z->packed_left = packed_size;
+    z->in_pos = 0;
+    z->in_len = 0;
+    z->bit_buf = 0;
+    z->bit_count = 0;
+    z->block_type = -1;
+    z->final_block = 0;
+    z->stored_left = 0;
+    z->copy_len = 0;
+    z->error = 0;
+    z->total_out = 0;
+}
+
+// Notes where the block about to start could be decoded from, if the last checkpoint
+// is INFLATE_CHECKPOINT_SPAN behind. Out of memory only stops the recording.
+static void inflate_checkpoint(Inflater *z) {
+    if (z->checkpoint_count == z->checkpoint_cap) {
+        int cap = z->checkpoint_cap ? z->checkpoint_cap * 2 : 16;
+        InflateCheckpoint *next = (InflateCheckpoint *)realloc(z->checkpoints, (size_t)cap * sizeof(*next));
+        if (!next) {
+            z->checkpoint_next = 0;
+            return;
+        }
+        z->checkpoints = next;
+        z->checkpoint_cap = cap;
+    }
+    InflateCheckpoint *cp = &z->checkpoints[z->checkpoint_count++];
+    cp->out = z->total_out;
+    cp->bits = inflate_bit_position(z);
+    memcpy(cp->window, z->window, INFLATE_WINDOW);
+    cp->window_checksum = checksum64(cp->window, INFLATE_WINDOW, (Uint64)cp->out);
+    z->checkpoint_next = z->total_out + INFLATE_CHECKPOINT_SPAN;
+}
+
+// Resumes decoding the member at data_offset from checkpoint cp. Returns 0 if the
+// checkpoint's window is damaged or it can't be reached.
+static int inflate_resume(Inflater *z, FILE *fp, Sint64 data_offset, Sint64 packed_size, const InflateCheckpoint *cp) {
+    Sint64 byte = cp->bits / 8;
+    if (cp->out < 0 || cp->bits < 0 || byte > packed_size ||
+        checksum64(cp->window, INFLATE_WINDOW, (Uint64)cp->out) != cp->window_checksum ||
+        file_seek(fp, data_offset + byte, SEEK_SET) != 0) {
+        return 0;
+    }
+    inflate_reset(z, fp, packed_size);
+    z->packed_left = packed_size - byte;
+    z->total_out = cp->out;
+    memcpy(z->window, cp->window, INFLATE_WINDOW);
+    if (cp->bits % 8) inflate_bits(z, (int)(cp->bits % 8));
+    return !z->error;
+}
+
+// Produces up to n bytes; returns fewer only at the end of the stream or on an error.
+static int inflate_read(Inflater *z, unsigned char *out, int n) {
+    static const short length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                          35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const short length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                           3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const short dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                        513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    static const short dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                         7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    int produced = 0;
+    while (produced < n && !z->error) {
+        int c;
+        if (z->copy_len > 0) {
+            c = z->window[(z->total_out - z->copy_dist) & (INFLATE_WINDOW - 1)];
+            z->copy_len--;
+        } else if (z->block_type == 0 && z->stored_left > 0) {
+            c = inflate_stored_byte(z);
+            z->stored_left--;
+        } else if (z->block_type == 1 || z->block_type == 2) {
+            int symbol = inflate_decode(z, &z->lit);
+            if (symbol == 256) {
+                z->block_type = -1;
+                continue;
+            }
+            if (symbol > 256) {
+                symbol -= 257;
+                if (symbol >= 29) {
+                    z->error = 1;
+                    break;
+                }
+                int len = length_base[symbol] + inflate_bits(z, length_extra[symbol]);
+                int dist_symbol = inflate_decode(z, &z->dist);
+                if (dist_symbol >= 30) {
+                    z->error = 1;
+                    break;
+                }
+                int dist = dist_base[dist_symbol] + inflate_bits(z, dist_extra[dist_symbol]);
+                if ((Sint64)dist > z->total_out) {
+                    z->error = 1;
+                    break;
+                }
+                z->copy_len = len;
+                z->copy_dist = dist;
+                continue;
+            }
+            c = symbol;
+        } else if (z->final_block) {
+            break;
+        } else {
+            if (z->checkpoint_next > 0 && z->total_out >= z->checkpoint_next) inflate_checkpoint(z);
+            z->final_block = inflate_bits(z, 1);
+            z->block_type = inflate_bits(z, 2);
+            if (z->block_type == 0) {
+                inflate_bits(z, z->bit_count % 8);
+                Uint32 len = (Uint32)inflate_stored_byte(z);
+                len |= (Uint32)inflate_stored_byte(z) << 8;
+                Uint32 check = (Uint32)inflate_stored_byte(z);
+                check |= (Uint32)inflate_stored_byte(z) << 8;
+                if (len != (~check & 0xFFFFu)) z->error = 1;
+                z->stored_left = len;
+            } else if (z->block_type == 1) {
+                inflate_fixed(z);
+            } else if (z->block_type == 2) {
+                inflate_dynamic(z);
+            } else {
+                z->error = 1;
+            }
+            continue;
+        }
+        if (z->error) break;
+        out[produced++] = (unsigned char)c;
+        z->window[z->total_out & (INFLATE_WINDOW - 1)] = (unsigned char)c;
+        z->total_out++;
+    }
+    return produced;
+}
+
+// Zip local headers carry their own name and extra lengths, so the data offset is only
+// known after reading the header.
+static int archive_locate_data(FILE *fp, ArchiveMember *m) {
+    unsigned char h[30];
+    if (file_seek(fp, m->header_offset, SEEK_SET) != 0 || fread(h, 1, sizeof(h), fp) != sizeof(h) ||
+        read_le32(h) != 0x04034b50u) {
+        return 0;
+    }
+    m->data_offset = m->header_offset + 30 + read_le16(h + 26) + read_le16(h + 28);
+    return 1;
+}
+
+static int pgn_rewind(PgnStream *s) {
+    s->filled = 0;
+    s->buf_len = 0;
+    s->buf_pos = 0;
+    if (file_seek(s->fp, s->member.data_offset, SEEK_SET) != 0) return 0;
+    if (s->method == ARCHIVE_DEFLATED) inflate_reset(s->inflater, s->fp, s->member.packed_size);
+    return 1;
+}
+
+void pgn_close(PgnStream *s) {
+    if (s->fp) fclose(s->fp);
+    if (s->inflater) free(s->inflater->checkpoints);
+    free(s->inflater);
+    s->fp = NULL;
+    s->inflater = NULL;
+}
+
+// Opens one member of `archive` for reading; `m` may come from archive_list or the index.
+int pgn_open_member(PgnStream *s, const char *archive, const ArchiveMember *m) {
+    memset(s, 0, sizeof(*s));
+    s->fp = fopen(archive, "rb");
+    if (!s->fp) return 0;
+    s->member = *m;
+    s->member.name = NULL;
+    s->method = m->method;
+    if (s->method == ARCHIVE_DEFLATED) s->inflater = (Inflater *)calloc(1, sizeof(Inflater));
+    if ((s->method == ARCHIVE_DEFLATED && !s->inflater) ||
+        (s->member.data_offset < 0 && !archive_locate_data(s->fp, &s->member)) || !pgn_rewind(s)) {
+        pgn_close(s);
+        return 0;
+    }
+    return 1;
+}
+
+// Opens a PGN by path; paths that run through a .zip or .tar open the member inside.
+int pgn_open(PgnStream *s, const char *path) {
+    char archive[1024];
+    char member[1024];
+    memset(s, 0, sizeof(*s));
+    if (!split_archive_path(path, archive, sizeof(archive), member, sizeof(member))) {
+        s->fp = fopen(path, "r");
+        s->method = PGN_SOURCE_FILE;
+        return s->fp != NULL;
+    }
+    ArchiveMember *members = NULL;
+    int count = archive_list(archive, &members);
+    int ok = 0;
+    for (int i = 0; i < count && !ok; i++) {
+        if (strcmp(members[i].name, member) == 0) ok = pgn_open_member(s, archive, &members[i]);
+    }
+    free_archive_members(members, count);
+    return ok;
+}
+
+int pgn_readable(const char *path) {
+    if (has_scid_extension(path)) {
+        ScidBase *db = scid_acquire(path);
+        scid_release(db);
+        return db != NULL;
+    }
+    PgnStream s;
+    if (!pgn_open(&s, path)) return 0;
+    pgn_close(&s);
+    return 1;
+}
+
+static int pgn_fill(PgnStream *s) {
+    Sint64 left = s->member.size - s->filled;
+    int want = (left < (Sint64)sizeof(s->buf)) ? (int)left : (int)sizeof(s->buf);
+    if (want <= 0) return 0;
+    int got = (s->method == ARCHIVE_DEFLATED) ? inflate_read(s->inflater, s->buf, want)
+                                              : (int)fread(s->buf, 1, (size_t)want, s->fp);
+    if (got <= 0) return 0;
+    s->buf_len = got;
+    s->buf_pos = 0;
+    s->filled += got;
+    return 1;
+}
+
+// fgets for a PgnStream.
+char *pgn_gets(char *line, int size, PgnStream *s) {
+    if (s->method == PGN_SOURCE_FILE) return fgets(line, size, s->fp);
+    int len = 0;
+    while (len < size - 1) {
+        if (s->buf_pos == s->buf_len && !pgn_fill(s)) break;
+        char c = (char)s->buf[s->buf_pos++];
+        line[len++] = c;
+        if (c == '\n') break;
+    }
+    if (len == 0) return NULL;
+    line[len] = '\0';
+    return line;
+}
+
+Sint64 pgn_tell(PgnStream *s) {
+    if (s->method == PGN_SOURCE_FILE) return file_tell(s->fp);
+    return s->filled - (s->buf_len - s->buf_pos);
+}
+
+// Keeps a checkpoint every INFLATE_CHECKPOINT_SPAN bytes while a deflated member is
+// read through; pgn_take_checkpoints hands them over once it has been.
+void pgn_record_checkpoints(PgnStream *s) {
+    if (s->method == ARCHIVE_DEFLATED) s->inflater->checkpoint_next = INFLATE_CHECKPOINT_SPAN;
+}
+
+InflateCheckpoint *pgn_take_checkpoints(PgnStream *s, int *count) {
+    *count = 0;
+    if (s->method != ARCHIVE_DEFLATED) return NULL;
+    InflateCheckpoint *checkpoints = s->inflater->checkpoints;
+    *count = s->inflater->checkpoint_count;
+    s->inflater->checkpoints = NULL;
+    s->inflater->checkpoint_count = 0;
+    s->inflater->checkpoint_cap = 0;
+    return checkpoints;
+}
+
+// Stored members and plain files seek directly. A deflated member has no random
+// access: it is decoded up to the offset from s->resume when that lies on the way,
+// else from where the stream is or from its start.
+int pgn_seek(PgnStream *s, Sint64 offset) {
+    if (s->method == PGN_SOURCE_FILE) return file_seek(s->fp, offset, SEEK_SET) == 0;
+    if (offset < 0 || offset > s->member.size) return 0;
+    if (s->method == ARCHIVE_STORED) {
+        s->filled = offset;
+        s->buf_len = 0;
+        s->buf_pos = 0;
+        return file_seek(s->fp, s->member.data_offset + offset, SEEK_SET) == 0;
+    }
+    Sint64 here = pgn_tell(s);
+    const InflateCheckpoint *cp = s->resume;
+    if (cp && cp->out <= offset && (offset < here || cp->out > here) &&
+        inflate_resume(s->inflater, s->fp, s->member.data_offset, s->member.packed_size, cp)) {
+        s->filled = cp->out;
+        s->buf_len = 0;
+        s->buf_pos = 0;
+    } else if (offset < here && !pgn_rewind(s)) {
+        return 0;
+    }
+    while (pgn_tell(s) < offset) {
+        if (s->buf_pos == s->buf_len && !pgn_fill(s)) return 0;
+        Sint64 skip = offset - pgn_tell(s);
+        int avail = s->buf_len - s->buf_pos;
+        s->buf_pos += (skip < avail) ? (int)skip : avail;
+    }
+    return 1;
+}
+
+int map_file(const char *path, MappedFile *m) {
+    memset(m, 0, sizeof(*m));
+#ifdef _WIN32
+    // FILE_SHARE_DELETE lets a writer rename a new version over a file that is mapped.
+    m->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m->file == INVALID_HANDLE_VALUE) {
+        m->file = NULL;
+        return 0;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m->file, &size)) {
+        unmap_file(m);
+        return 0;
+    }
+    m->size = (size_t)size.QuadPart;
+    if (m->size == 0) return 1;
+    m->mapping = CreateFileMappingA(m->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m->mapping) m->data = (const unsigned char *)MapViewOfFile(m->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m->data) {
+        unmap_file(m);
+        return 0;
+    }
+    return 1;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    int ok = (fstat(fd, &st) == 0);
+    if (ok && st.st_size > 0) {
+        void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ok = (data != MAP_FAILED);
+        if (ok) {
+            m->data = (const unsigned char *)data;
+            m->size = (size_t)st.st_size;
+        }
+    }
+    close(fd);
+    return ok;
+#endif
+}
+
+void unmap_file(MappedFile *m) {
+#ifdef _WIN32
+    if (m->data) UnmapViewOfFile((LPCVOID)m->data);
+    if (m->mapping) CloseHandle(m->mapping);
+    if (m->file) CloseHandle(m->file);
+#else
+    if (m->data) munmap((void *)m->data, m->size);
+#endif
+    memset(m, 0, sizeof(*m));
+}
+
+// Flushes a written tmp file through to the disk before it is published, so a crash
+// after the rename finds the whole new file rather than a torn one.
+int sync_file(FILE *fp) {
+    if (fflush(fp) != 0) return 0;
+#ifdef _WIN32
+    return _commit(_fileno(fp)) == 0;
+#else
+    return fsync(fileno(fp)) == 0;
+#endif
+}
+
+// Moves a finished tmp file over `path` in one step. Readers that mapped the old file
+// keep its pages until they unmap; new opens see only the new one. The rename is made
+// durable too, so after a crash `path` is either the old file or the new one.
+int publish_file(const char *tmp_path, const char *path) {
+#ifdef _WIN32
+    return MoveFileExA(tmp_path, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    if (rename(tmp_path, path) != 0) return 0;
+    char dir[1024];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash) slash[slash == dir] = '\0';
+    else snprintf(dir, sizeof(dir), ".");
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    return 1;
+#endif
+}
+
+// Held by the one process allowed to write a shared file. The lock goes away with the
+// process, so a crashed writer never blocks the next one.
+typedef struct {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    int fd;
+#endif
+} WriterLock;
+
+int writer_lock_acquire(const char *path, WriterLock *lock) {
+    char lock_path[1024];
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+#ifdef _WIN32
+    lock->handle = CreateFileA(lock_path, GENERIC_WRITE, 0, NULL, OPEN_ALWAYS,
+                               FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (lock->handle == INVALID_HANDLE_VALUE) {
+        lock->handle = NULL;
+        return 0;
+    }
+    return 1;
+#else
+    lock->fd = open(lock_path, O_RDWR | O_CREAT, 0644);
+    if (lock->fd < 0) return 0;
+    if (flock(lock->fd, LOCK_EX | LOCK_NB) != 0) {
+        close(lock->fd);
+        lock->fd = -1;
+        return 0;
+    }
+    return 1;
+#endif
+}
+
+void writer_lock_release(WriterLock *lock) {
+#ifdef _WIN32
+    if (lock->handle) CloseHandle(lock->handle);
+    lock->handle = NULL;
+#else
+    if (lock->fd >= 0) close(lock->fd);
+    lock->fd = -1;
+#endif
+}
+
+// Scid stores every multi-byte field big-endian.
+static Uint32 read_be16(const unsigned char *p) {
+    return ((Uint32)p[0] << 8) | p[1];
+}
+
+static Uint32 read_be24(const unsigned char *p) {
+    return ((Uint32)p[0] << 16) | ((Uint32)p[1] << 8) | p[2];
+}
+
+static Uint32 read_be32(const unsigned char *p) {
+    return ((Uint32)p[0] << 24) | read_be24(p + 1);
+}
+
+int has_scid_extension(const char *name) {
+    return has_extension(name, ".si4");
+}
+
+// The .sn4 and .sg4 files sit next to the .si4 under the same base name.
+static int scid_sibling_path(const char *path, const char *ext, char *out, size_t size) {
+    size_t len = strlen(path);
+    if (len < 4 || len >= size) return 0;
+    memcpy(out, path, len - 4);
+    memcpy(out + len - 4, ext, 5);
+    return 1;
+}
+
+// Decodes the player section of the name file, which comes first. Names are sorted
+// and front-coded: each one stores how many leading bytes it shares with the last.
+static int scid_load_names(ScidBase *db) {
+    const unsigned char *d = db->names.data;
+    size_t size = db->names.size;
+    if (size < SCID_NAME_HEADER || memcmp(d, "Scid.sn", 8) != 0) return 0;
+    Uint32 count = read_be24(d + 12);
+    Uint32 max_freq = read_be24(d + 24);
+    size_t id_bytes = (count >= 65536) ? 3 : 2;
+    size_t freq_bytes = (max_freq >= 65536) ? 3 : (max_freq >= 256) ? 2 : 1;
+    char name[256];
+    size_t total = 1;
+    for (int pass = 0; pass < 2; pass++) {
+        size_t p = SCID_NAME_HEADER;
+        size_t out = 1;
+        for (Uint32 i = 0; i < count; i++) {
+            if (p + id_bytes + freq_bytes + 2 > size) return 0;
+            Uint32 id = (id_bytes == 3) ? read_be24(d + p) : read_be16(d + p);
+            p += id_bytes + freq_bytes;
+            size_t len = d[p++];
+            size_t prefix = (i > 0) ? d[p++] : 0;
+            if (prefix > len || p + (len - prefix) > size) return 0;
+            memcpy(name + prefix, d + p, len - prefix);
+            name[len] = '\0';
+            p += len - prefix;
+            if (pass == 0) {
+                total += len + 1;
+            } else {
+                if (id < count) db->player_offsets[id] = (Uint32)out;
+                memcpy(db->player_names + out, name, len + 1);
+                out += len + 1;
+            }
+        }
+        if (pass == 0) {
+            db->player_offsets = (Uint32 *)calloc(count ? count : 1, sizeof(Uint32));
+            db->player_names = (char *)malloc(total);
+            if (!db->player_offsets || !db->player_names) return 0;
+            db->player_names[0] = '\0';  // ids the file never names read as ""
+            db->player_count = count;
+        }
+    }
+    return 1;
+}
+
+static void scid_close(ScidBase *db) {
+    if (!db) return;
+    unmap_file(&db->index);
+    unmap_file(&db->names);
+    unmap_file(&db->games);
+    free(db->player_offsets);
+    free(db->player_names);
+    free(db->path);
+    free(db);
+}
+
+static ScidBase *scid_open(const char *path) {
+    ScidBase *db = (ScidBase *)calloc(1, sizeof(ScidBase));
+    if (!db) return NULL;
+    char sibling[1024];
+    FileStat st;
+    db->path = copy_string(path);
+    int ok = db->path && file_stat(path, &st) == 0 && map_file(path, &db->index) &&
+             scid_sibling_path(path, ".sn4", sibling, sizeof(sibling)) && map_file(sibling, &db->names) &&
+             scid_sibling_path(path, ".sg4", sibling, sizeof(sibling)) && map_file(sibling, &db->games);
+    const unsigned char *h = db->index.data;
+    if (ok) {
+        // Scid 4 index files are version 400 and up; older .si3 entries are a byte shorter.
+        Uint32 version = read_be16(h + 8);
+        ok = db->index.size >= SCID_INDEX_HEADER && memcmp(h, "Scid.si", 8) == 0 &&
+             version >= 400 && version < 500;
+    }
+    if (ok) {
+        db->mtime = (Sint64)st.st_mtime;
+        db->game_count = read_be24(h + 14);
+        size_t room = (db->index.size - SCID_INDEX_HEADER) / SCID_INDEX_ENTRY;
+        if (db->game_count > room) db->game_count = (Uint32)room;
+        ok = scid_load_names(db);
+    }
+    if (!ok) {
+        scid_close(db);
+        return NULL;
+    }
+    return db;
+}
+
+static ScidBase *scid_cache[SCID_CACHE_SLOTS];
+static SDL_SpinLock scid_cache_lock;
+
+// Returns the open database for `path`, mapping it on first use. Every viewer and
+// prefetch worker shares one mapping and one decoded name table per database.
+ScidBase *scid_acquire(const char *path) {
+    FileStat st;
+    if (file_stat(path, &st) != 0) return NULL;
+    SDL_AtomicLock(&scid_cache_lock);
+    for (int i = 0; i < SCID_CACHE_SLOTS; i++) {
+        ScidBase *db = scid_cache[i];
+        if (db && db->mtime == (Sint64)st.st_mtime && strcmp(db->path, path) == 0) {
+            db->refs++;
+            SDL_AtomicUnlock(&scid_cache_lock);
+            return db;
+        }
+    }
+    SDL_AtomicUnlock(&scid_cache_lock);
+
+    ScidBase *db = scid_open(path);
+    if (!db) return NULL;
+    db->refs = 1;
+    ScidBase *evicted = NULL;
+    SDL_AtomicLock(&scid_cache_lock);
+    int slot = -1;
+    for (int i = 0; i < SCID_CACHE_SLOTS && slot < 0; i++) {
+        if (!scid_cache[i]) slot = i;
+    }
+    for (int i = 0; i < SCID_CACHE_SLOTS && slot < 0; i++) {
+        if (scid_cache[i]->refs == 0) slot = i;
+    }
+    if (slot >= 0) {
+        evicted = scid_cache[slot];
+        scid_cache[slot] = db;
+        db->cached = 1;
+    }
+    SDL_AtomicUnlock(&scid_cache_lock);
+    scid_close(evicted);
+    return db;
+}
+
+void scid_release(ScidBase *db) {
+    if (!db) return;
+    SDL_AtomicLock(&scid_cache_lock);
+    db->refs--;
+    int drop = (!db->cached && db->refs == 0);
+    SDL_AtomicUnlock(&scid_cache_lock);
+    if (drop) scid_close(db);
+}
+
+void scid_cache_free(void) {
+    for (int i = 0; i < SCID_CACHE_SLOTS; i++) {
+        scid_close(scid_cache[i]);
+        scid_cache[i] = NULL;
+    }
+}
+
+static const char *scid_player(const ScidBase *db, Uint32 id) {
+    return db->player_names + ((id < db->player_count) ? db->player_offsets[id] : 0);
+}
+
+static void scid_start_position(ScidPosition *p) {
+    static const char back[] = "RNBQKBNR";
+    static const int order[8] = {4, 0, 1, 2, 3, 5, 6, 7};  // king first, then a..h
+    memset(p, 0, sizeof(*p));
+    memset(p->board, '.', sizeof(p->board));
+    for (int f = 0; f < 8; f++) {
+        p->board[f] = back[f];
+        p->board[8 + f] = 'P';
+        p->board[48 + f] = 'p';
+        p->board[56 + f] = (char)tolower((unsigned char)back[f]);
+        p->list[0][f] = (unsigned char)order[f];
+        p->list[1][f] = (unsigned char)(56 + order[f]);
+        p->list[0][8 + f] = (unsigned char)(8 + f);
+        p->list[1][8 + f] = (unsigned char)(48 + f);
+    }
+    for (int c = 0; c < 2; c++) {
+        for (int i = 0; i < 16; i++) p->list_pos[p->list[c][i]] = (unsigned char)i;
+        p->count[c] = 16;
+    }
+}
+
+// A captured piece's slot is refilled from the end of its list, as Scid does, so the
+// piece numbers in later move bytes keep matching.
+static void scid_remove_piece(ScidPosition *p, int side, int sq) {
+    int idx = p->list_pos[sq];
+    int last = --p->count[side];
+    p->list[side][idx] = p->list[side][last];
+    p->list_pos[p->list[side][idx]] = (unsigned char)idx;
+    p->board[sq] = '.';
+}
+
+static void scid_move_piece(ScidPosition *p, int side, int from, int to) {
+    int idx = p->list_pos[from];
+    p->board[to] = p->board[from];
+    p->board[from] = '.';
+    p->list[side][idx] = (unsigned char)to;
+    p->list_pos[to] = (unsigned char)idx;
+}
+
+static const int scid_king_diff[11] = {0, -9, -8, -7, -1, 1, 7, 8, 9, -2, 2};
+static const int scid_knight_diff[9] = {0, -17, -15, -10, -6, 6, 10, 15, 17};
+static const int scid_pawn_diff[16] = {7, 8, 9, 7, 8, 9, 7, 8, 9, 7, 8, 9, 7, 8, 9, 16};
+static const char scid_pawn_promo[16] = {0, 0, 0, 'Q', 'Q', 'Q', 'R', 'R', 'R', 'B', 'B', 'B', 'N', 'N', 'N', 0};
+
+// Plays one move byte: the high nibble picks a piece from the mover's list and the
+// low nibble says where it goes, in a way that depends on the piece. Writes the move
+// with its from-square spelled out, which parse_san takes as full disambiguation.
+// Returns 1 for a move, 2 for a null move and 0 for bytes that make no sense here.
+static int scid_play_move(ScidPosition *p, int byte, ScidReader *rd, char *san) {
+    int side = p->side;
+    int num = byte >> 4;
+    int val = byte & 15;
+    if (num >= p->count[side]) return 0;
+    int from = p->list[side][num];
+    char piece = p->board[from];
+    if (piece == '.' || (isupper((unsigned char)piece) != 0) != (side == 0)) return 0;
+    char type = (char)toupper((unsigned char)piece);
+    char promo = 0;
+    int to;
+    switch (type) {
+        case 'K':
+            if (val == 0) {
+                p->side = !side;
+                return 2;
+            }
+            if (val > 10) return 0;
+            to = from + scid_king_diff[val];
+            break;
+        case 'Q':
+            if (val >= 8) {
+                to = (val - 8) * 8 + (from & 7);
+            } else if (val != (from & 7)) {
+                to = (from & ~7) + val;
+            } else {
+                if (rd->pos >= rd->end) return 0;  // diagonal: the square follows in a second byte
+                to = rd->data[rd->pos++] - 64;
+            }
+            break;
+        case 'R':
+            to = (val >= 8) ? (val - 8) * 8 + (from & 7) : (from & ~7) + val;
+            break;
+        case 'B': {
+            int file_diff = (val & 7) - (from & 7);
+            to = (val >= 8) ? from - 7 * file_diff : from + 9 * file_diff;
+            break;
+        }
+        case 'N':
+            if (val < 1 || val > 8) return 0;
+            to = from + scid_knight_diff[val];
+            break;
+        default:
+            to = (side == 0) ? from + scid_pawn_diff[val] : from - scid_pawn_diff[val];
+            promo = scid_pawn_promo[val];
+            break;
+    }
+    if (to < 0 || to > 63 || to == from) return 0;
+    if ((type == 'K' || type == 'N' || type == 'P') && abs((to & 7) - (from & 7)) > 2) return 0;
+    char target = p->board[to];
+    if (target != '.' && ((isupper((unsigned char)target) != 0) == (side == 0) || toupper((unsigned char)target) == 'K')) {
+        return 0;
+    }
+    int castle = (type == 'K' && (to - from == 2 || from - to == 2));
+    int passant = (type == 'P' && target == '.' && (to & 7) != (from & 7));
+    if (castle) {
+        snprintf(san, MOVE_TEXT_LEN, "%s", (to > from) ? "O-O" : "O-O-O");
+    } else {
+        int n = 0;
+        if (type != 'P') san[n++] = type;
+        san[n++] = (char)('a' + (from & 7));
+        san[n++] = (char)('1' + (from >> 3));
+        if (target != '.' || passant) san[n++] = 'x';
+        san[n++] = (char)('a' + (to & 7));
+        san[n++] = (char)('1' + (to >> 3));
+        if (promo) {
+            san[n++] = '=';
+            san[n++] = promo;
+        }
+        san[n] = '\0';
+    }
+
+    if (passant) {
+        int victim = (side == 0) ? to - 8 : to + 8;
+        if (toupper((unsigned char)p->board[victim]) != 'P') return 0;
+        scid_remove_piece(p, !side, victim);
+    } else if (target != '.') {
+        scid_remove_piece(p, !side, to);
+    }
+    scid_move_piece(p, side, from, to);
+    if (promo) p->board[to] = (side == 0) ? promo : (char)tolower((unsigned char)promo);
+    if (castle) {
+        int rook_from = (to > from) ? from + 3 : from - 4;
+        int rook_to = (to > from) ? from + 1 : from - 1;
+        if (toupper((unsigned char)p->board[rook_from]) != 'R' || p->board[rook_to] != '.') return 0;
+        scid_move_piece(p, side, rook_from, rook_to);
+    }
+    p->side = !side;
+    return 1;
+}
+
+// Plays one line of the move stream. Main-line moves are appended to `text`; a
+// variation is replayed from the position before the move it replaces, only to stay
+// in step with the bytes. Returns 0 on malformed data.
+static int scid_decode_line(ScidReader *rd, ScidPosition *pos, char *text, size_t size, size_t *len, int depth) {
+    ScidPosition before = *pos;
+    while (rd->pos < rd->end) {
+        int byte = rd->data[rd->pos++];
+        if (byte == SCID_NAG) {
+            rd->pos++;
+            continue;
+        }
+        if (byte == SCID_COMMENT) continue;  // comment text lives after the moves
+        if (byte == SCID_START_VARIATION) {
+            if (depth >= SCID_MAX_DEPTH) return 0;
+            ScidPosition variation = before;
+            if (!scid_decode_line(rd, &variation, NULL, 0, NULL, depth + 1)) return 0;
+            continue;
+        }
+        if (byte == SCID_END_VARIATION) return depth > 0;
+        if (byte == SCID_END_GAME) return depth == 0;
+
+        char san[MOVE_TEXT_LEN];
+        ScidPosition prev = *pos;
+        int played = scid_play_move(pos, byte, rd, san);
+        if (!played) return 0;
+        before = prev;
+        if (played == 2) {
+            text = NULL;  // the board can't show a null move, so the game stops before it
+        } else if (text) {
+            size_t n = strlen(san);
+            if (*len + n + 2 > size) {
+                text = NULL;
+            } else {
+                text[(*len)++] = ' ';
+                memcpy(text + *len, san, n + 1);
+                *len += n;
+            }
+        }
+    }
+    return 0;
+}
+
+// Tags are a length byte (0 ends them, 255 is a packed date, 241..254 a common tag
+// with no name bytes), the name, then a value length and value.
+static int scid_skip_tags(ScidReader *rd) {
+    while (rd->pos < rd->end) {
+        int tag = rd->data[rd->pos++];
+        if (tag == 0) return 1;
+        if (tag == 255) {
+            rd->pos += 3;
+            continue;
+        }
+        if (tag <= 240) rd->pos += (size_t)tag;
+        if (rd->pos >= rd->end) return 0;
+        rd->pos += 1 + (size_t)rd->data[rd->pos];
+    }
+    return 0;
+}
+
+// Decodes game `number` straight from the mapped files. Deleted games, games from a
+// set-up position and games with no moves fail, since the board always starts from
+// the initial position.
+int scid_load_game(const ScidBase *db, Uint32 number, Game *out) {
+    static const char *results[4] = {"*", "1-0", "0-1", "1/2-1/2"};
+    if (number >= db->game_count) return 0;
+    const unsigned char *e = db->index.data + SCID_INDEX_HEADER + (size_t)number * SCID_INDEX_ENTRY;
+    Uint32 offset = read_be32(e);
+    Uint32 length = read_be16(e + 4) | ((Uint32)(e[6] & 0x80) << 9);
+    if ((read_be16(e + 7) & SCID_FLAG_DELETE) || (size_t)offset + length > db->games.size) return 0;
+
+    ScidReader rd = {db->games.data + offset, 0, length};
+    if (!scid_skip_tags(&rd) || rd.pos >= rd.end) return 0;
+    if (rd.data[rd.pos++] & 1) return 0;  // non-standard start, followed by its FEN
+
+    char *text = (char *)malloc(SCID_TEXT_LEN);
+    if (!text) return 0;
+    ScidPosition pos;
+    scid_start_position(&pos);
+    size_t len = 0;
+    text[0] = '\0';
+    if (!scid_decode_line(&rd, &pos, text, SCID_TEXT_LEN - RESULT_LEN, &len, 0) || len == 0) {
+        free(text);
+        return 0;
+    }
+    Uint32 result = read_be16(e + 21) >> 12;
+    const char *result_text = results[(result < 4) ? result : 0];
+    snprintf(text + len, RESULT_LEN + 1, " %s", result_text);
+
+    memset(out, 0, sizeof(*out));
+    out->moves = text;
+    strncpy(out->white, scid_player(db, ((Uint32)(e[9] >> 4) << 16) | read_be16(e + 10)), NAME_LEN - 1);
+    strncpy(out->black, scid_player(db, ((Uint32)(e[9] & 15) << 16) | read_be16(e + 12)), NAME_LEN - 1);
+    Uint32 year = (read_be32(e + 25) & 0xFFFFF) >> 9;
+    if (year > 0 && year < 10000) snprintf(out->year, YEAR_LEN, "%u", (unsigned int)year);
+    strncpy(out->result, result_text, RESULT_LEN - 1);
+    // Elo is the low 12 bits; the top 4 give the rating type.
+    out->rating = mean_rating((int)(read_be16(e + 29) & 0xFFF), (int)(read_be16(e + 31) & 0xFFF));
+    out->offset = (Sint64)number;
+    return 1;
+}
+
+// Built-in search. Moves are generated directly from the board array, which is slow
+// next to a real engine but plenty for the shallow depths shown during playback.
+// Castling follows Position.castle, the rights still held: castle_rights works them
+// out for a position of a replayed game, and play_move drops a right once its king or
+// rook moves or the rook is captured.
+static const int knight_steps[8][2] = {{-2, -1}, {-2, 1}, {-1, -2}, {-1, 2}, {1, -2}, {1, 2}, {2, -1}, {2, 1}};
+static const int king_steps[8][2] = {{-1, -1}, {-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, -1}, {1, 0}, {1, 1}};
+
+static int on_board(int r, int f) {
+    return r >= 0 && r < BOARD_SIZE && f >= 0 && f < BOARD_SIZE;
+}
+
+static int is_side_piece(char p, int white) {
+    return p != '.' && is_white_piece(p) == (white != 0);
+}
+
+// Whether a piece of the given color attacks (r, f), looking outward from the square.
+int square_attacked(char b[BOARD_SIZE][BOARD_SIZE], int r, int f, int by_white) {
+    char pawn = by_white ? 'P' : 'p';
+    int pawn_r = r + (by_white ? 1 : -1);
+    if ((on_board(pawn_r, f - 1) && b[pawn_r][f - 1] == pawn) || (on_board(pawn_r, f + 1) && b[pawn_r][f + 1] == pawn)) {
+        return 1;
+    }
+    char knight = by_white ? 'N' : 'n';
+    char king = by_white ? 'K' : 'k';
+    for (int i = 0; i < 8; i++) {
+        int nr = r + knight_steps[i][0], nf = f + knight_steps[i][1];
+        if (on_board(nr, nf) && b[nr][nf] == knight) return 1;
+        nr = r + king_steps[i][0];
+        nf = f + king_steps[i][1];
+        if (on_board(nr, nf) && b[nr][nf] == king) return 1;
+    }
+    for (int i = 0; i < 8; i++) {
+        int dr = king_steps[i][0], df = king_steps[i][1];
+        char slider = (dr == 0 || df == 0) ? (by_white ? 'R' : 'r') : (by_white ? 'B' : 'b');
+        char queen = by_white ? 'Q' : 'q';
+        for (int nr = r + dr, nf = f + df; on_board(nr, nf); nr += dr, nf += df) {
+            char p = b[nr][nf];
+            if (p == '.') continue;
+            if (p == slider || p == queen) return 1;
+            break;
+        }
+    }
+    return 0;
+}
+
+static int king_attacked(char b[BOARD_SIZE][BOARD_SIZE], int white) {
+    char king = white ? 'K' : 'k';
+    for (int r = 0; r < BOARD_SIZE; r++) {
+        for (int f = 0; f < BOARD_SIZE; f++) {
+            if (b[r][f] == king) return square_attacked(b, r, f, !white);
+        }
+    }
+    return 0;
+}
+
+// Field by field: Move has padding, and moves unpacked from the evaluation cache are
+// built up separately from generated ones.
+static int same_move(const Move *a, const Move *b) {
+    return a->from_r == b->from_r && a->from_f == b->from_f && a->to_r == b->to_r && a->to_f == b->to_f &&
+           a->promo == b->promo;
+}
+
+static int add_move(const Position *pos, Move *moves, int n, int fr, int ff, int tr, int tf, char promo) {
+    if (n >= MAX_LEGAL_MOVES) return n;
+    Move m = {fr, ff, tr, tf, promo};
+    char after[BOARD_SIZE][BOARD_SIZE];
+    memcpy(after, pos->b, sizeof(after));
+    apply_move(after, &m, pos->white);
+    if (king_attacked(after, pos->white)) return n;
+    moves[n] = m;
+    return n + 1;
+}
+
+static int add_pawn_move(const Position *pos, Move *moves, int n, int fr, int ff, int tr, int tf) {
+    if (tr != 0 && tr != BOARD_SIZE - 1) return add_move(pos, moves, n, fr, ff, tr, tf, '\0');
+    for (int k = 0; k < 4; k++) n = add_move(pos, moves, n, fr, ff, tr, tf, "QRBN"[k]);
+    return n;
+}
+
+// Legal moves for the side to move. With captures_only, just captures and promotions,
+// which is what quiescence search looks at.
+int generate_moves(const Position *pos, Move *moves, int captures_only) {
+    int n = 0;
+    int white = pos->white;
+    for (int r = 0; r < BOARD_SIZE; r++) {
+        for (int f = 0; f < BOARD_SIZE; f++) {
+            char p = pos->b[r][f];
+            if (!is_side_piece(p, white)) continue;
+            char type = (char)toupper((unsigned char)p);
+            if (type == 'P') {
+                int dir = white ? -1 : 1;
+                int tr = r + dir;
+                if (!on_board(tr, f)) continue;
+                if (pos->b[tr][f] == '.' && (!captures_only || tr == 0 || tr == BOARD_SIZE - 1)) {
+                    n = add_pawn_move(pos, moves, n, r, f, tr, f);
+                    int home = white ? 6 : 1;
+                    if (!captures_only && r == home && pos->b[tr + dir][f] == '.') {
+                        n = add_move(pos, moves, n, r, f, tr + dir, f, '\0');
+                    }
+                }
+                for (int df = -1; df <= 1; df += 2) {
+                    int tf = f + df;
+                    if (!on_board(tr, tf)) continue;
+                    int passant = (pos->b[tr][tf] == '.' && tf == pos->ep_file && tr == (white ? 2 : 5));
+                    if (is_side_piece(pos->b[tr][tf], !white) || passant) n = add_pawn_move(pos, moves, n, r, f, tr, tf);
+                }
+            } else if (type == 'N' || type == 'K') {
+                const int (*steps)[2] = (type == 'N') ? knight_steps : king_steps;
+                for (int i = 0; i < 8; i++) {
+                    int tr = r + steps[i][0], tf = f + steps[i][1];
+                    if (!on_board(tr, tf) || is_side_piece(pos->b[tr][tf], white)) continue;
+                    if (captures_only && pos->b[tr][tf] == '.') continue;
+                    n = add_move(pos, moves, n, r, f, tr, tf, '\0');
+                }
+            } else {
+                for (int i = 0; i < 8; i++) {
+                    int dr = king_steps[i][0], df = king_steps[i][1];
+                    if (type == 'B' && (dr == 0 || df == 0)) continue;
+                    if (type == 'R' && dr != 0 && df != 0) continue;
+                    for (int tr = r + dr, tf = f + df; on_board(tr, tf); tr += dr, tf += df) {
+                        char target = pos->b[tr][tf];
+                        if (is_side_piece(target, white)) break;
+                        if (target != '.' || !captures_only) n = add_move(pos, moves, n, r, f, tr, tf, '\0');
+                        if (target != '.') break;
+                    }
+                }
+            }
+        }
+    }
+    int short_right = white ? CASTLE_WHITE_SHORT : CASTLE_BLACK_SHORT;
+    int long_right = white ? CASTLE_WHITE_LONG : CASTLE_BLACK_LONG;
+    if (captures_only || !(pos->castle & (short_right | long_right))) return n;
+
+    char (*b)[BOARD_SIZE] = (char (*)[BOARD_SIZE])pos->b;
+    int home = white ? 7 : 0;
+    char rook = white ? 'R' : 'r';
+    if (pos->b[home][4] != (white ? 'K' : 'k') || square_attacked(b, home, 4, !white)) return n;
+    if ((pos->castle & short_right) && pos->b[home][7] == rook && pos->b[home][5] == '.' && pos->b[home][6] == '.' &&
+        !square_attacked(b, home, 5, !white)) {
+        n = add_move(pos, moves, n, home, 4, home, 6, '\0');
+    }
+    if ((pos->castle & long_right) && pos->b[home][0] == rook && pos->b[home][1] == '.' && pos->b[home][2] == '.' &&
+        pos->b[home][3] == '.' && !square_attacked(b, home, 3, !white)) {
+        n = add_move(pos, moves, n, home, 4, home, 2, '\0');
+    }
+    return n;
+}
+
+int is_capture(const Position *pos, const Move *m) {
+    return pos->b[m->to_r][m->to_f] != '.' ||
+           (toupper((unsigned char)pos->b[m->from_r][m->from_f]) == 'P' && m->from_f != m->to_f);
+}
+
+// The castling right a king or rook standing on (r, f) at the start carries, or 0.
+static int castle_square_right(int r, int f) {
+    if (r == 7) return (f == 4) ? CASTLE_WHITE_SHORT | CASTLE_WHITE_LONG : (f == 7) ? CASTLE_WHITE_SHORT : (f == 0) ? CASTLE_WHITE_LONG : 0;
+    if (r == 0) return (f == 4) ? CASTLE_BLACK_SHORT | CASTLE_BLACK_LONG : (f == 7) ? CASTLE_BLACK_SHORT : (f == 0) ? CASTLE_BLACK_LONG : 0;
+    return 0;
+}
+
+void play_move(const Position *pos, const Move *m, Position *next) {
+    char piece = pos->b[m->from_r][m->from_f];
+    *next = *pos;
+    apply_move(next->b, m, pos->white);
+    next->white = !pos->white;
+    next->ep_file = -1;
+    next->castle &= ~(castle_square_right(m->from_r, m->from_f) | castle_square_right(m->to_r, m->to_f));
+    if (toupper((unsigned char)piece) == 'P' && abs(m->to_r - m->from_r) == 2) {
+        char enemy = pos->white ? 'p' : 'P';
+        if ((m->to_f > 0 && next->b[m->to_r][m->to_f - 1] == enemy) ||
+            (m->to_f < BOARD_SIZE - 1 && next->b[m->to_r][m->to_f + 1] == enemy)) {
+            next->ep_file = m->to_f;
+        }
+    }
+}
+
+// File of a pawn that just moved two squares and can be taken en passant, or -1.
+int passant_file(char before[BOARD_SIZE][BOARD_SIZE], char after[BOARD_SIZE][BOARD_SIZE], int white_to_move) {
+    char pawn = white_to_move ? 'p' : 'P';
+    int start = white_to_move ? 1 : 6;
+    int land = white_to_move ? 3 : 4;
+    for (int f = 0; f < BOARD_SIZE; f++) {
+        if (before[start][f] != pawn || after[start][f] != '.' || after[land][f] != pawn || before[land][f] != '.') continue;
+        char enemy = white_to_move ? 'P' : 'p';
+        if ((f > 0 && after[land][f - 1] == enemy) || (f < BOARD_SIZE - 1 && after[land][f + 1] == enemy)) return f;
+    }
+    return -1;
+}
+
+// Castling rights at `ply` of a replayed game: a right holds while its king and rook
+// have stood on their home squares in every position up to it.
+int castle_rights(char (*boards)[BOARD_SIZE][BOARD_SIZE], int ply) {
+    int rights = CASTLE_WHITE_SHORT | CASTLE_WHITE_LONG | CASTLE_BLACK_SHORT | CASTLE_BLACK_LONG;
+    for (int i = 0; i <= ply && rights; i++) {
+        char (*b)[BOARD_SIZE] = boards[i];
+        if (b[7][4] != 'K') rights &= ~(CASTLE_WHITE_SHORT | CASTLE_WHITE_LONG);
+        if (b[7][7] != 'R') rights &= ~CASTLE_WHITE_SHORT;
+        if (b[7][0] != 'R') rights &= ~CASTLE_WHITE_LONG;
+        if (b[0][4] != 'k') rights &= ~(CASTLE_BLACK_SHORT | CASTLE_BLACK_LONG);
+        if (b[0][7] != 'r') rights &= ~CASTLE_BLACK_SHORT;
+        if (b[0][0] != 'r') rights &= ~CASTLE_BLACK_LONG;
+    }
+    return rights;
+}
+
+Uint64 position_key(const Position *pos) {
+    return position_hash((char (*)[BOARD_SIZE])pos->b, pos->white) ^ mix64((Uint64)(pos->ep_file + 2) << 40) ^
+           (pos->castle ? mix64((Uint64)pos->castle << 48) : 0);
+}
+
+// Evaluation cache, kept in EVAL_CACHE_FILE_NAME next to the games and shared by every
+// thread and viewer process through a writable mapping. Buckets hold EVAL_CACHE_WAYS
+// entries; each entry stores its key XORed with its data, so an entry torn by two
+// concurrent writers fails the key check and reads as a miss. Lookups and stores take
+// no locks; only opening the file does (see eval_cache_open).
+typedef struct {
+    Uint32 magic;
+    Uint32 version;
+    Uint32 bucket_count;
+    SDL_atomic_t generation;
+} EvalCacheHeader;
+
+typedef struct {
+    Uint64 check;  // key ^ data
+    Uint64 data;
+} EvalCacheEntry;
+
+typedef struct {
+    int active;
+    unsigned char *base;
+    size_t size;
+    EvalCacheHeader *header;
+    volatile EvalCacheEntry *entries;
+    Uint32 bucket_mask;
+    Uint32 generation;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} EvalCache;
+
+EvalCache eval_cache = {0};
+int eval_enabled = 0;
+
+typedef struct {
+    int depth;
+    int score;
+    int bound;
+    int has_move;
+    Move move;
+} EvalEntry;
+
+static Uint64 eval_pack(const EvalEntry *e, Uint32 generation) {
+    static const char promos[] = "\0QRBN";
+    Uint64 data = (Uint64)(Uint16)(Sint16)e->score;
+    data |= (Uint64)(e->depth & 0xFF) << 16;
+    data |= (Uint64)(e->bound & 3) << 24;
+    if (e->has_move) {
+        int promo = 0;
+        for (int i = 1; i < 5; i++) {
+            if (e->move.promo == promos[i]) promo = i;
+        }
+        data |= (Uint64)(e->move.from_r * 8 + e->move.from_f) << 26;
+        data |= (Uint64)(e->move.to_r * 8 + e->move.to_f) << 32;
+        data |= (Uint64)promo << 38;
+        data |= (Uint64)1 << 41;
+    }
+    data |= (Uint64)(generation & 0xFF) << 48;
+    return data;
+}
+
+static void eval_unpack(Uint64 data, EvalEntry *e) {
+    static const char promos[] = "\0QRBN";
+    e->score = (Sint16)(Uint16)(data & 0xFFFF);
+    e->depth = (int)((data >> 16) & 0xFF);
+    e->bound = (int)((data >> 24) & 3);
+    e->has_move = (int)((data >> 41) & 1);
+    int from = (int)((data >> 26) & 63);
+    int to = (int)((data >> 32) & 63);
+    int promo = (int)((data >> 38) & 7);
+    e->move.from_r = from / 8;
+    e->move.from_f = from % 8;
+    e->move.to_r = to / 8;
+    e->move.to_f = to % 8;
+    e->move.promo = (promo < 5) ? promos[promo] : '\0';
+}
+
+int eval_cache_probe(Uint64 key, EvalEntry *out) {
+    if (!eval_cache.active) return 0;
+    volatile EvalCacheEntry *bucket = eval_cache.entries + (size_t)(key & eval_cache.bucket_mask) * EVAL_CACHE_WAYS;
+    for (int i = 0; i < EVAL_CACHE_WAYS; i++) {
+        Uint64 data = bucket[i].data;
+        Uint64 check = bucket[i].check;
+        if ((check ^ data) != key || data == 0) continue;
+        eval_unpack(data, out);
+        return 1;
+    }
+    return 0;
+}
+
+// Keeps the deeper result for a position already stored; otherwise evicts the entry
+// from the oldest run, shallowest first.
+void eval_cache_store(Uint64 key, const EvalEntry *e) {
+    if (!eval_cache.active) return;
+    volatile EvalCacheEntry *bucket = eval_cache.entries + (size_t)(key & eval_cache.bucket_mask) * EVAL_CACHE_WAYS;
+    int victim = 0;
+    int victim_worth = 0x7FFFFFFF;
+    for (int i = 0; i < EVAL_CACHE_WAYS; i++) {
+        Uint64 data = bucket[i].data;
+        Uint64 check = bucket[i].check;
+        if ((check ^ data) == key && data != 0) {
+            if ((int)((data >> 16) & 0xFF) > e->depth && e->bound != EVAL_BOUND_EXACT) return;
+            victim = i;
+            break;
+        }
+        int age = (int)((eval_cache.generation - (Uint32)(data >> 48)) & 0xFF);
+        int worth = (int)((data >> 16) & 0xFF) - 4 * age;
+        if (data == 0) worth = -0x10000;
+        if (worth < victim_worth) {
+            victim_worth = worth;
+            victim = i;
+        }
+    }
+    Uint64 data = eval_pack(e, eval_cache.generation);
+    bucket[victim].data = data;
+    bucket[victim].check = key ^ data;
+}
+
+// Maps the cache file, creating it on first use. A file of the wrong size or version
+// is started afresh rather than reused. Viewers starting together set the file up one
+// at a time under a lock on it, and the file only ever grows, so it never shrinks
+// under a mapping another process already holds.
+int eval_cache_open(const char *games_dir) {
+    size_t size = sizeof(EvalCacheHeader) + (size_t)EVAL_CACHE_BUCKETS * EVAL_CACHE_WAYS * sizeof(EvalCacheEntry);
+    char *path = join_path(games_dir, EVAL_CACHE_FILE_NAME);
+    if (!path) return 0;
+#ifdef _WIN32
+    eval_cache.file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                                  OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (eval_cache.file == INVALID_HANDLE_VALUE) eval_cache.file = NULL;
+    // A byte past any cache size, so the lock never covers the mapped entries.
+    OVERLAPPED lock_at = {0};
+    lock_at.OffsetHigh = 1;
+    int locked = eval_cache.file && LockFileEx(eval_cache.file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &lock_at);
+    LARGE_INTEGER existing = {0};
+    int fresh = !locked || !GetFileSizeEx(eval_cache.file, &existing) || (size_t)existing.QuadPart != size;
+    if (locked) {
+        // Grows the file to `size` if it is smaller; never shrinks it.
+        eval_cache.mapping = CreateFileMappingA(eval_cache.file, NULL, PAGE_READWRITE, (DWORD)((Uint64)size >> 32),
+                                                (DWORD)size, NULL);
+    }
+    if (eval_cache.mapping) eval_cache.base = (unsigned char *)MapViewOfFile(eval_cache.mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    int ok = (fd >= 0 && flock(fd, LOCK_EX) == 0 && fstat(fd, &st) == 0);
+    int fresh = (!ok || (size_t)st.st_size != size);
+    if (ok && (size_t)st.st_size < size && ftruncate(fd, (off_t)size) != 0) ok = 0;
+    if (ok) {
+        void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base != MAP_FAILED) eval_cache.base = (unsigned char *)base;
+    }
+#endif
+    if (eval_cache.base) {
+        eval_cache.size = size;
+        eval_cache.header = (EvalCacheHeader *)eval_cache.base;
+        eval_cache.entries = (volatile EvalCacheEntry *)(eval_cache.header + 1);
+        if (fresh || eval_cache.header->magic != EVAL_CACHE_MAGIC ||
+            eval_cache.header->version != EVAL_CACHE_VERSION || eval_cache.header->bucket_count != EVAL_CACHE_BUCKETS) {
+            memset(eval_cache.base, 0, size);
+            eval_cache.header->magic = EVAL_CACHE_MAGIC;
+            eval_cache.header->version = EVAL_CACHE_VERSION;
+            eval_cache.header->bucket_count = EVAL_CACHE_BUCKETS;
+        }
+        // Every run is a generation; entries from runs long past are the first evicted.
+        eval_cache.generation = (Uint32)SDL_AtomicAdd(&eval_cache.header->generation, 1) + 1;
+    }
+#ifdef _WIN32
+    if (locked) UnlockFileEx(eval_cache.file, 0, 1, 0, &lock_at);
+    if (!eval_cache.base) {
+        if (eval_cache.mapping) CloseHandle(eval_cache.mapping);
+        if (eval_cache.file) CloseHandle(eval_cache.file);
+        eval_cache.mapping = NULL;
+        eval_cache.file = NULL;
+    }
+#else
+    if (fd >= 0) close(fd);  // drops the lock; the mapping stays
+#endif
+    if (!eval_cache.base) {
+        printf("Could not map evaluation cache %s\n", path);
+        free(path);
+        return 0;
+    }
+    free(path);
+    eval_cache.bucket_mask = EVAL_CACHE_BUCKETS - 1;
+    eval_cache.active = 1;
+    return 1;
+}
+
+void eval_cache_close(void) {
+    if (!eval_cache.active) return;
+#ifdef _WIN32
+    UnmapViewOfFile(eval_cache.base);
+    CloseHandle(eval_cache.mapping);
+    CloseHandle(eval_cache.file);
+#else
+    munmap(eval_cache.base, eval_cache.size);
+#endif
+    memset(&eval_cache, 0, sizeof(eval_cache));
+}
+
+static int piece_worth(char p) {
+    switch (toupper((unsigned char)p)) {
+        case 'P': return 100;
+        case 'N': return 320;
+        case 'B': return 330;
+        case 'R': return 500;
+        case 'Q': return 900;
+        default: return 0;
+    }
+}
+
+// Material, plus small bonuses for central minor pieces and queens and for pawns
+// that have advanced. Centipawns from the side to move's point of view.
+static int evaluate(const Position *pos) {
+    int score = 0;
+    for (int r = 0; r < BOARD_SIZE; r++) {
+        for (int f = 0; f < BOARD_SIZE; f++) {
+            char p = pos->b[r][f];
+            if (p == '.') continue;
+            char type = (char)toupper((unsigned char)p);
+            int white = is_white_piece(p);
+            int value = piece_worth(p);
+            int center = 6 - abs(2 * r - 7) / 2 - abs(2 * f - 7) / 2;
+            if (type == 'N' || type == 'B') value += 4 * center;
+            else if (type == 'Q') value += 2 * center;
+            else if (type == 'P') value += 6 * (white ? 6 - r : r - 1) + ((f == 3 || f == 4) ? 10 : 0);
+            score += white ? value : -value;
+        }
+    }
+    return pos->white ? score : -score;
+}
+
+// Most valuable victim first, then least valuable attacker.
+static int move_order(const Position *pos, const Move *m) {
+    char target = pos->b[m->to_r][m->to_f];
+    int order = 0;
+    if (is_capture(pos, m)) order = 10 * (target != '.' ? piece_worth(target) : 100) - piece_worth(pos->b[m->from_r][m->from_f]) / 10 + 10000;
+    if (m->promo) order += piece_worth(m->promo);
+    return order;
+}
+
+static void sort_moves(const Position *pos, Move *moves, int count, const Move *first) {
+    int orders[MAX_LEGAL_MOVES];
+    for (int i = 0; i < count; i++) {
+        orders[i] = move_order(pos, &moves[i]);
+        if (first && same_move(&moves[i], first)) orders[i] = 0x7FFFFFFF;
+    }
+    for (int i = 1; i < count; i++) {
+        Move m = moves[i];
+        int o = orders[i];
+        int j = i - 1;
+        while (j >= 0 && orders[j] < o) {
+            moves[j + 1] = moves[j];
+            orders[j + 1] = orders[j];
+            j--;
+        }
+        moves[j + 1] = m;
+        orders[j + 1] = o;
+    }
+}
+
+static int quiesce(const Position *pos, int alpha, int beta, int ply, Uint64 *nodes) {
+    (*nodes)++;
+    int stand = evaluate(pos);
+    if (stand >= beta || ply >= SEARCH_MAX_PLY) return stand;
+    if (stand > alpha) alpha = stand;
+    Move moves[MAX_LEGAL_MOVES];
+    int count = generate_moves(pos, moves, 1);
+    sort_moves(pos, moves, count, NULL);
+    for (int i = 0; i < count; i++) {
+        Position next;
+        play_move(pos, &moves[i], &next);
+        int score = -quiesce(&next, -beta, -alpha, ply + 1, nodes);
+        if (score >= beta) return score;
+        if (score > alpha) alpha = score;
+    }
+    return alpha;
+}
+
+// Mate scores are stored relative to the position, not the root, so a cached mate
+// is right wherever the position turns up again.
+static int score_to_cache(int score, int ply) {
+    if (score > SEARCH_MATE - SEARCH_MAX_PLY * 2) return score + ply;
+    if (score < -SEARCH_MATE + SEARCH_MAX_PLY * 2) return score - ply;
+    return score;
+}
+
+static int score_from_cache(int score, int ply) {
+    if (score > SEARCH_MATE - SEARCH_MAX_PLY * 2) return score - ply;
+    if (score < -SEARCH_MATE + SEARCH_MAX_PLY * 2) return score + ply;
+    return score;
+}
+
+// Alpha-beta over legal moves, with the evaluation cache as transposition table.
+// Repetitions and the fifty-move rule are not known to the board and are ignored.
+static int negamax(const Position *pos, int depth, int alpha, int beta, int ply, Move *best_out, Uint64 *nodes) {
+    if (depth <= 0) return quiesce(pos, alpha, beta, ply, nodes);
+    (*nodes)++;
+    Uint64 key = position_key(pos);
+    EvalEntry cached;
+    int have_cached = eval_cache_probe(key, &cached);
+    if (have_cached && cached.depth >= depth && ply > 0) {
+        int score = score_from_cache(cached.score, ply);
+        if (cached.bound == EVAL_BOUND_EXACT || (cached.bound == EVAL_BOUND_LOWER && score >= beta) ||
+            (cached.bound == EVAL_BOUND_UPPER && score <= alpha)) {
+            return score;
+        }
+    }
+
+    Move moves[MAX_LEGAL_MOVES];
+    int count = generate_moves(pos, moves, 0);
+    if (count == 0) return king_attacked((char (*)[BOARD_SIZE])pos->b, pos->white) ? -SEARCH_MATE + ply : 0;
+    sort_moves(pos, moves, count, (have_cached && cached.has_move) ? &cached.move : NULL);
+
+    int start_alpha = alpha;
+    int best = -SEARCH_INFINITE;
+    Move best_move = moves[0];
+    for (int i = 0; i < count; i++) {
+        Position next;
+        play_move(pos, &moves[i], &next);
+        int score = -negamax(&next, depth - 1, -beta, -alpha, ply + 1, NULL, nodes);
+        if (score > best) {
+            best = score;
+            best_move = moves[i];
+        }
+        if (score > alpha) alpha = score;
+        if (alpha >= beta) break;
+    }
+    EvalEntry store = {depth, score_to_cache(best, ply), EVAL_BOUND_EXACT, 1, best_move};
+    if (best <= start_alpha) store.bound = EVAL_BOUND_UPPER;
+    else if (best >= beta) store.bound = EVAL_BOUND_LOWER;
+    eval_cache_store(key, &store);
+    if (best_out) *best_out = best_move;
+    return best;
+}
+
+// Searches to `depth` plies by iterative deepening. A position already searched that
+// deep, by this run or an earlier one, comes straight from the cache. Returns 0 when
+// the side to move has no legal move; *score is then the mate or stalemate score.
+int search_position(const Position *pos, int depth, int *score, Move *best) {
+    Uint64 key = position_key(pos);
+    EvalEntry cached;
+    if (eval_cache_probe(key, &cached) && cached.depth >= depth && cached.bound == EVAL_BOUND_EXACT && cached.has_move) {
+        *score = cached.score;
+        *best = cached.move;
+        return 1;
+    }
+    Uint64 nodes = 0;
+    int result = 0;
+    for (int d = 1; d <= depth; d++) {
+        result = negamax(pos, d, -SEARCH_INFINITE, SEARCH_INFINITE, 0, best, &nodes);
+    }
+    *score = result;
+    Move moves[MAX_LEGAL_MOVES];
+    return generate_moves(pos, moves, 0) > 0;
+}
+
+// The evaluation line for `pos`, from White's point of view.
+static void eval_format(const Position *pos, char *text, size_t size) {
+    int score = 0;
+    Move best;
+    int has_move = search_position(pos, EVAL_DEPTH, &score, &best);
+    if (!pos->white) score = -score;
+    if (abs(score) > SEARCH_MATE - SEARCH_MAX_PLY * 2) {
+        int moves = (SEARCH_MATE - abs(score) + 1) / 2;
+        if (moves == 0) snprintf(text, size, "CHECKMATE");
+        else snprintf(text, size, "EVAL: %s MATES IN %d", (score > 0) ? "WHITE" : "BLACK", moves);
+    } else if (!has_move) {
+        snprintf(text, size, "STALEMATE");
+    } else {
+        snprintf(text, size, "EVAL %s%d.%02d, BEST %c%d%c%d", (score < 0) ? "-" : "", abs(score) / 100, abs(score) % 100,
+                 'a' + best.from_f, 8 - best.from_r, 'a' + best.to_f, 8 - best.to_r);
+    }
+}
+
+// Searches run on one worker thread so a deep position never stalls playback. Each
+// viewer leaves the position it shows in its slot, replacing any request not yet
+// started; the worker takes them in turn and leaves the text for the viewer to pick up.
+typedef struct {
+    Position pos;
+    int serial;
+    int ply;
+    int pending;  // posted, not yet taken by the worker
+    int done;     // text holds the result for serial/ply
+    char text[EVAL_TEXT_LEN];
+} EvalRequest;
+
+typedef struct {
+    SDL_Thread *thread;
+    SDL_mutex *lock;
+    SDL_cond *wake;
+    int stop;
+    EvalRequest requests[MAX_VIEWERS];
+} EvalWorker;
+
+EvalWorker eval_worker = {0};
+
+static int eval_worker_main(void *data) {
+    (void)data;
+    int next = 0;
+    SDL_LockMutex(eval_worker.lock);
+    while (!eval_worker.stop) {
+        EvalRequest *req = NULL;
+        for (int i = 0; i < MAX_VIEWERS && !req; i++) {
+            EvalRequest *r = &eval_worker.requests[(next + i) % MAX_VIEWERS];
+            if (r->pending) req = r;
+        }
+        if (!req) {
+            SDL_CondWait(eval_worker.wake, eval_worker.lock);
+            continue;
+        }
+        next = (int)(req - eval_worker.requests + 1) % MAX_VIEWERS;
+        Position pos = req->pos;
+        int serial = req->serial;
+        int ply = req->ply;
+        req->pending = 0;
+        SDL_UnlockMutex(eval_worker.lock);
+
+        char text[EVAL_TEXT_LEN];
+        eval_format(&pos, text, sizeof(text));
+
+        SDL_LockMutex(eval_worker.lock);
+        if (!req->pending && req->serial == serial && req->ply == ply) {
+            memcpy(req->text, text, sizeof(req->text));
+            req->done = 1;
+        }
+    }
+    SDL_UnlockMutex(eval_worker.lock);
+    return 0;
+}
+
+int eval_start(void) {
+    eval_worker.lock = SDL_CreateMutex();
+    eval_worker.wake = SDL_CreateCond();
+    if (!eval_worker.lock || !eval_worker.wake) return 0;
+    eval_worker.thread = SDL_CreateThread(eval_worker_main, "eval", NULL);
+    return eval_worker.thread != NULL;
+}
+
+// Lets a search in progress finish; at EVAL_DEPTH that is well under a second.
+void eval_stop(void) {
+    if (eval_worker.thread) {
+        SDL_LockMutex(eval_worker.lock);
+        eval_worker.stop = 1;
+        SDL_CondSignal(eval_worker.wake);
+        SDL_UnlockMutex(eval_worker.lock);
+        SDL_WaitThread(eval_worker.thread, NULL);
+    }
+    if (eval_worker.wake) SDL_DestroyCond(eval_worker.wake);
+    if (eval_worker.lock) SDL_DestroyMutex(eval_worker.lock);
+    memset(&eval_worker, 0, sizeof(eval_worker));
+}
+
+// Refreshes the evaluation line for the position at `ply` of the game being shown.
+// A new position is handed to the eval worker and the line is cleared until its
+// result comes back; later calls pick the result up.
+void eval_update(Viewer *v, int ply) {
+    if (!eval_enabled || !eval_worker.thread) return;
+    EvalRequest *req = &eval_worker.requests[v->index];
+    char text[EVAL_TEXT_LEN] = "";
+    if (v->eval_serial != v->game_serial || v->eval_ply != ply) {
+        v->eval_serial = v->game_serial;
+        v->eval_ply = ply;
+        PlyCache *cache = &v->ply_cache;
+        int valid = cache->boards && ply >= 0 && ply <= cache->ply_count;
+        SDL_LockMutex(eval_worker.lock);
+        req->serial = v->game_serial;
+        req->ply = ply;
+        req->done = 0;
+        req->pending = valid;
+        if (valid) {
+            memcpy(req->pos.b, cache->boards[ply], sizeof(req->pos.b));
+            req->pos.white = (ply % 2 == 0);
+            req->pos.ep_file = (ply > 0) ? passant_file(cache->boards[ply - 1], cache->boards[ply], req->pos.white) : -1;
+            req->pos.castle = castle_rights(cache->boards, ply);
+            SDL_CondSignal(eval_worker.wake);
+        }
+        SDL_UnlockMutex(eval_worker.lock);
+    } else {
+        SDL_LockMutex(eval_worker.lock);
+        int ready = req->done;
+        if (ready) {
+            memcpy(text, req->text, sizeof(text));
+            req->done = 0;
+        }
+        SDL_UnlockMutex(eval_worker.lock);
+        if (!ready) return;
+    }
+    if (strcmp(text, v->eval_text) != 0) {
+        memcpy(v->eval_text, text, sizeof(v->eval_text));
+        draw_board(v);
+    }
+}
+
+// Syzygy endgame tables. Probing follows the layout the tables are generated with:
+// the position is mirrored into a canonical form, turned into an index from the
+// piece groups stored in the file, and the value is looked up in blocks of
+// Huffman-coded RE-PAIR symbols.
+Tablebase tb;
+
+static Uint64 tb_binomial[TB_MAX_PIECES + 1][64];
+static int tb_map_pawns[64];
+static Uint64 tb_lead_pawn_idx[TB_MAX_PIECES + 1][64];
+static Uint64 tb_lead_pawns_size[TB_MAX_PIECES + 1][4];
+static int tb_map_b1h1h7[64];
+static int tb_map_a1d1d4[64];
+static int tb_map_kk[10][64];
+
+// Squares here run a1 = 0 .. h8 = 63. Positive above the a1-h8 diagonal, 0 on it.
+static int tb_off_diagonal(int sq) {
+    return (sq >> 3) - (sq & 7);
+}
+
+static void tb_init_maps(void) {
+    int code = 0;
+    for (int s = 0; s < 64; s++) {
+        if (tb_off_diagonal(s) < 0) tb_map_b1h1h7[s] = code++;
+    }
+
+    // a1-d1-d4 triangle: the six squares below the diagonal first, then the diagonal.
+    int diagonal[4];
+    int diagonal_count = 0;
+    code = 0;
+    for (int s = 0; s <= 27; s++) {
+        if ((s & 7) > 3) continue;
+        if (tb_off_diagonal(s) < 0) tb_map_a1d1d4[s] = code++;
+        else if (tb_off_diagonal(s) == 0) diagonal[diagonal_count++] = s;
+    }
+    for (int i = 0; i < diagonal_count; i++) tb_map_a1d1d4[diagonal[i]] = code++;
+
+    // The 462 legal king pairs with the first king in the triangle; pairs with both
+    // kings on the diagonal are numbered last.
+    int both[10 * 64][2];
+    int both_count = 0;
+    code = 0;
+    for (int idx = 0; idx < 10; idx++) {
+        for (int s1 = 0; s1 <= 27; s1++) {
+            if (tb_map_a1d1d4[s1] != idx || (idx == 0 && s1 != 1)) continue;
+            for (int s2 = 0; s2 < 64; s2++) {
+                if (abs((s1 & 7) - (s2 & 7)) <= 1 && abs((s1 >> 3) - (s2 >> 3)) <= 1) continue;
+                if (!tb_off_diagonal(s1) && tb_off_diagonal(s2) > 0) continue;
+                if (!tb_off_diagonal(s1) && !tb_off_diagonal(s2)) {
+                    both[both_count][0] = idx;
+                    both[both_count][1] = s2;
+                    both_count++;
+                } else {
+                    tb_map_kk[idx][s2] = code++;
+                }
+            }
+        }
+    }
+    for (int i = 0; i < both_count; i++) tb_map_kk[both[i][0]][both[i][1]] = code++;
+
+    tb_binomial[0][0] = 1;
+    for (int n = 1; n < 64; n++) {
+        for (int k = 0; k <= TB_MAX_PIECES && k <= n; k++) {
+            tb_binomial[k][n] = (k > 0 ? tb_binomial[k - 1][n - 1] : 0) + (k < n ? tb_binomial[k][n - 1] : 0);
+        }
+    }
+
+    // Pawn squares a2-h7 ranked so the leading pawn (nearest the edge, then lowest)
+    // has the highest value, and the index offsets of each leading pawn square.
+    int available = 47;
+    for (int lead = 1; lead <= TB_MAX_PIECES; lead++) {
+        for (int f = 0; f < 4; f++) {
+            Uint64 idx = 0;
+            for (int r = 1; r <= 6; r++) {
+                int sq = r * 8 + f;
+                if (lead == 1) {
+                    tb_map_pawns[sq] = available--;
+                    tb_map_pawns[sq ^ 7] = available--;
+                }
+                tb_lead_pawn_idx[lead][sq] = idx;
+                idx += tb_binomial[lead - 1][tb_map_pawns[sq]];
+            }
+            tb_lead_pawns_size[lead][f] = idx;
+        }
+    }
+}
+
+static int tb_piece_code(char p) {
+    static const char types[] = "PNBRQK";
+    const char *t = (p != '\0') ? strchr(types, toupper((unsigned char)p)) : NULL;
+    if (!t) return 0;
+    return (int)(t - types) + 1 + (islower((unsigned char)p) ? 8 : 0);
+}
+
+static char tb_at(const Position *pos, int sq) {
+    return pos->b[7 - (sq >> 3)][sq & 7];
+}
+
+// "KQR" style name of one side's pieces, strongest first, as in the file names.
+static void tb_side_name(const int counts[7], char *out) {
+    static const char order[] = "QRBNP";
+    int n = 0;
+    out[n++] = 'K';
+    for (int i = 0; i < 5; i++) {
+        for (int k = 0; k < counts[5 - i] && n < 7; k++) out[n++] = order[i];
+    }
+    out[n] = '\0';
+}
+
+static void tb_describe_material(TbTable *e, const char *name) {
+    int counts[2][7] = {{0}};
+    int side = 0;
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    for (const char *p = name; *p; p++) {
+        if (*p == 'v') {
+            side = 1;
+            continue;
+        }
+        counts[side][tb_piece_code(*p) & 7]++;
+        e->piece_count++;
+    }
+    e->has_pawns = (counts[0][1] + counts[1][1] > 0);
+    for (int c = 0; c < 2; c++) {
+        for (int t = 1; t < 6; t++) {
+            if (counts[c][t] == 1) e->has_unique = 1;
+        }
+    }
+    e->symmetric = (memcmp(counts[0], counts[1], sizeof(counts[0])) == 0);
+    // With pawns on both sides the side with fewer pawns leads; it compresses better.
+    int lead = (!counts[1][1] || (counts[0][1] && counts[1][1] >= counts[0][1])) ? 0 : 1;
+    e->pawn_count[0] = counts[lead][1];
+    e->pawn_count[1] = counts[!lead][1];
+}
+
+static int tb_btree_left(const TbPairs *d, int sym) {
+    const unsigned char *lr = d->btree + 3 * sym;
+    return ((lr[1] & 0xF) << 8) | lr[0];
+}
+
+static int tb_btree_right(const TbPairs *d, int sym) {
+    const unsigned char *lr = d->btree + 3 * sym;
+    return (lr[2] << 4) | (lr[1] >> 4);
+}
+
+// Number of values a symbol expands to, minus one. Pairs only refer to symbols
+// defined before them, so the recursion is bounded.
+static int tb_set_symlen(TbPairs *d, int sym, unsigned char *visited) {
+    visited[sym] = 1;
+    int right = tb_btree_right(d, sym);
+    if (right == 0xFFF) return 0;
+    int left = tb_btree_left(d, sym);
+    if (left >= d->symlen_count || right >= d->symlen_count) return 0;
+    if (!visited[left]) d->symlen[left] = (unsigned char)tb_set_symlen(d, left, visited);
+    if (!visited[right]) d->symlen[right] = (unsigned char)tb_set_symlen(d, right, visited);
+    return d->symlen[left] + d->symlen[right] + 1;
+}
+
+static void tb_set_groups(const TbTable *e, TbPairs *d, const int order[2], int f) {
+    int n = 0;
+    int first_len = e->has_pawns ? 0 : e->has_unique ? 3 : 2;
+    d->group_len[n] = 1;
+    for (int i = 1; i < e->piece_count; i++) {
+        if (--first_len > 0 || d->pieces[i] == d->pieces[i - 1]) d->group_len[n]++;
+        else d->group_len[++n] = 1;
+    }
+    d->group_len[++n] = 0;
+
+    // Groups are combined in the order the file asks for, not in piece order.
+    int pp = e->has_pawns && e->pawn_count[1];
+    int next = pp ? 2 : 1;
+    int free_squares = 64 - d->group_len[0] - (pp ? d->group_len[1] : 0);
+    Uint64 idx = 1;
+    for (int k = 0; next < n || k == order[0] || k == order[1]; k++) {
+        if (k == order[0]) {
+            d->group_idx[0] = idx;
+            idx *= e->has_pawns ? tb_lead_pawns_size[d->group_len[0]][f] : e->has_unique ? 31332 : 462;
+        } else if (k == order[1]) {
+            d->group_idx[1] = idx;
+            idx *= tb_binomial[d->group_len[1]][48 - d->group_len[0]];
+        } else {
+            d->group_idx[next] = idx;
+            idx *= tb_binomial[d->group_len[next]][free_squares];
+            free_squares -= d->group_len[next++];
+        }
+    }
+    d->group_idx[n] = idx;
+}
+
+static const unsigned char *tb_set_sizes(TbPairs *d, const unsigned char *data, const unsigned char *end) {
+    if (data + 2 > end) return NULL;
+    d->flags = *data++;
+    if (d->flags & TB_FLAG_SINGLE_VALUE) {
+        d->min_sym_len = *data++;  // the one value every position has
+        return data;
+    }
+    if (data + 10 > end) return NULL;
+    int n = 0;
+    while (d->group_len[n]) n++;
+    d->block_size = (Uint64)1 << (data[0] & 63);
+    d->span = (Uint64)1 << (data[1] & 63);
+    d->sparse_index_size = (size_t)((d->group_idx[n] + d->span - 1) / d->span);
+    int padding = data[2];
+    d->blocks_num = read_le32(data + 3);
+    d->block_length_size = d->blocks_num + (Uint32)padding;
+    d->max_sym_len = data[7];
+    d->min_sym_len = data[8];
+    data += 9;
+    int lengths = d->max_sym_len - d->min_sym_len + 1;
+    if (d->min_sym_len < 1 || lengths < 1 || d->max_sym_len > 32 || data + lengths * 2 + 2 > end) return NULL;
+    d->lowest_sym = data;
+
+    // Canonical Huffman: codes of one length are consecutive, and longer codes are
+    // numerically smaller. base64[l] is the smallest code of length l, left-aligned.
+    d->base64 = (Uint64 *)calloc((size_t)lengths, sizeof(Uint64));
+    if (!d->base64) return NULL;
+    for (int i = lengths - 2; i >= 0; i--) {
+        d->base64[i] = (d->base64[i + 1] + read_le16(d->lowest_sym + 2 * i) -
+                        read_le16(d->lowest_sym + 2 * (i + 1))) / 2;
+    }
+    for (int i = 0; i < lengths; i++) d->base64[i] <<= 64 - i - d->min_sym_len;
+    data += lengths * 2;
+
+    d->symlen_count = (int)read_le16(data);
+    data += 2;
+    d->btree = data;
+    if (data + d->symlen_count * 3 > end) return NULL;
+    d->symlen = (unsigned char *)calloc((size_t)d->symlen_count + 1, 1);
+    unsigned char *visited = (unsigned char *)calloc((size_t)d->symlen_count + 1, 1);
+    if (!d->symlen || !visited) {
+        free(visited);
+        return NULL;
+    }
+    for (int s = 0; s < d->symlen_count; s++) {
+        if (!visited[s]) d->symlen[s] = (unsigned char)tb_set_symlen(d, s, visited);
+    }
+    free(visited);
+    return data + d->symlen_count * 3 + (d->symlen_count & 1);
+}
+
+static const unsigned char *tb_set_dtz_map(TbTable *e, const unsigned char *data, int max_file) {
+    const unsigned char *base = e->file[TB_DTZ].data;
+    e->dtz_map = data;
+    for (int f = 0; f <= max_file; f++) {
+        TbPairs *d = &e->pairs[TB_DTZ][0][f];
+        if (!(d->flags & TB_FLAG_MAPPED)) continue;
+        if (d->flags & TB_FLAG_WIDE) {
+            data += (data - base) & 1;
+            for (int i = 0; i < 4; i++) {
+                d->map_idx[i] = (Uint16)((data - e->dtz_map) / 2 + 1);
+                data += 2 * read_le16(data) + 2;
+            }
+        } else {
+            for (int i = 0; i < 4; i++) {
+                d->map_idx[i] = (Uint16)(data - e->dtz_map + 1);
+                data += *data + 1;
+            }
+        }
+    }
+    return data + ((data - base) & 1);
+}
+
+static void tb_free_pairs(TbTable *e, int kind) {
+    for (int i = 0; i < 2; i++) {
+        for (int f = 0; f < 4; f++) {
+            free(e->pairs[kind][i][f].base64);
+            free(e->pairs[kind][i][f].symlen);
+        }
+    }
+    memset(e->pairs[kind], 0, sizeof(e->pairs[kind]));
+}
+
+// Lays the sub-tables over the mapped file: piece orders, then sizes and Huffman
+// tables, the DTZ value maps, sparse indexes, block lengths and the blocks.
+static int tb_parse(TbTable *e, int kind) {
+    const unsigned char *base = e->file[kind].data;
+    const unsigned char *end = base + e->file[kind].size;
+    const unsigned char *data = base + 4;
+    int sides = (kind == TB_WDL && !e->symmetric) ? 2 : 1;
+    int max_file = e->has_pawns ? 3 : 0;
+    int pp = e->has_pawns && e->pawn_count[1];
+    if (((data[0] & 2) != 0) != (e->has_pawns != 0)) return 0;
+    data++;
+
+    for (int f = 0; f <= max_file; f++) {
+        if (data + 1 + pp + e->piece_count > end) return 0;
+        int order[2][2] = {{data[0] & 0xF, pp ? (data[1] & 0xF) : 0xF},
+                           {data[0] >> 4, pp ? (data[1] >> 4) : 0xF}};
+        data += 1 + pp;
+        for (int k = 0; k < e->piece_count; k++, data++) {
+            for (int i = 0; i < sides; i++) e->pairs[kind][i][f].pieces[k] = i ? (data[0] >> 4) : (data[0] & 0xF);
+        }
+        for (int i = 0; i < sides; i++) tb_set_groups(e, &e->pairs[kind][i][f], order[i], f);
+    }
+    data += (data - base) & 1;
+
+    for (int f = 0; f <= max_file; f++) {
+        for (int i = 0; i < sides; i++) {
+            data = tb_set_sizes(&e->pairs[kind][i][f], data, end);
+            if (!data) return 0;
+        }
+    }
+    if (kind == TB_DTZ) data = tb_set_dtz_map(e, data, max_file);
+    for (int f = 0; f <= max_file; f++) {
+        for (int i = 0; i < sides; i++) {
+            e->pairs[kind][i][f].sparse_index = data;
+            data += e->pairs[kind][i][f].sparse_index_size * 6;
+        }
+    }
+    for (int f = 0; f <= max_file; f++) {
+        for (int i = 0; i < sides; i++) {
+            e->pairs[kind][i][f].block_lengths = data;
+            data += (size_t)e->pairs[kind][i][f].block_length_size * 2;
+        }
+    }
+    for (int f = 0; f <= max_file; f++) {
+        for (int i = 0; i < sides; i++) {
+            data = base + (((data - base) + 0x3F) & ~(ptrdiff_t)0x3F);
+            e->pairs[kind][i][f].data = data;
+            data += (size_t)e->pairs[kind][i][f].blocks_num * e->pairs[kind][i][f].block_size;
+        }
+    }
+    return data <= end;
+}
+
+static int tb_open(TbTable *e, int kind) {
+    static const unsigned char magic[2][4] = {{0x71, 0xE8, 0x23, 0x5D}, {0xD7, 0x66, 0x0C, 0xA5}};
+    for (int i = 0; i < tb.dir_count; i++) {
+        char file[32];
+        snprintf(file, sizeof(file), "%s%s", e->name, (kind == TB_WDL) ? ".rtbw" : ".rtbz");
+        char *path = join_path(tb.dirs[i], file);
+        int mapped = path && map_file(path, &e->file[kind]);
+        free(path);
+        if (!mapped) continue;
+        if (e->file[kind].size > 5 && memcmp(e->file[kind].data, magic[kind], 4) == 0 && tb_parse(e, kind)) {
+            return 1;
+        }
+        printf("Ignoring damaged tablebase file %s\n", file);
+        tb_free_pairs(e, kind);
+        unmap_file(&e->file[kind]);
+    }
+    return 0;
+}
+
+// Finds the tables for one material name, mapping the file on first use. Returns
+// NULL when no directory has it; the miss is remembered, so it isn't searched again.
+static TbTable *tb_table(const char *name, int kind) {
+    SDL_LockMutex(tb.lock);
+    TbTable *e = NULL;
+    for (int i = 0; i < tb.table_count && !e; i++) {
+        if (strcmp(tb.tables[i]->name, name) == 0) e = tb.tables[i];
+    }
+    if (!e && tb.table_count < TB_MAX_TABLES) {
+        e = (TbTable *)calloc(1, sizeof(TbTable));
+        if (e) {
+            tb_describe_material(e, name);
+            tb.tables[tb.table_count++] = e;
+        }
+    }
+    if (e && e->ready[kind] == 0) e->ready[kind] = tb_open(e, kind) ? 1 : -1;
+    SDL_UnlockMutex(tb.lock);
+    return (e && e->ready[kind] == 1) ? e : NULL;
+}
+
+static int tb_decompress(const TbPairs *d, Uint64 idx) {
+    if (d->flags & TB_FLAG_SINGLE_VALUE) return d->min_sym_len;
+
+    // The sparse index gives the block and offset of the middle of each span; walk
+    // block lengths from there to the block that holds idx.
+    Uint64 k = idx / d->span;
+    if (k >= d->sparse_index_size) return 0;
+    const unsigned char *entry = d->sparse_index + 6 * k;
+    Uint32 block = read_le32(entry);
+    long offset = (long)read_le16(entry + 4) + (long)(idx % d->span) - (long)(d->span / 2);
+    while (offset < 0 && block > 0) offset += (long)read_le16(d->block_lengths + 2 * (size_t)(--block)) + 1;
+    while (block < d->block_length_size && offset > (long)read_le16(d->block_lengths + 2 * (size_t)block)) {
+        offset -= (long)read_le16(d->block_lengths + 2 * (size_t)block++) + 1;
+    }
+    if (block >= d->blocks_num) return 0;
+
+    const unsigned char *ptr = d->data + (Uint64)block * d->block_size;
+    Uint64 buf64 = ((Uint64)read_be32(ptr) << 32) | read_be32(ptr + 4);
+    ptr += 8;
+    int buf_size = 64;
+    int sym;
+    for (;;) {
+        int len = 0;
+        while (buf64 < d->base64[len]) len++;
+        sym = (int)((buf64 - d->base64[len]) >> (64 - len - d->min_sym_len));
+        sym += (int)read_le16(d->lowest_sym + 2 * len);
+        if (sym >= d->symlen_count) return 0;
+        if (offset < d->symlen[sym] + 1) break;
+        offset -= d->symlen[sym] + 1;
+        len += d->min_sym_len;
+        buf64 <<= len;
+        buf_size -= len;
+        if (buf_size <= 32) {
+            buf_size += 32;
+            buf64 |= (Uint64)read_be32(ptr) << (64 - buf_size);
+            ptr += 4;
+        }
+    }
+
+    // The symbol stands for a run of values; descend its pair tree to the one we want.
+    while (d->symlen[sym]) {
+        int left = tb_btree_left(d, sym);
+        if (offset < d->symlen[left] + 1) {
+            sym = left;
+        } else {
+            offset -= d->symlen[left] + 1;
+            sym = tb_btree_right(d, sym);
+        }
+    }
+    return tb_btree_left(d, sym);
+}
+
+static int tb_map_dtz(const TbTable *e, int f, int value, int wdl) {
+    static const int wdl_map[5] = {1, 3, 0, 2, 0};
+    const TbPairs *d = &e->pairs[TB_DTZ][0][f];
+    if (d->flags & TB_FLAG_MAPPED) {
+        int idx = d->map_idx[wdl_map[wdl + 2]] + value;
+        value = (d->flags & TB_FLAG_WIDE) ? (int)read_le16(e->dtz_map + 2 * idx) : e->dtz_map[idx];
+    }
+    // Tables count moves unless flagged as counting plies; we always report plies.
+    if ((wdl == 2 && !(d->flags & TB_FLAG_WIN_PLIES)) || (wdl == -2 && !(d->flags & TB_FLAG_LOSS_PLIES)) ||
+        wdl == 1 || wdl == -1) {
+        value *= 2;
+    }
+    return value + 1;
+}
+
+static void tb_sort_squares(int *squares, int count, int by_pawn_map) {
+    for (int i = 1; i < count; i++) {
+        int s = squares[i];
+        int key = by_pawn_map ? tb_map_pawns[s] : s;
+        int j = i - 1;
+        while (j >= 0 && (by_pawn_map ? tb_map_pawns[squares[j]] : squares[j]) > key) {
+            squares[j + 1] = squares[j];
+            j--;
+        }
+        squares[j + 1] = s;
+    }
+}
+
+// Reads the stored value for the position: WDL as -2..2 for the side to move, or the
+// DTZ in plies for a position whose WDL is `wdl`. DTZ tables hold one side to move
+// only; for the other side *state is set to TB_CHANGE_STM.
+static int tb_probe_table(const Position *pos, int kind, int wdl, int *state) {
+    int counts[2][7] = {{0}};
+    int total = 0;
+    for (int sq = 0; sq < 64; sq++) {
+        int code = tb_piece_code(tb_at(pos, sq));
+        if (!code) continue;
+        counts[code >> 3][code & 7]++;
+        total++;
+    }
+    if (total == 2) return 0;  // bare kings
+    if (total > TB_MAX_PIECES) {
+        *state = TB_FAIL;
+        return 0;
+    }
+
+    // Files are named with the stronger side first; a position whose material only
+    // matches the reversed name is looked up with colors swapped and the board flipped.
+    char white_name[8], black_name[8], name[16];
+    tb_side_name(counts[0], white_name);
+    tb_side_name(counts[1], black_name);
+    snprintf(name, sizeof(name), "%sv%s", white_name, black_name);
+    int black_stronger = 0;
+    TbTable *e = tb_table(name, kind);
+    if (!e) {
+        snprintf(name, sizeof(name), "%sv%s", black_name, white_name);
+        e = tb_table(name, kind);
+        black_stronger = 1;
+    }
+    if (!e) {
+        *state = TB_FAIL;
+        return 0;
+    }
+    int flip = (e->symmetric && !pos->white) || (!e->symmetric && black_stronger);
+    int flip_color = flip ? 8 : 0;
+    int flip_squares = flip ? 56 : 0;
+    int stm = flip ^ !pos->white;
+
+    int squares[TB_MAX_PIECES];
+    int pieces[TB_MAX_PIECES];
+    int size = 0;
+    int lead_count = 0;
+    int tb_file = 0;
+    Uint64 lead_mask = 0;
+    if (e->has_pawns) {
+        // Pawn tables are split by the file of the leading pawn of the reference color.
+        int pc = e->pairs[kind][0][0].pieces[0] ^ flip_color;
+        char pawn = (pc & 8) ? 'p' : 'P';
+        for (int sq = 0; sq < 64; sq++) {
+            if (tb_at(pos, sq) != pawn) continue;
+            squares[size++] = sq ^ flip_squares;
+            lead_mask |= (Uint64)1 << sq;
+        }
+        lead_count = size;
+        int best = 0;
+        for (int i = 1; i < lead_count; i++) {
+            if (tb_map_pawns[squares[i]] > tb_map_pawns[squares[best]]) best = i;
+        }
+        int tmp = squares[0];
+        squares[0] = squares[best];
+        squares[best] = tmp;
+        tb_file = squares[0] & 7;
+        if (tb_file > 3) tb_file = (squares[0] ^ 7) & 7;
+    }
+    if (kind == TB_DTZ) {
+        const TbPairs *d0 = &e->pairs[TB_DTZ][0][tb_file];
+        if ((d0->flags & TB_FLAG_STM) != stm && !(e->symmetric && !e->has_pawns)) {
+            *state = TB_CHANGE_STM;
+            return 0;
+        }
+    }
+    for (int sq = 0; sq < 64; sq++) {
+        char p = tb_at(pos, sq);
+        if (p == '.' || (lead_mask & ((Uint64)1 << sq))) continue;
+        squares[size] = sq ^ flip_squares;
+        pieces[size++] = tb_piece_code(p) ^ flip_color;
+    }
+    const TbPairs *d = &e->pairs[kind][(kind == TB_WDL) ? stm : 0][tb_file];
+
+    // Put the pieces in the order the table lists them.
+    for (int i = lead_count; i < size - 1; i++) {
+        for (int j = i + 1; j < size; j++) {
+            if (d->pieces[i] != pieces[j]) continue;
+            int tp = pieces[i], ts = squares[i];
+            pieces[i] = pieces[j];
+            squares[i] = squares[j];
+            pieces[j] = tp;
+            squares[j] = ts;
+            break;
+        }
+    }
+    if ((squares[0] & 7) > 3) {
+        for (int i = 0; i < size; i++) squares[i] ^= 7;
+    }
+
+    Uint64 idx;
+    if (e->has_pawns) {
+        idx = tb_lead_pawn_idx[lead_count][squares[0]];
+        tb_sort_squares(squares + 1, lead_count - 1, 1);
+        for (int i = 1; i < lead_count; i++) idx += tb_binomial[i][tb_map_pawns[squares[i]]];
+    } else {
+        // Without pawns the board has eight symmetries: bring the leading piece into
+        // the a1-d1-d4 triangle, and the first piece off the diagonal below it.
+        if ((squares[0] >> 3) > 3) {
+            for (int i = 0; i < size; i++) squares[i] ^= 56;
+        }
+        for (int i = 0; i < d->group_len[0]; i++) {
+            if (!tb_off_diagonal(squares[i])) continue;
+            if (tb_off_diagonal(squares[i]) > 0) {
+                for (int j = i; j < size; j++) squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+            }
+            break;
+        }
+        if (e->has_unique) {
+            int adjust1 = (squares[1] > squares[0]);
+            int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+            if (tb_off_diagonal(squares[0])) {
+                idx = ((Uint64)tb_map_a1d1d4[squares[0]] * 63 + (Uint64)(squares[1] - adjust1)) * 62 +
+                      (Uint64)(squares[2] - adjust2);
+            } else if (tb_off_diagonal(squares[1])) {
+                idx = ((Uint64)6 * 63 + (Uint64)(squares[0] >> 3) * 28 + (Uint64)tb_map_b1h1h7[squares[1]]) * 62 +
+                      (Uint64)(squares[2] - adjust2);
+            } else if (tb_off_diagonal(squares[2])) {
+                idx = 6 * 63 * 62 + 4 * 28 * 62 + (Uint64)(squares[0] >> 3) * 7 * 28 +
+                      (Uint64)((squares[1] >> 3) - adjust1) * 28 + (Uint64)tb_map_b1h1h7[squares[2]];
+            } else {
+                idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 + (Uint64)(squares[0] >> 3) * 7 * 6 +
+                      (Uint64)((squares[1] >> 3) - adjust1) * 6 + (Uint64)((squares[2] >> 3) - adjust2);
+            }
+        } else {
+            idx = (Uint64)tb_map_kk[tb_map_a1d1d4[squares[0]]][squares[1]];
+        }
+    }
+
+    // Remaining groups: each is a set of like pieces, counted as a combination of the
+    // squares the earlier groups left free.
+    idx *= d->group_idx[0];
+    int *group_sq = squares + d->group_len[0];
+    int remaining_pawns = e->has_pawns && e->pawn_count[1];
+    for (int next = 1; d->group_len[next]; next++) {
+        int len = d->group_len[next];
+        tb_sort_squares(group_sq, len, 0);
+        Uint64 n = 0;
+        for (int i = 0; i < len; i++) {
+            int adjust = 0;
+            for (const int *s = squares; s < group_sq; s++) adjust += (group_sq[i] > *s);
+            n += tb_binomial[i + 1][group_sq[i] - adjust - 8 * remaining_pawns];
+        }
+        remaining_pawns = 0;
+        idx += n * d->group_idx[next];
+        group_sq += len;
+    }
+
+    int value = tb_decompress(d, idx);
+    return (kind == TB_WDL) ? value - 2 : tb_map_dtz(e, tb_file, value, wdl);
+}
+
+// Tables may store any value for a position whose best move is a capture (and DTZ
+// tables for one whose best move zeroes the counter), so captures are searched and
+// the better of them and the stored value is the answer.
+static int tb_search(Position *pos, int check_zeroing, int *state) {
+    Move moves[MAX_LEGAL_MOVES];
+    int total = generate_moves(pos, moves, 0);
+    int best = -2;
+    int searched = 0;
+    for (int i = 0; i < total; i++) {
+        int pawn = (toupper((unsigned char)pos->b[moves[i].from_r][moves[i].from_f]) == 'P');
+        if (!is_capture(pos, &moves[i]) && (!check_zeroing || !pawn)) continue;
+        searched++;
+        Position next;
+        play_move(pos, &moves[i], &next);
+        int value = -tb_search(&next, 0, state);
+        if (*state == TB_FAIL) return 0;
+        if (value > best) {
+            best = value;
+            if (value >= 2) {
+                *state = TB_ZEROING_BEST_MOVE;
+                return value;
+            }
+        }
+    }
+    int no_more_moves = (searched && searched == total);
+    int value = best;
+    if (!no_more_moves) {
+        value = tb_probe_table(pos, TB_WDL, 0, state);
+        if (*state == TB_FAIL) return 0;
+    }
+    if (best >= value) {
+        *state = (best > 0 || no_more_moves) ? TB_ZEROING_BEST_MOVE : TB_OK;
+        return best;
+    }
+    *state = TB_OK;
+    return value;
+}
+
+static int tb_dtz_before_zeroing(int wdl) {
+    return (wdl == 2) ? 1 : (wdl == 1) ? 101 : (wdl == -1) ? -101 : (wdl == -2) ? -1 : 0;
+}
+
+// DTZ in plies, signed like the WDL value; 0 for draws and on failure.
+static int tb_probe_dtz(Position *pos, int *state) {
+    *state = TB_OK;
+    int wdl = tb_search(pos, 1, state);
+    if (*state == TB_FAIL || wdl == 0) return 0;
+    if (*state == TB_ZEROING_BEST_MOVE) return tb_dtz_before_zeroing(wdl);
+
+    int dtz = tb_probe_table(pos, TB_DTZ, wdl, state);
+    if (*state == TB_FAIL) return 0;
+    if (*state != TB_CHANGE_STM) return (dtz + 100 * (wdl == -1 || wdl == 1)) * sign(wdl);
+
+    // The table only has the other side to move: take the best reply one ply down.
+    Move moves[MAX_LEGAL_MOVES];
+    int total = generate_moves(pos, moves, 0);
+    int min_dtz = 0xFFFF;
+    for (int i = 0; i < total; i++) {
+        int zeroing = is_capture(pos, &moves[i]) ||
+                      toupper((unsigned char)pos->b[moves[i].from_r][moves[i].from_f]) == 'P';
+        Position next;
+        play_move(pos, &moves[i], &next);
+        if (zeroing) {
+            *state = TB_OK;
+            dtz = -tb_dtz_before_zeroing(tb_search(&next, 0, state));
+        } else {
+            dtz = -tb_probe_dtz(&next, state);
+        }
+        if (*state == TB_FAIL) return 0;
+        if (dtz == 1 && is_in_check(next.b, next.white) && generate_moves(&next, moves + total, 0) == 0) min_dtz = 1;
+        if (!zeroing) dtz += sign(dtz);
+        if (dtz < min_dtz && sign(dtz) == sign(wdl)) min_dtz = dtz;
+    }
+    return (min_dtz == 0xFFFF) ? -1 : min_dtz;
+}
+
+static int tb_piece_total(char b[BOARD_SIZE][BOARD_SIZE]) {
+    int n = 0;
+    for (int r = 0; r < BOARD_SIZE; r++) {
+        for (int f = 0; f < BOARD_SIZE; f++) n += (b[r][f] != '.');
+    }
+    return n;
+}
+
+// Probes a position with at most TB_MAX_PIECES pieces. wdl is -2 (loss) .. 2 (win)
+// for the side to move, with -1/1 for results the fifty-move rule turns into draws;
+// dtz is plies to the next capture or pawn move, 0 when unknown. Results are cached
+// by position hash, so replaying or stepping through a game probes each position once.
+int tb_probe(char b[BOARD_SIZE][BOARD_SIZE], int white_to_move, int ep_file, int *wdl, int *dtz) {
+    if (!tb.active || tb_piece_total(b) > TB_MAX_PIECES) return 0;
+    Position pos;
+    memcpy(pos.b, b, sizeof(pos.b));
+    pos.white = white_to_move;
+    pos.ep_file = ep_file;
+    pos.castle = 0;
+    Uint64 key = position_key(&pos);
+    TbCacheEntry *slot = &tb.cache[key & (TB_CACHE_SIZE - 1)];
+    SDL_AtomicLock(&tb.cache_lock);
+    TbCacheEntry hit = *slot;
+    SDL_AtomicUnlock(&tb.cache_lock);
+    if (hit.key == key) {
+        *wdl = hit.wdl;
+        *dtz = hit.dtz;
+        return hit.found;
+    }
+
+    int state = TB_OK;
+    TbCacheEntry fresh = {key, 0, 0, 0};
+    fresh.wdl = tb_search(&pos, 0, &state);
+    fresh.found = (state != TB_FAIL);
+    if (fresh.found && fresh.wdl != 0) {
+        fresh.dtz = tb_probe_dtz(&pos, &state);
+        if (state == TB_FAIL) fresh.dtz = 0;
+    }
+    SDL_AtomicLock(&tb.cache_lock);
+    *slot = fresh;
+    SDL_AtomicUnlock(&tb.cache_lock);
+    *wdl = fresh.wdl;
+    *dtz = fresh.dtz;
+    return fresh.found;
+}
+
+static void tb_format(char *out, size_t size, int wdl, int dtz, int white_to_move) {
+    const char *winner = ((wdl > 0) == (white_to_move != 0)) ? "WHITE" : "BLACK";
+    int plies = abs(dtz) - ((wdl == 1 || wdl == -1) ? 100 : 0);
+    if (wdl == 0) {
+        snprintf(out, size, "TB: DRAW");
+    } else if (wdl == 2 || wdl == -2) {
+        if (dtz != 0) snprintf(out, size, "TB: %s WINS, DTZ %d", winner, plies);
+        else snprintf(out, size, "TB: %s WINS", winner);
+    } else {
+        snprintf(out, size, "TB: DRAW, %s CURSED WIN", winner);
+    }
+}
+
+// Announces the move that left theory when playback arrives at the position it made.
+void novelty_update(Viewer *v, int ply) {
+    if (v->novelty_ply < 0 || ply == v->novelty_seen_ply) return;
+    v->novelty_seen_ply = ply;
+    if (ply != v->novelty_ply + 1) return;
+    char text[STATUS_TEXT_LEN];
+    snprintf(text, sizeof(text), "NOVELTY: MOVE %d%s", v->novelty_ply / 2 + 1, (v->novelty_ply % 2) ? "..." : "");
+    show_status(v, text);
+    draw_board(v);
+}
+
+// Refreshes the tablebase line for the position at `ply` of the game being shown.
+// Each ply is looked at once; positions with too many pieces leave the line empty.
+void tablebase_update(Viewer *v, int ply) {
+    if (!tb.active) return;
+    if (v->tb_serial == v->game_serial && v->tb_ply == ply) return;
+    v->tb_serial = v->game_serial;
+    v->tb_ply = ply;
+    char text[TB_TEXT_LEN] = "";
+    PlyCache *cache = &v->ply_cache;
+    if (cache->boards && ply >= 0 && ply <= cache->ply_count && tb_piece_total(cache->boards[ply]) <= TB_MAX_PIECES) {
+        int white_to_move = (ply % 2 == 0);
+        int ep_file = (ply > 0) ? passant_file(cache->boards[ply - 1], cache->boards[ply], white_to_move) : -1;
+        int wdl, dtz;
+        if (tb_probe(cache->boards[ply], white_to_move, ep_file, &wdl, &dtz)) {
+            tb_format(text, sizeof(text), wdl, dtz, white_to_move);
+        }
+    }
+    if (strcmp(text, v->tb_text) != 0) {
+        memcpy(v->tb_text, text, sizeof(v->tb_text));
+        draw_board(v);
+    }
+}
+
+// `paths` lists directories like PATH does; tables in them are opened on demand.
+int tb_init(const char *paths) {
+    char dir[1024];
+    const char *p = paths;
+    while (*p) {
+        size_t len = strcspn(p, TB_PATH_SEP);
+        if (len > 0 && len < sizeof(dir)) {
+            memcpy(dir, p, len);
+            dir[len] = '\0';
+            int cap = tb.dir_count;
+            if (!push_string(&tb.dirs, &tb.dir_count, &cap, dir)) return 0;
+        }
+        p += len;
+        if (*p) p++;
+    }
+    if (tb.dir_count == 0) return 0;
+    tb.lock = SDL_CreateMutex();
+    if (!tb.lock) return 0;
+    tb_init_maps();
+    tb.active = 1;
+    return 1;
+}
+
+void tb_free(void) {
+    for (int i = 0; i < tb.table_count; i++) {
+        for (int kind = 0; kind < 2; kind++) {
+            tb_free_pairs(tb.tables[i], kind);
+            unmap_file(&tb.tables[i]->file[kind]);
+        }
+        free(tb.tables[i]);
+    }
+    free_string_list(tb.dirs, tb.dir_count);
+    if (tb.lock) SDL_DestroyMutex(tb.lock);
+    memset(&tb, 0, sizeof(tb));
+}
+
+// Positions whose tablebase values are known by hand: mates in one, a stalemate and
+// a capture into a won ending. dtz is only compared when check_dtz is set.
+typedef struct {
+    const char *fen;
+    const char *material;
+    int wdl;
+    int dtz;
+    int check_dtz;
+} TbKnownPosition;
+
+static const TbKnownPosition tb_known_positions[] = {
+    {"7k/8/6K1/8/8/8/Q7/8 w", "KQvK", 2, 1, 1},      // Qa8#
+    {"7k/8/6K1/8/8/8/Q7/8 b", "KQvK", 0, 0, 1},      // stalemate
+    {"7k/8/6K1/8/8/8/8/R7 w", "KRvK", 2, 1, 1},      // Ra8#
+    {"7k/8/6K1/8/8/8/8/R7 b", "KRvK", -2, 0, 0},     // lost, Kg8 only delays it
+    {"7k/8/6K1/8/8/8/8/R6r w", "KRvKR", 2, 1, 1},    // Ra8#, the h1 rook can't interpose
+    {"7k/8/6K1/8/8/8/8/R6r b", "KRvKR", 2, 1, 1},    // Rxa1 zeroes into a won KRvK
+};
+
+// --syzygy-check: probes the positions above against the tables given with --syzygy
+// and prints each result next to the expected one. Positions whose tables aren't
+// there are skipped; returns 0 if one disagrees or nothing could be probed.
+int tb_check_known(void) {
+    int count = (int)(sizeof(tb_known_positions) / sizeof(tb_known_positions[0]));
+    int probed = 0;
+    int wrong = 0;
+    for (int i = 0; i < count; i++) {
+        const TbKnownPosition *k = &tb_known_positions[i];
+        char b[BOARD_SIZE][BOARD_SIZE];
+        int white_to_move;
+        int wdl, dtz;
+        if (!fen_to_board(k->fen, b, &white_to_move)) continue;
+        if (!tb_probe(b, white_to_move, -1, &wdl, &dtz)) {
+            printf("%-24s %-6s skipped: table missing or unreadable\n", k->fen, k->material);
+            continue;
+        }
+        probed++;
+        int ok = (wdl == k->wdl) && (!k->check_dtz || dtz == k->dtz);
+        if (!ok) wrong++;
+        if (k->check_dtz) {
+            printf("%-24s %-6s WDL %d DTZ %d, expected WDL %d DTZ %d: %s\n", k->fen, k->material, wdl, dtz, k->wdl,
+                   k->dtz, ok ? "ok" : "WRONG");
+        } else {
+            printf("%-24s %-6s WDL %d, expected WDL %d: %s\n", k->fen, k->material, wdl, k->wdl, ok ? "ok" : "WRONG");
+        }
+    }
+    if (probed == 0) {
+        printf("No KQvK, KRvK or KRvKR tables found in the --syzygy directories\n");
+        return 0;
+    }
+    printf("%d of %d positions probed, %d wrong\n", probed, count, wrong);
+    return wrong == 0;
+}
+
+int list_pgn_files(const char *dir, char ***out_files) {
+    char **files = NULL;
+    int count = 0;
+    int cap = 0;
+    if (list_pgn_files_recursive(dir, dir, &files, &count, &cap) < 0) {
+        free_string_list(files, count);
+        return -1;
+    }
+    *out_files = files;
+    return count;
+}
+
+int push_selection(GameSelection **history, int *count, int *cap, GameSelection sel) {
+    if (*count >= *cap) {
+        int new_cap = (*cap == 0) ? 8 : (*cap * 2);
+        GameSelection *next = (GameSelection *)realloc(*history, new_cap * sizeof(*next));
+        if (!next) return 0;
+        *history = next;
+        *cap = new_cap;
+    }
+    (*history)[*count] = sel;
+    (*count)++;
+    return 1;
+}
+
+int rand_next(unsigned int *state) {
+    *state = *state * 1103515245u + 12345u;
+    return (int)((*state >> 16) & 0x7FFF);
+}
+
+// Each viewer draws from its own generator so concurrent streams never share rand() state.
+int viewer_rand(Viewer *v) {
+    return rand_next(&v->rng_state);
+}
+
+char *index_random_path(const char *games_dir, unsigned int *rng);
+
+// Picks a random PGN from the shared corpus; the caller owns the returned path. With an
+// index the file table comes from it, so viewer processes don't each walk games/.
+// Otherwise, or once a listed file went missing, the directory is scanned.
+char *corpus_random_path(const char *games_dir, unsigned int *rng) {
+    SDL_LockMutex(corpus.lock);
+    if (!corpus.stale && corpus.file_count <= 0) {
+        char *path = index_random_path(games_dir, rng);
+        if (path) {
+            SDL_UnlockMutex(corpus.lock);
+            return path;
+        }
+    }
+    if (corpus.stale || corpus.file_count <= 0) {
+        free_string_list(corpus.files, corpus.file_count);
+        corpus.files = NULL;
+        corpus.file_count = 0;
+        char **files = NULL;
+        int file_count = list_pgn_files(games_dir, &files);
+        if (file_count > 0) {
+            corpus.files = files;
+            corpus.file_count = file_count;
+        } else {
+            free(files);
+        }
+        corpus.stale = 0;
+    }
+    char *path = NULL;
+    if (corpus.file_count > 0) {
+        path = join_path(games_dir, corpus.files[rand_next(rng) % corpus.file_count]);
+    }
+    SDL_UnlockMutex(corpus.lock);
+    return path;
+}
+
+void corpus_mark_stale(void) {
+    SDL_LockMutex(corpus.lock);
+    corpus.stale = 1;
+    SDL_UnlockMutex(corpus.lock);
+}
+
+static int relpath_from_base(const char *base, const char *path, char *out, size_t out_size);
+
+// Adds the PGN members of an archive as "<archive>/<member>" so the corpus treats the
+// archive like a folder. An unreadable archive is skipped rather than failing the scan.
+static int list_archive_pgn_files(const char *archive, const char *base,
+                                  char ***out_files, int *count, int *cap) {
+    ArchiveMember *members = NULL;
+    int member_count = archive_list(archive, &members);
+    if (member_count < 0) {
+        printf("Skipping unreadable archive %s\n", archive);
+        return 0;
+    }
+    char relbuf[1024];
+    int status = relpath_from_base(base, archive, relbuf, sizeof(relbuf)) ? 0 : -1;
+    for (int i = 0; i < member_count && status == 0; i++) {
+        if (!has_pgn_extension(members[i].name)) continue;
+        char entry[2048];
+        snprintf(entry, sizeof(entry), "%s/%s", relbuf, members[i].name);
+        if (!push_string(out_files, count, cap, entry)) status = -1;
+    }
+    free_archive_members(members, member_count);
+    return status;
+}
+
+static int relpath_from_base(const char *base, const char *path, char *out, size_t out_size) {
+    size_t base_len = strlen(base);
+    const char *p = path;
+    if (strncmp(path, base, base_len) == 0) {
+        p = path + base_len;
+        if (*p == '\\' || *p == '/') p++;
+    }
+    if (strlen(p) + 1 > out_size) return 0;
+    strcpy(out, p);
+    return 1;
+}
+
+static int list_pgn_files_recursive(const char *dir, const char *base,
+                                    char ***out_files, int *count, int *cap) {
+#ifdef _WIN32
+    char *search = join_path(dir, "*");
+    if (!search) return -1;
+    WIN32_FIND_DATAA data;
+    HANDLE h = FindFirstFileA(search, &data);
+    free(search);
+    if (h == INVALID_HANDLE_VALUE) return -1;
+    do {
+        if (strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0) continue;
+        char *full = join_path(dir, data.cFileName);
+        if (!full) {
+            FindClose(h);
+            return -1;
+        }
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            if (list_pgn_files_recursive(full, base, out_files, count, cap) < 0) {
+                free(full);
+                FindClose(h);
+                return -1;
+            }
+        } else if (has_archive_extension(data.cFileName)) {
+            if (list_archive_pgn_files(full, base, out_files, count, cap) < 0) {
+                free(full);
+                FindClose(h);
+                return -1;
+            }
+        } else if (has_pgn_extension(data.cFileName) || has_scid_extension(data.cFileName)) {
+            char relbuf[1024];
+            if (!relpath_from_base(base, full, relbuf, sizeof(relbuf))) {
+                free(full);
+                FindClose(h);
+                return -1;
+            }
+            if (!push_string(out_files, count, cap, relbuf)) {
+                free(full);
+                FindClose(h);
+                return -1;
+            }
+        }
+        free(full);
     } while (FindNextFileA(h, &data));
     FindClose(h);
 #else
-    DIR *d = opendir(dir);
-    if (!d) return -1;
-    struct dirent *ent;
-    while ((ent = readdir(d)) != NULL) {
-        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
-        char *full = join_path(dir, ent->d_name);
-        if (!full) {
-            closedir(d);
+    DIR *d = opendir(dir);
+    if (!d) return -1;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+        char *full = join_path(dir, ent->d_name);
+        if (!full) {
+            closedir(d);
+            return -1;
+        }
+        int is_dir = 0;
+#ifdef DT_DIR
+        if (ent->d_type == DT_DIR) is_dir = 1;
+        if (ent->d_type == DT_UNKNOWN)
+#endif
+        {
+            DIR *probe = opendir(full);
+            if (probe) {
+                is_dir = 1;
+                closedir(probe);
+            }
+        }
+        if (is_dir) {
+            if (list_pgn_files_recursive(full, base, out_files, count, cap) < 0) {
+                free(full);
+                closedir(d);
+                return -1;
+            }
+        } else if (has_archive_extension(ent->d_name)) {
+            if (list_archive_pgn_files(full, base, out_files, count, cap) < 0) {
+                free(full);
+                closedir(d);
+                return -1;
+            }
+        } else if (has_pgn_extension(ent->d_name) || has_scid_extension(ent->d_name)) {
+            char relbuf[1024];
+            if (!relpath_from_base(base, full, relbuf, sizeof(relbuf))) {
+                free(full);
+                closedir(d);
+                return -1;
+            }
+            if (!push_string(out_files, count, cap, relbuf)) {
+                free(full);
+                closedir(d);
+                return -1;
+            }
+        }
+        free(full);
+    }
+    closedir(d);
+#endif
+    return 0;
+}
+
+int parse_tag_value(const char *line, const char *tag, char *out, size_t out_size) {
+    size_t tag_len = strlen(tag);
+    if (strncmp(line, "[", 1) != 0) return 0;
+    if (strncmp(line + 1, tag, tag_len) != 0) return 0;
+    if (!isspace((unsigned char)line[1 + tag_len])) return 0;
+    const char *first_quote = strchr(line, '"');
+    if (!first_quote) return 0;
+    const char *second_quote = strchr(first_quote + 1, '"');
+    if (!second_quote) return 0;
+    size_t len = (size_t)(second_quote - first_quote - 1);
+    if (len >= out_size) len = out_size - 1;
+    memcpy(out, first_quote + 1, len);
+    out[len] = '\0';
+    return 1;
+}
+
+void extract_year(char *out, size_t out_size, const char *date) {
+    if (!out || out_size == 0) return;
+    out[0] = '\0';
+    if (!date || strlen(date) < 4) return;
+    for (int i = 0; i < 4; i++) {
+        if (!isdigit((unsigned char)date[i])) return;
+    }
+    if (out_size < 5) return;
+    memcpy(out, date, 4);
+    out[4] = '\0';
+}
+
+void set_last_name(char *out, size_t out_size, const char *full) {
+    if (!out || out_size == 0) return;
+    out[0] = '\0';
+    if (!full) return;
+
+    const char *start = full;
+    while (isspace((unsigned char)*start)) start++;
+    if (*start == '\0') return;
+
+    const char *comma = strchr(start, ',');
+    const char *name_start = start;
+    const char *name_end = NULL;
+
+    if (comma) {
+        name_end = comma;
+        while (name_end > name_start && isspace((unsigned char)name_end[-1])) {
+            name_end--;
+        }
+    } else {
+        const char *p = start;
+        const char *last_word = start;
+        while (*p) {
+            while (isspace((unsigned char)*p)) p++;
+            if (*p == '\0') break;
+            last_word = p;
+            while (*p && !isspace((unsigned char)*p)) p++;
+        }
+        name_start = last_word;
+        name_end = name_start;
+        while (*name_end && !isspace((unsigned char)*name_end)) name_end++;
+    }
+
+    size_t len = (size_t)(name_end - name_start);
+    if (len >= out_size) len = out_size - 1;
+    memcpy(out, name_start, len);
+    out[len] = '\0';
+}
+
+int push_game(Game **games, int *count, int *cap, const char *move_buffer,
+              const char *white, const char *black, const char *year, const char *result, int rating,
+              Sint64 offset) {
+    if (*count >= *cap) {
+        int new_cap = (*cap == 0) ? 16 : (*cap * 2);
+        Game *new_games = (Game *)realloc(*games, (size_t)new_cap * sizeof(Game));
+        if (!new_games) return 0;
+        *games = new_games;
+        *cap = new_cap;
+    }
+    (*games)[*count].moves = copy_string(move_buffer);
+    if (!(*games)[*count].moves) return 0;
+    strncpy((*games)[*count].white, (white && white[0]) ? white : "White", NAME_LEN - 1);
+    (*games)[*count].white[NAME_LEN - 1] = '\0';
+    strncpy((*games)[*count].black, (black && black[0]) ? black : "Black", NAME_LEN - 1);
+    (*games)[*count].black[NAME_LEN - 1] = '\0';
+    strncpy((*games)[*count].year, (year && year[0]) ? year : "", YEAR_LEN - 1);
+    (*games)[*count].year[YEAR_LEN - 1] = '\0';
+    strncpy((*games)[*count].result, (result && result[0]) ? result : "", RESULT_LEN - 1);
+    (*games)[*count].result[RESULT_LEN - 1] = '\0';
+    (*games)[*count].rating = rating;
+    (*games)[*count].offset = offset;
+    (*count)++;
+    return 1;
+}
+
+void free_games(Game *games, int count) {
+    if (!games) return;
+    for (int i = 0; i < count; i++) {
+        free(games[i].moves);
+    }
+    free(games);
+}
+
+// Reads games from the current position of the stream; max_games > 0 stops after that many.
+int load_games_limit(PgnStream *fp, Game **out_games, int max_games) {
+    Game *games = NULL;
+    int count = 0;
+    int cap = 0;
+    char line[512];
+    char move_buffer[65536] = {0};
+    char current_white[NAME_LEN] = "";
+    char current_black[NAME_LEN] = "";
+    char current_date[NAME_LEN] = "";
+    char current_year[YEAR_LEN] = "";
+    char current_result[RESULT_LEN] = "";
+    char elo[16];
+    int white_elo = 0;
+    int black_elo = 0;
+    int in_game = 0;
+    Sint64 game_offset = 0;
+    Sint64 line_offset = pgn_tell(fp);
+
+    while (pgn_gets(line, sizeof(line), fp)) {
+        Sint64 this_offset = line_offset;
+        line_offset = pgn_tell(fp);
+        clean_line(line);
+        const char *trim = line;
+        while (isspace((unsigned char)*trim)) trim++;
+        if (strncmp(trim, "[Event", 6) == 0) {  // New game starts
+            if (in_game && move_buffer[0] != '\0') {
+                if (!push_game(&games, &count, &cap, move_buffer, current_white, current_black,
+                               current_year, current_result, mean_rating(white_elo, black_elo), game_offset)) goto error;
+                move_buffer[0] = '\0';
+                if (max_games > 0 && count >= max_games) {
+                    in_game = 0;
+                    break;
+                }
+            }
+            game_offset = this_offset;
+            current_white[0] = '\0';
+            current_black[0] = '\0';
+            current_date[0] = '\0';
+            current_year[0] = '\0';
+            current_result[0] = '\0';
+            white_elo = 0;
+            black_elo = 0;
+            in_game = 1;
+            continue;  // Skip header lines
+        }
+        if (in_game && trim[0] == '[') {
+            parse_tag_value(trim, "White", current_white, sizeof(current_white));
+            parse_tag_value(trim, "Black", current_black, sizeof(current_black));
+            if (parse_tag_value(trim, "Date", current_date, sizeof(current_date))) {
+                extract_year(current_year, sizeof(current_year), current_date);
+            }
+            parse_tag_value(trim, "Result", current_result, sizeof(current_result));
+            if (parse_tag_value(trim, "WhiteElo", elo, sizeof(elo))) white_elo = atoi(elo);
+            if (parse_tag_value(trim, "BlackElo", elo, sizeof(elo))) black_elo = atoi(elo);
+            continue;
+        }
+        if (in_game && trim[0] != '[' && trim[0] != '\0') {
+            strncat(move_buffer, " ", sizeof(move_buffer) - strlen(move_buffer) - 1);
+            strncat(move_buffer, trim, sizeof(move_buffer) - strlen(move_buffer) - 1);
+        }
+    }
+
+    if (in_game && move_buffer[0] != '\0') {
+        if (!push_game(&games, &count, &cap, move_buffer, current_white, current_black,
+                       current_year, current_result, mean_rating(white_elo, black_elo), game_offset)) goto error;
+    }
+
+    *out_games = games;
+    return count;
+
+error:
+    free_games(games, count);
+    *out_games = NULL;
+    return -1;
+}
+
+int load_games(PgnStream *fp, Game **out_games) {
+    return load_games_limit(fp, out_games, 0);
+}
+
+// Loads the one game whose [Event tag starts at `offset`, as recorded by the index. An
+// archive member recorded by the index is opened directly, without the member listing,
+// and a deflated one is decoded from `resume` (may be NULL), the index's nearest
+// checkpoint before the game. For a Scid database the offset is the game number.
+int load_game_at(const char *path, const ArchiveMember *member, const InflateCheckpoint *resume, Sint64 offset,
+                 Game *out) {
+    if (has_scid_extension(path)) {
+        ScidBase *db = scid_acquire(path);
+        int ok = db && offset >= 0 && scid_load_game(db, (Uint32)offset, out);
+        scid_release(db);
+        return ok;
+    }
+    PgnStream fp;
+    char archive[1024];
+    char name[1024];
+    int opened = member ? split_archive_path(path, archive, sizeof(archive), name, sizeof(name)) &&
+                              pgn_open_member(&fp, archive, member)
+                        : pgn_open(&fp, path);
+    if (!opened) return 0;
+    fp.resume = resume;
+    Game *games = NULL;
+    int count = 0;
+    if (pgn_seek(&fp, offset)) {
+        count = load_games_limit(&fp, &games, 1);
+    }
+    pgn_close(&fp);
+    if (count <= 0) {
+        free_games(games, count);
+        return 0;
+    }
+    *out = games[0];
+    free(games);
+    return 1;
+}
+
+// Loads game `*game_index` of a PGN file or Scid database, or a random one when the
+// index is out of range, and writes back the index it used. Returns 1 on success, 0 if
+// the source has no playable game and -1 if it can't be opened. A Scid database only
+// decodes the game it picks instead of loading every game like a PGN file.
+int load_source_game(const char *path, int *game_index, unsigned int *rng, Game *out) {
+    if (has_scid_extension(path)) {
+        ScidBase *db = scid_acquire(path);
+        if (!db) {
+            printf("Failed to open %s\n", path);
+            return -1;
+        }
+        int ok = 0;
+        if (*game_index >= 0 && (Uint32)*game_index < db->game_count) {
+            ok = scid_load_game(db, (Uint32)*game_index, out);
+        } else {
+            for (int i = 0; i < SCID_RANDOM_TRIES && !ok && db->game_count > 0; i++) {
+                Uint32 pick = (((Uint32)rand_next(rng) << 15) | (Uint32)rand_next(rng)) % db->game_count;
+                ok = scid_load_game(db, pick, out);
+                if (ok) *game_index = (int)pick;
+            }
+        }
+        if (!ok) printf("Failed to load games from %s\n", path);
+        scid_release(db);
+        return ok;
+    }
+    PgnStream fp;
+    if (!pgn_open(&fp, path)) {
+        printf("Failed to open %s\n", path);
+        return -1;
+    }
+    Game *games = NULL;
+    int game_count = load_games(&fp, &games);
+    pgn_close(&fp);
+    if (game_count <= 0) {
+        if (game_count < 0) {
+            printf("Failed to load games from PGN.\n");
+        }
+        free_games(games, game_count);
+        return 0;
+    }
+    if (*game_index < 0 || *game_index >= game_count) {
+        *game_index = rand_next(rng) % game_count;
+    }
+    *out = games[*game_index];
+    games[*game_index].moves = NULL;
+    free_games(games, game_count);
+    return 1;
+}
+
+void shuffle_games(Game *games, int count) {
+    for (int i = count - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        Game tmp = games[i];
+        games[i] = games[j];
+        games[j] = tmp;
+    }
+}
+
+typedef struct {
+    unsigned short start;
+    unsigned short end;
+} Segment;
+
+// The plies worth watching in one game, as half-open ranges in playback order.
+typedef struct {
+    int count;
+    Segment segments[MAX_SEGMENTS];
+} HighlightPlan;
+
+// On-disk index: a small manifest, INDEX_FILE_NAME, and under INDEX_SHARD_DIR one
+// shard per file plus one postings shard. Each shard is named by the XXH64 of its
+// bytes, so a rebuild rewrites only the shards whose contents changed, and a viewer
+// checks a shard against its name when it first maps it. The manifest is this header,
+// the files sorted by relative path, and their names. checksum covers the files and
+// names; header_checksum covers the header up to itself.
+typedef struct {
+    Uint32 magic;
+    Uint32 version;
+    Uint32 file_count;
+    Uint32 game_count;
+    Uint32 name_bytes;
+    Uint32 reserved;
+    Uint64 postings;  // names the postings shard
+    Uint64 checksum;
+    Uint64 header_checksum;
+} IndexHeader;
+
+// One file's shard: this header, then the file's games, the inflate checkpoints of a
+// deflated archive member (see InflateCheckpoint), the games' segments, its Bloom
+// filter, its players' games, the blocks of its visits (see ShardVisit), its players'
+// names and the visits' bytes. Visits are packed like posting lists, POSTING_BLOCK to
+// a block: a PostingBlock holding the block's first key, then a width byte and the
+// key gaps bit-packed at that width, each visit's game at the width the shard's game
+// count needs, and each ply in 8 bits. Game numbers and first_segment count from the
+// start of the shard's own sections, so a shard depends on nothing but its file and a
+// rebuild reuses it while the file is unchanged. Visits are sorted by key and game
+// and players by name, ready to merge into the postings. bloom_checksum covers the
+// header up to itself and the Bloom filter, so a query can read and trust the filter
+// without mapping or checking the rest of the shard.
+typedef struct {
+    Uint32 magic;
+    Uint32 version;
+    Uint32 game_count;
+    Uint32 segment_count;
+    Uint32 bloom_words;
+    Uint32 visit_count;
+    Uint32 visit_bytes;
+    Uint32 player_count;
+    Uint32 player_bytes;
+    Uint32 checkpoint_count;
+    Uint64 bloom_checksum;
+} IndexShardHeader;
+
+// The postings shard: this header, then positions, players, posting blocks, every
+// game's novelty ply, player names and posting bytes. Unlike the file shards it covers
+// the whole corpus, so it is rebuilt whenever any file changes.
+typedef struct {
+    Uint32 magic;
+    Uint32 version;
+    Uint32 game_count;
+    Uint32 position_count;
+    Uint32 player_count;
+    Uint32 posting_block_count;
+    Uint32 name_bytes;
+    Uint32 posting_bytes;
+} IndexPostingsHeader;
+
+// Size and mtime are the archive's for archive members. `source` is PGN_SOURCE_FILE
+// or the member's ARCHIVE_* method, with the member's location in the archive after it
+// so an indexed game is fetched as (archive, member, offset) without listing the archive.
+// The file's games are ids first_game on, and live in the shard named by `shard`.
+typedef struct {
+    Uint32 name_offset;
+    Uint32 first_game;
+    Uint32 game_count;
+    Uint32 source;
+    Sint64 size;
+    Sint64 mtime;
+    Sint64 data_offset;
+    Sint64 packed_size;
+    Sint64 unpacked_size;
+    Uint64 shard;
+} IndexFile;
+
+// fingerprint hashes the final position and length, so one game saved in several
+// files can be told apart from a different one; 0 for a game with no moves.
+// rating, decisive and swings feed the interestingness score (see interest_score).
+// A game's novelty depends on every other game, so it is kept in the postings shard.
+typedef struct {
+    Uint16 ply_count;
+    Uint16 segment_count;
+    Uint32 first_segment;
+    Uint16 rating;
+    Uint8 decisive;
+    Uint8 swings;  // plies where material swung, capped at 255
+    Uint32 fingerprint;
+    Sint64 offset;
+} IndexGame;
+
+// An ascending list of game ids, compressed: the ids go in blocks of POSTING_BLOCK,
+// each stored as its first id and the gaps after it bit-packed at the block's width.
+// Game ids are dense, so most gaps take a few bits instead of 32.
+typedef struct {
+    Uint32 first_block;
+    Uint32 count;
+} PostingList;
+
+// The block's first id doubles as a skip pointer: a search finds the block it needs by
+// binary search over these and decodes only that one.
+typedef struct {
+    Uint32 first;
+    Uint32 offset;  // into the posting bytes
+} PostingBlock;
+
+// A game's first visit to a position after ply 0 and up to NOVELTY_MAX_PLY, keyed by
+// the high half of position_hash. `ply` has VISIT_LISTED set if the game also passes
+// through the position between POSITION_MIN_PLY and POSITION_MAX_PLY; those visits
+// make the position lists. Once all files are merged, a position only one game visits
+// at all, counting copies of it as one, is a novelty candidate for each copy.
+typedef struct {
+    Uint32 key;
+    Uint32 game;
+    Uint32 ply;
+} ShardVisit;
+
+// One game of the player whose normalized name starts at name_offset in the shard's
+// player names.
+typedef struct {
+    Uint32 name_offset;
+    Uint32 game;
+} ShardPlayer;
+
+// The games reaching one position. Sorted by key; positions only one game reached are
+// left out.
+typedef struct {
+    Uint32 key;
+    PostingList games;
+} IndexPositionList;
+
+// One player, by normalized name (see normalize_player), with every game they played.
+// Sorted by name.
+typedef struct {
+    Uint32 name_offset;
+    PostingList games;
+} IndexPlayer;
+
+// A file's shard with its sections located (see shard_view).
+typedef struct {
+    const IndexShardHeader *header;
+    const IndexGame *games;
+    const InflateCheckpoint *checkpoints;
+    const Segment *segments;
+    const ShardPlayer *players;
+    const PostingBlock *visit_blocks;
+    const char *player_names;
+    const unsigned char *visit_bytes;
+} ShardView;
+
+// One file's shard while it is mapped. Readers pin it while they copy out of it (see
+// index_shard_pin), and only a shard nobody has pinned is ever unmapped. The Bloom
+// filter is read on its own by the first query that probes it (see bloom_may_contain)
+// and kept for the life of the version: it is a small fraction of the shard, and a
+// search probes every file's.
+typedef struct {
+    MappedFile map;
+    ShardView view;
+    Uint32 last_used;
+    int pins;
+    int damaged;  // missing or failed its checksum; the file's games are analyzed on the spot
+    Uint32 *bloom;
+    Uint32 bloom_words;
+    int bloom_state;  // 0 not read yet, 1 read, -1 missing or damaged
+} IndexShard;
+
+// Walker's alias table over the indexed games: pick a column uniformly, then keep it
+// with probability prob[i] or take alias[i] instead. Two random numbers per pick
+// whatever the corpus size; built once per index version and set of weights.
+typedef struct {
+    float *prob;
+    Uint32 *alias;
+    Uint32 count;
+} InterestTable;
+
+// One version of the index. The manifest and shards are mapped read-only and shared,
+// so every viewer process on the host reads the same physical pages. Loading maps
+// only the manifest; a file's shard is mapped the first time one of its games is
+// looked up, and the postings shard by the first player or position query. What the
+// session picks games from by id (--interesting, --vs) is built per version before the
+// version is published, so a pick and the load that follows agree on the ids.
+typedef struct {
+    SDL_atomic_t refs;
+    MappedFile map;
+    const unsigned char *data;
+    size_t size;
+    const IndexHeader *header;
+    const IndexFile *files;
+    const char *names;
+    char *shard_dir;
+    IndexShard *shards;  // one per file
+    size_t mapped_bytes;
+    Uint32 clock;
+    SDL_mutex *lock;
+    MappedFile postings_map;
+    int postings_state;  // 0 not mapped yet, 1 mapped, -1 missing or damaged
+    const IndexPostingsHeader *postings;
+    const IndexPositionList *positions;
+    const IndexPlayer *players;
+    const PostingBlock *posting_blocks;
+    const Uint16 *novelty;  // per game, NO_NOVELTY if none
+    const char *player_names;
+    const unsigned char *posting_bytes;
+    InterestTable interest;
+    Uint32 *matchup_games;  // games between the --vs players, ascending
+    int matchup_count;
+} CorpusIndex;
+
+// The version new lookups see, or NULL. Readers take a reference with index_acquire
+// and drop it with index_release; a swap (see index_publish) drops only the reference
+// held here, so an old version stays mapped until the last reader lets it go.
+CorpusIndex *corpus_index = NULL;
+SDL_SpinLock corpus_index_lock = 0;
+
+#define XXH_PRIME1 11400714785074694791ull
+#define XXH_PRIME2 14029467366897019727ull
+#define XXH_PRIME3 1609587929392839161ull
+#define XXH_PRIME4 9650029242287828579ull
+#define XXH_PRIME5 2870177450012600261ull
+
+static Uint64 rotl64(Uint64 x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static Uint64 xxh_round(Uint64 acc, Uint64 input) {
+    acc += input * XXH_PRIME2;
+    return rotl64(acc, 31) * XXH_PRIME1;
+}
+
+static Uint64 xxh_merge(Uint64 acc, Uint64 lane) {
+    acc ^= xxh_round(0, lane);
+    return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+static Uint64 read_le64(const unsigned char *p) {
+    Uint64 v;
+    memcpy(&v, p, sizeof(v));
+    return SDL_SwapLE64(v);
+}
+
+// XXH64 of a buffer. Four independent lanes keep four multiplies in flight, so it
+// runs at several GB/s and checking a whole index at load costs a fraction of a
+// millisecond per MB. Chain buffers by passing one's hash as the next one's seed.
+static Uint64 checksum64(const void *data, size_t size, Uint64 seed) {
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + size;
+    Uint64 h;
+    if (size >= 32) {
+        Uint64 v1 = seed + XXH_PRIME1 + XXH_PRIME2;
+        Uint64 v2 = seed + XXH_PRIME2;
+        Uint64 v3 = seed;
+        Uint64 v4 = seed - XXH_PRIME1;
+        for (; end - p >= 32; p += 32) {
+            v1 = xxh_round(v1, read_le64(p));
+            v2 = xxh_round(v2, read_le64(p + 8));
+            v3 = xxh_round(v3, read_le64(p + 16));
+            v4 = xxh_round(v4, read_le64(p + 24));
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + XXH_PRIME5;
+    }
+    h += (Uint64)size;
+    for (; end - p >= 8; p += 8) {
+        h ^= xxh_round(0, read_le64(p));
+        h = rotl64(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+    }
+    if (end - p >= 4) {
+        Uint32 v;
+        memcpy(&v, p, sizeof(v));
+        h ^= (Uint64)SDL_SwapLE32(v) * XXH_PRIME1;
+        h = rotl64(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * XXH_PRIME5;
+        h = rotl64(h, 11) * XXH_PRIME1;
+    }
+    h ^= h >> 33;
+    h *= XXH_PRIME2;
+    h ^= h >> 29;
+    h *= XXH_PRIME3;
+    return h ^ (h >> 32);
+}
+
+// Returns 0 if the path doesn't fit in out.
+static int shard_path(const char *shard_dir, Uint64 checksum, char *out, size_t out_size) {
+    int len = snprintf(out, out_size, "%s%c%016llx.shard", shard_dir, PATH_SEP, (unsigned long long)checksum);
+    return len >= 0 && (size_t)len < out_size;
+}
+
+// Maps shard `checksum` and checks its bytes against the name; the shard is small, so
+// the check costs little next to the first lookup it serves.
+static int map_shard(const char *shard_dir, Uint64 checksum, size_t min_size, MappedFile *out) {
+    char path[1024];
+    if (!shard_path(shard_dir, checksum, path, sizeof(path)) || !map_file(path, out)) return 0;
+    if (out->size >= min_size && checksum64(out->data, out->size, 0) == checksum) return 1;
+    unmap_file(out);
+    return 0;
+}
+
+static int bit_width(Uint32 max) {
+    int bits = 0;
+    while (bits < 32 && (max >> bits) != 0) bits++;
+    return bits;
+}
+
+static Uint32 visit_block_count(const IndexShardHeader *h) {
+    return (h->visit_count + POSTING_BLOCK - 1) / POSTING_BLOCK;
+}
+
+// Width of the games in a shard's visit blocks.
+static int visit_game_bits(const IndexShardHeader *h) {
+    return bit_width(h->game_count > 0 ? h->game_count - 1 : 0);
+}
+
+// Bytes after the width byte of a visit block of n visits.
+static size_t visit_block_bytes(size_t n, int key_bits, int game_bits) {
+    return ((n - 1) * (size_t)key_bits + n * ((size_t)game_bits + 8) + 7) / 8;
+}
+
+// Locates the sections of a file's shard and checks that they fill it exactly and that
+// every visit block, game number and name in them points inside it. Visits' game
+// numbers are checked as they are decoded (see visit_decode_block). Returns 0 if it is
+// no shard of this version.
+static int shard_view(const unsigned char *data, size_t size, ShardView *out) {
+    const IndexShardHeader *h = (const IndexShardHeader *)data;
+    if (size < sizeof(IndexShardHeader) || h->magic != INDEX_SHARD_MAGIC || h->version != INDEX_VERSION) return 0;
+    Uint32 block_count = visit_block_count(h);
+    size_t expected = sizeof(IndexShardHeader) + (size_t)h->game_count * sizeof(IndexGame) +
+                      (size_t)h->checkpoint_count * sizeof(InflateCheckpoint) +
+                      (size_t)h->segment_count * sizeof(Segment) + (size_t)h->bloom_words * sizeof(Uint32) +
+                      (size_t)h->player_count * sizeof(ShardPlayer) + (size_t)block_count * sizeof(PostingBlock) +
+                      (size_t)h->player_bytes + (size_t)h->visit_bytes;
+    if (expected != size) return 0;
+    out->header = h;
+    out->games = (const IndexGame *)(h + 1);
+    out->checkpoints = (const InflateCheckpoint *)(out->games + h->game_count);
+    out->segments = (const Segment *)(out->checkpoints + h->checkpoint_count);
+    out->players = (const ShardPlayer *)((const Uint32 *)(out->segments + h->segment_count) + h->bloom_words);
+    out->visit_blocks = (const PostingBlock *)(out->players + h->player_count);
+    out->player_names = (const char *)(out->visit_blocks + block_count);
+    out->visit_bytes = (const unsigned char *)(out->player_names + h->player_bytes);
+    if (h->player_bytes > 0 && out->player_names[h->player_bytes - 1] != '\0') return 0;
+    int game_bits = visit_game_bits(h);
+    for (Uint32 b = 0; b < block_count; b++) {
+        Uint32 n = h->visit_count - b * POSTING_BLOCK;
+        if (n > POSTING_BLOCK) n = POSTING_BLOCK;
+        Uint32 offset = out->visit_blocks[b].offset;
+        // The decoder loads a whole word at the block's last bits.
+        if (offset >= h->visit_bytes || out->visit_bytes[offset] > 32 ||
+            (size_t)offset + 1 + visit_block_bytes(n, out->visit_bytes[offset], game_bits) + 8 > h->visit_bytes) {
+            return 0;
+        }
+    }
+    for (Uint32 i = 0; i < h->player_count; i++) {
+        if (out->players[i].game >= h->game_count || out->players[i].name_offset >= h->player_bytes) return 0;
+    }
+    return 1;
+}
+
+// Unmaps the least recently used unpinned shards while more than INDEX_SHARD_BUDGET
+// bytes are mapped, so a long session over a large library holds only the shards it
+// is using. Pinned shards stay mapped, over the budget if need be, until unpinned.
+// Call with the index lock held.
+static void index_evict_locked(CorpusIndex *ix) {
+    while (ix->mapped_bytes > INDEX_SHARD_BUDGET) {
+        IndexShard *oldest = NULL;
+        for (Uint32 i = 0; i < ix->header->file_count; i++) {
+            IndexShard *s = &ix->shards[i];
+            if (s->map.data && s->pins == 0 && (!oldest || s->last_used < oldest->last_used)) oldest = s;
+        }
+        if (!oldest) break;
+        ix->mapped_bytes -= oldest->map.size;
+        unmap_file(&oldest->map);
+    }
+}
+
+// Pins file `file`'s shard, mapping it if it isn't yet, or returns NULL if it can't be
+// used. Mapping and checking a shard against its name happen without the index lock,
+// so lookups in shards already mapped never wait on them; when two threads map the
+// same shard at once, the first to finish keeps its mapping. The view stays valid
+// until index_shard_unpin.
+static IndexShard *index_shard_pin(CorpusIndex *ix, Uint32 file) {
+    IndexShard *shard = &ix->shards[file];
+    SDL_LockMutex(ix->lock);
+    shard->last_used = ++ix->clock;
+    int pinned = (shard->map.data != NULL);
+    int damaged = shard->damaged;
+    if (pinned) shard->pins++;
+    SDL_UnlockMutex(ix->lock);
+    if (pinned) return shard;
+    if (damaged) return NULL;
+
+    const IndexFile *rec = &ix->files[file];
+    MappedFile map;
+    ShardView view;
+    int ok = map_shard(ix->shard_dir, rec->shard, sizeof(IndexShardHeader), &map) &&
+             shard_view(map.data, map.size, &view) && view.header->game_count == rec->game_count;
+    if (!ok) unmap_file(&map);
+    int report = 0;
+    SDL_LockMutex(ix->lock);
+    if (!shard->map.data && ok) {
+        shard->map = map;
+        shard->view = view;
+        ix->mapped_bytes += map.size;
+        memset(&map, 0, sizeof(map));
+    } else if (!shard->map.data) {
+        report = !shard->damaged;
+        shard->damaged = 1;
+    }
+    pinned = (shard->map.data != NULL);
+    if (pinned) {
+        shard->pins++;
+        index_evict_locked(ix);
+    }
+    SDL_UnlockMutex(ix->lock);
+    unmap_file(&map);  // another thread's mapping won
+    if (report) {
+        printf("Index shard for %s is missing or damaged; its games are analyzed on the spot\n",
+               ix->names + rec->name_offset);
+    }
+    return pinned ? shard : NULL;
+}
+
+static void index_shard_unpin(CorpusIndex *ix, IndexShard *shard) {
+    SDL_LockMutex(ix->lock);
+    shard->pins--;
+    index_evict_locked(ix);
+    SDL_UnlockMutex(ix->lock);
+}
+
+// The file holding game `game_id`: the last one whose games start at or before it.
+static Uint32 index_game_file(const CorpusIndex *ix, Uint32 game_id) {
+    Uint32 lo = 0;
+    Uint32 hi = ix->header->file_count;
+    while (lo + 1 < hi) {
+        Uint32 mid = lo + (hi - lo) / 2;
+        if (ix->files[mid].first_game <= game_id) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Copies game `game_id`'s record, and its highlight segments if plan is not NULL.
+// Returns 0 if there is no such game or its shard can't be used.
+int index_game(CorpusIndex *ix, Uint32 game_id, IndexGame *out, HighlightPlan *plan) {
+    if (!ix || game_id >= ix->header->game_count) return 0;
+    Uint32 file = index_game_file(ix, game_id);
+    IndexShard *shard = index_shard_pin(ix, file);
+    int ok = (shard != NULL);
+    if (ok) {
+        *out = shard->view.games[game_id - ix->files[file].first_game];
+        if (plan) {
+            ok = out->segment_count > 0 && out->segment_count <= MAX_SEGMENTS &&
+                 out->first_segment + out->segment_count <= shard->view.header->segment_count;
+            if (ok) {
+                plan->count = out->segment_count;
+                memcpy(plan->segments, shard->view.segments + out->first_segment,
+                       (size_t)out->segment_count * sizeof(Segment));
+            }
+        }
+        index_shard_unpin(ix, shard);
+    }
+    return ok;
+}
+
+// Copies the last inflate checkpoint at or before `offset` in game `game_id`'s file.
+// Returns 0 if the file has none there or its shard can't be used.
+int index_checkpoint(CorpusIndex *ix, Uint32 game_id, Sint64 offset, InflateCheckpoint *out) {
+    if (!ix || game_id >= ix->header->game_count) return 0;
+    Uint32 file = index_game_file(ix, game_id);
+    IndexShard *shard = index_shard_pin(ix, file);
+    int found = 0;
+    if (shard) {
+        const InflateCheckpoint *cps = shard->view.checkpoints;
+        Uint32 lo = 0;
+        Uint32 hi = shard->view.header->checkpoint_count;
+        while (lo < hi) {
+            Uint32 mid = lo + (hi - lo) / 2;
+            if (cps[mid].out <= offset) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo > 0) {
+            *out = cps[lo - 1];
+            found = 1;
+        }
+        index_shard_unpin(ix, shard);
+    }
+    return found;
+}
+
+// Ordinal of game `game_id` within its file.
+int index_game_ordinal(const CorpusIndex *ix, Uint32 game_id) {
+    return (int)(game_id - ix->files[index_game_file(ix, game_id)].first_game);
+}
+
+// Maps the postings shard on first use; it stays mapped until the index is freed.
+// Returns 0 if there is none to use.
+int index_postings(CorpusIndex *ix) {
+    if (!ix) return 0;
+    SDL_LockMutex(ix->lock);
+    if (ix->postings_state == 0) {
+        MappedFile map;
+        int ok = map_shard(ix->shard_dir, ix->header->postings, sizeof(IndexPostingsHeader), &map);
+        const IndexPostingsHeader *h = (const IndexPostingsHeader *)map.data;
+        if (ok) {
+            size_t expected = sizeof(IndexPostingsHeader) + (size_t)h->position_count * sizeof(IndexPositionList) +
+                              (size_t)h->player_count * sizeof(IndexPlayer) +
+                              (size_t)h->posting_block_count * sizeof(PostingBlock) +
+                              (size_t)h->game_count * sizeof(Uint16) + (size_t)h->name_bytes + (size_t)h->posting_bytes;
+            ok = h->magic == INDEX_SHARD_MAGIC && h->version == INDEX_VERSION && h->game_count == ix->header->game_count &&
+                 expected == map.size;
+        }
+        if (ok) {
+            ix->postings_map = map;
+            ix->postings = h;
+            ix->positions = (const IndexPositionList *)(h + 1);
+            ix->players = (const IndexPlayer *)(ix->positions + h->position_count);
+            ix->posting_blocks = (const PostingBlock *)(ix->players + h->player_count);
+            ix->novelty = (const Uint16 *)(ix->posting_blocks + h->posting_block_count);
+            ix->player_names = (const char *)(ix->novelty + h->game_count);
+            ix->posting_bytes = (const unsigned char *)(ix->player_names + h->name_bytes);
+            ix->postings_state = 1;
+        } else {
+            unmap_file(&map);
+            ix->postings_state = -1;
+            printf("Index postings are missing or damaged; rebuild with --build-index\n");
+        }
+    }
+    int ready = (ix->postings_state == 1);
+    SDL_UnlockMutex(ix->lock);
+    return ready;
+}
+
+static void index_destroy(CorpusIndex *ix) {
+    for (Uint32 i = 0; ix->shards && i < ix->header->file_count; i++) {
+        unmap_file(&ix->shards[i].map);
+        free(ix->shards[i].bloom);
+    }
+    free(ix->shards);
+    free(ix->shard_dir);
+    unmap_file(&ix->postings_map);
+    if (ix->lock) SDL_DestroyMutex(ix->lock);
+    unmap_file(&ix->map);
+    free(ix->interest.prob);
+    free(ix->interest.alias);
+    free(ix->matchup_games);
+    free(ix);
+}
+
+// The published version with a reference taken, or NULL without an index. Hold it for
+// as long as ids or records from it are in use, then index_release it.
+CorpusIndex *index_acquire(void) {
+    SDL_AtomicLock(&corpus_index_lock);
+    CorpusIndex *ix = corpus_index;
+    if (ix) SDL_AtomicIncRef(&ix->refs);
+    SDL_AtomicUnlock(&corpus_index_lock);
+    return ix;
+}
+
+void index_release(CorpusIndex *ix) {
+    if (ix && SDL_AtomicDecRef(&ix->refs)) index_destroy(ix);
+}
+
+// Makes `ix` (or no index) the version new lookups see, taking over the caller's
+// reference to it. Readers still holding the old version finish with it undisturbed;
+// the last one to let go of it frees it.
+void index_publish(CorpusIndex *ix) {
+    SDL_AtomicLock(&corpus_index_lock);
+    CorpusIndex *old = corpus_index;
+    corpus_index = ix;
+    SDL_AtomicUnlock(&corpus_index_lock);
+    index_release(old);
+}
+
+// Whether map holds a whole file table (the index manifest, or a slice's) with the
+// given magic, its size and checksums matching, so a truncated, foreign or damaged one
+// is never trusted.
+static int file_table_valid(const MappedFile *map, Uint32 magic) {
+    if (map->size <= sizeof(IndexHeader)) return 0;
+    const IndexHeader *header = (const IndexHeader *)map->data;
+    const IndexFile *files = (const IndexFile *)(header + 1);
+    size_t files_size = (size_t)header->file_count * sizeof(IndexFile);
+    size_t expected = sizeof(IndexHeader) + files_size + (size_t)header->name_bytes;
+    return header->magic == magic && header->version == INDEX_VERSION && expected == map->size &&
+           header->header_checksum == checksum64(header, offsetof(IndexHeader, header_checksum), 0) &&
+           header->checksum == checksum64((const char *)files + files_size, header->name_bytes,
+                                          checksum64(files, files_size, 0));
+}
+
+// Maps the index manifest under games_dir as a new version holding one reference, or
+// returns NULL if there is none. Shards are mapped as they are used, so this costs the
+// same however large the library. A manifest that fails file_table_valid is ignored.
+CorpusIndex *index_open(const char *games_dir) {
+    char *path = join_path(games_dir, INDEX_FILE_NAME);
+    MappedFile map;
+    int mapped = path && map_file(path, &map);
+    free(path);
+    if (!mapped) return NULL;
+    if (!file_table_valid(&map, INDEX_MAGIC)) {
+        printf("Ignoring stale or damaged %s\n", INDEX_FILE_NAME);
+        unmap_file(&map);
+        return NULL;
+    }
+    const IndexHeader *header = (const IndexHeader *)map.data;
+    const IndexFile *files = (const IndexFile *)(header + 1);
+    size_t files_size = (size_t)header->file_count * sizeof(IndexFile);
+    CorpusIndex *ix = (CorpusIndex *)calloc(1, sizeof(CorpusIndex));
+    if (!ix) {
+        unmap_file(&map);
+        return NULL;
+    }
+    SDL_AtomicSet(&ix->refs, 1);
+    ix->map = map;
+    ix->data = map.data;
+    ix->size = map.size;
+    ix->header = header;
+    ix->files = files;
+    ix->names = (const char *)files + files_size;
+    ix->shards = (IndexShard *)calloc(header->file_count + 1, sizeof(IndexShard));
+    ix->shard_dir = join_path(games_dir, INDEX_SHARD_DIR);
+    ix->lock = SDL_CreateMutex();
+    if (!ix->shards || !ix->shard_dir || !ix->lock) {
+        index_destroy(ix);
+        return NULL;
+    }
+    return ix;
+}
+
+// The file table entry for `rel`, a path relative to games_dir, or NULL. Binary search
+// over the sorted file table.
+static const IndexFile *index_file_named(const CorpusIndex *ix, const char *rel) {
+    int lo = 0;
+    int hi = (int)ix->header->file_count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(rel, ix->names + ix->files[mid].name_offset);
+        if (cmp < 0) hi = mid - 1;
+        else if (cmp > 0) lo = mid + 1;
+        else return &ix->files[mid];
+    }
+    return NULL;
+}
+
+// Picks highlight segments from per-ply flags: every swing or tactic with a few plies
+// of lead-in, merged where they touch, followed by the final plies of the game.
+void select_highlights(const unsigned char *flags, int ply_count, HighlightPlan *plan) {
+    plan->count = 0;
+    int final_start = ply_count - HIGHLIGHT_FINAL_PLIES;
+    if (final_start < 0) final_start = 0;
+    for (int i = 0; i < final_start && plan->count < MAX_SEGMENTS - 1; i++) {
+        if (!(flags[i] & (PLY_SWING | PLY_TACTIC))) continue;
+        int start = (i > HIGHLIGHT_LEAD_PLIES) ? i - HIGHLIGHT_LEAD_PLIES : 0;
+        int end = i + 1 + HIGHLIGHT_TAIL_PLIES;
+        if (end > ply_count) end = ply_count;
+        Segment *last = plan->count > 0 ? &plan->segments[plan->count - 1] : NULL;
+        if (last && start <= last->end) {
+            if (end > last->end) last->end = (unsigned short)end;
+        } else {
+            plan->segments[plan->count].start = (unsigned short)start;
+            plan->segments[plan->count].end = (unsigned short)end;
+            plan->count++;
+        }
+    }
+    Segment *last = plan->count > 0 ? &plan->segments[plan->count - 1] : NULL;
+    if (last && final_start <= last->end) {
+        last->end = (unsigned short)ply_count;
+    } else {
+        plan->segments[plan->count].start = (unsigned short)final_start;
+        plan->segments[plan->count].end = (unsigned short)ply_count;
+        plan->count++;
+    }
+}
+
+// For a member of an archive this is the archive's size and time.
+static int stat_file(const char *path, Sint64 *out_size, Sint64 *out_mtime) {
+    FileStat st;
+    char archive[1024];
+    char member[1024];
+    if (split_archive_path(path, archive, sizeof(archive), member, sizeof(member))) path = archive;
+    if (file_stat(path, &st) != 0) return 0;
+    *out_size = (Sint64)st.st_size;
+    *out_mtime = (Sint64)st.st_mtime;
+    return 1;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static int compare_visits(const void *a, const void *b) {
+    const ShardVisit *pa = (const ShardVisit *)a;
+    const ShardVisit *pb = (const ShardVisit *)b;
+    if (pa->key != pb->key) return (pa->key < pb->key) ? -1 : 1;
+    if (pa->game != pb->game) return (pa->game < pb->game) ? -1 : 1;
+    return 0;
+}
+
+// Lowercase with runs of spaces folded to one and the ends trimmed, so the spellings
+// files disagree on most often still meet in one player.
+static void normalize_player(const char *name, char *out, size_t out_size) {
+    size_t len = 0;
+    int space = 0;
+    for (const char *c = name; *c && len + 1 < out_size; c++) {
+        if (isspace((unsigned char)*c)) {
+            space = (len > 0);
+            continue;
+        }
+        if (space && len + 2 < out_size) out[len++] = ' ';
+        space = 0;
+        out[len++] = (char)tolower((unsigned char)*c);
+    }
+    out[len] = '\0';
+}
+
+typedef struct {
+    Uint32 name_offset;  // into the player name text while indexing
+    Uint32 game;
+    const char *name;    // set once the text stops growing, for sorting
+} PlayerGame;
+
+static int compare_player_games(const void *a, const void *b) {
+    const PlayerGame *pa = (const PlayerGame *)a;
+    const PlayerGame *pb = (const PlayerGame *)b;
+    int cmp = strcmp(pa->name, pb->name);
+    if (cmp != 0) return cmp;
+    return (pa->game < pb->game) ? -1 : (pa->game > pb->game);
+}
+
+static int grow_buffer(void **data, size_t *cap, size_t needed, size_t item_size) {
+    if (needed <= *cap) return 1;
+    size_t new_cap = (*cap == 0) ? 256 : *cap;
+    while (new_cap < needed) new_cap *= 2;
+    void *next = realloc(*data, new_cap * item_size);
+    if (!next) return 0;
+    *data = next;
+    *cap = new_cap;
+    return 1;
+}
+
+// Appends one ascending list of game ids: a PostingBlock per POSTING_BLOCK ids, and
+// for each a width byte and the gaps minus one, bit-packed little-endian at that width.
+typedef struct {
+    PostingBlock *blocks;
+    size_t block_count;
+    size_t block_cap;
+    unsigned char *bytes;
+    size_t byte_count;
+    size_t byte_cap;
+} PostingWriter;
+
+// ORs a value of up to 32 bits into p at bit offset `bit`, little-endian.
+static void pack_bits(unsigned char *p, size_t bit, Uint64 value) {
+    for (int k = 0; k < 5 && (value << (bit & 7)) >> (8 * k) != 0; k++) {
+        p[bit / 8 + (size_t)k] |= (unsigned char)((value << (bit & 7)) >> (8 * k));
+    }
+}
+
+static int posting_append(PostingWriter *w, const Uint32 *ids, size_t count, PostingList *out) {
+    out->first_block = (Uint32)w->block_count;
+    out->count = (Uint32)count;
+    for (size_t start = 0; start < count; start += POSTING_BLOCK) {
+        size_t n = (count - start < POSTING_BLOCK) ? count - start : POSTING_BLOCK;
+        Uint32 widest = 0;
+        for (size_t i = 1; i < n; i++) widest |= ids[start + i] - ids[start + i - 1] - 1;
+        int bits = bit_width(widest);
+        size_t packed = ((n - 1) * (size_t)bits + 7) / 8;
+        // The spare 8 bytes let the decoder always load a whole word.
+        if (!grow_buffer((void **)&w->blocks, &w->block_cap, w->block_count + 1, sizeof(PostingBlock)) ||
+            !grow_buffer((void **)&w->bytes, &w->byte_cap, w->byte_count + 1 + packed + 8, 1)) {
+            return 0;
+        }
+        PostingBlock *block = &w->blocks[w->block_count++];
+        block->first = ids[start];
+        block->offset = (Uint32)w->byte_count;
+        unsigned char *p = w->bytes + w->byte_count;
+        memset(p, 0, 1 + packed + 8);
+        p[0] = (unsigned char)bits;
+        p++;
+        for (size_t i = 1; i < n && bits > 0; i++) {
+            pack_bits(p, (i - 1) * (size_t)bits, ids[start + i] - ids[start + i - 1] - 1);
+        }
+        w->byte_count += 1 + packed;
+    }
+    return 1;
+}
+
+// Appends a shard's visits, sorted by key and game, a block at a time as laid out under
+// IndexShardHeader, then the spare word the decoder may load past the last block.
+static int visits_append(PostingWriter *w, const ShardVisit *visits, size_t count, int game_bits) {
+    for (size_t start = 0; start < count; start += POSTING_BLOCK) {
+        size_t n = (count - start < POSTING_BLOCK) ? count - start : POSTING_BLOCK;
+        const ShardVisit *v = visits + start;
+        Uint32 widest = 0;
+        for (size_t i = 1; i < n; i++) widest |= v[i].key - v[i - 1].key;
+        int key_bits = bit_width(widest);
+        size_t packed = visit_block_bytes(n, key_bits, game_bits);
+        if (!grow_buffer((void **)&w->blocks, &w->block_cap, w->block_count + 1, sizeof(PostingBlock)) ||
+            !grow_buffer((void **)&w->bytes, &w->byte_cap, w->byte_count + 1 + packed, 1)) {
+            return 0;
+        }
+        PostingBlock *block = &w->blocks[w->block_count++];
+        block->first = v[0].key;
+        block->offset = (Uint32)w->byte_count;
+        unsigned char *p = w->bytes + w->byte_count;
+        memset(p, 0, 1 + packed);
+        p[0] = (unsigned char)key_bits;
+        p++;
+        size_t bit = 0;
+        for (size_t i = 1; i < n; i++, bit += (size_t)key_bits) pack_bits(p, bit, v[i].key - v[i - 1].key);
+        for (size_t i = 0; i < n; i++, bit += (size_t)game_bits) pack_bits(p, bit, v[i].game);
+        for (size_t i = 0; i < n; i++, bit += 8) pack_bits(p, bit, v[i].ply);
+        w->byte_count += 1 + packed;
+    }
+    if (!grow_buffer((void **)&w->bytes, &w->byte_cap, w->byte_count + 8, 1)) return 0;
+    memset(w->bytes + w->byte_count, 0, 8);
+    w->byte_count += 8;
+    return 1;
+}
+
+// Decodes block `block` (counted from the list's first) into out. Every gap sits at a
+// fixed bit position, so unpacking is one unaligned load and shift per id with no
+// branches, and the running sum is left to a second pass. Returns the number of ids.
+static int posting_decode_block(const CorpusIndex *ix, const PostingList *list, Uint32 block, Uint32 *out) {
+    Uint32 start = block * POSTING_BLOCK;
+    if (start >= list->count) return 0;
+    int n = (list->count - start < POSTING_BLOCK) ? (int)(list->count - start) : POSTING_BLOCK;
+    const PostingBlock *b = &ix->posting_blocks[list->first_block + block];
+    const unsigned char *p = ix->posting_bytes + b->offset;
+    int bits = p[0];
+    p++;
+    Uint64 mask = (bits >= 32) ? 0xFFFFFFFFu : ((Uint64)1 << bits) - 1;
+    out[0] = 0;
+    for (int i = 1; i < n; i++) {
+        size_t bit = (size_t)(i - 1) * (size_t)bits;
+        Uint64 word;
+        memcpy(&word, p + bit / 8, sizeof(word));
+        out[i] = (Uint32)((SDL_SwapLE64(word) >> (bit & 7)) & mask) + 1;
+    }
+    out[0] = b->first;
+    for (int i = 1; i < n; i++) out[i] += out[i - 1];
+    return n;
+}
+
+static Uint32 posting_block_count(const PostingList *list) {
+    return (list->count + POSTING_BLOCK - 1) / POSTING_BLOCK;
+}
+
+// Walks one list in order, a decoded block at a time.
+typedef struct {
+    const CorpusIndex *index;
+    PostingList list;
+    Uint32 block;  // decoded block, or posting_block_count once past the end
+    int count;
+    int pos;
+    Uint32 ids[POSTING_BLOCK];
+} PostingCursor;
+
+static void posting_cursor_init(PostingCursor *c, const CorpusIndex *ix, const PostingList *list) {
+    c->index = ix;
+    c->list = *list;
+    c->block = 0;
+    c->count = posting_decode_block(ix, list, 0, c->ids);
+    c->pos = 0;
+}
+
+// Moves to the first id >= target, never backwards, and stores it in *out. The block
+// firsts act as skip pointers: blocks that end before the target are never decoded.
+// Returns 0 once the list has nothing that large.
+static int posting_seek(PostingCursor *c, Uint32 target, Uint32 *out) {
+    Uint32 blocks = posting_block_count(&c->list);
+    if (c->pos >= c->count || c->ids[c->count - 1] < target) {
+        const PostingBlock *first = c->index->posting_blocks + c->list.first_block;
+        Uint32 lo = c->block + 1;
+        Uint32 hi = blocks;
+        // Last block starting at or below the target; the answer is in it or the next.
+        while (lo < hi) {
+            Uint32 mid = lo + (hi - lo) / 2;
+            if (first[mid].first <= target) lo = mid + 1;
+            else hi = mid;
+        }
+        Uint32 block = (lo > c->block + 1) ? lo - 1 : c->block + 1;
+        if (block >= blocks) {
+            c->block = blocks;
+            c->count = 0;
+            c->pos = 0;
+            return 0;
+        }
+        c->block = block;
+        c->count = posting_decode_block(c->index, &c->list, block, c->ids);
+        c->pos = 0;
+        if (c->ids[c->count - 1] < target) return posting_seek(c, target, out);
+    }
+    int lo = c->pos;
+    int hi = c->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (c->ids[mid] < target) lo = mid + 1;
+        else hi = mid;
+    }
+    c->pos = lo;
+    *out = c->ids[lo];
+    return 1;
+}
+
+// Per-file Bloom filters over the names of a file's players and every position its
+// games reach, BLOOM_BITS_PER_KEY bits per distinct key. The BLOOM_HASHES probes come
+// from the two halves of one 64-bit hash. A query probes a few words per file and
+// opens only the files that may match; about 1% of the others are false alarms. The
+// filters are read once per version, apart from the rest of their shards.
+static Uint64 bloom_player_key(const char *normalized) {
+    Uint64 h = 14695981039346656037ull;
+    for (const unsigned char *c = (const unsigned char *)normalized; *c; c++) h = (h ^ *c) * 1099511628211ull;
+    // Salted apart from position_hash, which shares the filter.
+    return mix64(h ^ 0x706C61796572ull);
+}
+
+static void bloom_add(Uint32 *words, Uint32 word_count, Uint64 key) {
+    Uint64 bits = (Uint64)word_count * 32;
+    Uint32 h1 = (Uint32)key;
+    Uint32 h2 = (Uint32)(key >> 32) | 1;
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        Uint64 bit = ((Uint64)h1 + (Uint64)i * h2) % bits;
+        words[bit / 32] |= 1u << (bit % 32);
+    }
+}
+
+// Reads file `file`'s Bloom filter (*out, malloc'd) straight from its shard: just the
+// header and the filter, checked against bloom_checksum. Returns 0 if the shard is
+// missing, damaged or of another version.
+static int read_shard_bloom(const CorpusIndex *ix, Uint32 file, Uint32 **out, Uint32 *out_words) {
+    const IndexFile *rec = &ix->files[file];
+    char path[1024];
+    if (!shard_path(ix->shard_dir, rec->shard, path, sizeof(path))) return 0;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    IndexShardHeader h;
+    Uint32 *bloom = NULL;
+    int ok = fread(&h, sizeof(h), 1, fp) == 1 && h.magic == INDEX_SHARD_MAGIC && h.version == INDEX_VERSION &&
+             h.game_count == rec->game_count && h.bloom_words > 0;
+    if (ok) {
+        Sint64 offset = (Sint64)sizeof(h) + (Sint64)h.game_count * (Sint64)sizeof(IndexGame) +
+                        (Sint64)h.checkpoint_count * (Sint64)sizeof(InflateCheckpoint) +
+                        (Sint64)h.segment_count * (Sint64)sizeof(Segment);
+        bloom = (Uint32 *)malloc((size_t)h.bloom_words * sizeof(Uint32));
+        ok = bloom && file_seek(fp, offset, SEEK_SET) == 0 &&
+             fread(bloom, sizeof(Uint32), h.bloom_words, fp) == h.bloom_words &&
+             checksum64(bloom, (size_t)h.bloom_words * sizeof(Uint32),
+                        checksum64(&h, offsetof(IndexShardHeader, bloom_checksum), 0)) == h.bloom_checksum;
+    }
+    fclose(fp);
+    if (!ok) {
+        free(bloom);
+        return 0;
+    }
+    *out = bloom;
+    *out_words = h.bloom_words;
+    return 1;
+}
+
+// A file whose filter can't be read may contain anything. The filter is read without
+// the index lock, like a shard (see index_shard_pin), and never changes once set.
+int bloom_may_contain(CorpusIndex *ix, const IndexFile *file, Uint64 key) {
+    Uint32 index = (Uint32)(file - ix->files);
+    IndexShard *shard = &ix->shards[index];
+    SDL_LockMutex(ix->lock);
+    int state = shard->bloom_state;
+    SDL_UnlockMutex(ix->lock);
+    if (state == 0) {
+        Uint32 *bloom = NULL;
+        Uint32 words = 0;
+        int ok = read_shard_bloom(ix, index, &bloom, &words);
+        SDL_LockMutex(ix->lock);
+        if (shard->bloom_state == 0) {
+            shard->bloom = bloom;
+            shard->bloom_words = words;
+            shard->bloom_state = ok ? 1 : -1;
+            bloom = NULL;
+        }
+        state = shard->bloom_state;
+        SDL_UnlockMutex(ix->lock);
+        free(bloom);  // another thread's read won
+    }
+    if (state != 1) return 1;
+    Uint64 bits = (Uint64)shard->bloom_words * 32;
+    Uint32 h1 = (Uint32)key;
+    Uint32 h2 = (Uint32)(key >> 32) | 1;
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        Uint64 bit = ((Uint64)h1 + (Uint64)i * h2) % bits;
+        if (!(shard->bloom[bit / 32] & (1u << (bit % 32)))) return 0;
+    }
+    return 1;
+}
+
+static int compare_keys64(const void *a, const void *b) {
+    Uint64 ka = *(const Uint64 *)a;
+    Uint64 kb = *(const Uint64 *)b;
+    return (ka < kb) ? -1 : (ka > kb);
+}
+
+// Sizes a filter for a file's distinct keys. *out is malloc'd.
+static int build_bloom(Uint64 *keys, size_t key_count, Uint32 **out, Uint32 *out_words) {
+    if (key_count > 0) qsort(keys, key_count, sizeof(Uint64), compare_keys64);
+    size_t distinct = 0;
+    for (size_t i = 0; i < key_count; i++) {
+        if (distinct == 0 || keys[distinct - 1] != keys[i]) keys[distinct++] = keys[i];
+    }
+    size_t words = (distinct * BLOOM_BITS_PER_KEY + 31) / 32;
+    if (words < 2) words = 2;
+    Uint32 *filter = (Uint32 *)calloc(words, sizeof(Uint32));
+    if (!filter) return 0;
+    for (size_t i = 0; i < distinct; i++) bloom_add(filter, (Uint32)words, keys[i]);
+    *out = filter;
+    *out_words = (Uint32)words;
+    return 1;
+}
+
+// Lays a header and its sections end to end in one malloc'd buffer.
+static unsigned char *pack_sections(const void *header, size_t header_size, const void *const *data,
+                                    const size_t *parts, int part_count, size_t *out_size) {
+    size_t size = header_size;
+    for (int i = 0; i < part_count; i++) size += parts[i];
+    unsigned char *buf = (unsigned char *)malloc(size);
+    if (!buf) return NULL;
+    memcpy(buf, header, header_size);
+    unsigned char *p = buf + header_size;
+    for (int i = 0; i < part_count; i++) {
+        if (parts[i] > 0) memcpy(p, data[i], parts[i]);
+        p += parts[i];
+    }
+    *out_size = size;
+    return buf;
+}
+
+// Writes one shard under shard_dir, named by its checksum. A shard already there with
+// the same contents is left alone, so a rebuild writes only the shards that changed.
+// The tmp file is named for the process, so slices indexed side by side (see
+// index_slice) that write the same shard don't clobber each other's.
+static int write_shard(const char *shard_dir, const void *data, size_t size, Uint64 *out_checksum) {
+    Uint64 checksum = checksum64(data, size, 0);
+    char path[1024];
+    char tmp_path[sizeof(path) + 32];  // path, a pid of up to 20 digits and the suffix
+    *out_checksum = checksum;
+    if (!shard_path(shard_dir, checksum, path, sizeof(path))) return 0;
+    MappedFile existing;
+    if (map_file(path, &existing)) {
+        int same = existing.size == size && checksum64(existing.data, existing.size, 0) == checksum;
+        unmap_file(&existing);
+        if (same) return 1;
+    }
+#ifdef _WIN32
+    unsigned long pid = (unsigned long)GetCurrentProcessId();
+#else
+    unsigned long pid = (unsigned long)getpid();
+#endif
+    int len = snprintf(tmp_path, sizeof(tmp_path), "%s.%lu.tmp", path, pid);
+    if (len < 0 || (size_t)len >= sizeof(tmp_path)) return 0;
+    FILE *out = fopen(tmp_path, "wb");
+    int ok = out && fwrite(data, 1, size, out) == size && sync_file(out);
+    if (out && fclose(out) != 0) ok = 0;
+    if (ok && !publish_file(tmp_path, path)) ok = 0;
+    if (!ok) remove(tmp_path);
+    return ok;
+}
+
+// Parses file `name` under games_dir into the bytes of its shard (*out, malloc'd) and
+// fills in rec's size, time, source and game count. A file that can't be opened gets
+// a shard with no games. Returns 0 if out of memory.
+static int build_file_shard(const char *games_dir, const char *name, IndexFile *rec, unsigned char **out,
+                            size_t *out_size, int quiet) {
+    IndexGame *games = NULL;
+    Segment *segments = NULL;
+    ShardVisit *visits = NULL;
+    PostingWriter packed_visits;
+    memset(&packed_visits, 0, sizeof(packed_visits));
+    PlayerGame *player_games = NULL;
+    char *player_text = NULL;
+    ShardPlayer *players = NULL;
+    char *player_names = NULL;
+    Uint64 *bloom_keys = NULL;
+    Uint32 *bloom = NULL;
+    Uint32 bloom_words = 0;
+    InflateCheckpoint *checkpoints = NULL;
+    int checkpoint_count = 0;
+    size_t games_cap = 0, segments_cap = 0, visits_cap = 0;
+    size_t game_count = 0, segment_count = 0, visit_count = 0;
+    size_t player_games_cap = 0, player_text_cap = 0, player_names_cap = 0, bloom_keys_cap = 0;
+    size_t player_game_count = 0, player_text_len = 0, player_names_len = 0, bloom_key_count = 0;
+    char (*moves)[MOVE_TEXT_LEN] = malloc(MAX_MOVES * sizeof(*moves));
+    char (*boards)[BOARD_SIZE][BOARD_SIZE] = malloc((MAX_MOVES + 1) * sizeof(*boards));
+    unsigned char *flags = (unsigned char *)malloc(MAX_MOVES);
+    int ok = moves && boards && flags;
+    *out = NULL;
+
+    char *path = join_path(games_dir, name);
+    PgnStream fp;
+    ScidBase *db = NULL;
+    int opened = 0;
+    if (path && has_scid_extension(path)) {
+        db = scid_acquire(path);
+        opened = (db != NULL);
+    } else if (path) {
+        opened = pgn_open(&fp, path);
+    }
+    Game *file_games = NULL;
+    int count = 0;
+    if (!opened || !stat_file(path, &rec->size, &rec->mtime)) {
+        if (!quiet) printf("Failed to open %s\n", path ? path : name);
+        if (opened && db) scid_release(db);
+        else if (opened) pgn_close(&fp);
+        db = NULL;
+    } else if (db) {
+        // Every game number gets an entry, so ordinals stay equal to Scid game numbers;
+        // games that can't be shown are indexed with no plies.
+        rec->source = SCID_SOURCE;
+        count = (int)db->game_count;
+    } else {
+        rec->source = (Uint32)fp.method;
+        rec->data_offset = fp.member.data_offset;
+        rec->packed_size = fp.member.packed_size;
+        rec->unpacked_size = fp.member.size;
+        pgn_record_checkpoints(&fp);
+        count = load_games(&fp, &file_games);
+        checkpoints = pgn_take_checkpoints(&fp, &checkpoint_count);
+        pgn_close(&fp);
+    }
+    free(path);
+    for (int g = 0; ok && g < count; g++) {
+        char result[RESULT_LEN];
+        Game scid_game = {0};
+        const Game *source = db ? &scid_game : &file_games[g];
+        if (db && !scid_load_game(db, (Uint32)g, &scid_game)) scid_game.offset = g;
+        int move_count = source->moves ? build_move_list(source->moves, moves, MAX_MOVES, result, sizeof(result)) : 0;
+        free(scid_game.moves);
+        int ply_count = replay_game_plies(moves, move_count, boards, flags);
+        if (ply_count > 0xFFFF) ply_count = 0xFFFF;
+        if (!grow_buffer((void **)&bloom_keys, &bloom_keys_cap, bloom_key_count + (size_t)ply_count + 3,
+                         sizeof(Uint64))) {
+            ok = 0;
+            break;
+        }
+        for (int ply = 0; ply <= ply_count; ply++) {
+            bloom_keys[bloom_key_count++] = position_hash(boards[ply], ply % 2 == 0);
+        }
+        HighlightPlan plan;
+        select_highlights(flags, ply_count, &plan);
+        if (!grow_buffer((void **)&games, &games_cap, game_count + 1, sizeof(IndexGame)) ||
+            !grow_buffer((void **)&segments, &segments_cap, segment_count + (size_t)plan.count, sizeof(Segment)) ||
+            !grow_buffer((void **)&visits, &visits_cap, visit_count + NOVELTY_MAX_PLY, sizeof(ShardVisit))) {
+            ok = 0;
+            break;
+        }
+        // A position repeated within one game still counts once for it.
+        size_t game_visits = visit_count;
+        for (int ply = 1; ply <= ply_count && ply <= NOVELTY_MAX_PLY; ply++) {
+            Uint32 key = (Uint32)(position_hash(boards[ply], ply % 2 == 0) >> 32);
+            Uint32 listed = (ply >= POSITION_MIN_PLY && ply <= POSITION_MAX_PLY) ? VISIT_LISTED : 0;
+            size_t k = game_visits;
+            while (k < visit_count && visits[k].key != key) k++;
+            if (k < visit_count) {
+                visits[k].ply |= listed;
+                continue;
+            }
+            visits[visit_count].key = key;
+            visits[visit_count].game = (Uint32)game_count;
+            visits[visit_count].ply = (Uint32)ply | listed;
+            visit_count++;
+        }
+        char player[2][NAME_LEN];
+        normalize_player(source->white, player[0], sizeof(player[0]));
+        normalize_player(source->black, player[1], sizeof(player[1]));
+        for (int side = 0; side < 2; side++) {
+            if (!player[side][0] || strcmp(player[side], "?") == 0) continue;
+            if (side == 1 && strcmp(player[0], player[1]) == 0) continue;
+            size_t len = strlen(player[side]) + 1;
+            if (!grow_buffer((void **)&player_text, &player_text_cap, player_text_len + len, 1) ||
+                !grow_buffer((void **)&player_games, &player_games_cap, player_game_count + 1, sizeof(PlayerGame))) {
+                ok = 0;
+                break;
+            }
+            memcpy(player_text + player_text_len, player[side], len);
+            bloom_keys[bloom_key_count++] = bloom_player_key(player[side]);
+            player_games[player_game_count].name_offset = (Uint32)player_text_len;
+            player_games[player_game_count].game = (Uint32)game_count;
+            player_game_count++;
+            player_text_len += len;
+        }
+        if (!ok) break;
+        IndexGame *game = &games[game_count++];
+        memset(game, 0, sizeof(*game));
+        game->rating = (Uint16)((source->rating > 0 && source->rating < 0xFFFF) ? source->rating : 0);
+        game->decisive = (Uint8)loser_from_result(source->result[0] ? source->result : result, NULL);
+        for (int ply = 0; ply < ply_count && game->swings < 255; ply++) {
+            if (flags[ply] & PLY_SWING) game->swings++;
+        }
+        if (ply_count > 0) {
+            game->fingerprint = (Uint32)(position_hash(boards[ply_count], ply_count % 2 == 0) >> 32) ^
+                                ((Uint32)ply_count * 0x9E3779B1u);
+            if (game->fingerprint == 0) game->fingerprint = 1;
+        }
+        game->ply_count = (Uint16)ply_count;
+        game->segment_count = (Uint16)plan.count;
+        game->first_segment = (Uint32)segment_count;
+        game->offset = (Sint64)source->offset;
+        memcpy(segments + segment_count, plan.segments, (size_t)plan.count * sizeof(Segment));
+        segment_count += (size_t)plan.count;
+    }
+    if (db) scid_release(db);
+    else free_games(file_games, count);
+    rec->game_count = (Uint32)game_count;
+
+    if (ok) ok = build_bloom(bloom_keys, bloom_key_count, &bloom, &bloom_words);
+    if (ok && visit_count > 0) qsort(visits, visit_count, sizeof(ShardVisit), compare_visits);
+    // Players sorted by name, each name stored once.
+    for (size_t i = 0; ok && i < player_game_count; i++) player_games[i].name = player_text + player_games[i].name_offset;
+    if (ok && player_game_count > 0) qsort(player_games, player_game_count, sizeof(PlayerGame), compare_player_games);
+    players = (ShardPlayer *)malloc((player_game_count + 1) * sizeof(ShardPlayer));
+    if (!players) ok = 0;
+    for (size_t i = 0; ok && i < player_game_count; i++) {
+        if (i > 0 && strcmp(player_games[i].name, player_games[i - 1].name) == 0) {
+            players[i].name_offset = players[i - 1].name_offset;
+        } else {
+            size_t len = strlen(player_games[i].name) + 1;
+            if (!grow_buffer((void **)&player_names, &player_names_cap, player_names_len + len, 1)) {
+                ok = 0;
+                break;
+            }
+            memcpy(player_names + player_names_len, player_games[i].name, len);
+            players[i].name_offset = (Uint32)player_names_len;
+            player_names_len += len;
+        }
+        players[i].game = player_games[i].game;
+    }
+    if (ok) {
+        IndexShardHeader header = {INDEX_SHARD_MAGIC, INDEX_VERSION, (Uint32)game_count, (Uint32)segment_count,
+                                   bloom_words, (Uint32)visit_count, 0, (Uint32)player_game_count,
+                                   (Uint32)player_names_len, (Uint32)checkpoint_count, 0};
+        ok = visits_append(&packed_visits, visits, visit_count, visit_game_bits(&header));
+        header.visit_bytes = (Uint32)packed_visits.byte_count;
+        header.bloom_checksum = checksum64(bloom, (size_t)bloom_words * sizeof(Uint32),
+                                           checksum64(&header, offsetof(IndexShardHeader, bloom_checksum), 0));
+        size_t parts[8] = {game_count * sizeof(IndexGame), (size_t)checkpoint_count * sizeof(InflateCheckpoint),
+                           segment_count * sizeof(Segment), (size_t)bloom_words * sizeof(Uint32),
+                           player_game_count * sizeof(ShardPlayer), packed_visits.block_count * sizeof(PostingBlock),
+                           player_names_len, packed_visits.byte_count};
+        const void *data[8] = {games, checkpoints, segments, bloom, players, packed_visits.blocks, player_names,
+                               packed_visits.bytes};
+        if (ok) *out = pack_sections(&header, sizeof(header), data, parts, 8, out_size);
+        ok = (*out != NULL);
+    }
+
+    free(moves);
+    free(boards);
+    free(flags);
+    free(games);
+    free(segments);
+    free(visits);
+    free(packed_visits.blocks);
+    free(packed_visits.bytes);
+    free(player_games);
+    free(player_text);
+    free(players);
+    free(player_names);
+    free(bloom_keys);
+    free(bloom);
+    free(checkpoints);
+    return ok;
+}
+
+static int write_postings_shard(const char *shard_dir, const Uint16 *novelty, size_t game_count,
+                                const IndexPositionList *positions, size_t position_count, const IndexPlayer *players,
+                                size_t player_count, const PostingWriter *writer, const char *names, size_t name_bytes,
+                                Uint64 *out_checksum) {
+    IndexPostingsHeader header = {INDEX_SHARD_MAGIC, INDEX_VERSION, (Uint32)game_count, (Uint32)position_count,
+                                  (Uint32)player_count, (Uint32)writer->block_count, (Uint32)name_bytes,
+                                  (Uint32)writer->byte_count};
+    size_t parts[6] = {position_count * sizeof(IndexPositionList), player_count * sizeof(IndexPlayer),
+                       writer->block_count * sizeof(PostingBlock), game_count * sizeof(Uint16), name_bytes,
+                       writer->byte_count};
+    const void *data[6] = {positions, players, writer->blocks, novelty, names, writer->bytes};
+    size_t size = 0;
+    unsigned char *buf = pack_sections(&header, sizeof(header), data, parts, 6, &size);
+    int ok = buf && write_shard(shard_dir, buf, size, out_checksum);
+    free(buf);
+    return ok;
+}
+
+static void remove_if_stale(const char *shard_dir, const char *name, const Uint64 *keep, size_t keep_count) {
+    size_t len = strlen(name);
+    int stale = (len > 4 && strcmp(name + len - 4, ".tmp") == 0 && strstr(name, ".shard.") != NULL);
+    if (len == 22 && strcmp(name + 16, ".shard") == 0 && strspn(name, "0123456789abcdef") == 16) {
+        Uint64 checksum = (Uint64)strtoull(name, NULL, 16);
+        stale = !bsearch(&checksum, keep, keep_count, sizeof(Uint64), compare_keys64);
+    }
+    if (!stale) return;
+    char *path = join_path(shard_dir, name);
+    if (path) remove(path);
+    free(path);
+}
+
+// Removes the shards under shard_dir that the manifest no longer names, and tmp files
+// left by a crashed build. A viewer that mapped one keeps its pages; on Windows the
+// removal fails while it is mapped and is retried by the next build.
+static void remove_stale_shards(const char *shard_dir, const IndexFile *files, int file_count, Uint64 postings) {
+    Uint64 *keep = (Uint64 *)malloc(((size_t)file_count + 1) * sizeof(Uint64));
+    if (!keep) return;
+    for (int i = 0; i < file_count; i++) keep[i] = files[i].shard;
+    keep[file_count] = postings;
+    qsort(keep, (size_t)file_count + 1, sizeof(Uint64), compare_keys64);
+#ifdef _WIN32
+    char *search = join_path(shard_dir, "*");
+    WIN32_FIND_DATAA data;
+    HANDLE h = search ? FindFirstFileA(search, &data) : INVALID_HANDLE_VALUE;
+    free(search);
+    if (h != INVALID_HANDLE_VALUE) {
+        do {
+            remove_if_stale(shard_dir, data.cFileName, keep, (size_t)file_count + 1);
+        } while (FindNextFileA(h, &data));
+        FindClose(h);
+    }
+#else
+    DIR *d = opendir(shard_dir);
+    if (d) {
+        struct dirent *ent;
+        while ((ent = readdir(d)) != NULL) remove_if_stale(shard_dir, ent->d_name, keep, (size_t)file_count + 1);
+        closedir(d);
+    }
+#endif
+    free(keep);
+}
+
+// Copies file `name`'s record from the previous version if the file has the same size
+// and time as then and its shard is intact, and maps the shard into *map. Returns 0 if
+// the file has to be parsed again.
+static int reuse_file_shard(const CorpusIndex *old, const char *games_dir, const char *name, IndexFile *rec,
+                            MappedFile *map, ShardView *view) {
+    const IndexFile *prev = old ? index_file_named(old, name) : NULL;
+    if (!prev) return 0;
+    char *path = join_path(games_dir, name);
+    Sint64 size = 0;
+    Sint64 mtime = 0;
+    int same = path && stat_file(path, &size, &mtime) && size == prev->size && mtime == prev->mtime;
+    free(path);
+    if (!same || !map_shard(old->shard_dir, prev->shard, sizeof(IndexShardHeader), map)) return 0;
+    if (!shard_view(map->data, map->size, view) || view->header->game_count != prev->game_count) {
+        unmap_file(map);
+        return 0;
+    }
+    *rec = *prev;
+    return 1;
+}
+
+// Brings the shards of `files` (sorted, relative to games_dir) up to date: files
+// unchanged since the index on disk keep their shards, the rest are parsed and their
+// shards written. Fills in each file's record and appends its name to *names;
+// first_game is left to merge_index. *parsed counts the files parsed. Gives up
+// between files once `stop`, if given, is set.
+static int index_file_shards(const char *games_dir, char **files, int file_count, IndexFile *recs, char **names,
+                             size_t *names_len, int *parsed, SDL_atomic_t *stop) {
+    CorpusIndex *old = index_open(games_dir);
+    char *shard_dir = join_path(games_dir, INDEX_SHARD_DIR);
+    size_t names_cap = 0;
+    int ok = (shard_dir != NULL);
+    if (ok) {
+#ifdef _WIN32
+        CreateDirectoryA(shard_dir, NULL);
+#else
+        mkdir(shard_dir, 0755);
+#endif
+    }
+    for (int i = 0; ok && i < file_count; i++) {
+        if (stop && SDL_AtomicGet(stop)) {
+            ok = 0;
+            break;
+        }
+        IndexFile *rec = &recs[i];
+        size_t name_len = strlen(files[i]) + 1;
+        if (!grow_buffer((void **)names, &names_cap, *names_len + name_len, 1)) {
+            ok = 0;
+            break;
+        }
+        memcpy(*names + *names_len, files[i], name_len);
+        MappedFile map;
+        ShardView view;
+        if (reuse_file_shard(old, games_dir, files[i], rec, &map, &view)) {
+            unmap_file(&map);
+        } else {
+            unsigned char *shard = NULL;
+            size_t shard_size = 0;
+            memset(rec, 0, sizeof(*rec));
+            ok = build_file_shard(games_dir, files[i], rec, &shard, &shard_size, stop != NULL) &&
+                 write_shard(shard_dir, shard, shard_size, &rec->shard);
+            free(shard);
+            (*parsed)++;
+        }
+        rec->name_offset = (Uint32)*names_len;
+        *names_len += name_len;
+    }
+    index_release(old);
+    free(shard_dir);
+    return ok;
+}
+
+// One block of a shard's visits, unpacked.
+typedef struct {
+    Uint32 index;  // the block held, or 0xFFFFFFFF for none yet
+    int damaged;   // a game number past the shard's games turned up
+    Uint32 keys[POSTING_BLOCK];
+    Uint32 games[POSTING_BLOCK];
+    Uint32 plies[POSTING_BLOCK];
+} VisitBlock;
+
+// Up to 32 bits from p at bit offset `bit`; the caller leaves a spare word after them.
+static Uint32 unpack_bits(const unsigned char *p, size_t bit, int bits) {
+    if (bits == 0) return 0;
+    Uint64 word;
+    memcpy(&word, p + bit / 8, sizeof(word));
+    return (Uint32)((SDL_SwapLE64(word) >> (bit & 7)) & (((Uint64)1 << bits) - 1));
+}
+
+static void visit_decode_block(const ShardView *view, Uint32 block, VisitBlock *out) {
+    const IndexShardHeader *h = view->header;
+    Uint32 n = h->visit_count - block * POSTING_BLOCK;
+    if (n > POSTING_BLOCK) n = POSTING_BLOCK;
+    const PostingBlock *b = &view->visit_blocks[block];
+    const unsigned char *p = view->visit_bytes + b->offset;
+    int key_bits = p[0];
+    int game_bits = visit_game_bits(h);
+    p++;
+    size_t bit = 0;
+    out->keys[0] = b->first;
+    for (Uint32 i = 1; i < n; i++, bit += (size_t)key_bits) out->keys[i] = out->keys[i - 1] + unpack_bits(p, bit, key_bits);
+    for (Uint32 i = 0; i < n; i++, bit += (size_t)game_bits) {
+        out->games[i] = unpack_bits(p, bit, game_bits);
+        if (out->games[i] >= h->game_count) {
+            out->games[i] = 0;
+            out->damaged = 1;
+        }
+    }
+    for (Uint32 i = 0; i < n; i++, bit += 8) out->plies[i] = unpack_bits(p, bit, 8);
+    out->index = block;
+}
+
+// One input of a k-way merge: a file's shard, read from entry `next` of one of its
+// sorted sections. Its games are numbered from first_game in the merged corpus.
+// `visits` holds the block of its visits the merge is in.
+typedef struct {
+    const ShardView *view;
+    VisitBlock *visits;
+    Uint32 first_game;
+    Uint32 next;
+    Uint32 count;
+} MergeInput;
+
+typedef int (*MergeLess)(const MergeInput *a, const MergeInput *b);
+
+// A binary min-heap over the inputs that still have entries, by their next entry.
+typedef struct {
+    MergeInput *inputs;
+    int *heap;
+    int size;
+    MergeLess less;
+} MergeHeap;
+
+static void merge_sift(MergeHeap *h, int i) {
+    for (;;) {
+        int least = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < h->size && h->less(&h->inputs[h->heap[left]], &h->inputs[h->heap[least]])) least = left;
+        if (right < h->size && h->less(&h->inputs[h->heap[right]], &h->inputs[h->heap[least]])) least = right;
+        if (least == i) return;
+        int swap = h->heap[i];
+        h->heap[i] = h->heap[least];
+        h->heap[least] = swap;
+        i = least;
+    }
+}
+
+// Starts a merge over inputs whose next and count are set; heap needs a slot per input.
+static void merge_start(MergeHeap *h, MergeInput *inputs, int *heap, int count, MergeLess less) {
+    h->inputs = inputs;
+    h->heap = heap;
+    h->less = less;
+    h->size = 0;
+    for (int i = 0; i < count; i++) {
+        if (inputs[i].next < inputs[i].count) heap[h->size++] = i;
+    }
+    for (int i = h->size / 2 - 1; i >= 0; i--) merge_sift(h, i);
+}
+
+// The input holding the smallest entry left, or NULL once all are used up.
+static MergeInput *merge_top(const MergeHeap *h) {
+    return (h->size > 0) ? &h->inputs[h->heap[0]] : NULL;
+}
+
+static void merge_pop(MergeHeap *h) {
+    MergeInput *top = &h->inputs[h->heap[0]];
+    if (++top->next >= top->count) h->heap[0] = h->heap[--h->size];
+    if (h->size > 0) merge_sift(h, 0);
+}
+
+// Where an input's next visit sits in its unpacked block, unpacking the block first if
+// the merge has just reached it.
+static int merge_visit(const MergeInput *in) {
+    Uint32 block = in->next / POSTING_BLOCK;
+    if (in->visits->index != block) visit_decode_block(in->view, block, in->visits);
+    return (int)(in->next % POSTING_BLOCK);
+}
+
+// Entries order by key, then by game in the merged corpus, as one sort of them all would.
+static int merge_visit_less(const MergeInput *a, const MergeInput *b) {
+    int ia = merge_visit(a);
+    int ib = merge_visit(b);
+    Uint32 ka = a->visits->keys[ia];
+    Uint32 kb = b->visits->keys[ib];
+    if (ka != kb) return ka < kb;
+    return a->first_game + a->visits->games[ia] < b->first_game + b->visits->games[ib];
+}
+
+static int merge_player_less(const MergeInput *a, const MergeInput *b) {
+    const ShardPlayer *pa = &a->view->players[a->next];
+    const ShardPlayer *pb = &b->view->players[b->next];
+    int cmp = strcmp(a->view->player_names + pa->name_offset, b->view->player_names + pb->name_offset);
+    if (cmp != 0) return cmp < 0;
+    return a->first_game + pa->game < b->first_game + pb->game;
+}
+
+// Writes a file table, the index manifest or a slice's (see index_slice), through a
+// synced tmp file and a rename.
+static int write_file_table(const char *path, Uint32 magic, const IndexFile *files, int file_count,
+                            const char *names, size_t names_len, size_t game_count, Uint64 postings) {
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *out = fopen(tmp_path, "wb");
+    if (!out) return 0;
+    IndexHeader header = {magic, INDEX_VERSION, (Uint32)file_count, (Uint32)game_count, (Uint32)names_len,
+                          0, postings, 0, 0};
+    header.checksum = checksum64(names, names_len, checksum64(files, (size_t)file_count * sizeof(IndexFile), 0));
+    header.header_checksum = checksum64(&header, offsetof(IndexHeader, header_checksum), 0);
+    int ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+             fwrite(files, sizeof(IndexFile), (size_t)file_count, out) == (size_t)file_count &&
+             fwrite(names, 1, names_len, out) == names_len && sync_file(out);
+    if (fclose(out) != 0) ok = 0;
+    if (ok && !publish_file(tmp_path, path)) ok = 0;
+    if (!ok) remove(tmp_path);
+    return ok;
+}
+
+// Builds the postings from the shards of `files` (sorted by name, their shards already
+// under games_dir) and publishes the manifest naming them. Every shard's sections are
+// sorted, so one k-way merge per section streams the whole corpus's keys out in order:
+// beyond the mapped shards, memory is a heap slot and an unpacked visit block per file
+// and the longest posting list. Numbers the files' games in order. Returns the game count, or -1;
+// `quiet` leaves saying why to the caller.
+static long merge_index(const char *games_dir, IndexFile *files, int file_count, const char *names,
+                        size_t names_len, int quiet) {
+    char *index_path = join_path(games_dir, INDEX_FILE_NAME);
+    char *shard_dir = join_path(games_dir, INDEX_SHARD_DIR);
+    MappedFile *maps = (MappedFile *)calloc((size_t)file_count + 1, sizeof(MappedFile));
+    ShardView *views = (ShardView *)calloc((size_t)file_count + 1, sizeof(ShardView));
+    MergeInput *inputs = (MergeInput *)calloc((size_t)file_count + 1, sizeof(MergeInput));
+    VisitBlock *visit_blocks = (VisitBlock *)calloc((size_t)file_count + 1, sizeof(VisitBlock));
+    int *heap_slots = (int *)calloc((size_t)file_count + 1, sizeof(int));
+    Uint16 *novelty = NULL;
+    Uint32 *postings = NULL;
+    Uint32 *copies = NULL;  // game, ply pairs
+    IndexPlayer *players = NULL;
+    IndexPositionList *position_lists = NULL;
+    char *player_names = NULL;
+    PostingWriter writer;
+    memset(&writer, 0, sizeof(writer));
+    size_t postings_cap = 0, copies_cap = 0, players_cap = 0, position_lists_cap = 0, player_names_cap = 0;
+    size_t player_count = 0, position_list_count = 0, player_names_len = 0, game_count = 0;
+    int ok = index_path && shard_dir && maps && views && inputs && visit_blocks && heap_slots;
+
+    for (int i = 0; ok && i < file_count; i++) {
+        files[i].first_game = (Uint32)game_count;
+        if (!map_shard(shard_dir, files[i].shard, sizeof(IndexShardHeader), &maps[i]) ||
+            !shard_view(maps[i].data, maps[i].size, &views[i]) || views[i].header->game_count != files[i].game_count) {
+            if (!quiet) printf("Shard for %s is missing or damaged\n", names + files[i].name_offset);
+            ok = 0;
+            break;
+        }
+        inputs[i].view = &views[i];
+        inputs[i].first_game = (Uint32)game_count;
+        game_count += files[i].game_count;
+    }
+
+    // One pass over every file's visits in key order. Copies of one game (the same
+    // fingerprint, see IndexGame) count as a single game. A position more than one game
+    // passes through between POSITION_MIN_PLY and POSITION_MAX_PLY gets a posting
+    // list; one only a single game visits at all is a novelty candidate for every copy
+    // of it, the earliest winning.
+    novelty = (Uint16 *)malloc((game_count + 1) * sizeof(Uint16));
+    if (!novelty) ok = 0;
+    if (ok) memset(novelty, 0xFF, game_count * sizeof(Uint16));
+    for (int i = 0; ok && i < file_count; i++) {
+        visit_blocks[i].index = 0xFFFFFFFFu;
+        inputs[i].visits = &visit_blocks[i];
+        inputs[i].next = 0;
+        inputs[i].count = views[i].header->visit_count;
+    }
+    MergeHeap heap;
+    if (ok) merge_start(&heap, inputs, heap_slots, file_count, merge_visit_less);
+    size_t group = 0;
+    size_t visitors = 0;
+    Uint32 key = 0;
+    Uint32 first_print = 0, listed_print = 0;
+    int one_game = 0, one_listed = 0;
+    while (ok) {
+        MergeInput *top = merge_top(&heap);
+        int at = top ? merge_visit(top) : 0;
+        if (visitors > 0 && (!top || top->visits->keys[at] != key)) {
+            if (group > 1 && !one_listed) {
+                if (!grow_buffer((void **)&position_lists, &position_lists_cap, position_list_count + 1,
+                                 sizeof(IndexPositionList))) {
+                    ok = 0;
+                    break;
+                }
+                IndexPositionList *rec = &position_lists[position_list_count++];
+                rec->key = key;
+                if (!posting_append(&writer, postings, group, &rec->games)) ok = 0;
+            }
+            for (size_t i = 0; one_game && i < visitors; i++) {
+                if (copies[2 * i + 1] < novelty[copies[2 * i]]) novelty[copies[2 * i]] = (Uint16)copies[2 * i + 1];
+            }
+            group = 0;
+            visitors = 0;
+        }
+        if (!top || !ok) break;
+        key = top->visits->keys[at];
+        Uint32 game = top->first_game + top->visits->games[at];
+        Uint32 ply = (top->visits->plies[at] & ~VISIT_LISTED) - 1;  // the move that reached it
+        Uint32 print = top->view->games[top->visits->games[at]].fingerprint;
+        if (visitors == 0) {
+            first_print = print;
+            one_game = 1;
+        }
+        one_game = one_game && print == first_print;
+        if (one_game) {
+            if (!grow_buffer((void **)&copies, &copies_cap, 2 * (visitors + 1), sizeof(Uint32))) {
+                ok = 0;
+                break;
+            }
+            copies[2 * visitors] = game;
+            copies[2 * visitors + 1] = ply;
+        }
+        visitors++;
+        if (top->visits->plies[at] & VISIT_LISTED) {
+            if (!grow_buffer((void **)&postings, &postings_cap, group + 1, sizeof(Uint32))) {
+                ok = 0;
+                break;
+            }
+            if (group == 0) {
+                listed_print = print;
+                one_listed = 1;
+            }
+            one_listed = one_listed && print == listed_print;
+            postings[group++] = game;
+        }
+        merge_pop(&heap);
+    }
+    for (int i = 0; ok && i < file_count; i++) {
+        if (visit_blocks[i].damaged) {
+            if (!quiet) printf("Shard for %s is damaged\n", names + files[i].name_offset);
+            ok = 0;
+        }
+    }
+
+    // One posting list per player, each name stored once.
+    for (int i = 0; ok && i < file_count; i++) {
+        inputs[i].next = 0;
+        inputs[i].count = views[i].header->player_count;
+    }
+    if (ok) merge_start(&heap, inputs, heap_slots, file_count, merge_player_less);
+    const char *player = NULL;
+    group = 0;
+    while (ok) {
+        MergeInput *top = merge_top(&heap);
+        const ShardPlayer *p = top ? &top->view->players[top->next] : NULL;
+        const char *name = p ? top->view->player_names + p->name_offset : NULL;
+        if (group > 0 && (!p || strcmp(name, player) != 0)) {
+            size_t len = strlen(player) + 1;
+            if (!grow_buffer((void **)&players, &players_cap, player_count + 1, sizeof(IndexPlayer)) ||
+                !grow_buffer((void **)&player_names, &player_names_cap, player_names_len + len, 1)) {
+                ok = 0;
+                break;
+            }
+            IndexPlayer *rec = &players[player_count++];
+            rec->name_offset = (Uint32)player_names_len;
+            memcpy(player_names + player_names_len, player, len);
+            player_names_len += len;
+            if (!posting_append(&writer, postings, group, &rec->games)) ok = 0;
+            group = 0;
+        }
+        if (!p || !ok) break;
+        if (!grow_buffer((void **)&postings, &postings_cap, group + 1, sizeof(Uint32))) {
+            ok = 0;
+            break;
+        }
+        player = name;
+        postings[group++] = top->first_game + p->game;
+        merge_pop(&heap);
+    }
+    // Room for the decoder's whole-word load past the last block.
+    if (ok && grow_buffer((void **)&writer.bytes, &writer.byte_cap, writer.byte_count + 8, 1)) {
+        memset(writer.bytes + writer.byte_count, 0, 8);
+        writer.byte_count += 8;
+    } else {
+        ok = 0;
+    }
+
+    // Shards first, then the manifest naming them: until the manifest's rename a reader
+    // sees only the old index, whose shards are all still there.
+    Uint64 postings_shard = 0;
+    if (ok) {
+        ok = write_postings_shard(shard_dir, novelty, game_count, position_lists, position_list_count, players,
+                                  player_count, &writer, player_names, player_names_len, &postings_shard) &&
+             write_file_table(index_path, INDEX_MAGIC, files, file_count, names, names_len, game_count,
+                              postings_shard);
+    }
+    if (ok) remove_stale_shards(shard_dir, files, file_count, postings_shard);
+
+    for (int i = 0; maps && i < file_count; i++) unmap_file(&maps[i]);
+    free(index_path);
+    free(shard_dir);
+    free(maps);
+    free(views);
+    free(inputs);
+    free(visit_blocks);
+    free(heap_slots);
+    free(novelty);
+    free(postings);
+    free(copies);
+    free(players);
+    free(position_lists);
+    free(player_names);
+    free(writer.blocks);
+    free(writer.bytes);
+    return ok ? (long)game_count : -1;
+}
+
+// Messages from the index watcher. While viewers run, stdout may be the --terminal
+// screen, which only rewrites the cells that changed, so the watcher posts a short
+// notice instead and every viewer shows the latest one on its status line.
+typedef struct {
+    SDL_SpinLock lock;
+    SDL_atomic_t serial;
+    char text[STATUS_TEXT_LEN];
+} IndexNotice;
+
+IndexNotice index_notice = {0};
+
+static void index_notify(const char *text) {
+    SDL_AtomicLock(&index_notice.lock);
+    snprintf(index_notice.text, sizeof(index_notice.text), "%s", text);
+    SDL_AtomicUnlock(&index_notice.lock);
+    SDL_AtomicIncRef(&index_notice.serial);
+}
+
+// Logic side: shows a notice posted since the viewer last looked.
+void index_notice_update(Viewer *v) {
+    int serial = SDL_AtomicGet(&index_notice.serial);
+    if (serial == v->index_notice_serial) return;
+    v->index_notice_serial = serial;
+    char text[STATUS_TEXT_LEN];
+    SDL_AtomicLock(&index_notice.lock);
+    memcpy(text, index_notice.text, sizeof(text));
+    SDL_AtomicUnlock(&index_notice.lock);
+    show_status(v, text);
+}
+
+// Builds the index with the writer lock held. A build given `stop` is the watcher's:
+// it reports through index_notify, and returns 0 without a word if `stop` is set
+// before it gets to its merge.
+static int build_index_locked(const char *games_dir, SDL_atomic_t *stop) {
+    char **files = NULL;
+    int file_count = list_pgn_files(games_dir, &files);
+    if (file_count <= 0) {
+        if (stop) {
+            index_notify("INDEX UPDATE: NO PGN FILES");
+        } else {
+            printf("No PGN files found in %s\n", games_dir);
+        }
+        return 0;
+    }
+    qsort(files, (size_t)file_count, sizeof(files[0]), compare_names);
+    IndexFile *recs = (IndexFile *)calloc((size_t)file_count, sizeof(IndexFile));
+    char *names = NULL;
+    size_t names_len = 0;
+    int parsed = 0;
+    int ok = recs && index_file_shards(games_dir, files, file_count, recs, &names, &names_len, &parsed, stop);
+    int stopped = stop && SDL_AtomicGet(stop);
+    long game_count = -1;
+    if (ok && !stopped) game_count = merge_index(games_dir, recs, file_count, names, names_len, stop != NULL);
+    if (stop) {
+        // The watcher announces the new version once it switches to it.
+        if (game_count < 0 && !stopped) index_notify("INDEX UPDATE FAILED");
+    } else if (game_count >= 0) {
+        printf("Indexed %ld games from %d files (%d parsed, %d unchanged) into %s%c%s\n", game_count, file_count,
+               parsed, file_count - parsed, games_dir, PATH_SEP, INDEX_FILE_NAME);
+    } else {
+        printf("Failed to write index for %s\n", games_dir);
+    }
+    free(recs);
+    free(names);
+    free_string_list(files, file_count);
+    return game_count >= 0;
+}
+
+// Only one process writes the index at a time; a second one gives up rather than
+// racing it, saying so if `report` is set.
+static int index_writer_lock(const char *games_dir, WriterLock *lock, int report) {
+    char *lock_target = join_path(games_dir, INDEX_FILE_NAME);
+    int locked = lock_target && writer_lock_acquire(lock_target, lock);
+    free(lock_target);
+    if (!locked && report) printf("Another process is building the index for %s\n", games_dir);
+    return locked;
+}
+
+// Indexes the PGNs under games_dir and writes the index next to them. Files unchanged
+// since the previous index keep their shards unread, so a rebuild after a few files
+// were added or replaced parses only those. The index is replaced by rename, so a
+// viewer mapping the old one is never disturbed.
+int build_index(const char *games_dir) {
+    WriterLock lock;
+    if (!index_writer_lock(games_dir, &lock, 1)) return 0;
+    int built = build_index_locked(games_dir, NULL);
+    writer_lock_release(&lock);
+    return built;
+}
+
+// --index-slice LIST: indexes just the files LIST names, one path per line relative to
+// games_dir as --build-index lists them. Their shards go under INDEX_SHARD_DIR and the
+// slice's file table to LIST.slice, for --merge-index. Slices share nothing while they
+// run, so several processes, or machines each with a copy of games/, can take one each.
+int index_slice(const char *games_dir, const char *list_path) {
+    FILE *fp = fopen(list_path, "r");
+    if (!fp) {
+        printf("Failed to open %s\n", list_path);
+        return 0;
+    }
+    char **files = NULL;
+    int file_count = 0;
+    int files_cap = 0;
+    char line[2048];
+    int ok = 1;
+    while (ok && fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] && !push_string(&files, &file_count, &files_cap, line)) ok = 0;
+    }
+    fclose(fp);
+    if (file_count > 0) qsort(files, (size_t)file_count, sizeof(files[0]), compare_names);
+    int distinct = 0;
+    for (int i = 0; i < file_count; i++) {
+        if (distinct > 0 && strcmp(files[distinct - 1], files[i]) == 0) {
+            free(files[i]);
+            continue;
+        }
+        files[distinct++] = files[i];
+    }
+    file_count = distinct;
+
+    IndexFile *recs = (IndexFile *)calloc((size_t)file_count + 1, sizeof(IndexFile));
+    char *names = NULL;
+    size_t names_len = 0;
+    int parsed = 0;
+    ok = ok && recs && index_file_shards(games_dir, files, file_count, recs, &names, &names_len, &parsed, NULL);
+    size_t game_count = 0;
+    for (int i = 0; ok && i < file_count; i++) {
+        recs[i].first_game = (Uint32)game_count;
+        game_count += recs[i].game_count;
+    }
+    char out_path[1024];
+    snprintf(out_path, sizeof(out_path), "%s.slice", list_path);
+    ok = ok && write_file_table(out_path, INDEX_SLICE_MAGIC, recs, file_count, names ? names : "", names_len,
+                                game_count, 0);
+    if (ok) {
+        printf("Indexed %d games from %d files (%d parsed, %d unchanged) into %s\n", (int)game_count, file_count,
+               parsed, file_count - parsed, out_path);
+    } else {
+        printf("Failed to index slice %s\n", list_path);
+    }
+    free(recs);
+    free(names);
+    free_string_list(files, file_count);
+    return ok;
+}
+
+// --merge-index SLICE...: builds the index from slices written by --index-slice, whose
+// shards must all be under games_dir's INDEX_SHARD_DIR. Each slice's file table is
+// sorted, so they are joined in name order by a k-way merge; the postings are then
+// merged from the shards as for --build-index.
+int merge_slices(const char *games_dir, char **slice_paths, int slice_count) {
+    MappedFile *maps = (MappedFile *)calloc((size_t)slice_count + 1, sizeof(MappedFile));
+    Uint32 *next = (Uint32 *)calloc((size_t)slice_count + 1, sizeof(Uint32));
+    int ok = maps && next;
+    size_t total = 0;
+    for (int k = 0; ok && k < slice_count; k++) {
+        if (!map_file(slice_paths[k], &maps[k]) || !file_table_valid(&maps[k], INDEX_SLICE_MAGIC)) {
+            printf("%s is not a slice written by --index-slice\n", slice_paths[k]);
+            ok = 0;
+            break;
+        }
+        total += ((const IndexHeader *)maps[k].data)->file_count;
+    }
+    IndexFile *recs = (IndexFile *)calloc(total + 1, sizeof(IndexFile));
+    char *names = NULL;
+    size_t names_len = 0, names_cap = 0;
+    int file_count = 0;
+    if (!recs) ok = 0;
+    while (ok) {
+        int best = -1;
+        const IndexFile *best_file = NULL;
+        const char *best_name = NULL;
+        for (int k = 0; k < slice_count; k++) {
+            const IndexHeader *header = (const IndexHeader *)maps[k].data;
+            if (next[k] >= header->file_count) continue;
+            const IndexFile *file = (const IndexFile *)(header + 1) + next[k];
+            const char *name = (const char *)((const IndexFile *)(header + 1) + header->file_count) + file->name_offset;
+            if (best < 0 || strcmp(name, best_name) < 0) {
+                best = k;
+                best_file = file;
+                best_name = name;
+            }
+        }
+        if (best < 0) break;
+        if (file_count > 0 && strcmp(best_name, names + recs[file_count - 1].name_offset) == 0) {
+            printf("%s is in more than one slice\n", best_name);
+            ok = 0;
+            break;
+        }
+        size_t len = strlen(best_name) + 1;
+        if (!grow_buffer((void **)&names, &names_cap, names_len + len, 1)) {
+            ok = 0;
+            break;
+        }
+        memcpy(names + names_len, best_name, len);
+        recs[file_count] = *best_file;
+        recs[file_count].name_offset = (Uint32)names_len;
+        names_len += len;
+        file_count++;
+        next[best]++;
+    }
+    if (ok && file_count == 0) {
+        printf("No files in the slices\n");
+        ok = 0;
+    }
+    WriterLock lock;
+    if (ok && index_writer_lock(games_dir, &lock, 1)) {
+        long game_count = merge_index(games_dir, recs, file_count, names, names_len, 0);
+        writer_lock_release(&lock);
+        if (game_count >= 0) {
+            printf("Merged %d slices: %ld games from %d files into %s%c%s\n", slice_count, game_count, file_count,
+                   games_dir, PATH_SEP, INDEX_FILE_NAME);
+        } else {
+            printf("Failed to write index for %s\n", games_dir);
+        }
+        ok = (game_count >= 0);
+    } else {
+        ok = 0;
+    }
+    for (int k = 0; maps && k < slice_count; k++) unmap_file(&maps[k]);
+    free(maps);
+    free(next);
+    free(recs);
+    free(names);
+    return ok;
+}
+
+void index_free(void) {
+    index_publish(NULL);
+}
+
+// Publishes the index under games_dir if there is one.
+int index_load(const char *games_dir) {
+    CorpusIndex *ix = index_open(games_dir);
+    if (!ix) return 0;
+    index_publish(ix);
+    return 1;
+}
+
+// Finds the index id of one game of a PGN file. Returns 0 if the file is not indexed
+// or changed since.
+int index_find_game(const CorpusIndex *ix, const char *path, int game_ordinal, Uint32 *out_id) {
+    if (!ix || game_ordinal < 0) return 0;
+    char rel[1024];
+    if (!relpath_from_base(games_dir_root, path, rel, sizeof(rel))) return 0;
+    const IndexFile *file = index_file_named(ix, rel);
+    Sint64 size = 0;
+    Sint64 mtime = 0;
+    if (!file || !stat_file(path, &size, &mtime) || size != file->size || mtime != file->mtime) return 0;
+    if ((Uint32)game_ordinal >= file->game_count) return 0;
+    *out_id = file->first_game + (Uint32)game_ordinal;
+    return 1;
+}
+
+int index_highlights(const char *path, int game_ordinal, HighlightPlan *plan) {
+    CorpusIndex *ix = index_acquire();
+    Uint32 id = 0;
+    IndexGame game;
+    int found = index_find_game(ix, path, game_ordinal, &id) && index_game(ix, id, &game, plan);
+    index_release(ix);
+    return found;
+}
+
+// A random indexed file under games_dir, or NULL without an index.
+char *index_random_path(const char *games_dir, unsigned int *rng) {
+    CorpusIndex *ix = index_acquire();
+    char *path = NULL;
+    if (ix && ix->header->file_count > 0) {
+        Uint32 file = (((Uint32)rand_next(rng) << 15) ^ (Uint32)rand_next(rng)) % ix->header->file_count;
+        path = join_path(games_dir, ix->names + ix->files[file].name_offset);
+    }
+    index_release(ix);
+    return path;
+}
+
+// Ply of the game's first move out of known theory, or -1 if unknown or there is none.
+int index_novelty(const char *path, int game_ordinal) {
+    CorpusIndex *ix = index_acquire();
+    Uint32 id = 0;
+    int ply = -1;
+    if (index_find_game(ix, path, game_ordinal, &id) && index_postings(ix) && ix->novelty[id] != NO_NOVELTY) {
+        ply = ix->novelty[id];
+    }
+    index_release(ix);
+    return ply;
+}
+
+// The two --vs players; each index version gets its own matchup (see head_to_head).
+const char *matchup_players[2] = {NULL, NULL};
+
+// Players whose normalized name is `key` or starts with it followed by a space or a
+// comma, so "karpov" finds "karpov, anatoly" and "karpov a" but not "karpova".
+static void find_players(const CorpusIndex *ix, const char *key, Uint32 *first, Uint32 *last) {
+    size_t key_len = strlen(key);
+    Uint32 lo = 0;
+    Uint32 hi = ix->postings->player_count;
+    while (lo < hi) {
+        Uint32 mid = lo + (hi - lo) / 2;
+        if (strcmp(ix->player_names + ix->players[mid].name_offset, key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    *first = lo;
+    while (lo < ix->postings->player_count &&
+           strncmp(ix->player_names + ix->players[lo].name_offset, key, key_len) == 0) {
+        lo++;
+    }
+    *last = lo;
+}
+
+static int player_name_matches(const char *name, const char *key, size_t key_len) {
+    if (strncmp(name, key, key_len) != 0) return 0;
+    return name[key_len] == '\0' || name[key_len] == ' ' || name[key_len] == ',';
+}
+
+static int player_matches(const CorpusIndex *ix, Uint32 player, size_t key_len) {
+    char next = ix->player_names[ix->players[player].name_offset + key_len];
+    return next == '\0' || next == ' ' || next == ',';
+}
+
+// Players matching `name` (see find_players), as a list of player numbers in *out.
+// Returns how many, with the sum of their game counts in *games.
+static int matching_players(const CorpusIndex *ix, const char *name, Uint32 **out, size_t *games) {
+    char key[NAME_LEN];
+    normalize_player(name, key, sizeof(key));
+    size_t key_len = strlen(key);
+    Uint32 first = 0;
+    Uint32 last = 0;
+    if (key_len > 0) find_players(ix, key, &first, &last);
+    *out = (Uint32 *)malloc((last - first + 1) * sizeof(Uint32));
+    *games = 0;
+    int count = 0;
+    for (Uint32 p = first; *out && p < last; p++) {
+        if (!player_matches(ix, p, key_len)) continue;
+        (*out)[count++] = p;
+        *games += ix->players[p].games.count;
+    }
+    return count;
+}
+
+// Every game of the given players, ascending and without repeats. NULL if out of memory.
+static Uint32 *decode_player_games(const CorpusIndex *ix, const Uint32 *players, int player_count, size_t *count) {
+    Uint32 *result = (Uint32 *)malloc(sizeof(Uint32));
+    Uint32 block[POSTING_BLOCK];
+    *count = 0;
+    for (int k = 0; result && k < player_count; k++) {
+        const PostingList *list = &ix->players[players[k]].games;
+        Uint32 *merged = (Uint32 *)malloc((*count + list->count + 1) * sizeof(Uint32));
+        if (!merged) {
+            free(result);
+            return NULL;
+        }
+        size_t i = 0, n = 0;
+        Uint32 blocks = posting_block_count(list);
+        for (Uint32 b = 0; b < blocks; b++) {
+            int got = posting_decode_block(ix, list, b, block);
+            for (int j = 0; j < got; j++) {
+                while (i < *count && result[i] < block[j]) merged[n++] = result[i++];
+                if (i < *count && result[i] == block[j]) i++;
+                merged[n++] = block[j];
+            }
+        }
+        while (i < *count) merged[n++] = result[i++];
+        free(result);
+        result = merged;
+        *count = n;
+    }
+    return result;
+}
+
+typedef struct {
+    Uint32 fingerprint;
+    Uint32 game;
+} FingerprintedGame;
+
+static int compare_fingerprinted_games(const void *a, const void *b) {
+    const FingerprintedGame *ga = (const FingerprintedGame *)a;
+    const FingerprintedGame *gb = (const FingerprintedGame *)b;
+    if (ga->fingerprint != gb->fingerprint) return (ga->fingerprint < gb->fingerprint) ? -1 : 1;
+    return (ga->game < gb->game) ? -1 : (ga->game > gb->game);
+}
+
+static int compare_game_ids(const void *a, const void *b) {
+    Uint32 ga = *(const Uint32 *)a;
+    Uint32 gb = *(const Uint32 *)b;
+    return (ga < gb) ? -1 : (ga > gb);
+}
+
+// Fills ix's matchup_games with the games `a` and `b` played against each other. The side
+// with fewer games is decoded whole; each of its games is then sought in the other
+// side's lists, whose skip pointers pass over blocks without decoding them. A game
+// saved in several files (each player's own collection, an opening file) is kept
+// once. Returns the number of games, or -1.
+int head_to_head(CorpusIndex *ix, const char *a, const char *b) {
+    if (!index_postings(ix)) return -1;
+    free(ix->matchup_games);
+    ix->matchup_games = NULL;
+    ix->matchup_count = 0;
+    Uint32 *players_a = NULL;
+    Uint32 *players_b = NULL;
+    size_t games_a = 0;
+    size_t games_b = 0;
+    int count_a = matching_players(ix, a, &players_a, &games_a);
+    int count_b = matching_players(ix, b, &players_b, &games_b);
+    if (games_a > games_b) {
+        Uint32 *players = players_a;
+        players_a = players_b;
+        players_b = players;
+        int count = count_a;
+        count_a = count_b;
+        count_b = count;
+    }
+    size_t short_count = 0;
+    Uint32 *short_list = (players_a && players_b) ? decode_player_games(ix, players_a, count_a, &short_count) : NULL;
+    PostingCursor *cursors = (PostingCursor *)malloc(((size_t)count_b + 1) * sizeof(PostingCursor));
+    Uint32 *found = (Uint32 *)malloc((short_count + 1) * sizeof(Uint32));
+    int ok = short_list && cursors && found;
+    size_t n = 0;
+    for (int k = 0; ok && k < count_b; k++) posting_cursor_init(&cursors[k], ix, &ix->players[players_b[k]].games);
+    for (size_t i = 0; ok && i < short_count; i++) {
+        for (int k = 0; k < count_b; k++) {
+            Uint32 id;
+            if (posting_seek(&cursors[k], short_list[i], &id) && id == short_list[i]) {
+                found[n++] = id;
+                break;
+            }
+        }
+    }
+    free(players_a);
+    free(players_b);
+    free(short_list);
+    free(cursors);
+    if (!ok) {
+        free(found);
+        return -1;
+    }
+
+    // Games whose shard can't be read are dropped; they couldn't be loaded to play.
+    if (n > 0) {
+        FingerprintedGame *keyed = (FingerprintedGame *)malloc(n * sizeof(FingerprintedGame));
+        if (!keyed) {
+            free(found);
             return -1;
         }
-        int is_dir = 0;
-#ifdef DT_DIR
-        if (ent->d_type == DT_DIR) is_dir = 1;
-        if (ent->d_type == DT_UNKNOWN)
-#endif
-        {
-            DIR *probe = opendir(full);
-            if (probe) {
-                is_dir = 1;
-                closedir(probe);
+        size_t readable = 0;
+        for (size_t i = 0; i < n; i++) {
+            IndexGame game;
+            if (!index_game(ix, found[i], &game, NULL)) continue;
+            keyed[readable].game = found[i];
+            keyed[readable].fingerprint = game.fingerprint;
+            readable++;
+        }
+        qsort(keyed, readable, sizeof(FingerprintedGame), compare_fingerprinted_games);
+        size_t kept = 0;
+        for (size_t i = 0; i < readable; i++) {
+            if (i > 0 && keyed[i].fingerprint != 0 && keyed[i - 1].fingerprint == keyed[i].fingerprint) continue;
+            found[kept++] = keyed[i].game;
+        }
+        free(keyed);
+        n = kept;
+        qsort(found, n, sizeof(Uint32), compare_game_ids);
+    }
+    ix->matchup_games = found;
+    ix->matchup_count = (int)n;
+    return ix->matchup_count;
+}
+
+// Weights of the interestingness score, as set by --interest-weights: how much a
+// decisive result, length, swings of material and the players' rating each add.
+typedef struct {
+    float decisive;
+    float length;
+    float volatility;
+    float rating;
+} InterestWeights;
+
+InterestWeights interest_weights = {1.0f, 1.0f, 2.0f, 1.0f};
+int interest_mode = 0;
+
+// Each feature is scaled to [0, 1]. Unrated games count as middling rather than weak,
+// so old collections aren't buried under rated modern ones.
+static float interest_score(const IndexGame *game, const InterestWeights *w) {
+    if (game->ply_count == 0) return 0.0f;
+    float length = (game->ply_count >= INTEREST_FULL_PLIES) ? 1.0f : (float)game->ply_count / INTEREST_FULL_PLIES;
+    float volatility = (game->swings >= INTEREST_FULL_SWINGS) ? 1.0f : (float)game->swings / INTEREST_FULL_SWINGS;
+    float rating = 0.5f;
+    if (game->rating > 0) {
+        rating = (float)((int)game->rating - INTEREST_RATING_LOW) / (INTEREST_RATING_HIGH - INTEREST_RATING_LOW);
+        if (rating < 0.0f) rating = 0.0f;
+        if (rating > 1.0f) rating = 1.0f;
+    }
+    return INTEREST_FLOOR + w->decisive * (float)game->decisive + w->length * length + w->volatility * volatility +
+           w->rating * rating;
+}
+
+// Fills ix's interest table by Vose's construction: columns below the mean are topped
+// up from ones above it, so every column holds at most two games. Returns 0 if there
+// is nothing to pick.
+int interest_build(CorpusIndex *ix, const InterestWeights *w) {
+    if (!ix || ix->header->game_count == 0) return 0;
+    Uint32 n = ix->header->game_count;
+    float *prob = (float *)malloc(n * sizeof(float));
+    Uint32 *alias = (Uint32 *)malloc(n * sizeof(Uint32));
+    Uint32 *work = (Uint32 *)malloc(n * sizeof(Uint32));
+    if (!prob || !alias || !work) {
+        free(prob);
+        free(alias);
+        free(work);
+        return 0;
+    }
+    double total = 0.0;
+    for (Uint32 i = 0; i < n; i++) {
+        // A game whose shard can't be read can't be loaded by id either.
+        IndexGame game;
+        prob[i] = index_game(ix, i, &game, NULL) ? interest_score(&game, w) : 0.0f;
+        if (prob[i] < 0.0f) prob[i] = 0.0f;
+        total += prob[i];
+    }
+    if (total <= 0.0) {
+        free(prob);
+        free(alias);
+        free(work);
+        return 0;
+    }
+    // Small columns fill the work list from the front, large ones from the back.
+    Uint32 small = 0;
+    Uint32 large = n;
+    for (Uint32 i = 0; i < n; i++) {
+        prob[i] = (float)(prob[i] * (double)n / total);
+        alias[i] = i;
+        if (prob[i] < 1.0f) work[small++] = i;
+        else work[--large] = i;
+    }
+    Uint32 next_small = 0;
+    while (next_small < small && large < n) {
+        Uint32 s = work[next_small++];
+        Uint32 l = work[large];
+        alias[s] = l;
+        prob[l] -= 1.0f - prob[s];
+        if (prob[l] < 1.0f) {
+            // l is small now; it takes the slot just freed at the front.
+            large++;
+            work[--next_small] = l;
+        }
+    }
+    // Whatever is left is 1 up to rounding.
+    for (Uint32 i = 0; i < n; i++) {
+        if (alias[i] == i) prob[i] = 1.0f;
+    }
+    free(work);
+    free(ix->interest.prob);
+    free(ix->interest.alias);
+    ix->interest.prob = prob;
+    ix->interest.alias = alias;
+    ix->interest.count = n;
+    return 1;
+}
+
+// An indexed game id, drawn in proportion to its score.
+Uint32 interest_pick(const InterestTable *table, unsigned int *rng) {
+    Uint32 column = (((Uint32)rand_next(rng) << 15) ^ (Uint32)rand_next(rng)) % table->count;
+    float u = (float)rand_next(rng) / 32768.0f;
+    return (u < table->prob[column]) ? column : table->alias[column];
+}
+
+// Readies a freshly opened version for this session before it is published: what the
+// viewers pick games from by id is rebuilt against its ids. Returns 0 if the version
+// can't serve the session, e.g. the --vs players' games are gone from it.
+static int index_prepare(CorpusIndex *ix) {
+    if (interest_mode && !interest_build(ix, &interest_weights)) return 0;
+    if (matchup_players[0] && head_to_head(ix, matchup_players[0], matchup_players[1]) <= 0) return 0;
+    return 1;
+}
+
+// Watches games/ while the viewers run. When an ingest adds, replaces or removes files
+// the index is rebuilt in the background, which parses only the changed files, and
+// the new version is published. Of the viewers watching one games/, only the one
+// holding the writer lock rebuilds; the rest publish its manifest once it appears.
+// Playback goes on from the old version, which is freed once its last reader lets
+// go; the next selection sees the new one.
+typedef struct {
+    SDL_Thread *thread;
+    SDL_atomic_t stop;
+    const char *games_dir;
+    Uint64 attempted;  // listing last built for, so a failing build isn't retried every pass
+    Uint64 rejected;   // manifest last found unfit by index_prepare
+} IndexWatcher;
+
+IndexWatcher index_watcher = {0};
+
+// XXH64 of a file listing: each path relative to games_dir with its size and time.
+static Uint64 listing_add(Uint64 signature, const char *name, Sint64 size, Sint64 mtime) {
+    Sint64 stamp[2] = {size, mtime};
+    return checksum64(stamp, sizeof(stamp), checksum64(name, strlen(name) + 1, signature));
+}
+
+// The listing signature of games_dir as it is now. Returns 0 if it can't be listed.
+static int games_signature(const char *games_dir, Uint64 *out) {
+    char **files = NULL;
+    int file_count = list_pgn_files(games_dir, &files);
+    if (file_count < 0) return 0;
+    qsort(files, (size_t)file_count, sizeof(files[0]), compare_names);
+    Uint64 signature = 0;
+    for (int i = 0; i < file_count; i++) {
+        char *path = join_path(games_dir, files[i]);
+        Sint64 size = 0;
+        Sint64 mtime = 0;
+        if (path) stat_file(path, &size, &mtime);
+        signature = listing_add(signature, files[i], size, mtime);
+        free(path);
+    }
+    free_string_list(files, file_count);
+    *out = signature;
+    return 1;
+}
+
+// The listing signature of the files version ix was built from.
+static Uint64 index_signature(const CorpusIndex *ix) {
+    Uint64 signature = 0;
+    for (Uint32 i = 0; i < ix->header->file_count; i++) {
+        const IndexFile *file = &ix->files[i];
+        signature = listing_add(signature, ix->names + file->name_offset, file->size, file->mtime);
+    }
+    return signature;
+}
+
+// header_checksum of the manifest on disk, or 0 if there is none to read.
+static Uint64 manifest_checksum(const char *games_dir) {
+    char *path = join_path(games_dir, INDEX_FILE_NAME);
+    FILE *fp = path ? fopen(path, "rb") : NULL;
+    IndexHeader header;
+    int read = fp && fread(&header, sizeof(header), 1, fp) == 1;
+    if (fp) fclose(fp);
+    free(path);
+    return read ? header.header_checksum : 0;
+}
+
+// Publishes the manifest on disk if it isn't the one in use, whichever process wrote it.
+static void index_adopt(IndexWatcher *w) {
+    CorpusIndex *ix = index_acquire();
+    Uint64 on_disk = manifest_checksum(w->games_dir);
+    if (ix && on_disk != 0 && on_disk != ix->header->header_checksum && on_disk != w->rejected) {
+        CorpusIndex *next = index_open(w->games_dir);
+        if (next && index_prepare(next)) {
+            char text[STATUS_TEXT_LEN];
+            snprintf(text, sizeof(text), "INDEX UPDATED: %u GAMES", next->header->game_count);
+            index_notify(text);
+            index_publish(next);
+        } else {
+            w->rejected = on_disk;
+            if (next) index_notify("KEEPING THE CURRENT INDEX");
+            index_release(next);
+        }
+    }
+    index_release(ix);
+}
+
+// One pass of the watcher: picks up a manifest another process wrote, then rebuilds if
+// games/ still doesn't match the index in use. A viewer that can't take the writer
+// lock leaves the rebuild to the one that holds it, and one that takes it rebuilds
+// only if the manifest on disk is behind games/ too, so each change is built once.
+static void index_refresh(IndexWatcher *w) {
+    index_adopt(w);
+    CorpusIndex *ix = index_acquire();
+    Uint64 games = 0;
+    WriterLock lock;
+    if (ix && games_signature(w->games_dir, &games) && games != index_signature(ix) && games != w->attempted &&
+        index_writer_lock(w->games_dir, &lock, 0)) {
+        w->attempted = games;
+        CorpusIndex *on_disk = index_open(w->games_dir);
+        if (!on_disk || index_signature(on_disk) != games) build_index_locked(w->games_dir, &w->stop);
+        index_release(on_disk);
+        writer_lock_release(&lock);
+        index_adopt(w);
+    }
+    index_release(ix);
+}
+
+static int index_watch_main(void *data) {
+    IndexWatcher *w = (IndexWatcher *)data;
+    while (!SDL_AtomicGet(&w->stop)) {
+        for (int waited = 0; waited < INDEX_WATCH_MS && !SDL_AtomicGet(&w->stop); waited += 100) SDL_Delay(100);
+        if (!SDL_AtomicGet(&w->stop)) index_refresh(w);
+    }
+    return 0;
+}
+
+// Starts watching games_dir; only worth it when there is an index to keep current.
+void index_watch_start(const char *games_dir) {
+    if (!corpus_index) return;
+    index_watcher.games_dir = games_dir;
+    SDL_AtomicSet(&index_watcher.stop, 0);
+    index_watcher.thread = SDL_CreateThread(index_watch_main, "index-watch", &index_watcher);
+}
+
+// Stops the watcher. A rebuild in progress gives up at the next file, before its merge,
+// so no manifest is left half written; the next build keeps or removes the shards it
+// wrote.
+void index_watch_stop(void) {
+    if (!index_watcher.thread) return;
+    SDL_AtomicSet(&index_watcher.stop, 1);
+    SDL_WaitThread(index_watcher.thread, NULL);
+    index_watcher.thread = NULL;
+}
+
+// Where highlight playback continues from ply `index`: unchanged inside a segment,
+// the next segment's start in a gap, or -1 once every segment has played.
+int highlight_target(const HighlightPlan *plan, int index) {
+    for (int i = 0; i < plan->count; i++) {
+        if (index < plan->segments[i].end) {
+            return (index < plan->segments[i].start) ? plan->segments[i].start : index;
+        }
+    }
+    return -1;
+}
+
+// Mined puzzles: positions from the corpus where the side to move has exactly one
+// clearly winning move. Written by --mine-puzzles as a header and records sorted by
+// game; only valid for the index it was mined from.
+typedef struct {
+    Uint32 magic;
+    Uint32 version;
+    Uint64 index_checksum;  // header_checksum of the index the puzzles refer to
+    Uint32 count;
+    Uint32 reserved;
+} PuzzleHeader;
+
+typedef struct {
+    Uint32 game;     // index game number
+    Uint16 ply;      // ply whose move is the puzzle
+    Uint16 move;     // solution: from | to << 6 | promotion << 12, squares as row * 8 + file
+    Sint16 score;    // centipawns after the solution, for the side to move
+    Uint16 reserved;
+} PuzzleRecord;
+
+// The puzzles refer to games by id, so they keep the index version they were mined
+// from for the whole session.
+typedef struct {
+    MappedFile map;
+    const PuzzleRecord *records;
+    Uint32 count;
+    CorpusIndex *index;
+} PuzzleSet;
+
+PuzzleSet puzzles = {0};
+int puzzle_mode = 0;
+
+static Uint16 pack_move(const Move *m) {
+    static const char promos[] = "\0QRBN";
+    int promo = 0;
+    for (int i = 1; i < 5; i++) {
+        if (m->promo == promos[i]) promo = i;
+    }
+    return (Uint16)((m->from_r * 8 + m->from_f) | ((m->to_r * 8 + m->to_f) << 6) | (promo << 12));
+}
+
+static void unpack_move(Uint16 packed, Move *m) {
+    static const char promos[] = "\0QRBN";
+    int promo = (packed >> 12) & 7;
+    m->from_r = (packed & 63) / 8;
+    m->from_f = (packed & 63) % 8;
+    m->to_r = ((packed >> 6) & 63) / 8;
+    m->to_f = ((packed >> 6) & 63) % 8;
+    m->promo = (promo < 5) ? promos[promo] : '\0';
+}
+
+// Loads game `game_id` of index version ix by its recorded offset, without reading the
+// rest of its file. *out_path gets the game's full path; the caller frees it. A file
+// changed since that version was built is not read, so a stale id fails cleanly.
+int index_load_game(CorpusIndex *ix, Uint32 game_id, char **out_path, Game *out) {
+    if (!ix || game_id >= ix->header->game_count) return 0;
+    const IndexFile *file = &ix->files[index_game_file(ix, game_id)];
+    char *path = join_path(games_dir_root, ix->names + file->name_offset);
+    ArchiveMember member = {NULL, (int)file->source, -1, file->data_offset, file->packed_size, file->unpacked_size};
+    Sint64 size = 0;
+    Sint64 mtime = 0;
+    IndexGame rec;
+    InflateCheckpoint *resume = NULL;
+    int loaded = path && stat_file(path, &size, &mtime) && size == file->size && mtime == file->mtime &&
+                 index_game(ix, game_id, &rec, NULL);
+    if (loaded && file->source == ARCHIVE_DEFLATED) {
+        resume = (InflateCheckpoint *)malloc(sizeof(InflateCheckpoint));
+        if (resume && !index_checkpoint(ix, game_id, rec.offset, resume)) {
+            free(resume);
+            resume = NULL;
+        }
+    }
+    loaded = loaded && load_game_at(path, (file->source != PGN_SOURCE_FILE) ? &member : NULL, resume, rec.offset, out);
+    free(resume);
+    if (!loaded) {
+        free(path);
+        return 0;
+    }
+    if (out_path) *out_path = path;
+    else free(path);
+    return 1;
+}
+
+// Whether some move other than `best` scores at least `limit`. Null-window searches,
+// so a clearly worse move is dismissed after a few nodes.
+static int has_alternative(const Position *pos, int depth, const Move *best, int limit, Uint64 *nodes) {
+    Move moves[MAX_LEGAL_MOVES];
+    int count = generate_moves(pos, moves, 0);
+    for (int i = 0; i < count; i++) {
+        if (same_move(&moves[i], best)) continue;
+        Position next;
+        play_move(pos, &moves[i], &next);
+        if (-negamax(&next, depth - 1, -limit, -limit + 1, 1, NULL, nodes) >= limit) return 1;
+    }
+    return 0;
+}
+
+// A puzzle is a position that isn't already won by an obvious capture, where one move
+// wins at least PUZZLE_WIN_CP and every other move stays under PUZZLE_ALT_CP.
+static int find_puzzle(const Position *pos, Move *solution, int *score) {
+    Uint64 nodes = 0;
+    if (quiesce(pos, -SEARCH_INFINITE, SEARCH_INFINITE, 0, &nodes) >= PUZZLE_ALT_CP) return 0;
+    // A shallow look first; most positions are quiet and stop here.
+    if (!search_position(pos, 2, score, solution) || *score < PUZZLE_WIN_CP / 2) return 0;
+    if (!search_position(pos, PUZZLE_DEPTH, score, solution) || *score < PUZZLE_WIN_CP) return 0;
+    return !has_alternative(pos, PUZZLE_DEPTH, solution, PUZZLE_ALT_CP, &nodes);
+}
+
+typedef struct {
+    Uint32 magic;
+    Uint32 version;
+    Uint64 index_checksum;
+    Uint32 depth;
+    Uint32 reserved;
+} PuzzleCheckpointHeader;
+
+// One chunk of the checkpoint, followed by `count` records: the puzzles found since
+// the file's previous chunk, in its games up to `games`. offset is where game `games`
+// starts (its number in a Scid base), so a resumed run reads on from there.
+typedef struct {
+    Uint32 file;
+    Uint32 count;
+    Uint32 games;
+    Uint32 finished;
+    Sint64 offset;
+} PuzzleChunk;
+
+// How far into a file mining has got: the games done and where the next one starts.
+typedef struct {
+    Uint32 games;
+    Sint64 offset;
+} PuzzleProgress;
+
+// Shared by the mining workers. Every PUZZLE_CHECKPOINT_GAMES games, and at the end
+// of each file, a chunk is appended to the checkpoint, so an interrupted run picks up
+// at the game where it stopped, even in the middle of a large file.
+typedef struct {
+    CorpusIndex *index;
+    const char *games_dir;
+    SDL_atomic_t next_file;
+    SDL_mutex *lock;
+    FILE *checkpoint;
+    unsigned char *done;
+    PuzzleProgress *progress;
+    PuzzleRecord *records;
+    size_t count;
+    size_t cap;
+    int files_done;
+    int ok;
+} PuzzleMiner;
+
+// Every game of one indexed file, read in one pass as the indexer read them, for the
+// batch tools that walk the whole corpus.
+typedef struct {
+    Game *games;
+    ScidBase *db;
+    int first;  // file ordinal of games[0]
+    int count;
+} IndexedFileGames;
+
+// Games are matched to the index by ordinal, so a file changed since it was indexed
+// is skipped: out->count is then 0. Reading starts at game `first`, which begins at
+// `offset`; a deflated member is entered from the index's nearest checkpoint.
+static void open_indexed_file(CorpusIndex *ix, const char *games_dir, const IndexFile *file, int first, Sint64 offset,
+                              IndexedFileGames *out) {
+    memset(out, 0, sizeof(*out));
+    out->first = first;
+    char *path = join_path(games_dir, ix->names + file->name_offset);
+    int count = -1;
+    Sint64 size = 0;
+    Sint64 mtime = 0;
+    if (path && stat_file(path, &size, &mtime) && size == file->size && mtime == file->mtime) {
+        if (has_scid_extension(path)) {
+            out->db = scid_acquire(path);
+            if (out->db) count = (int)out->db->game_count - first;
+        } else {
+            PgnStream fp;
+            InflateCheckpoint *resume = NULL;
+            if (first > 0 && file->source == ARCHIVE_DEFLATED) {
+                resume = (InflateCheckpoint *)malloc(sizeof(InflateCheckpoint));
+                if (resume && !index_checkpoint(ix, file->first_game + (Uint32)first, offset, resume)) {
+                    free(resume);
+                    resume = NULL;
+                }
+            }
+            if (pgn_open(&fp, path)) {
+                fp.resume = resume;
+                if (first == 0 || pgn_seek(&fp, offset)) count = load_games(&fp, &out->games);
+                pgn_close(&fp);
             }
+            free(resume);
         }
-        if (is_dir) {
-            if (list_pgn_files_recursive(full, base, out_files, count, cap) < 0) {
-                free(full);
-                closedir(d);
-                return -1;
+    }
+    if (count != (int)file->game_count - first) {
+        printf("Skipping %s, changed since it was indexed\n", path ? path : "?");
+        if (!out->db) free_games(out->games, count);
+        out->games = NULL;
+        count = 0;
+    }
+    out->count = count;
+    free(path);
+}
+
+// Game g, or NULL. Scid games are decoded into *scratch, whose moves the caller frees
+// once done with the game.
+static const Game *indexed_file_game(IndexedFileGames *f, int g, Game *scratch) {
+    if (f->games) return &f->games[g];
+    if (f->db && scid_load_game(f->db, (Uint32)(f->first + g), scratch)) return scratch;
+    return NULL;
+}
+
+static void close_indexed_file(IndexedFileGames *f) {
+    if (f->db) scid_release(f->db);
+    else free_games(f->games, f->count);
+    memset(f, 0, sizeof(*f));
+}
+
+// Adds the puzzles of one stretch of a file to the results and appends them to the
+// checkpoint as a chunk. Returns 0 when out of memory.
+static int puzzle_commit(PuzzleMiner *miner, Uint32 file_index, const PuzzleRecord *found, size_t found_count,
+                         Uint32 games, Sint64 offset, int finished) {
+    SDL_LockMutex(miner->lock);
+    int ok = miner->ok && (found_count == 0 || grow_buffer((void **)&miner->records, &miner->cap,
+                                                           miner->count + found_count, sizeof(PuzzleRecord)));
+    if (ok) {
+        if (found_count > 0) memcpy(miner->records + miner->count, found, found_count * sizeof(PuzzleRecord));
+        miner->count += found_count;
+        PuzzleChunk chunk = {file_index, (Uint32)found_count, games, (Uint32)finished, offset};
+        if (miner->checkpoint) {
+            fwrite(&chunk, sizeof(chunk), 1, miner->checkpoint);
+            if (found_count > 0) fwrite(found, sizeof(PuzzleRecord), found_count, miner->checkpoint);
+            fflush(miner->checkpoint);
+        }
+        if (finished) {
+            miner->files_done++;
+            printf("Mined %d/%u files, %u puzzles\n", miner->files_done, miner->index->header->file_count,
+                   (unsigned)miner->count);
+        }
+    } else {
+        miner->ok = 0;
+    }
+    SDL_UnlockMutex(miner->lock);
+    return ok;
+}
+
+static int mine_file(PuzzleMiner *miner, Uint32 file_index) {
+    const IndexFile *file = &miner->index->files[file_index];
+    const PuzzleProgress *progress = &miner->progress[file_index];
+    char (*moves)[MOVE_TEXT_LEN] = malloc(MAX_MOVES * sizeof(*moves));
+    char (*boards)[BOARD_SIZE][BOARD_SIZE] = malloc((MAX_MOVES + 1) * sizeof(*boards));
+    unsigned char *flags = (unsigned char *)malloc(MAX_MOVES);
+    PuzzleRecord *found = NULL;
+    size_t found_count = 0, found_cap = 0;
+    size_t committed = 0;
+    int ok = moves && boards && flags;
+    IndexedFileGames source;
+    open_indexed_file(miner->index, miner->games_dir, file, (int)progress->games, progress->offset, &source);
+    for (int g = 0; ok && g < source.count; g++) {
+        Uint32 game_id = file->first_game + (Uint32)(source.first + g);
+        Game scid_game = {0};
+        const Game *game = indexed_file_game(&source, g, &scid_game);
+        const char *text = game ? game->moves : NULL;
+        char result[RESULT_LEN];
+        int move_count = text ? build_move_list(text, moves, MAX_MOVES, result, sizeof(result)) : 0;
+        free(scid_game.moves);
+        int ply_count = replay_game_plies(moves, move_count, boards, flags);
+        int per_game = 0;
+        for (int ply = PUZZLE_MIN_PLY; ply < ply_count && per_game < PUZZLES_PER_GAME; ply++) {
+            Position pos;
+            memcpy(pos.b, boards[ply], sizeof(pos.b));
+            pos.white = (ply % 2 == 0);
+            pos.ep_file = passant_file(boards[ply - 1], boards[ply], pos.white);
+            pos.castle = castle_rights(boards, ply);
+            Move solution;
+            int score = 0;
+            if (!find_puzzle(&pos, &solution, &score)) continue;
+            if (!grow_buffer((void **)&found, &found_cap, found_count + 1, sizeof(PuzzleRecord))) {
+                ok = 0;
+                break;
             }
-        } else if (has_pgn_extension(ent->d_name)) {
-            char relbuf[1024];
-            if (!relpath_from_base(base, full, relbuf, sizeof(relbuf))) {
-                free(full);
-                closedir(d);
-                return -1;
+            PuzzleRecord rec = {game_id, (Uint16)ply, pack_move(&solution), (Sint16)((score > 0x7FFF) ? 0x7FFF : score), 0};
+            found[found_count++] = rec;
+            per_game++;
+            ply++;  // the reply to a puzzle is rarely a puzzle of its own
+        }
+        if (ok && (g + 1) % PUZZLE_CHECKPOINT_GAMES == 0 && g + 1 < source.count) {
+            int next = source.first + g + 1;
+            Sint64 offset = source.games ? source.games[g + 1].offset : (Sint64)next;
+            ok = puzzle_commit(miner, file_index, found + committed, found_count - committed, (Uint32)next, offset, 0);
+            committed = found_count;
+        }
+    }
+    if (ok) {
+        ok = puzzle_commit(miner, file_index, found + committed, found_count - committed,
+                           (Uint32)(source.first + source.count), 0, 1);
+    } else {
+        SDL_LockMutex(miner->lock);
+        miner->ok = 0;
+        SDL_UnlockMutex(miner->lock);
+    }
+    close_indexed_file(&source);
+    free(moves);
+    free(boards);
+    free(flags);
+    free(found);
+    return ok;
+}
+
+static int puzzle_worker_main(void *data) {
+    PuzzleMiner *miner = (PuzzleMiner *)data;
+    for (;;) {
+        Uint32 file_index = (Uint32)SDL_AtomicAdd(&miner->next_file, 1);
+        if (file_index >= miner->index->header->file_count || !miner->ok) break;
+        if (miner->done[file_index]) continue;
+        if (!mine_file(miner, file_index)) break;
+    }
+    return 0;
+}
+
+static int compare_puzzles(const void *a, const void *b) {
+    const PuzzleRecord *pa = (const PuzzleRecord *)a;
+    const PuzzleRecord *pb = (const PuzzleRecord *)b;
+    if (pa->game != pb->game) return (pa->game < pb->game) ? -1 : 1;
+    return (int)pa->ply - (int)pb->ply;
+}
+
+// Reads the chunks a previous run got through. A torn final chunk is dropped, and the
+// file is rewritten with one chunk per file started before mining goes on appending.
+static void resume_puzzle_checkpoint(PuzzleMiner *miner, const char *path, const PuzzleCheckpointHeader *expect) {
+    FILE *fp = fopen(path, "rb");
+    PuzzleCheckpointHeader header;
+    int started = 0;
+    if (fp && fread(&header, sizeof(header), 1, fp) == 1 && memcmp(&header, expect, sizeof(header)) == 0) {
+        PuzzleChunk chunk;
+        while (fread(&chunk, sizeof(chunk), 1, fp) == 1 && chunk.file < miner->index->header->file_count) {
+            if (!grow_buffer((void **)&miner->records, &miner->cap, miner->count + chunk.count, sizeof(PuzzleRecord)) ||
+                fread(miner->records + miner->count, sizeof(PuzzleRecord), chunk.count, fp) != chunk.count) {
+                break;
             }
-            if (!push_string(out_files, count, cap, relbuf)) {
-                free(full);
-                closedir(d);
-                return -1;
+            miner->count += chunk.count;
+            miner->progress[chunk.file].games = chunk.games;
+            miner->progress[chunk.file].offset = chunk.offset;
+            if (chunk.finished && !miner->done[chunk.file]) miner->files_done++;
+            if (chunk.finished) miner->done[chunk.file] = 1;
+        }
+    }
+    if (fp) fclose(fp);
+    for (Uint32 f = 0; f < miner->index->header->file_count; f++) {
+        started += (!miner->done[f] && miner->progress[f].games > 0);
+    }
+    if (miner->files_done > 0 || started > 0) {
+        printf("Resuming puzzle mining: %d files already done, %d part done\n", miner->files_done, started);
+    }
+
+    miner->checkpoint = fopen(path, "wb");
+    if (!miner->checkpoint) return;
+    fwrite(expect, sizeof(*expect), 1, miner->checkpoint);
+    // Workers appended chunks of different files in turn; sorted, each file's records
+    // are one run, as game ids of a file are contiguous.
+    qsort(miner->records, miner->count, sizeof(PuzzleRecord), compare_puzzles);
+    size_t next = 0;
+    for (Uint32 f = 0; f < miner->index->header->file_count; f++) {
+        const IndexFile *file = &miner->index->files[f];
+        size_t first = next;
+        while (next < miner->count && miner->records[next].game - file->first_game < file->game_count) next++;
+        if (!miner->done[f] && miner->progress[f].games == 0) continue;
+        PuzzleChunk chunk = {f, (Uint32)(next - first), miner->progress[f].games, miner->done[f],
+                             miner->progress[f].offset};
+        fwrite(&chunk, sizeof(chunk), 1, miner->checkpoint);
+        if (chunk.count > 0) fwrite(miner->records + first, sizeof(PuzzleRecord), chunk.count, miner->checkpoint);
+    }
+    fflush(miner->checkpoint);
+}
+
+// --mine-puzzles: searches every position of every indexed game on all cores and
+// writes PUZZLE_FILE_NAME. Needs the index, which maps puzzles back to their games.
+int mine_puzzles(const char *games_dir) {
+    CorpusIndex *ix = index_acquire();
+    if (!ix) {
+        printf("Build the index first with --build-index\n");
+        return 0;
+    }
+    PuzzleMiner miner;
+    memset(&miner, 0, sizeof(miner));
+    miner.index = ix;
+    miner.games_dir = games_dir;
+    miner.ok = 1;
+    miner.lock = SDL_CreateMutex();
+    miner.done = (unsigned char *)calloc(ix->header->file_count + 1, 1);
+    miner.progress = (PuzzleProgress *)calloc(ix->header->file_count + 1, sizeof(PuzzleProgress));
+    char *path = join_path(games_dir, PUZZLE_FILE_NAME);
+    if (!miner.lock || !miner.done || !miner.progress || !path) {
+        if (miner.lock) SDL_DestroyMutex(miner.lock);
+        free(miner.done);
+        free(miner.progress);
+        free(path);
+        index_release(ix);
+        return 0;
+    }
+    // Searches from earlier runs and from viewers with --eval are reused.
+    eval_cache_open(games_dir);
+
+    char part_path[1024];
+    snprintf(part_path, sizeof(part_path), "%s.part", path);
+    PuzzleCheckpointHeader expect = {PUZZLE_MAGIC, PUZZLE_CHECKPOINT_VERSION, ix->header->header_checksum, PUZZLE_DEPTH,
+                                     0};
+    resume_puzzle_checkpoint(&miner, part_path, &expect);
+
+    int worker_count = SDL_GetCPUCount();
+    if (worker_count < 1) worker_count = 1;
+    if (worker_count > PUZZLE_MAX_WORKERS) worker_count = PUZZLE_MAX_WORKERS;
+    SDL_Thread *workers[PUZZLE_MAX_WORKERS];
+    int started = 0;
+    for (int i = 0; i < worker_count; i++) {
+        workers[i] = SDL_CreateThread(puzzle_worker_main, "mine", &miner);
+        if (workers[i]) started++;
+    }
+    if (started == 0) puzzle_worker_main(&miner);
+    for (int i = 0; i < worker_count; i++) {
+        if (workers[i]) SDL_WaitThread(workers[i], NULL);
+    }
+    if (miner.checkpoint) fclose(miner.checkpoint);
+    eval_cache_close();
+
+    int ok = miner.ok;
+    if (ok) {
+        qsort(miner.records, miner.count, sizeof(PuzzleRecord), compare_puzzles);
+        char tmp_path[1024];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+        FILE *out = fopen(tmp_path, "wb");
+        PuzzleHeader header = {PUZZLE_MAGIC, PUZZLE_VERSION, ix->header->header_checksum, (Uint32)miner.count, 0};
+        ok = out && fwrite(&header, sizeof(header), 1, out) == 1 &&
+             fwrite(miner.records, sizeof(PuzzleRecord), miner.count, out) == miner.count && sync_file(out);
+        if (out && fclose(out) != 0) ok = 0;
+        if (ok && !publish_file(tmp_path, path)) ok = 0;
+        if (!ok) remove(tmp_path);
+    }
+    if (ok) {
+        remove(part_path);
+        printf("Mined %u puzzles into %s\n", (unsigned)miner.count, path);
+    } else {
+        printf("Failed to write puzzles for %s\n", games_dir);
+    }
+    SDL_DestroyMutex(miner.lock);
+    free(miner.done);
+    free(miner.progress);
+    free(miner.records);
+    free(path);
+    index_release(ix);
+    return ok;
+}
+
+void puzzle_free(void) {
+    unmap_file(&puzzles.map);
+    index_release(puzzles.index);
+    memset(&puzzles, 0, sizeof(puzzles));
+}
+
+// Loads the mined puzzles for the loaded index. Returns the number of puzzles.
+int puzzle_load(const char *games_dir) {
+    char *path = join_path(games_dir, PUZZLE_FILE_NAME);
+    CorpusIndex *ix = index_acquire();
+    MappedFile map;
+    int mapped = path && ix && map_file(path, &map);
+    free(path);
+    if (!mapped) {
+        index_release(ix);
+        return 0;
+    }
+    const PuzzleHeader *header = (const PuzzleHeader *)map.data;
+    if (map.size < sizeof(PuzzleHeader) || header->magic != PUZZLE_MAGIC || header->version != PUZZLE_VERSION ||
+        header->index_checksum != ix->header->header_checksum ||
+        sizeof(PuzzleHeader) + (size_t)header->count * sizeof(PuzzleRecord) != map.size) {
+        printf("Ignoring stale or damaged %s\n", PUZZLE_FILE_NAME);
+        unmap_file(&map);
+        index_release(ix);
+        return 0;
+    }
+    puzzle_free();
+    puzzles.index = ix;
+    puzzles.map = map;
+    puzzles.records = (const PuzzleRecord *)(header + 1);
+    puzzles.count = header->count;
+    return (int)puzzles.count;
+}
+
+// Approximate position counts in bounded memory (the "space-saving" summary): at most
+// TOP_SKETCH_SIZE counters, and a position that isn't counted takes over the smallest
+// counter, inheriting its count as the error bound. Any position occurring more often
+// than total / TOP_SKETCH_SIZE is guaranteed to hold a counter.
+typedef struct {
+    Uint64 key;
+    Uint32 count;
+    Uint32 error;  // count may overstate the true count by up to this much
+    Uint32 game;   // an index game that reaches the position, to show it by
+    Uint16 ply;
+    Uint16 heap_pos;
+} HeavyHitter;
+
+typedef struct {
+    HeavyHitter *items;
+    Uint16 *heap;   // item numbers, smallest count first
+    Uint32 *table;  // linear probing on the key: item number + 1, 0 when free
+    int count;
+    Uint32 table_mask;
+} SpaceSaving;
+
+static int space_saving_init(SpaceSaving *s) {
+    memset(s, 0, sizeof(*s));
+    s->items = (HeavyHitter *)calloc(TOP_SKETCH_SIZE, sizeof(HeavyHitter));
+    s->heap = (Uint16 *)calloc(TOP_SKETCH_SIZE, sizeof(Uint16));
+    s->table = (Uint32 *)calloc(TOP_SKETCH_SIZE * 2, sizeof(Uint32));
+    s->table_mask = TOP_SKETCH_SIZE * 2 - 1;
+    return s->items && s->heap && s->table;
+}
+
+static void space_saving_free(SpaceSaving *s) {
+    free(s->items);
+    free(s->heap);
+    free(s->table);
+    memset(s, 0, sizeof(*s));
+}
+
+static Uint32 space_saving_find(const SpaceSaving *s, Uint64 key) {
+    Uint32 i = (Uint32)mix64(key) & s->table_mask;
+    while (s->table[i] && s->items[s->table[i] - 1].key != key) i = (i + 1) & s->table_mask;
+    return i;
+}
+
+// Backward-shift deletion keeps every probe chain unbroken without tombstones.
+static void space_saving_unlink(SpaceSaving *s, Uint64 key) {
+    Uint32 i = space_saving_find(s, key);
+    if (!s->table[i]) return;
+    for (;;) {
+        s->table[i] = 0;
+        Uint32 j = i;
+        for (;;) {
+            j = (j + 1) & s->table_mask;
+            if (!s->table[j]) return;
+            Uint32 home = (Uint32)mix64(s->items[s->table[j] - 1].key) & s->table_mask;
+            int movable = (j > i) ? (home <= i || home > j) : (home <= i && home > j);
+            if (movable) {
+                s->table[i] = s->table[j];
+                i = j;
+                break;
+            }
+        }
+    }
+}
+
+static void space_saving_sift(SpaceSaving *s, int pos) {
+    for (;;) {
+        int smallest = pos;
+        int left = 2 * pos + 1;
+        int right = left + 1;
+        if (left < s->count && s->items[s->heap[left]].count < s->items[s->heap[smallest]].count) smallest = left;
+        if (right < s->count && s->items[s->heap[right]].count < s->items[s->heap[smallest]].count) smallest = right;
+        if (smallest == pos) return;
+        Uint16 tmp = s->heap[pos];
+        s->heap[pos] = s->heap[smallest];
+        s->heap[smallest] = tmp;
+        s->items[s->heap[pos]].heap_pos = (Uint16)pos;
+        s->items[s->heap[smallest]].heap_pos = (Uint16)smallest;
+        pos = smallest;
+    }
+}
+
+static void space_saving_sift_up(SpaceSaving *s, int pos) {
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (s->items[s->heap[parent]].count <= s->items[s->heap[pos]].count) return;
+        Uint16 tmp = s->heap[pos];
+        s->heap[pos] = s->heap[parent];
+        s->heap[parent] = tmp;
+        s->items[s->heap[pos]].heap_pos = (Uint16)pos;
+        s->items[s->heap[parent]].heap_pos = (Uint16)parent;
+        pos = parent;
+    }
+}
+
+static void space_saving_add(SpaceSaving *s, Uint64 key, Uint32 game, int ply) {
+    Uint32 slot = space_saving_find(s, key);
+    if (s->table[slot]) {
+        HeavyHitter *item = &s->items[s->table[slot] - 1];
+        item->count++;
+        space_saving_sift(s, item->heap_pos);
+        return;
+    }
+    HeavyHitter *item;
+    if (s->count < TOP_SKETCH_SIZE) {
+        int n = s->count++;
+        item = &s->items[n];
+        item->count = 0;
+        item->error = 0;
+        item->heap_pos = (Uint16)n;
+        s->heap[n] = (Uint16)n;
+    } else {
+        item = &s->items[s->heap[0]];
+        space_saving_unlink(s, item->key);
+        item->error = item->count;
+        slot = space_saving_find(s, key);
+    }
+    item->key = key;
+    item->count++;
+    item->game = game;
+    item->ply = (Uint16)ply;
+    s->table[slot] = (Uint32)(item - s->items) + 1;
+    space_saving_sift(s, item->heap_pos);
+    space_saving_sift_up(s, item->heap_pos);
+}
+
+static Uint32 space_saving_min(const SpaceSaving *s) {
+    return (s->count < TOP_SKETCH_SIZE) ? 0 : s->items[s->heap[0]].count;
+}
+
+typedef struct {
+    CorpusIndex *index;
+    const char *games_dir;
+    const char *prefix;
+    SDL_atomic_t next_file;
+    SpaceSaving *sketches;
+    Uint64 total;
+    SDL_SpinLock total_lock;
+    int ok;
+} TopPositionScan;
+
+typedef struct {
+    TopPositionScan *scan;
+    SpaceSaving *sketch;
+} TopPositionWorker;
+
+static int top_positions_worker_main(void *data) {
+    TopPositionWorker *worker = (TopPositionWorker *)data;
+    TopPositionScan *scan = worker->scan;
+    char (*moves)[MOVE_TEXT_LEN] = malloc(MAX_MOVES * sizeof(*moves));
+    char (*boards)[BOARD_SIZE][BOARD_SIZE] = malloc((MAX_MOVES + 1) * sizeof(*boards));
+    unsigned char *flags = (unsigned char *)malloc(MAX_MOVES);
+    if (!moves || !boards || !flags) scan->ok = 0;
+    Uint64 counted = 0;
+    size_t prefix_len = scan->prefix ? strlen(scan->prefix) : 0;
+    while (scan->ok) {
+        Uint32 file_index = (Uint32)SDL_AtomicAdd(&scan->next_file, 1);
+        if (file_index >= scan->index->header->file_count) break;
+        const IndexFile *file = &scan->index->files[file_index];
+        if (prefix_len && strncmp(scan->index->names + file->name_offset, scan->prefix, prefix_len) != 0) continue;
+        IndexedFileGames source;
+        open_indexed_file(scan->index, scan->games_dir, file, 0, 0, &source);
+        for (int g = 0; g < source.count; g++) {
+            Game scid_game = {0};
+            const Game *game = indexed_file_game(&source, g, &scid_game);
+            const char *text = game ? game->moves : NULL;
+            char result[RESULT_LEN];
+            int move_count = text ? build_move_list(text, moves, MAX_MOVES, result, sizeof(result)) : 0;
+            free(scid_game.moves);
+            int ply_count = replay_game_plies(moves, move_count, boards, flags);
+            for (int ply = 0; ply <= ply_count; ply++) {
+                space_saving_add(worker->sketch, position_hash(boards[ply], ply % 2 == 0), file->first_game + (Uint32)g, ply);
             }
+            counted += (Uint64)ply_count + 1;
         }
-        free(full);
+        close_indexed_file(&source);
     }
-    closedir(d);
-#endif
+    SDL_AtomicLock(&scan->total_lock);
+    scan->total += counted;
+    SDL_AtomicUnlock(&scan->total_lock);
+    free(moves);
+    free(boards);
+    free(flags);
     return 0;
 }
 
-int parse_tag_value(const char *line, const char *tag, char *out, size_t out_size) {
-    size_t tag_len = strlen(tag);
-    if (strncmp(line, "[", 1) != 0) return 0;
-    if (strncmp(line + 1, tag, tag_len) != 0) return 0;
-    if (!isspace((unsigned char)line[1 + tag_len])) return 0;
-    const char *first_quote = strchr(line, '"');
-    if (!first_quote) return 0;
-    const char *second_quote = strchr(first_quote + 1, '"');
-    if (!second_quote) return 0;
-    size_t len = (size_t)(second_quote - first_quote - 1);
-    if (len >= out_size) len = out_size - 1;
-    memcpy(out, first_quote + 1, len);
-    out[len] = '\0';
-    return 1;
+static int compare_hitter_keys(const void *a, const void *b) {
+    Uint64 ka = ((const HeavyHitter *)a)->key;
+    Uint64 kb = ((const HeavyHitter *)b)->key;
+    return (ka < kb) ? -1 : (ka > kb) ? 1 : 0;
 }
 
-void extract_year(char *out, size_t out_size, const char *date) {
-    if (!out || out_size == 0) return;
-    out[0] = '\0';
-    if (!date || strlen(date) < 4) return;
-    for (int i = 0; i < 4; i++) {
-        if (!isdigit((unsigned char)date[i])) return;
-    }
-    if (out_size < 5) return;
-    memcpy(out, date, 4);
-    out[4] = '\0';
+static int compare_hitter_counts(const void *a, const void *b) {
+    const HeavyHitter *ha = (const HeavyHitter *)a;
+    const HeavyHitter *hb = (const HeavyHitter *)b;
+    if (ha->count != hb->count) return (ha->count > hb->count) ? -1 : 1;
+    return (ha->error < hb->error) ? -1 : (ha->error > hb->error);
 }
 
-void set_last_name(char *out, size_t out_size, const char *full) {
-    if (!out || out_size == 0) return;
-    out[0] = '\0';
-    if (!full) return;
+// Merges per-thread summaries into one list, largest first. A summary without a key
+// may still have seen it up to its smallest count, so that much is added to both the
+// estimate and its error; the true count stays within [count - error, count].
+static int merge_sketches(SpaceSaving *sketches, int sketch_count, HeavyHitter **out) {
+    size_t total = 0;
+    Uint32 min_sum = 0;
+    for (int i = 0; i < sketch_count; i++) {
+        total += (size_t)sketches[i].count;
+        min_sum += space_saving_min(&sketches[i]);
+    }
+    HeavyHitter *all = (HeavyHitter *)malloc((total + 1) * sizeof(HeavyHitter));
+    if (!all) return -1;
+    size_t n = 0;
+    for (int i = 0; i < sketch_count; i++) {
+        for (int k = 0; k < sketches[i].count; k++) {
+            all[n] = sketches[i].items[k];
+            // heap_pos is spare from here on: it remembers the summary's own minimum.
+            all[n].heap_pos = (Uint16)i;
+            n++;
+        }
+    }
+    qsort(all, n, sizeof(HeavyHitter), compare_hitter_keys);
+    size_t merged = 0;
+    for (size_t i = 0; i < n;) {
+        size_t j = i;
+        HeavyHitter sum = all[i];
+        Uint32 seen_min = 0;
+        sum.count = 0;
+        sum.error = 0;
+        for (; j < n && all[j].key == all[i].key; j++) {
+            sum.count += all[j].count;
+            sum.error += all[j].error;
+            seen_min += space_saving_min(&sketches[all[j].heap_pos]);
+        }
+        sum.count += min_sum - seen_min;
+        sum.error += min_sum - seen_min;
+        all[merged++] = sum;
+        i = j;
+    }
+    qsort(all, merged, sizeof(HeavyHitter), compare_hitter_counts);
+    *out = all;
+    return (int)merged;
+}
 
-    const char *start = full;
-    while (isspace((unsigned char)*start)) start++;
-    if (*start == '\0') return;
+// --top-positions: the most frequent positions in the corpus (or, with --top-in, in
+// the files under one path), counted on all cores in a few MB whatever the corpus size.
+int report_top_positions(const char *games_dir, int top_n, const char *prefix) {
+    CorpusIndex *ix = index_acquire();
+    if (!ix) {
+        printf("Build the index first with --build-index\n");
+        return 0;
+    }
+    int worker_count = SDL_GetCPUCount();
+    if (worker_count < 1) worker_count = 1;
+    if (worker_count > TOP_MAX_WORKERS) worker_count = TOP_MAX_WORKERS;
+    TopPositionScan scan;
+    memset(&scan, 0, sizeof(scan));
+    scan.index = ix;
+    scan.games_dir = games_dir;
+    scan.prefix = prefix;
+    scan.ok = 1;
+    SpaceSaving sketches[TOP_MAX_WORKERS];
+    TopPositionWorker workers[TOP_MAX_WORKERS];
+    SDL_Thread *threads[TOP_MAX_WORKERS];
+    int ready = 0;
+    for (; ready < worker_count; ready++) {
+        if (!space_saving_init(&sketches[ready])) {
+            space_saving_free(&sketches[ready]);
+            break;
+        }
+    }
+    if (ready == 0) {
+        index_release(ix);
+        return 0;
+    }
+    for (int i = 0; i < ready; i++) {
+        workers[i].scan = &scan;
+        workers[i].sketch = &sketches[i];
+        threads[i] = SDL_CreateThread(top_positions_worker_main, "top", &workers[i]);
+        if (!threads[i]) top_positions_worker_main(&workers[i]);
+    }
+    for (int i = 0; i < ready; i++) {
+        if (threads[i]) SDL_WaitThread(threads[i], NULL);
+    }
 
-    const char *comma = strchr(start, ',');
-    const char *name_start = start;
-    const char *name_end = NULL;
+    HeavyHitter *top = NULL;
+    int count = scan.ok ? merge_sketches(sketches, ready, &top) : -1;
+    for (int i = 0; i < ready; i++) space_saving_free(&sketches[i]);
+    if (count < 0) {
+        printf("Out of memory counting positions\n");
+        index_release(ix);
+        return 0;
+    }
+    printf("%llu positions counted%s%s\n", (unsigned long long)scan.total, prefix ? " under " : "", prefix ? prefix : "");
+    char (*moves)[MOVE_TEXT_LEN] = malloc(MAX_MOVES * sizeof(*moves));
+    char (*boards)[BOARD_SIZE][BOARD_SIZE] = malloc((MAX_MOVES + 1) * sizeof(*boards));
+    unsigned char *flags = (unsigned char *)malloc(MAX_MOVES);
+    for (int i = 0; i < count && i < top_n && moves && boards && flags; i++) {
+        // The position itself is rebuilt from one game that reached it. Castling and en
+        // passant rights depend on how each game got there, so only placement and side
+        // to move are printed, which is what was counted.
+        char fen[SHM_FEN_LEN] = "?";
+        Game game = {0};
+        char *path = NULL;
+        if (index_load_game(ix, top[i].game, &path, &game)) {
+            char result[RESULT_LEN];
+            int move_count = game.moves ? build_move_list(game.moves, moves, MAX_MOVES, result, sizeof(result)) : 0;
+            if (replay_game_plies(moves, move_count, boards, flags) >= top[i].ply) {
+                board_placement(boards[top[i].ply], top[i].ply % 2 == 0, fen);
+            }
+            free(game.moves);
+        }
+        printf("%4d. %10u", i + 1, (unsigned)top[i].count);
+        if (top[i].error) printf(" (at least %u)", (unsigned)(top[i].count - top[i].error));
+        printf("  %s\n", fen);
+        free(path);
+    }
+    free(moves);
+    free(boards);
+    free(flags);
+    free(top);
+    index_release(ix);
+    return 1;
+}
 
-    if (comma) {
-        name_end = comma;
-        while (name_end > name_start && isspace((unsigned char)name_end[-1])) {
-            name_end--;
+// --find-player NAME or --find-fen FEN: lists every game with that player (matched as
+// for --vs) or reaching that position, without the posting lists. Each file's Bloom
+// filter is probed first, and only files that may match are opened and checked.
+int find_games(const char *games_dir, const char *player, const char *fen) {
+    CorpusIndex *ix = index_acquire();
+    if (!ix) {
+        printf("Build the index first with --build-index\n");
+        return 0;
+    }
+    char key[NAME_LEN] = "";
+    Uint64 *keys = NULL;
+    size_t key_count = 0;
+    Uint64 position = 0;
+    if (player) {
+        normalize_player(player, key, sizeof(key));
+        Uint32 first = 0;
+        Uint32 last = 0;
+        int have_postings = index_postings(ix);
+        if (key[0] && have_postings) find_players(ix, key, &first, &last);
+        keys = (Uint64 *)malloc((last - first + 1) * sizeof(Uint64));
+        for (Uint32 p = first; keys && p < last; p++) {
+            const char *name = ix->player_names + ix->players[p].name_offset;
+            if (player_name_matches(name, key, strlen(key))) keys[key_count++] = bloom_player_key(name);
+        }
+        // Without the player list only the exact name can be probed for.
+        if (keys && key[0] && !have_postings) keys[key_count++] = bloom_player_key(key);
+        if (key_count == 0) {
+            printf("No player %s in the index\n", player);
+            free(keys);
+            index_release(ix);
+            return 0;
         }
     } else {
-        const char *p = start;
-        const char *last_word = start;
-        while (*p) {
-            while (isspace((unsigned char)*p)) p++;
-            if (*p == '\0') break;
-            last_word = p;
-            while (*p && !isspace((unsigned char)*p)) p++;
+        char b[BOARD_SIZE][BOARD_SIZE];
+        int white = 1;
+        if (!fen_to_board(fen, b, &white)) {
+            printf("Not a FEN: %s\n", fen);
+            index_release(ix);
+            return 0;
         }
-        name_start = last_word;
-        name_end = name_start;
-        while (*name_end && !isspace((unsigned char)*name_end)) name_end++;
+        position = position_hash(b, white);
     }
 
-    size_t len = (size_t)(name_end - name_start);
-    if (len >= out_size) len = out_size - 1;
-    memcpy(out, name_start, len);
-    out[len] = '\0';
+    char (*moves)[MOVE_TEXT_LEN] = malloc(MAX_MOVES * sizeof(*moves));
+    char (*boards)[BOARD_SIZE][BOARD_SIZE] = malloc((MAX_MOVES + 1) * sizeof(*boards));
+    unsigned char *flags = (unsigned char *)malloc(MAX_MOVES);
+    int ok = moves && boards && flags;
+    Uint32 opened = 0;
+    int found = 0;
+    for (Uint32 f = 0; ok && f < ix->header->file_count; f++) {
+        const IndexFile *file = &ix->files[f];
+        int may_match = !player && bloom_may_contain(ix, file, position);
+        for (size_t k = 0; !may_match && k < key_count; k++) may_match = bloom_may_contain(ix, file, keys[k]);
+        if (!may_match) continue;
+        opened++;
+        IndexedFileGames source;
+        open_indexed_file(ix, games_dir, file, 0, 0, &source);
+        for (int g = 0; g < source.count; g++) {
+            Game scid_game = {0};
+            const Game *game = indexed_file_game(&source, g, &scid_game);
+            int match = 0;
+            if (game && player) {
+                char white[NAME_LEN];
+                char black[NAME_LEN];
+                normalize_player(game->white, white, sizeof(white));
+                normalize_player(game->black, black, sizeof(black));
+                match = player_name_matches(white, key, strlen(key)) || player_name_matches(black, key, strlen(key));
+            } else if (game && game->moves) {
+                char result[RESULT_LEN];
+                int move_count = build_move_list(game->moves, moves, MAX_MOVES, result, sizeof(result));
+                int ply_count = replay_game_plies(moves, move_count, boards, flags);
+                for (int ply = 0; ply <= ply_count && !match; ply++) {
+                    match = (position_hash(boards[ply], ply % 2 == 0) == position);
+                }
+            }
+            if (match) {
+                printf("%s@%d  %s - %s %s\n", ix->names + file->name_offset, g + 1, game->white, game->black,
+                       game->year);
+                found++;
+            }
+            free(scid_game.moves);
+        }
+        close_indexed_file(&source);
+    }
+    printf("%d games; opened %u of %u files\n", found, opened, ix->header->file_count);
+    free(keys);
+    free(moves);
+    free(boards);
+    free(flags);
+    index_release(ix);
+    return ok;
 }
 
-int push_game(Game **games, int *count, int *cap, const char *move_buffer,
-              const char *white, const char *black, const char *year, const char *result) {
-    if (*count >= *cap) {
-        int new_cap = (*cap == 0) ? 16 : (*cap * 2);
-        Game *new_games = (Game *)realloc(*games, (size_t)new_cap * sizeof(Game));
-        if (!new_games) return 0;
-        *games = new_games;
-        *cap = new_cap;
+// Loads one random game from a random corpus file. Returns 1 on success, 0 if the
+// chosen file was unusable, and -1 if there are no PGN files at all.
+static int prepare_random_game(PreparedGame *out, unsigned int *rng) {
+    if (interest_mode) {
+        // Weighted picks come straight from the index; the game is read at its offset.
+        CorpusIndex *ix = index_acquire();
+        Uint32 game_id = interest_pick(&ix->interest, rng);
+        int loaded = index_load_game(ix, game_id, &out->path, &out->game);
+        if (loaded) out->game_index = index_game_ordinal(ix, game_id);
+        index_release(ix);
+        return loaded;
     }
-    (*games)[*count].moves = copy_string(move_buffer);
-    if (!(*games)[*count].moves) return 0;
-    strncpy((*games)[*count].white, (white && white[0]) ? white : "White", NAME_LEN - 1);
-    (*games)[*count].white[NAME_LEN - 1] = '\0';
-    strncpy((*games)[*count].black, (black && black[0]) ? black : "Black", NAME_LEN - 1);
-    (*games)[*count].black[NAME_LEN - 1] = '\0';
-    strncpy((*games)[*count].year, (year && year[0]) ? year : "", YEAR_LEN - 1);
-    (*games)[*count].year[YEAR_LEN - 1] = '\0';
-    strncpy((*games)[*count].result, (result && result[0]) ? result : "", RESULT_LEN - 1);
-    (*games)[*count].result[RESULT_LEN - 1] = '\0';
-    (*count)++;
+    char *path = corpus_random_path(games_dir_root, rng);
+    if (!path) return -1;
+    int game_index = -1;
+    int loaded = load_source_game(path, &game_index, rng, &out->game);
+    if (loaded <= 0) {
+        if (loaded < 0) corpus_mark_stale();
+        free(path);
+        return 0;
+    }
+    out->path = path;
+    out->game_index = game_index;
     return 1;
 }
 
-void free_games(Game *games, int count) {
-    if (!games) return;
-    for (int i = 0; i < count; i++) {
-        free(games[i].moves);
+static int prefetch_worker_main(void *data) {
+    unsigned int rng = (unsigned int)(size_t)data;
+    for (;;) {
+        SDL_LockMutex(prefetch.lock);
+        while (!prefetch.stop && prefetch.count + prefetch.pending >= prefetch.capacity) {
+            SDL_CondWait(prefetch.not_full, prefetch.lock);
+        }
+        if (prefetch.stop) {
+            SDL_UnlockMutex(prefetch.lock);
+            break;
+        }
+        prefetch.pending++;
+        SDL_UnlockMutex(prefetch.lock);
+
+        PreparedGame game;
+        int status = prepare_random_game(&game, &rng);
+
+        SDL_LockMutex(prefetch.lock);
+        prefetch.pending--;
+        if (status > 0 && !prefetch.stop) {
+            prefetch.slots[(prefetch.head + prefetch.count) % PREFETCH_SLOTS] = game;
+            prefetch.count++;
+            status = 2;
+            SDL_CondSignal(prefetch.not_empty);
+        } else if (status < 0) {
+            prefetch.exhausted = 1;
+            SDL_CondBroadcast(prefetch.not_empty);
+        }
+        SDL_UnlockMutex(prefetch.lock);
+
+        if (status == 1) {
+            free(game.path);
+            free(game.game.moves);
+        } else if (status < 0) {
+            break;
+        } else if (status == 0) {
+            SDL_Delay(100);
+        }
     }
-    free(games);
+    return 0;
 }
 
-int load_games(FILE *fp, Game **out_games) {
-    Game *games = NULL;
-    int count = 0;
-    int cap = 0;
-    char line[512];
-    char move_buffer[65536] = {0};
-    char current_white[NAME_LEN] = "";
-    char current_black[NAME_LEN] = "";
-    char current_date[NAME_LEN] = "";
-    char current_year[YEAR_LEN] = "";
-    char current_result[RESULT_LEN] = "";
-    int in_game = 0;
+// Starts one decode worker per viewer so every window has a game ready when it wants one.
+int prefetch_start(int worker_count) {
+    prefetch.lock = SDL_CreateMutex();
+    prefetch.not_empty = SDL_CreateCond();
+    prefetch.not_full = SDL_CreateCond();
+    corpus.lock = SDL_CreateMutex();
+    if (!prefetch.lock || !prefetch.not_empty || !prefetch.not_full || !corpus.lock) return 0;
+    prefetch.capacity = worker_count * 2;
+    if (prefetch.capacity > PREFETCH_SLOTS) prefetch.capacity = PREFETCH_SLOTS;
+    for (int i = 0; i < worker_count && i < MAX_VIEWERS; i++) {
+        unsigned int seed = (unsigned int)time(NULL) ^ (0x9E3779B9u * (unsigned int)(i + 1));
+        prefetch.workers[i] = SDL_CreateThread(prefetch_worker_main, "prefetch", (void *)(size_t)seed);
+        if (!prefetch.workers[i]) break;
+        prefetch.worker_count++;
+    }
+    return prefetch.worker_count > 0;
+}
 
-    while (fgets(line, sizeof(line), fp)) {
-        clean_line(line);
-        const char *trim = line;
-        while (isspace((unsigned char)*trim)) trim++;
-        if (strncmp(trim, "[Event", 6) == 0) {  // New game starts
-            if (in_game && move_buffer[0] != '\0') {
-                if (!push_game(&games, &count, &cap, move_buffer,
-                               current_white, current_black, current_year, current_result)) goto error;
-                move_buffer[0] = '\0';
+// Blocks until a prepared game is available. Returns 1 with the game, 0 once the pool
+// is stopping, and -1 if the corpus is empty.
+int prefetch_take(PreparedGame *out) {
+    SDL_LockMutex(prefetch.lock);
+    while (prefetch.count == 0 && !prefetch.exhausted && !prefetch.stop) {
+        SDL_CondWait(prefetch.not_empty, prefetch.lock);
+    }
+    int status = 0;
+    if (prefetch.count > 0) {
+        *out = prefetch.slots[prefetch.head];
+        prefetch.head = (prefetch.head + 1) % PREFETCH_SLOTS;
+        prefetch.count--;
+        SDL_CondSignal(prefetch.not_full);
+        status = 1;
+    } else if (prefetch.exhausted) {
+        status = -1;
+    }
+    SDL_UnlockMutex(prefetch.lock);
+    return status;
+}
+
+void prefetch_stop(void) {
+    if (!prefetch.lock) return;
+    SDL_LockMutex(prefetch.lock);
+    prefetch.stop = 1;
+    SDL_CondBroadcast(prefetch.not_empty);
+    SDL_CondBroadcast(prefetch.not_full);
+    SDL_UnlockMutex(prefetch.lock);
+}
+
+void prefetch_shutdown(void) {
+    prefetch_stop();
+    for (int i = 0; i < prefetch.worker_count; i++) {
+        SDL_WaitThread(prefetch.workers[i], NULL);
+    }
+    prefetch.worker_count = 0;
+    while (prefetch.count > 0) {
+        PreparedGame *game = &prefetch.slots[prefetch.head];
+        free(game->path);
+        free(game->game.moves);
+        prefetch.head = (prefetch.head + 1) % PREFETCH_SLOTS;
+        prefetch.count--;
+    }
+    if (prefetch.not_empty) SDL_DestroyCond(prefetch.not_empty);
+    if (prefetch.not_full) SDL_DestroyCond(prefetch.not_full);
+    if (prefetch.lock) SDL_DestroyMutex(prefetch.lock);
+    prefetch.not_empty = NULL;
+    prefetch.not_full = NULL;
+    prefetch.lock = NULL;
+    free_string_list(corpus.files, corpus.file_count);
+    corpus.files = NULL;
+    corpus.file_count = 0;
+    if (corpus.lock) SDL_DestroyMutex(corpus.lock);
+    corpus.lock = NULL;
+}
+
+// Moves highlight playback on to the next segment once `*index` has left the current
+// one. Returns 1 if the board jumped.
+static int follow_highlights(Viewer *v, const HighlightPlan *plan, int *index) {
+    if (!v->highlights_mode || plan->count == 0 || !v->ply_cache.boards) return 0;
+    int target = highlight_target(plan, *index);
+    if (target < 0 || target == *index || target > v->ply_cache.ply_count) return 0;
+    *index = target;
+    memcpy(v->board, v->ply_cache.boards[target], sizeof(v->board));
+    v->turn_is_white = (target % 2 == 0);
+    draw_board(v);
+    return 1;
+}
+
+// Last name for the labels, or the full name if there is no obvious last name.
+static void set_display_name(char *out, const char *full) {
+    set_last_name(out, NAME_LEN, full);
+    if (out[0] == '\0') {
+        snprintf(out, NAME_LEN, "%s", full);
+    }
+}
+
+// A game that shares a position with the one being played and later parts from it.
+typedef struct {
+    Game game;
+    char (*moves)[MOVE_TEXT_LEN];
+    int move_count;
+    PlyCache cache;
+    int shared_ply;          // ply of the current game where the shared position stands
+    int partner_shared_ply;  // the same position's ply in the partner, which may differ
+    int diverge_ply;         // first ply of the current game whose move differs
+} Divergence;
+
+static void free_divergence(Divergence *d) {
+    free(d->game.moves);
+    free(d->moves);
+    free_ply_cache(&d->cache);
+    memset(d, 0, sizeof(*d));
+}
+
+// Loads indexed game `game_id` into d and checks that it really reaches `position` (the
+// index only keeps half of each hash) and then plays on differently from `cache`.
+static int try_divergence(CorpusIndex *ix, const PlyCache *cache, int ply, Uint32 game_id, Divergence *d) {
+    if (!index_load_game(ix, game_id, NULL, &d->game)) return 0;
+
+    char result[RESULT_LEN];
+    d->move_count = build_move_list(d->game.moves, d->moves, MAX_MOVES, result, sizeof(result));
+    if (build_ply_cache(&d->cache, d->moves, d->move_count)) {
+        for (int q = ply % 2; q <= d->cache.ply_count && q <= POSITION_MAX_PLY; q += 2) {
+            if (memcmp(d->cache.boards[q], cache->boards[ply], sizeof(cache->boards[ply])) != 0) continue;
+            int k = 0;
+            while (ply + k < cache->ply_count && q + k < d->cache.ply_count &&
+                   memcmp(cache->boards[ply + k + 1], d->cache.boards[q + k + 1],
+                          sizeof(cache->boards[0])) == 0) {
+                k++;
             }
-            current_white[0] = '\0';
-            current_black[0] = '\0';
-            current_date[0] = '\0';
-            current_year[0] = '\0';
-            current_result[0] = '\0';
-            in_game = 1;
-            continue;  // Skip header lines
+            if (ply + k >= cache->ply_count || q + k >= d->cache.ply_count) break;
+            d->diverge_ply = ply + k;
+            // Walk back to where the two move orders first meet.
+            while (ply > 0 && q > 0 &&
+                   memcmp(cache->boards[ply - 1], d->cache.boards[q - 1], sizeof(cache->boards[0])) == 0) {
+                ply--;
+                q--;
+            }
+            d->shared_ply = ply;
+            d->partner_shared_ply = q;
+            return 1;
         }
-        if (in_game && trim[0] == '[') {
-            parse_tag_value(trim, "White", current_white, sizeof(current_white));
-            parse_tag_value(trim, "Black", current_black, sizeof(current_black));
-            if (parse_tag_value(trim, "Date", current_date, sizeof(current_date))) {
-                extract_year(current_year, sizeof(current_year), current_date);
+    }
+    free(d->game.moves);
+    d->game.moves = NULL;
+    return 0;
+}
+
+// Looks up the current game's positions in the index, deepest first, and returns the
+// first other game that shares one of them and then goes its own way. Within one
+// position the starting candidate is random so repeated lookups vary.
+static int find_divergence(Viewer *v, const PlyCache *cache, Divergence *d) {
+    memset(d, 0, sizeof(*d));
+    CorpusIndex *ix = index_acquire();
+    if (!cache->boards || !index_postings(ix) || ix->postings->position_count == 0) {
+        index_release(ix);
+        return 0;
+    }
+    d->moves = malloc(MAX_MOVES * sizeof(*d->moves));
+    if (!d->moves) {
+        index_release(ix);
+        return 0;
+    }
+    Uint32 own_id = 0xFFFFFFFFu;
+    index_find_game(ix, v->current_game_path, v->current_game_ordinal, &own_id);
+    const IndexPositionList *positions = ix->positions;
+    size_t count = ix->postings->position_count;
+    Uint32 block[POSTING_BLOCK];
+    int attempts = 0;
+    int top = (cache->ply_count < POSITION_MAX_PLY) ? cache->ply_count : POSITION_MAX_PLY;
+    for (int ply = top; ply >= POSITION_MIN_PLY && attempts < DIVERGENCE_MAX_CANDIDATES; ply--) {
+        Uint32 key = (Uint32)(position_hash(cache->boards[ply], ply % 2 == 0) >> 32);
+        size_t lo = 0;
+        size_t hi = count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (positions[mid].key < key) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
             }
-            parse_tag_value(trim, "Result", current_result, sizeof(current_result));
-            continue;
         }
-        if (in_game && trim[0] != '[' && trim[0] != '\0') {
-            strncat(move_buffer, " ", sizeof(move_buffer) - strlen(move_buffer) - 1);
-            strncat(move_buffer, trim, sizeof(move_buffer) - strlen(move_buffer) - 1);
+        if (lo >= count || positions[lo].key != key) continue;
+        const PostingList *games = &positions[lo].games;
+        Uint32 group = games->count;
+        if (group == 0) continue;
+        Uint32 first = (Uint32)viewer_rand(v) % group;
+        Uint32 decoded = 0xFFFFFFFFu;
+        for (Uint32 n = 0; n < group && attempts < DIVERGENCE_MAX_CANDIDATES; n++) {
+            Uint32 at = (first + n) % group;
+            if (at / POSTING_BLOCK != decoded) {
+                decoded = at / POSTING_BLOCK;
+                posting_decode_block(ix, games, decoded, block);
+            }
+            Uint32 game_id = block[at % POSTING_BLOCK];
+            if (game_id == own_id || game_id >= ix->header->game_count) continue;
+            attempts++;
+            if (try_divergence(ix, cache, ply, game_id, d)) {
+                index_release(ix);
+                return 1;
+            }
         }
     }
+    free_divergence(d);
+    index_release(ix);
+    return 0;
+}
 
-    if (in_game && move_buffer[0] != '\0') {
-        if (!push_game(&games, &count, &cap, move_buffer,
-                       current_white, current_black, current_year, current_result)) goto error;
+// Divergence view: plays the current game beside one that reached the same position
+// and then went another way, starting a few plies before they part. Both boards step
+// together at the playback speed. Returns 1 if playback of the current game should end
+// (quit or navigation), or 0 to resume it from `*index`.
+static int play_divergence(Viewer *v, char moves[][MOVE_TEXT_LEN], int *index) {
+    Divergence d;
+    if (!find_divergence(v, &v->ply_cache, &d)) {
+        show_status(v, corpus_index ? "NO DIVERGING GAME FOUND" : "NO INDEX: RUN --BUILD-INDEX");
+        draw_board(v);
+        return 0;
     }
 
-    *out_games = games;
-    return count;
-
-error:
-    free_games(games, count);
-    *out_games = NULL;
-    return -1;
-}
+    int offset = d.partner_shared_ply - d.shared_ply;
+    int ia = d.diverge_ply - DIVERGENCE_LEAD_PLIES;
+    if (ia < d.shared_ply) ia = d.shared_ply;
+    for (int side = 0; side < 2; side++) {
+        int ply = d.diverge_ply + (side ? offset : 0);
+        char board[BOARD_SIZE][BOARD_SIZE];
+        memcpy(board, side ? d.cache.boards[ply] : v->ply_cache.boards[ply], sizeof(board));
+        Move m = {0};
+        memset(v->split_squares[side], -1, sizeof(v->split_squares[side]));
+        if (parse_san(board, side ? d.moves[ply] : moves[ply], ply % 2 == 0, &m)) {
+            v->split_squares[side][0] = (signed char)m.from_r;
+            v->split_squares[side][1] = (signed char)m.from_f;
+            v->split_squares[side][2] = (signed char)m.to_r;
+            v->split_squares[side][3] = (signed char)m.to_f;
+        }
+    }
+    set_display_name(v->split_white_name, d.game.white);
+    set_display_name(v->split_black_name, d.game.black);
+    strncpy(v->split_year, d.game.year, YEAR_LEN - 1);
+    v->split_year[YEAR_LEN - 1] = '\0';
+    v->split_move_number = d.diverge_ply / 2 + 1;
+    v->split_active = 1;
+
+    int stop = 0;
+    int leave = 0;
+    int paused = 0;
+    int end_a = v->ply_cache.ply_count;
+    int end_b = d.cache.ply_count - offset;
+    int last = (end_a > end_b) ? end_a : end_b;
+    Uint32 last_move_tick = SDL_GetTicks();
+    Uint32 finished_at = 0;
+    int dirty = 1;
+    while (!stop && !leave) {
+        if (dirty) {
+            memcpy(v->board, v->ply_cache.boards[(ia < end_a) ? ia : end_a], sizeof(v->board));
+            memcpy(v->split_board, d.cache.boards[((ia < end_b) ? ia : end_b) + offset], sizeof(v->split_board));
+            v->split_diverged = (ia > d.diverge_ply);
+            v->turn_is_white = (ia % 2 == 0);
+            draw_board(v);
+            dirty = 0;
+        }
+        shm_update_status(v, ia);
+        tablebase_update(v, ia);
+        eval_update(v, ia);
+        Uint32 now = SDL_GetTicks();
+        update_cursor_auto_hide(v, now);
+        SDL_Event e;
+        while (poll_input_event(v, &e)) {
+            note_mouse_activity_event(v, &e);
+            if (e.type == control_event_type) {
+                int fx = apply_control_batch(v, &e);
+                if (fx & CONTROL_FX_END_GAME) stop = 1;
+                if (fx & (CONTROL_FX_PAUSE | CONTROL_FX_RESUME)) {
+                    paused = (fx & CONTROL_FX_PAUSE) != 0;
+                    v->dim_board = paused;
+                    last_move_tick = SDL_GetTicks();
+                }
+                dirty = 1;
+                continue;
+            }
+            if (e.type == SDL_QUIT) {
+                stop = 1;
+            } else if (e.type == SDL_KEYDOWN) {
+                SDL_Keycode key = e.key.keysym.sym;
+                if (key == SDLK_q) {
+                    v->game_nav_request = GAME_NAV_NONE;
+                    stop = 1;
+                } else if (key == SDLK_n) {
+                    v->game_nav_request = GAME_NAV_NEXT;
+                    stop = 1;
+                } else if (key == SDLK_p) {
+                    v->game_nav_request = GAME_NAV_PREV;
+                    stop = 1;
+                } else if (key == SDLK_r) {
+                    v->game_nav_request = GAME_NAV_RESTART;
+                    stop = 1;
+                } else if (key == SDLK_d) {
+                    leave = 1;
+                } else if (key == SDLK_ESCAPE) {
+                    v->show_help = !v->show_help;
+                    dirty = 1;
+                } else if (key == SDLK_UP || key == SDLK_DOWN) {
+                    int delta = (key == SDLK_UP) ? MOVE_DELAY_STEP_MS : -MOVE_DELAY_STEP_MS;
+                    dirty = adjust_move_delay(v, delta, SDL_GetTicks());
+                } else if (key == SDLK_SPACE) {
+                    paused = !paused;
+                    v->dim_board = paused;
+                    last_move_tick = SDL_GetTicks();
+                    dirty = 1;
+                } else if (key == SDLK_f) {
+                    v->view_from_white = !v->view_from_white;
+                    dirty = 1;
+                } else if (paused && key == SDLK_LEFT && ia > d.shared_ply) {
+                    ia--;
+                    finished_at = 0;
+                    dirty = 1;
+                } else if (paused && key == SDLK_RIGHT && ia < last) {
+                    ia++;
+                    dirty = 1;
+                }
+            }
+        }
+        if (stop || leave) break;
 
-void shuffle_games(Game *games, int count) {
-    for (int i = count - 1; i > 0; i--) {
-        int j = rand() % (i + 1);
-        Game tmp = games[i];
-        games[i] = games[j];
-        games[j] = tmp;
+        now = SDL_GetTicks();
+        if (!paused && ia < last && now - last_move_tick >= (Uint32)current_move_delay(v)) {
+            ia++;
+            last_move_tick = now;
+            dirty = 1;
+        }
+        if (!paused && ia >= last) {
+            if (finished_at == 0) finished_at = now;
+            if (now - finished_at >= (Uint32)(v->turbo_mode ? TURBO_GAME_OVER_PAUSE_MS : GAME_OVER_PAUSE_MS)) {
+                leave = 1;
+            }
+        }
+        SDL_Delay(10);
     }
+
+    v->split_active = 0;
+    v->dim_board = 0;
+    *index = (ia < end_a) ? ia : end_a;
+    memcpy(v->board, v->ply_cache.boards[*index], sizeof(v->board));
+    v->turn_is_white = (*index % 2 == 0);
+    draw_board(v);
+    free_divergence(&d);
+    return stop;
 }
 
-int play_game(const char *move_buffer, const char *header_result) {
+int play_game(Viewer *v, const char *move_buffer, const char *header_result, const HighlightPlan *indexed_plan) {
     char moves[MAX_MOVES][MOVE_TEXT_LEN];
     char result_buf[RESULT_LEN];
     int move_count = build_move_list(move_buffer, moves, MAX_MOVES, result_buf, sizeof(result_buf));
+    if (!build_ply_cache(&v->ply_cache, moves, move_count)) {
+        free_ply_cache(&v->ply_cache);
+    }
+    HighlightPlan plan = {0};
+    if (indexed_plan) {
+        plan = *indexed_plan;
+    } else if (v->ply_cache.boards) {
+        select_highlights(v->ply_cache.flags, v->ply_cache.ply_count, &plan);
+    }
     const char *result = (result_buf[0] != '\0') ? result_buf : header_result;
     int has_loser = 0;
     int loser_is_white_local = 0;
@@ -2075,19 +11264,21 @@ int play_game(const char *move_buffer, const char *header_result) {
         is_draw = is_draw_result(result);
     }
 
-    init_board();
-    clear_analysis_marks();
-    draw_board();
+    init_board(v->board);
+    clear_analysis_marks(v);
+    v->game_serial++;
+    draw_board(v);
 
     int index = 0;
     int paused = 0;
     int quit = 0;
+    follow_highlights(v, &plan, &index);
     Uint32 last_move_tick = SDL_GetTicks();
-    show_loser_king = 0;
-    show_draw_kings = 0;
-    dim_board = 0;
-    pause_buffered = 0;
-    game_nav_request = GAME_NAV_NONE;
+    v->show_loser_king = 0;
+    v->show_draw_kings = 0;
+    v->dim_board = 0;
+    v->pause_buffered = 0;
+    v->game_nav_request = GAME_NAV_NONE;
     int analysis_dragging = 0;
     char analysis_piece = '.';
     int analysis_from_r = -1;
@@ -2103,19 +11294,48 @@ int play_game(const char *move_buffer, const char *header_result) {
     int guess_pending = 0;
     int guess_to_r = -1;
     int guess_to_f = -1;
-    guess_score = 0;
+    Uint32 puzzle_done_at = 0;
+
+    // A puzzle starts at its position in guess mode, and the score runs across puzzles.
+    const PuzzleRecord *puzzle = (v->puzzle >= 0) ? &puzzles.records[v->puzzle] : NULL;
+    if (puzzle && v->ply_cache.boards && puzzle->ply < v->ply_cache.ply_count) {
+        index = puzzle->ply;
+        memcpy(v->board, v->ply_cache.boards[index], sizeof(v->board));
+        v->view_from_white = (index % 2 == 0);
+        v->guess_mode = 1;
+        show_status(v, (index % 2 == 0) ? "WHITE TO PLAY AND WIN" : "BLACK TO PLAY AND WIN");
+        draw_board(v);
+    } else {
+        puzzle = NULL;
+        v->guess_score = 0;
+    }
 
     while (!quit) {
         Uint32 loop_now = SDL_GetTicks();
-        update_cursor_auto_hide(loop_now);
-        turn_is_white = (index % 2 == 0);
+        update_cursor_auto_hide(v, loop_now);
+        v->turn_is_white = (index % 2 == 0);
+        shm_update_status(v, index);
+        tablebase_update(v, index);
+        novelty_update(v, index);
+        eval_update(v, index);
         SDL_Event e;
-        while (SDL_PollEvent(&e)) {
-            note_mouse_activity_event(&e);
-            if (handle_catalog_event(&e, games_dir_root)) {
-                draw_board();
-        if (game_nav_request == GAME_NAV_SELECT && catalog_selection_made) {
-            catalog_selection_made = 0;
+        while (poll_input_event(v, &e)) {
+            note_mouse_activity_event(v, &e);
+            if (e.type == control_event_type) {
+                int fx = apply_control_batch(v, &e);
+                if (fx & CONTROL_FX_END_GAME) quit = 1;
+                if ((fx & (CONTROL_FX_PAUSE | CONTROL_FX_RESUME)) && !v->analysis_mode && !v->guess_mode) {
+                    paused = (fx & CONTROL_FX_PAUSE) != 0;
+                    v->dim_board = paused;
+                    last_move_tick = SDL_GetTicks();
+                }
+                draw_board(v);
+                continue;
+            }
+            if (handle_catalog_event(v, &e, games_dir_root)) {
+                draw_board(v);
+        if (v->game_nav_request == GAME_NAV_SELECT && v->catalog_selection_made) {
+            v->catalog_selection_made = 0;
             quit = 1;
         }
                 continue;
@@ -2125,116 +11345,137 @@ int play_game(const char *move_buffer, const char *header_result) {
             } else if (e.type == SDL_KEYDOWN) {
                 SDL_Keycode key = e.key.keysym.sym;
                 if (key == SDLK_q) {
-                    game_nav_request = GAME_NAV_NONE;
+                    v->game_nav_request = GAME_NAV_NONE;
                     quit = 1;
                 } else if (key == SDLK_n) {
-                    game_nav_request = GAME_NAV_NEXT;
+                    v->game_nav_request = GAME_NAV_NEXT;
                     quit = 1;
                 } else if (key == SDLK_p) {
-                    game_nav_request = GAME_NAV_PREV;
+                    v->game_nav_request = GAME_NAV_PREV;
                     quit = 1;
                 } else if (key == SDLK_r) {
-                    game_nav_request = GAME_NAV_RESTART;
+                    v->game_nav_request = GAME_NAV_RESTART;
                     quit = 1;
                 } else if (key == SDLK_c) {
-                    catalog_open(games_dir_root);
-                    draw_board();
+                    catalog_open(v, games_dir_root);
+                    draw_board(v);
                 } else if (key == SDLK_ESCAPE) {
-                    show_help = !show_help;
-                    draw_board();
+                    v->show_help = !v->show_help;
+                    draw_board(v);
                 } else if (key == SDLK_UP || key == SDLK_DOWN) {
                     Uint32 now = SDL_GetTicks();
-                    int prev = move_delay_ms;
+                    int prev = current_move_delay(v);
                     int delta = (key == SDLK_UP) ? MOVE_DELAY_STEP_MS : -MOVE_DELAY_STEP_MS;
-                    if (adjust_move_delay(delta, now)) {
-                        if (!paused && move_delay_ms > prev) {
+                    if (adjust_move_delay(v, delta, now)) {
+                        if (!paused && current_move_delay(v) > prev) {
                             last_move_tick = now;
                         }
-                        draw_board();
+                        draw_board(v);
+                    }
+                } else if (key == SDLK_t) {
+                    Uint32 now = SDL_GetTicks();
+                    toggle_turbo(v, now);
+                    last_move_tick = now;
+                    draw_board(v);
+                } else if (key == SDLK_h) {
+                    v->highlights_mode = !v->highlights_mode;
+                    if (!v->guess_mode && !v->analysis_mode) {
+                        follow_highlights(v, &plan, &index);
+                    }
+                    last_move_tick = SDL_GetTicks();
+                    draw_board(v);
+                } else if (key == SDLK_d) {
+                    if (!v->analysis_mode && !v->guess_mode) {
+                        if (play_divergence(v, moves, &index)) {
+                            quit = 1;
+                        }
+                        v->dim_board = paused;
+                        last_move_tick = SDL_GetTicks();
+                        draw_board(v);
                     }
                 } else if (key == SDLK_a) {
-                    if (analysis_mode) {
-                        exit_analysis_mode();
+                    if (v->analysis_mode) {
+                        exit_analysis_mode(v);
                         analysis_dragging = 0;
                         analysis_piece = '.';
-                    } else if (guess_mode) {
-                        guess_mode = 0;
+                    } else if (v->guess_mode) {
+                        v->guess_mode = 0;
                         guess_dragging = 0;
                         guess_pending = 0;
-                        enter_analysis_mode();
+                        enter_analysis_mode(v);
                     } else {
-                        enter_analysis_mode();
+                        enter_analysis_mode(v);
                         analysis_dragging = 0;
                         analysis_piece = '.';
                     }
-                    draw_board();
+                    draw_board(v);
                 } else if (key == SDLK_g) {
-                    if (guess_mode) {
-                        guess_mode = 0;
+                    if (v->guess_mode) {
+                        v->guess_mode = 0;
                         guess_dragging = 0;
                         guess_pending = 0;
                     } else {
-                        if (analysis_mode) {
-                            exit_analysis_mode();
+                        if (v->analysis_mode) {
+                            exit_analysis_mode(v);
                             analysis_dragging = 0;
                             analysis_piece = '.';
                         }
-                        guess_mode = 1;
+                        v->guess_mode = 1;
                         guess_dragging = 0;
                         guess_pending = 0;
                     }
-                    dim_board = 0;
+                    v->dim_board = 0;
                     paused = 0;
-                    pause_buffered = 0;
-                    draw_board();
+                    v->pause_buffered = 0;
+                    draw_board(v);
                 } else if (key == SDLK_SPACE) {
-                    if (!analysis_mode && !guess_mode) {
+                    if (!v->analysis_mode && !v->guess_mode) {
                         paused = !paused;
-                        dim_board = paused;
+                        v->dim_board = paused;
                         last_move_tick = SDL_GetTicks();
-                        draw_board();
+                        draw_board(v);
                     }
                 } else if (key == SDLK_f) {
-                    view_from_white = !view_from_white;
-                    draw_board();
-                } else if (!analysis_mode && !guess_mode && paused && key == SDLK_LEFT) {
+                    v->view_from_white = !v->view_from_white;
+                    draw_board(v);
+                } else if (!v->analysis_mode && !v->guess_mode && paused && key == SDLK_LEFT) {
                     if (index > 0) {
                         index--;
-                        replay_moves_to_index(moves, move_count, index);
+                        replay_moves_to_index(v, moves, move_count, index);
                     }
-                } else if (!analysis_mode && !guess_mode && paused && key == SDLK_RIGHT) {
+                } else if (!v->analysis_mode && !v->guess_mode && paused && key == SDLK_RIGHT) {
                     if (index < move_count) {
                         index++;
-                        replay_moves_to_index(moves, move_count, index);
+                        replay_moves_to_index(v, moves, move_count, index);
                     }
                 }
-            } else if (analysis_mode && e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT) {
+            } else if (v->analysis_mode && e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT) {
                 BoardView view;
-                get_board_view(&view);
+                get_board_view(v, &view);
                 int r = -1;
                 int f = -1;
                 if (screen_to_board(&view, e.button.x, e.button.y, &r, &f)) {
-                    if (board[r][f] != '.') {
+                    if (v->board[r][f] != '.') {
                         analysis_dragging = 1;
-                        analysis_piece = board[r][f];
+                        analysis_piece = v->board[r][f];
                         analysis_from_r = r;
                         analysis_from_f = f;
                         analysis_mouse_x = e.button.x;
                         analysis_mouse_y = e.button.y;
-                        board[r][f] = '.';
+                        v->board[r][f] = '.';
                     }
                 }
-            } else if (guess_mode && !analysis_mode && e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT) {
+            } else if (v->guess_mode && !v->analysis_mode && e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT) {
                 BoardView view;
-                get_board_view(&view);
+                get_board_view(v, &view);
                 int r = -1;
                 int f = -1;
                 if (screen_to_board(&view, e.button.x, e.button.y, &r, &f)) {
-                    if (board[r][f] != '.') {
+                    if (v->board[r][f] != '.') {
                         int is_white_turn = (index % 2 == 0);
-                        if (is_white_piece(board[r][f]) == is_white_turn) {
+                        if (is_white_piece(v->board[r][f]) == is_white_turn) {
                             guess_dragging = 1;
-                            guess_piece = board[r][f];
+                            guess_piece = v->board[r][f];
                             guess_from_r = r;
                             guess_from_f = f;
                             guess_mouse_x = e.button.x;
@@ -2243,56 +11484,56 @@ int play_game(const char *move_buffer, const char *header_result) {
                     }
                 }
             } else if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_MIDDLE) {
-                clear_analysis_marks();
-                if (!analysis_mode || !analysis_dragging) {
-                    draw_board();
+                clear_analysis_marks(v);
+                if (!v->analysis_mode || !analysis_dragging) {
+                    draw_board(v);
                 }
             } else if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_RIGHT) {
                 BoardView view;
-                get_board_view(&view);
-                if (begin_mark_drag(&view, e.button.x, e.button.y) && !analysis_mode) {
-                    draw_board();
+                get_board_view(v, &view);
+                if (begin_mark_drag(v, &view, e.button.x, e.button.y) && !v->analysis_mode) {
+                    draw_board(v);
                 }
             } else if (e.type == SDL_MOUSEMOTION) {
                 if (e.motion.state & SDL_BUTTON_RMASK) {
                     BoardView view;
-                    get_board_view(&view);
-                    if (update_mark_drag(&view, e.motion.x, e.motion.y) && !analysis_mode) {
-                        draw_board();
+                    get_board_view(v, &view);
+                    if (update_mark_drag(v, &view, e.motion.x, e.motion.y) && !v->analysis_mode) {
+                        draw_board(v);
                     }
                 }
-                if (analysis_mode && analysis_dragging) {
+                if (v->analysis_mode && analysis_dragging) {
                     analysis_mouse_x = e.motion.x;
                     analysis_mouse_y = e.motion.y;
                 }
-                if (guess_mode && guess_dragging) {
+                if (v->guess_mode && guess_dragging) {
                     guess_mouse_x = e.motion.x;
                     guess_mouse_y = e.motion.y;
                 }
             } else if (e.type == SDL_MOUSEBUTTONUP && e.button.button == SDL_BUTTON_RIGHT) {
-                end_mark_drag();
-            } else if (analysis_mode && e.type == SDL_MOUSEBUTTONUP && e.button.button == SDL_BUTTON_LEFT) {
+                end_mark_drag(v);
+            } else if (v->analysis_mode && e.type == SDL_MOUSEBUTTONUP && e.button.button == SDL_BUTTON_LEFT) {
                 if (analysis_dragging) {
                     analysis_mouse_x = e.button.x;
                     analysis_mouse_y = e.button.y;
                     BoardView view;
-                    get_board_view(&view);
+                    get_board_view(v, &view);
                     int r = -1;
                     int f = -1;
                     if (screen_to_board(&view, analysis_mouse_x, analysis_mouse_y, &r, &f)) {
-                        board[r][f] = analysis_piece;
+                        v->board[r][f] = analysis_piece;
                     } else {
-                        board[analysis_from_r][analysis_from_f] = analysis_piece;
+                        v->board[analysis_from_r][analysis_from_f] = analysis_piece;
                     }
                     analysis_dragging = 0;
                     analysis_piece = '.';
                 }
-            } else if (guess_mode && !analysis_mode && e.type == SDL_MOUSEBUTTONUP && e.button.button == SDL_BUTTON_LEFT) {
+            } else if (v->guess_mode && !v->analysis_mode && e.type == SDL_MOUSEBUTTONUP && e.button.button == SDL_BUTTON_LEFT) {
                 if (guess_dragging) {
                     guess_mouse_x = e.button.x;
                     guess_mouse_y = e.button.y;
                     BoardView view;
-                    get_board_view(&view);
+                    get_board_view(v, &view);
                     if (screen_to_board(&view, guess_mouse_x, guess_mouse_y, &guess_to_r, &guess_to_f)) {
                         if (guess_to_r != guess_from_r || guess_to_f != guess_from_f) {
                             guess_pending = 1;
@@ -2305,47 +11546,72 @@ int play_game(const char *move_buffer, const char *header_result) {
         if (quit) break;
 
         Uint32 speed_now = SDL_GetTicks();
-        if (!analysis_mode && speed_message_until != 0 && speed_now >= speed_message_until) {
-            speed_message_until = 0;
-            draw_board();
+        if (!v->analysis_mode && v->speed_message_until != 0 && speed_now >= v->speed_message_until) {
+            v->speed_message_until = 0;
+            draw_board(v);
         }
 
-        if (catalog_active) {
-            BoardView view;
-            get_board_view(&view);
-            render_board(&view, NULL);
+        if (v->catalog_active) {
+            draw_board(v);
             SDL_Delay(10);
             continue;
         }
 
-        if (guess_pending && index < move_count) {
+        if (puzzle && puzzle_done_at != 0) {
+            // Solved or not, the next puzzle follows without the game-over review.
+            if (SDL_GetTicks() - puzzle_done_at >= PUZZLE_PAUSE_MS) return 0;
+        } else if (guess_pending && puzzle && index == puzzle->ply) {
+            // The answer is the mined solution, which need not be the move played.
+            int is_white = (index % 2 == 0);
+            Move solution;
+            unpack_move(puzzle->move, &solution);
+            if (solution.from_r == guess_from_r && solution.from_f == guess_from_f &&
+                solution.to_r == guess_to_r && solution.to_f == guess_to_f) {
+                v->guess_score++;
+                show_status(v, "CORRECT");
+            } else {
+                char text[STATUS_TEXT_LEN];
+                snprintf(text, sizeof(text), "SOLUTION: %c%d-%c%d", 'A' + solution.from_f, 8 - solution.from_r,
+                         'A' + solution.to_f, 8 - solution.to_r);
+                v->guess_score--;
+                show_status(v, text);
+            }
+            if (animate_move(v, &solution, is_white)) {
+                quit = 1;
+                break;
+            }
+            apply_move(v->board, &solution, is_white);
+            draw_board(v);
+            puzzle_done_at = SDL_GetTicks();
+            guess_pending = 0;
+        } else if (guess_pending && index < move_count) {
             int is_white = (index % 2 == 0);
             Move expected = {0};
-            if (parse_san(moves[index], is_white, &expected)) {
+            if (parse_san(v->board, moves[index], is_white, &expected)) {
                 if (expected.from_r == guess_from_r && expected.from_f == guess_from_f &&
                     expected.to_r == guess_to_r && expected.to_f == guess_to_f) {
-                    guess_score++;
+                    v->guess_score++;
                 } else {
-                    guess_score--;
+                    v->guess_score--;
                 }
-                if (animate_move(&expected, is_white)) {
+                if (animate_move(v, &expected, is_white)) {
                     quit = 1;
                     break;
                 }
-                apply_move(&expected, is_white);
+                apply_move(v->board, &expected, is_white);
                 index++;
-                turn_is_white = (index % 2 == 0);
+                v->turn_is_white = (index % 2 == 0);
                 last_move_tick = SDL_GetTicks();
-                draw_board();
+                draw_board(v);
             } else {
                 printf("Failed to parse move: %s\n", moves[index]);
             }
             guess_pending = 0;
         }
 
-        if (analysis_mode) {
+        if (v->analysis_mode) {
             BoardView view;
-            get_board_view(&view);
+            get_board_view(v, &view);
             Overlay overlay = {0};
             if (analysis_dragging) {
                 overlay.active = 1;
@@ -2355,14 +11621,14 @@ int play_game(const char *move_buffer, const char *header_result) {
                 overlay.skip_r1 = analysis_from_r;
                 overlay.skip_f1 = analysis_from_f;
             }
-            render_board(&view, analysis_dragging ? &overlay : NULL);
+            publish_frame(v, analysis_dragging ? &overlay : NULL);
             SDL_Delay(10);
             continue;
         }
 
-        if (guess_mode) {
+        if (v->guess_mode) {
             BoardView view;
-            get_board_view(&view);
+            get_board_view(v, &view);
             Overlay overlay = {0};
             if (guess_dragging) {
                 overlay.active = 1;
@@ -2371,38 +11637,69 @@ int play_game(const char *move_buffer, const char *header_result) {
                 overlay.y = (float)guess_mouse_y - (float)view.square * 0.5f;
                 overlay.skip_r1 = guess_from_r;
                 overlay.skip_f1 = guess_from_f;
-                render_board(&view, &overlay);
+                publish_frame(v, &overlay);
             } else {
-                render_board(&view, NULL);
+                publish_frame(v, NULL);
             }
             SDL_Delay(10);
             continue;
         }
 
-        if (!paused && index < move_count) {
+        if (!paused && index < move_count && v->turbo_mode &&
+            v->turbo_delay_ms < 2 * SDL_AtomicGet(&v->frame_ms)) {
+            // Too fast for a visible slide: apply every move that came due since the last
+            // pass and publish only the resulting position.
+            Uint32 now = SDL_GetTicks();
+            Uint32 delay = (Uint32)v->turbo_delay_ms;
+            int applied = 0;
+            while (index < move_count && now - last_move_tick >= delay) {
+                int is_white = (index % 2 == 0);
+                Move m = {0};
+                if (parse_san(v->board, moves[index], is_white, &m)) {
+                    apply_move(v->board, &m, is_white);
+                } else {
+                    printf("Failed to parse move: %s\n", moves[index]);
+                }
+                index++;
+                last_move_tick += delay;
+                applied = 1;
+                if (follow_highlights(v, &plan, &index)) {
+                    last_move_tick = now;
+                    applied = 0;
+                    break;
+                }
+            }
+            if (applied) {
+                v->turn_is_white = (index % 2 == 0);
+                draw_board(v);
+            }
+        } else if (!paused && index < move_count) {
             Uint32 now = SDL_GetTicks();
-            if (now - last_move_tick >= (Uint32)move_delay_ms) {
+            if (now - last_move_tick >= (Uint32)current_move_delay(v)) {
                 int is_white = (index % 2 == 0);
                 Move m = {0};
-                if (parse_san(moves[index], is_white, &m)) {
-                    if (animate_move(&m, is_white)) {
+                if (parse_san(v->board, moves[index], is_white, &m)) {
+                    if (animate_move(v, &m, is_white)) {
                         quit = 1;
                         break;
                     }
-                    if (pause_buffered) {
+                    if (v->pause_buffered) {
                         paused = 1;
-                        dim_board = 1;
-                        pause_buffered = 0;
+                        v->dim_board = 1;
+                        v->pause_buffered = 0;
                         last_move_tick = SDL_GetTicks();
                     }
-                    apply_move(&m, is_white);
-                    draw_board();
+                    apply_move(v->board, &m, is_white);
+                    draw_board(v);
                 } else {
                     printf("Failed to parse move: %s\n", moves[index]);
                 }
                 index++;
-                turn_is_white = (index % 2 == 0);
+                v->turn_is_white = (index % 2 == 0);
                 last_move_tick = now;
+                if (follow_highlights(v, &plan, &index)) {
+                    last_move_tick = SDL_GetTicks();
+                }
             }
         } else if (index >= move_count) {
             break;
@@ -2413,24 +11710,35 @@ int play_game(const char *move_buffer, const char *header_result) {
 
     int pause_ms = 2000;
     Uint32 pause_start = SDL_GetTicks();
-    dim_board = 0;
+    v->dim_board = 0;
     if (!quit && index >= move_count) {
-        pause_ms = GAME_OVER_PAUSE_MS;
-        if (has_loser) {
-            show_loser_king = 1;
-            loser_is_white = loser_is_white_local;
-            loser_king_angle = 0.0f;
+        pause_ms = v->turbo_mode ? TURBO_GAME_OVER_PAUSE_MS : GAME_OVER_PAUSE_MS;
+        if (v->turbo_mode) {
+            // No flip in turbo; the kings are shown already turned.
+            v->show_loser_king = has_loser;
+            v->loser_is_white = loser_is_white_local;
+            v->show_draw_kings = !has_loser && is_draw;
+            v->king_anim_start = SDL_GetTicks() - KING_FLIP_MS;
+            draw_board(v);
+        } else if (has_loser) {
+            v->show_loser_king = 1;
+            v->loser_is_white = loser_is_white_local;
             Uint32 flip_start = SDL_GetTicks();
+            v->king_anim_start = flip_start;
             for (;;) {
                 Uint32 loop_now = SDL_GetTicks();
-                update_cursor_auto_hide(loop_now);
+                update_cursor_auto_hide(v, loop_now);
                 SDL_Event e;
-                while (SDL_PollEvent(&e)) {
-                    note_mouse_activity_event(&e);
-                    if (handle_catalog_event(&e, games_dir_root)) {
-                        draw_board();
-        if (game_nav_request == GAME_NAV_SELECT && catalog_selection_made) {
-            catalog_selection_made = 0;
+                while (poll_input_event(v, &e)) {
+                    note_mouse_activity_event(v, &e);
+                    if (e.type == control_event_type) {
+                        if (apply_control_batch(v, &e) & CONTROL_FX_END_GAME) quit = 1;
+                        continue;
+                    }
+                    if (handle_catalog_event(v, &e, games_dir_root)) {
+                        draw_board(v);
+        if (v->game_nav_request == GAME_NAV_SELECT && v->catalog_selection_made) {
+            v->catalog_selection_made = 0;
             quit = 1;
         }
                         continue;
@@ -2440,32 +11748,32 @@ int play_game(const char *move_buffer, const char *header_result) {
                     } else if (e.type == SDL_KEYDOWN) {
                         SDL_Keycode key = e.key.keysym.sym;
                         if (key == SDLK_q) {
-                            game_nav_request = GAME_NAV_NONE;
+                            v->game_nav_request = GAME_NAV_NONE;
                             quit = 1;
                         } else if (key == SDLK_n) {
-                            game_nav_request = GAME_NAV_NEXT;
+                            v->game_nav_request = GAME_NAV_NEXT;
                             quit = 1;
                         } else if (key == SDLK_p) {
-                            game_nav_request = GAME_NAV_PREV;
+                            v->game_nav_request = GAME_NAV_PREV;
                             quit = 1;
                         } else if (key == SDLK_r) {
-                            game_nav_request = GAME_NAV_RESTART;
+                            v->game_nav_request = GAME_NAV_RESTART;
                             quit = 1;
                         } else if (key == SDLK_c) {
-                            catalog_open(games_dir_root);
-                            draw_board();
+                            catalog_open(v, games_dir_root);
+                            draw_board(v);
                         } else if (key == SDLK_ESCAPE) {
-                            show_help = !show_help;
+                            v->show_help = !v->show_help;
                         } else if (key == SDLK_UP || key == SDLK_DOWN) {
                             Uint32 tick_now = SDL_GetTicks();
                             int delta = (key == SDLK_UP) ? MOVE_DELAY_STEP_MS : -MOVE_DELAY_STEP_MS;
-                            adjust_move_delay(delta, tick_now);
+                            adjust_move_delay(v, delta, tick_now);
                         } else if (key == SDLK_f) {
-                            view_from_white = !view_from_white;
-                            draw_board();
+                            v->view_from_white = !v->view_from_white;
+                            draw_board(v);
                         }
                     } else if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_MIDDLE) {
-                        clear_analysis_marks();
+                        clear_analysis_marks(v);
                     }
                 }
                 if (quit) break;
@@ -2473,25 +11781,28 @@ int play_game(const char *move_buffer, const char *header_result) {
                 Uint32 now = SDL_GetTicks();
                 float t = (KING_FLIP_MS > 0) ? (float)(now - flip_start) / (float)KING_FLIP_MS : 1.0f;
                 if (t > 1.0f) t = 1.0f;
-                loser_king_angle = 180.0f * t;
-                draw_board();
+                draw_board(v);
                 if (t >= 1.0f) break;
                 SDL_Delay(10);
             }
         } else if (is_draw) {
-            show_draw_kings = 1;
-            draw_king_angle = 0.0f;
+            v->show_draw_kings = 1;
             Uint32 tilt_start = SDL_GetTicks();
+            v->king_anim_start = tilt_start;
             for (;;) {
                 Uint32 loop_now = SDL_GetTicks();
-                update_cursor_auto_hide(loop_now);
+                update_cursor_auto_hide(v, loop_now);
                 SDL_Event e;
-                while (SDL_PollEvent(&e)) {
-                    note_mouse_activity_event(&e);
-                    if (handle_catalog_event(&e, games_dir_root)) {
-                        draw_board();
-                        if (game_nav_request == GAME_NAV_SELECT && catalog_selection_made) {
-                            catalog_selection_made = 0;
+                while (poll_input_event(v, &e)) {
+                    note_mouse_activity_event(v, &e);
+                    if (e.type == control_event_type) {
+                        if (apply_control_batch(v, &e) & CONTROL_FX_END_GAME) quit = 1;
+                        continue;
+                    }
+                    if (handle_catalog_event(v, &e, games_dir_root)) {
+                        draw_board(v);
+                        if (v->game_nav_request == GAME_NAV_SELECT && v->catalog_selection_made) {
+                            v->catalog_selection_made = 0;
                             quit = 1;
                         }
                         continue;
@@ -2501,32 +11812,32 @@ int play_game(const char *move_buffer, const char *header_result) {
                     } else if (e.type == SDL_KEYDOWN) {
                         SDL_Keycode key = e.key.keysym.sym;
                         if (key == SDLK_q) {
-                            game_nav_request = GAME_NAV_NONE;
+                            v->game_nav_request = GAME_NAV_NONE;
                             quit = 1;
                         } else if (key == SDLK_n) {
-                            game_nav_request = GAME_NAV_NEXT;
+                            v->game_nav_request = GAME_NAV_NEXT;
                             quit = 1;
                         } else if (key == SDLK_p) {
-                            game_nav_request = GAME_NAV_PREV;
+                            v->game_nav_request = GAME_NAV_PREV;
                             quit = 1;
                         } else if (key == SDLK_r) {
-                            game_nav_request = GAME_NAV_RESTART;
+                            v->game_nav_request = GAME_NAV_RESTART;
                             quit = 1;
                         } else if (key == SDLK_c) {
-                            catalog_open(games_dir_root);
-                            draw_board();
+                            catalog_open(v, games_dir_root);
+                            draw_board(v);
                         } else if (key == SDLK_ESCAPE) {
-                            show_help = !show_help;
+                            v->show_help = !v->show_help;
                         } else if (key == SDLK_UP || key == SDLK_DOWN) {
                             Uint32 tick_now = SDL_GetTicks();
                             int delta = (key == SDLK_UP) ? MOVE_DELAY_STEP_MS : -MOVE_DELAY_STEP_MS;
-                            adjust_move_delay(delta, tick_now);
+                            adjust_move_delay(v, delta, tick_now);
                         } else if (key == SDLK_f) {
-                            view_from_white = !view_from_white;
-                            draw_board();
+                            v->view_from_white = !v->view_from_white;
+                            draw_board(v);
                         }
                     } else if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_MIDDLE) {
-                        clear_analysis_marks();
+                        clear_analysis_marks(v);
                     }
                 }
                 if (quit) break;
@@ -2534,8 +11845,7 @@ int play_game(const char *move_buffer, const char *header_result) {
                 Uint32 now = SDL_GetTicks();
                 float t = (KING_FLIP_MS > 0) ? (float)(now - tilt_start) / (float)KING_FLIP_MS : 1.0f;
                 if (t > 1.0f) t = 1.0f;
-                draw_king_angle = 90.0f * t;
-                draw_board();
+                draw_board(v);
                 if (t >= 1.0f) break;
                 SDL_Delay(10);
             }
@@ -2548,21 +11858,40 @@ int play_game(const char *move_buffer, const char *header_result) {
     int review_index = index;
     while (!quit) {
         Uint32 now = SDL_GetTicks();
-        update_cursor_auto_hide(now);
-        if (!analysis_mode && !pause_hold && now - pause_start - pause_hold_total >= (Uint32)pause_ms) {
+        update_cursor_auto_hide(v, now);
+        shm_update_status(v, review_index);
+        tablebase_update(v, review_index);
+        novelty_update(v, review_index);
+        eval_update(v, review_index);
+        if (!v->analysis_mode && !pause_hold && now - pause_start - pause_hold_total >= (Uint32)pause_ms) {
             break;
         }
-        if (!analysis_mode && speed_message_until != 0 && now >= speed_message_until) {
-            speed_message_until = 0;
-            draw_board();
+        if (!v->analysis_mode && v->speed_message_until != 0 && now >= v->speed_message_until) {
+            v->speed_message_until = 0;
+            draw_board(v);
         }
         SDL_Event e;
-        while (SDL_PollEvent(&e)) {
-            note_mouse_activity_event(&e);
-            if (handle_catalog_event(&e, games_dir_root)) {
-                draw_board();
-                        if (game_nav_request == GAME_NAV_SELECT && catalog_selection_made) {
-                            catalog_selection_made = 0;
+        while (poll_input_event(v, &e)) {
+            note_mouse_activity_event(v, &e);
+            if (e.type == control_event_type) {
+                int fx = apply_control_batch(v, &e);
+                if (fx & CONTROL_FX_END_GAME) quit = 1;
+                if (!v->analysis_mode && (fx & CONTROL_FX_PAUSE) && !pause_hold) {
+                    pause_hold = 1;
+                    pause_hold_start = now;
+                    v->dim_board = 1;
+                } else if (!v->analysis_mode && (fx & CONTROL_FX_RESUME) && pause_hold) {
+                    pause_hold = 0;
+                    pause_hold_total += now - pause_hold_start;
+                    v->dim_board = 0;
+                }
+                draw_board(v);
+                continue;
+            }
+            if (handle_catalog_event(v, &e, games_dir_root)) {
+                draw_board(v);
+                        if (v->game_nav_request == GAME_NAV_SELECT && v->catalog_selection_made) {
+                            v->catalog_selection_made = 0;
                             quit = 1;
                         }
                 continue;
@@ -2572,32 +11901,41 @@ int play_game(const char *move_buffer, const char *header_result) {
             } else if (e.type == SDL_KEYDOWN) {
                 SDL_Keycode key = e.key.keysym.sym;
                 if (key == SDLK_q) {
-                    game_nav_request = GAME_NAV_NONE;
+                    v->game_nav_request = GAME_NAV_NONE;
                     quit = 1;
                 } else if (key == SDLK_n) {
-                    game_nav_request = GAME_NAV_NEXT;
+                    v->game_nav_request = GAME_NAV_NEXT;
                     quit = 1;
                 } else if (key == SDLK_p) {
-                    game_nav_request = GAME_NAV_PREV;
+                    v->game_nav_request = GAME_NAV_PREV;
                     quit = 1;
                 } else if (key == SDLK_r) {
-                    game_nav_request = GAME_NAV_RESTART;
+                    v->game_nav_request = GAME_NAV_RESTART;
                     quit = 1;
                 } else if (key == SDLK_c) {
-                    catalog_open(games_dir_root);
-                    draw_board();
+                    catalog_open(v, games_dir_root);
+                    draw_board(v);
                 } else if (key == SDLK_ESCAPE) {
-                    show_help = !show_help;
-                    draw_board();
+                    v->show_help = !v->show_help;
+                    draw_board(v);
                 } else if (key == SDLK_UP || key == SDLK_DOWN) {
                     Uint32 tick_now = SDL_GetTicks();
                     int delta = (key == SDLK_UP) ? MOVE_DELAY_STEP_MS : -MOVE_DELAY_STEP_MS;
-                    if (adjust_move_delay(delta, tick_now)) {
-                        draw_board();
+                    if (adjust_move_delay(v, delta, tick_now)) {
+                        draw_board(v);
+                    }
+                } else if (key == SDLK_t) {
+                    toggle_turbo(v, SDL_GetTicks());
+                    if (v->turbo_mode && pause_ms > TURBO_GAME_OVER_PAUSE_MS) {
+                        pause_ms = TURBO_GAME_OVER_PAUSE_MS;
                     }
+                    draw_board(v);
+                } else if (key == SDLK_h) {
+                    v->highlights_mode = !v->highlights_mode;
+                    draw_board(v);
                 } else if (key == SDLK_a) {
-                    if (analysis_mode) {
-                        exit_analysis_mode();
+                    if (v->analysis_mode) {
+                        exit_analysis_mode(v);
                         analysis_dragging = 0;
                         analysis_piece = '.';
                         pause_start = now;
@@ -2606,103 +11944,103 @@ int play_game(const char *move_buffer, const char *header_result) {
                             pause_hold_start = now;
                         }
                     } else {
-                        enter_analysis_mode();
+                        enter_analysis_mode(v);
                         analysis_dragging = 0;
                         analysis_piece = '.';
                     }
-                    draw_board();
-                } else if (!analysis_mode && key == SDLK_SPACE) {
+                    draw_board(v);
+                } else if (!v->analysis_mode && key == SDLK_SPACE) {
                     if (!pause_hold) {
                         pause_hold = 1;
                         pause_hold_start = now;
-                        dim_board = 1;
-                        draw_board();
+                        v->dim_board = 1;
+                        draw_board(v);
                     } else {
                         pause_hold = 0;
                         pause_hold_total += now - pause_hold_start;
-                        dim_board = 0;
-                        draw_board();
+                        v->dim_board = 0;
+                        draw_board(v);
                     }
                 } else if (key == SDLK_f) {
-                    view_from_white = !view_from_white;
-                    draw_board();
-                } else if (!analysis_mode && key == SDLK_LEFT) {
+                    v->view_from_white = !v->view_from_white;
+                    draw_board(v);
+                } else if (!v->analysis_mode && key == SDLK_LEFT) {
                     if (review_index > 0) {
                         review_index--;
-                        show_loser_king = 0;
-                        show_draw_kings = 0;
-                        replay_moves_to_index(moves, move_count, review_index);
+                        v->show_loser_king = 0;
+                        v->show_draw_kings = 0;
+                        replay_moves_to_index(v, moves, move_count, review_index);
                     }
-                } else if (!analysis_mode && key == SDLK_RIGHT) {
+                } else if (!v->analysis_mode && key == SDLK_RIGHT) {
                     if (review_index < move_count) {
                         review_index++;
-                        show_loser_king = 0;
-                        show_draw_kings = 0;
-                        replay_moves_to_index(moves, move_count, review_index);
+                        v->show_loser_king = 0;
+                        v->show_draw_kings = 0;
+                        replay_moves_to_index(v, moves, move_count, review_index);
                     }
                 }
-            } else if (analysis_mode && e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT) {
+            } else if (v->analysis_mode && e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT) {
                 BoardView view;
-                get_board_view(&view);
+                get_board_view(v, &view);
                 int r = -1;
                 int f = -1;
                 if (screen_to_board(&view, e.button.x, e.button.y, &r, &f)) {
-                    if (board[r][f] != '.') {
+                    if (v->board[r][f] != '.') {
                         analysis_dragging = 1;
-                        analysis_piece = board[r][f];
+                        analysis_piece = v->board[r][f];
                         analysis_from_r = r;
                         analysis_from_f = f;
                         analysis_mouse_x = e.button.x;
                         analysis_mouse_y = e.button.y;
-                        board[r][f] = '.';
+                        v->board[r][f] = '.';
                     }
                 }
             } else if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_MIDDLE) {
-                clear_analysis_marks();
-                if (!analysis_mode || !analysis_dragging) {
-                    draw_board();
+                clear_analysis_marks(v);
+                if (!v->analysis_mode || !analysis_dragging) {
+                    draw_board(v);
                 }
             } else if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_RIGHT) {
                 BoardView view;
-                get_board_view(&view);
-                if (begin_mark_drag(&view, e.button.x, e.button.y) && !analysis_mode) {
-                    draw_board();
+                get_board_view(v, &view);
+                if (begin_mark_drag(v, &view, e.button.x, e.button.y) && !v->analysis_mode) {
+                    draw_board(v);
                 }
             } else if (e.type == SDL_MOUSEMOTION) {
                 if (e.motion.state & SDL_BUTTON_RMASK) {
                     BoardView view;
-                    get_board_view(&view);
-                    if (update_mark_drag(&view, e.motion.x, e.motion.y) && !analysis_mode) {
-                        draw_board();
+                    get_board_view(v, &view);
+                    if (update_mark_drag(v, &view, e.motion.x, e.motion.y) && !v->analysis_mode) {
+                        draw_board(v);
                     }
                 }
-                if (analysis_mode && analysis_dragging) {
+                if (v->analysis_mode && analysis_dragging) {
                     analysis_mouse_x = e.motion.x;
                     analysis_mouse_y = e.motion.y;
                 }
             } else if (e.type == SDL_MOUSEBUTTONUP && e.button.button == SDL_BUTTON_RIGHT) {
-                end_mark_drag();
-            } else if (analysis_mode && e.type == SDL_MOUSEBUTTONUP && e.button.button == SDL_BUTTON_LEFT) {
+                end_mark_drag(v);
+            } else if (v->analysis_mode && e.type == SDL_MOUSEBUTTONUP && e.button.button == SDL_BUTTON_LEFT) {
                 if (analysis_dragging) {
                     analysis_mouse_x = e.button.x;
                     analysis_mouse_y = e.button.y;
                     BoardView view;
-                    get_board_view(&view);
+                    get_board_view(v, &view);
                     int r = -1;
                     int f = -1;
                     if (screen_to_board(&view, analysis_mouse_x, analysis_mouse_y, &r, &f)) {
-                        board[r][f] = analysis_piece;
+                        v->board[r][f] = analysis_piece;
                     } else {
-                        board[analysis_from_r][analysis_from_f] = analysis_piece;
+                        v->board[analysis_from_r][analysis_from_f] = analysis_piece;
                     }
                     analysis_dragging = 0;
                     analysis_piece = '.';
                 }
             }
         }
-        if (analysis_mode) {
+        if (v->analysis_mode) {
             BoardView view;
-            get_board_view(&view);
+            get_board_view(v, &view);
             Overlay overlay = {0};
             if (analysis_dragging) {
                 overlay.active = 1;
@@ -2712,58 +12050,33 @@ int play_game(const char *move_buffer, const char *header_result) {
                 overlay.skip_r1 = analysis_from_r;
                 overlay.skip_f1 = analysis_from_f;
             }
-            render_board(&view, analysis_dragging ? &overlay : NULL);
+            publish_frame(v, analysis_dragging ? &overlay : NULL);
             SDL_Delay(10);
             continue;
         }
         if (!quit && review_index == move_count) {
             if (has_loser) {
-                show_loser_king = 1;
-                show_draw_kings = 0;
-                draw_board();
+                v->show_loser_king = 1;
+                v->show_draw_kings = 0;
+                draw_board(v);
             } else if (is_draw) {
-                show_draw_kings = 1;
-                show_loser_king = 0;
-                draw_board();
+                v->show_draw_kings = 1;
+                v->show_loser_king = 0;
+                draw_board(v);
             }
         }
         SDL_Delay(10);
     }
-    show_loser_king = 0;
-    show_draw_kings = 0;
-    dim_board = 0;
+    v->show_loser_king = 0;
+    v->show_draw_kings = 0;
+    v->dim_board = 0;
     return quit;
 }
 
-int main(int argc, char *argv[]) {
-    const char *games_dir = DEFAULT_GAMES_DIR;
-    (void)argc;
-    (void)argv;
-    games_dir_root = games_dir;
-
-    // Initialize SDL
-    if (SDL_Init(SDL_INIT_VIDEO) < 0 || !(IMG_Init(IMG_INIT_PNG) & IMG_INIT_PNG)) {
-        printf("SDL init error: %s\n", SDL_GetError());
-        return 1;
-    }
-
-    window = SDL_CreateWindow("Chess Viewer", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-                              SCREEN_SIZE, SCREEN_SIZE, SDL_WINDOW_SHOWN | SDL_WINDOW_FULLSCREEN_DESKTOP);
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-    if (!window || !renderer) {
-        printf("SDL window/renderer error: %s\n", SDL_GetError());
-        SDL_Quit();
-        return 1;
-    }
-    analysis_cursor = create_analysis_cursor();
-    if (!analysis_cursor) {
-        analysis_cursor = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_CROSSHAIR);
-    }
-    set_cursor_visible(1);
-    note_mouse_activity(SDL_GetTicks());
-
-    srand((unsigned int)time(NULL));
-
+// Runs the playback state machine. Everything here only publishes snapshots and
+// drains input; all SDL video calls stay on the main thread.
+static int logic_thread_main(void *data) {
+    Viewer *v = (Viewer *)data;
     GameSelection *history = NULL;
     int history_count = 0;
     int history_cap = 0;
@@ -2771,20 +12084,55 @@ int main(int argc, char *argv[]) {
     int need_new_selection = 1;
     int keep_view = 0;
     int quit = 0;
+    PreparedGame prepared;
+    int have_prepared = 0;
     while (!quit) {
         if (need_new_selection) {
             GameSelection sel = {0};
-            if (forced_pgn_path) {
-                sel.path = copy_string(forced_pgn_path);
+            sel.puzzle = -1;
+            if (puzzle_mode) {
+                // Puzzles come straight from the index; the game is read at its offset.
+                sel.puzzle = (int)((((Uint32)viewer_rand(v) << 15) ^ (Uint32)viewer_rand(v)) % puzzles.count);
+                const PuzzleRecord *puzzle = &puzzles.records[sel.puzzle];
+                if (!index_load_game(puzzles.index, puzzle->game, &sel.path, &prepared.game)) {
+                    SDL_Delay(100);
+                    continue;
+                }
+                sel.game_index = index_game_ordinal(puzzles.index, puzzle->game);
+                have_prepared = 1;
+            } else if (v->forced_pgn_path) {
+                sel.path = copy_string(v->forced_pgn_path);
                 sel.game_index = -1;
+            } else if (v->playlist_count > 0) {
+                sel.path = playlist_entry_path(v->playlist[v->playlist_pos], &sel.game_index);
+                v->playlist_pos = (v->playlist_pos + 1) % v->playlist_count;
+            } else if (matchup_players[0]) {
+                // Each index version carries its own matchup, so the pick and the load agree.
+                CorpusIndex *ix = index_acquire();
+                Uint32 game_id =
+                    ix->matchup_games[(((Uint32)viewer_rand(v) << 15) ^ (Uint32)viewer_rand(v)) % (Uint32)ix->matchup_count];
+                int loaded = index_load_game(ix, game_id, &sel.path, &prepared.game);
+                if (loaded) sel.game_index = index_game_ordinal(ix, game_id);
+                index_release(ix);
+                if (!loaded) {
+                    SDL_Delay(100);
+                    continue;
+                }
+                have_prepared = 1;
             } else {
-                if (!choose_random_selection(games_dir, &sel)) {
-                    printf("No PGN files found in %s\n", games_dir);
+                int status = prefetch_take(&prepared);
+                if (status <= 0) {
+                    if (status < 0) printf("No PGN files found in %s\n", games_dir_root);
                     break;
                 }
+                sel.path = copy_string(prepared.path);
+                sel.game_index = prepared.game_index;
+                free(prepared.path);
+                prepared.path = NULL;
+                have_prepared = 1;
             }
             if (!sel.path) {
-                printf("No PGN files found in %s\n", games_dir);
+                printf("No PGN files found in %s\n", games_dir_root);
                 break;
             }
             if (!push_selection(&history, &history_count, &history_cap, sel)) {
@@ -2802,52 +12150,43 @@ int main(int argc, char *argv[]) {
         }
 
         GameSelection *sel = &history[history_pos];
-        FILE *fp = fopen(sel->path, "r");
-        if (!fp) {
-            printf("Failed to open %s\n", sel->path);
-            SDL_Delay(500);
-            need_new_selection = 1;
-            continue;
-        }
-
-        Game *games = NULL;
-        int game_count = load_games(fp, &games);
-        fclose(fp);
-        if (game_count <= 0) {
-            if (game_count < 0) {
-                printf("Failed to load games from PGN.\n");
+        Game loaded;
+        Game *game = NULL;
+        if (have_prepared) {
+            // Fresh random picks arrive already decoded from the prefetch pool.
+            game = &prepared.game;
+            have_prepared = 0;
+        } else {
+            if (load_source_game(sel->path, &sel->game_index, &v->rng_state, &loaded) <= 0) {
+                drop_failed_source(v);
+                SDL_Delay(500);
+                need_new_selection = 1;
+                continue;
             }
-            free_games(games, game_count);
-            SDL_Delay(500);
-            need_new_selection = 1;
-            continue;
-        }
-
-        if (sel->game_index < 0 || sel->game_index >= game_count) {
-            sel->game_index = rand() % game_count;
-        }
-        int game_index = sel->game_index;
-        set_last_name(current_white_name, sizeof(current_white_name), games[game_index].white);
-        if (current_white_name[0] == '\0') {
-            strncpy(current_white_name, games[game_index].white, NAME_LEN - 1);
-            current_white_name[NAME_LEN - 1] = '\0';
+            v->playlist_failures = 0;
+            game = &loaded;
         }
-        set_last_name(current_black_name, sizeof(current_black_name), games[game_index].black);
-        if (current_black_name[0] == '\0') {
-            strncpy(current_black_name, games[game_index].black, NAME_LEN - 1);
-            current_black_name[NAME_LEN - 1] = '\0';
-        }
-        strncpy(current_game_year, games[game_index].year, YEAR_LEN - 1);
-        current_game_year[YEAR_LEN - 1] = '\0';
+        set_display_name(v->current_white_name, game->white);
+        set_display_name(v->current_black_name, game->black);
+        strncpy(v->current_game_year, game->year, YEAR_LEN - 1);
+        v->current_game_year[YEAR_LEN - 1] = '\0';
         if (!keep_view) {
-            view_from_white = (rand() % 2) ? 1 : 0;
+            v->view_from_white = (viewer_rand(v) % 2) ? 1 : 0;
         }
         keep_view = 0;
-        int stop = play_game(games[game_index].moves, games[game_index].result);
-        free_games(games, game_count);
-
-        int nav = game_nav_request;
-        game_nav_request = GAME_NAV_NONE;
+        v->current_game_path = sel->path;
+        v->current_game_ordinal = sel->game_index;
+        v->puzzle = sel->puzzle;
+        v->novelty_ply = index_novelty(sel->path, sel->game_index);
+        v->novelty_seen_ply = -1;
+        HighlightPlan plan;
+        int have_plan = index_highlights(sel->path, sel->game_index, &plan);
+        int stop = play_game(v, game->moves, game->result, have_plan ? &plan : NULL);
+        v->current_game_path = NULL;
+        free(game->moves);
+
+        int nav = v->game_nav_request;
+        v->game_nav_request = GAME_NAV_NONE;
         if (stop && nav == GAME_NAV_NONE) {
             quit = 1;
             break;
@@ -2889,21 +12228,754 @@ int main(int argc, char *argv[]) {
         free(history[i].path);
     }
     free(history);
-    catalog_free();
-    free(forced_pgn_path);
+    if (have_prepared) free(prepared.game.moves);
+    free_ply_cache(&v->ply_cache);
+    catalog_free(v);
+    free(v->forced_pgn_path);
+    free_string_list(v->playlist, v->playlist_count);
+
+    SDL_AtomicSet(&v->logic_finished, 1);
+    return 0;
+}
+
+static int display_refresh_ms(Viewer *v) {
+    SDL_DisplayMode mode;
+    int display = SDL_GetWindowDisplayIndex(v->window);
+    if (display >= 0 && SDL_GetCurrentDisplayMode(display, &mode) == 0 && mode.refresh_rate > 0) {
+        return 1000 / mode.refresh_rate;
+    }
+    return 1000 / 60;
+}
+
+// Main thread: redraws one window when its snapshot, layout, or a running animation
+// changed. Returns 1 if a frame was presented.
+static int render_viewer(Viewer *v, Uint32 now) {
+    int dirty = SDL_AtomicSet(&v->layout_dirty, 0);
+    if (dirty || !v->render_cache.valid) {
+        invalidate_render_cache(v, dirty == 2);
+        refresh_layout_cache(v);
+        v->refresh_ms = display_refresh_ms(v);
+        SDL_AtomicSet(&v->frame_ms, v->refresh_ms);
+        v->needs_redraw = 1;
+    }
+
+    if (take_latest_snapshot(&v->frame_buffer)) {
+        v->have_frame = 1;
+        v->needs_redraw = 1;
+    }
+    const FrameSnapshot *snap = &v->frame_buffer.slots[v->frame_buffer.front];
+    int animating = v->have_frame && snapshot_is_animating(snap, now);
+    // One more frame after an animation ends so its final state is shown.
+    if (animating || v->was_animating) v->needs_redraw = 1;
+    v->was_animating = animating;
+    if (!v->needs_redraw) return 0;
+
+    if (v->have_frame) {
+        BoardView view = v->render_cache.view;
+        view.from_white = snap->view_from_white;
+        render_frame(v, &view, snap);
+    } else {
+        SDL_SetRenderDrawColor(v->renderer, 50, 50, 50, 255);
+        SDL_RenderClear(v->renderer);
+    }
+    shm_publish_frame(v);
+    SDL_RenderPresent(v->renderer);
+    v->needs_redraw = 0;
+    return 1;
+}
+
+// Main thread: pumps events and paces every window against its own display until the
+// logic threads finish. A lone window rides vsync; several windows on one thread would
+// wait on each other's vsync, so those are presented on a timer at their display's rate.
+static void render_loop(void) {
+    int shown_cursor = -1;
+    int quitting = 0;
+    for (;;) {
+        SDL_Event e;
+        while (SDL_PollEvent(&e)) {
+            route_event(&e);
+        }
+        control_poll();
+
+        int running = 0;
+        for (int i = 0; i < viewer_count; i++) {
+            if (!SDL_AtomicGet(&viewers[i].logic_finished)) running++;
+        }
+        if (running == 0) break;
+        if (running < viewer_count && !quitting) {
+            // One stream ended the session; take the other windows down with it.
+            request_quit_all();
+            quitting = 1;
+        }
+
+        // There is a single mouse cursor, so it follows the window under the mouse.
+        SDL_Window *focus = SDL_GetMouseFocus();
+        Viewer *cursor_owner = focus ? find_viewer(SDL_GetWindowID(focus)) : NULL;
+        if (!cursor_owner) cursor_owner = &viewers[0];
+        int wanted_cursor = SDL_AtomicGet(&cursor_owner->cursor_wanted);
+        if (wanted_cursor != shown_cursor) {
+            apply_cursor_visible(wanted_cursor);
+            shown_cursor = wanted_cursor;
+        }
+
+        Uint32 now = SDL_GetTicks();
+        Uint32 next_due = now + 1000 / 60;
+        int waited_on_vsync = 0;
+        for (int i = 0; i < viewer_count; i++) {
+            Viewer *v = &viewers[i];
+            if (v->has_vsync || (Sint32)(now - v->next_frame_due) >= 0) {
+                if (render_viewer(v, now) && v->has_vsync) waited_on_vsync = 1;
+                v->next_frame_due += (Uint32)v->refresh_ms;
+                if ((Sint32)(now - v->next_frame_due) >= 0) v->next_frame_due = now + (Uint32)v->refresh_ms;
+            }
+            if ((Sint32)(v->next_frame_due - next_due) < 0) next_due = v->next_frame_due;
+        }
+        if (!waited_on_vsync) {
+            Sint32 wait = (Sint32)(next_due - SDL_GetTicks());
+            SDL_Delay(wait > 0 ? (Uint32)wait : 1);
+        }
+    }
+}
+
+// Terminal renderer (--terminal): draws the same snapshots as render_viewer into a grid
+// of character cells and writes only the cells that changed since the last frame, so a
+// move costs a few dozen bytes of cursor moves and colour changes over SSH.
+typedef struct {
+    char ch;
+    Uint8 bold;
+    Uint16 fg;
+    Uint16 bg;
+} TermCell;
+
+typedef struct {
+    TermCell cells[TERM_ROWS][TERM_COLS];
+    TermCell shown[TERM_ROWS][TERM_COLS];
+    int have_shown;
+    char out[TERM_OUT_LEN];
+    int out_len;
+#ifdef _WIN32
+    DWORD saved_mode;
+#else
+    struct termios saved;
+    int have_saved;
+#endif
+} TerminalState;
+
+TerminalState term;
+
+static void term_put(int row, int col, const char *text, Uint16 fg, Uint16 bg, int bold) {
+    for (; *text && col < TERM_COLS; text++, col++) {
+        if (row < 0 || row >= TERM_ROWS || col < 0) continue;
+        TermCell *c = &term.cells[row][col];
+        c->ch = (*text >= 32 && *text < 127) ? *text : '?';
+        c->fg = fg;
+        c->bg = bg;
+        c->bold = (Uint8)bold;
+    }
+}
+
+static void term_draw_board(int row, int col, const char b[BOARD_SIZE][BOARD_SIZE], int from_white,
+                            int dim, const signed char *squares) {
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        int r = from_white ? i : BOARD_SIZE - 1 - i;
+        char rank[2] = {(char)('8' - r), '\0'};
+        term_put(row + i, col, rank, TERM_LABEL_FG, TERM_DEFAULT_COLOR, 0);
+        for (int j = 0; j < BOARD_SIZE; j++) {
+            int f = from_white ? j : BOARD_SIZE - 1 - j;
+            int light = ((r + f) % 2 == 0);
+            Uint16 bg = light ? (dim ? TERM_DIM_LIGHT_BG : TERM_LIGHT_BG) : (dim ? TERM_DIM_DARK_BG : TERM_DARK_BG);
+            if (squares && ((squares[0] == r && squares[1] == f) || (squares[2] == r && squares[3] == f))) {
+                bg = TERM_MARK_BG;
+            }
+            char piece = b[r][f];
+            char text[4] = {' ', piece == '.' ? ' ' : piece, ' ', '\0'};
+            int white = isupper((unsigned char)piece);
+            term_put(row + i, col + 2 + j * 3, text, white ? TERM_WHITE_FG : TERM_BLACK_FG, bg, white);
+        }
+    }
+    for (int j = 0; j < BOARD_SIZE; j++) {
+        char file[2] = {(char)(from_white ? 'a' + j : 'h' - j), '\0'};
+        term_put(row + BOARD_SIZE, col + 3 + j * 3, file, TERM_LABEL_FG, TERM_DEFAULT_COLOR, 0);
+    }
+}
+
+static void term_draw_names(int row, int col, const char *white, const char *black, int from_white,
+                            int bottom_row) {
+    const char *top = from_white ? black : white;
+    const char *bottom = from_white ? white : black;
+    term_put(row, col + 2, top, TERM_TEXT_FG, TERM_DEFAULT_COLOR, 0);
+    term_put(bottom_row, col + 2, bottom, TERM_TEXT_FG, TERM_DEFAULT_COLOR, 0);
+}
+
+// Rebuilds the whole grid from a snapshot; diffing keeps that from costing output.
+static void term_compose(const FrameSnapshot *snap, Uint32 now) {
+    for (int r = 0; r < TERM_ROWS; r++) {
+        for (int c = 0; c < TERM_COLS; c++) {
+            term.cells[r][c].ch = ' ';
+            term.cells[r][c].bold = 0;
+            term.cells[r][c].fg = TERM_DEFAULT_COLOR;
+            term.cells[r][c].bg = TERM_DEFAULT_COLOR;
+        }
+    }
+
+    term_put(0, 0, snap->year, TERM_TEXT_FG, TERM_DEFAULT_COLOR, 1);
+    const char *mode = NULL;
+    if (snap->turbo_mode && snap->highlights_mode) {
+        mode = "TURBO HIGHLIGHTS";
+    } else if (snap->turbo_mode) {
+        mode = "TURBO";
+    } else if (snap->highlights_mode) {
+        mode = "HIGHLIGHTS";
+    }
+    if (mode) term_put(0, 2 + BOARD_SIZE * 3 - (int)strlen(mode), mode, TERM_TEXT_FG, TERM_DEFAULT_COLOR, 1);
+    if (snap->dim_board && !snap->catalog_active) term_put(0, 6, "PAUSED", TERM_LABEL_FG, TERM_DEFAULT_COLOR, 0);
+
+    const char *white = (snap->white_name[0] != '\0') ? snap->white_name : "White";
+    const char *black = (snap->black_name[0] != '\0') ? snap->black_name : "Black";
+    if (snap->catalog_active) {
+        // Keep the highlighted line in view; the list scrolls a board's height at a time.
+        int visible = BOARD_SIZE + 2;
+        int first = (snap->catalog_highlight / visible) * visible;
+        for (int i = 0; i < visible && first + i < snap->catalog_line_count; i++) {
+            int selected = (first + i == snap->catalog_highlight);
+            term_put(1 + i, 0, selected ? ">" : " ", TERM_TEXT_FG, TERM_DEFAULT_COLOR, 1);
+            term_put(1 + i, 2, snap->catalog_lines[first + i], selected ? TERM_BLACK_FG : TERM_TEXT_FG,
+                     selected ? TERM_LIGHT_BG : TERM_DEFAULT_COLOR, selected);
+        }
+    } else {
+        term_draw_names(1, 0, white, black, snap->view_from_white, BOARD_SIZE + 3);
+        term_draw_board(2, 0, snap->board, snap->view_from_white, snap->dim_board,
+                        snap->split_active ? snap->split_squares[0] : NULL);
+        if (snap->split_active) {
+            int col = TERM_SPLIT_COL;
+            term_draw_names(1, col, snap->split_white_name, snap->split_black_name, snap->view_from_white,
+                            BOARD_SIZE + 3);
+            term_draw_board(2, col, snap->split_board, snap->view_from_white, snap->dim_board,
+                            snap->split_squares[1]);
+            term_put(0, col + 2, snap->split_year, TERM_TEXT_FG, TERM_DEFAULT_COLOR, 1);
+        } else {
+            const char *side = snap->turn_is_white ? "white to move" : "black to move";
+            if (snap->white_in_check || snap->black_in_check) side = snap->white_in_check ? "white in check" : "black in check";
+            term_put(2, TERM_SPLIT_COL, side, TERM_LABEL_FG, TERM_DEFAULT_COLOR, 0);
+            if (snap->guess_mode) {
+                char score[32];
+                snprintf(score, sizeof(score), "Score: %d", snap->guess_score);
+                term_put(3, TERM_SPLIT_COL, score, TERM_TEXT_FG, TERM_DEFAULT_COLOR, 1);
+            }
+            if (snap->tb_text[0]) term_put(4, TERM_SPLIT_COL, snap->tb_text, TERM_LABEL_FG, TERM_DEFAULT_COLOR, 0);
+            if (snap->eval_text[0]) term_put(5, TERM_SPLIT_COL, snap->eval_text, TERM_LABEL_FG, TERM_DEFAULT_COLOR, 0);
+        }
+    }
+
+    char line[64];
+    line[0] = '\0';
+    if (snap->split_active) {
+        snprintf(line, sizeof(line), "SAME POSITION UNTIL MOVE %d", snap->split_move_number);
+    }
+    if (snap->speed_message_until != 0 && (Sint32)(now - snap->speed_message_until) < 0) {
+        int whole = snap->move_delay_ms / 1000;
+        int rem = snap->move_delay_ms % 1000;
+        if (snap->turbo_mode) {
+            snprintf(line, sizeof(line), "Turbo: %d moves/second", 1000 / snap->move_delay_ms);
+        } else if (rem == 0) {
+            snprintf(line, sizeof(line), "%d %s/move", whole, (whole == 1) ? "second" : "seconds");
+        } else {
+            snprintf(line, sizeof(line), "%d.%d seconds/move", whole, rem / 100);
+        }
+    }
+    if (snap->status_until != 0 && snap->status_text[0] != '\0' && (Sint32)(now - snap->status_until) < 0) {
+        snprintf(line, sizeof(line), "%s", snap->status_text);
+    }
+    term_put(BOARD_SIZE + 4, 0, line, TERM_TEXT_FG, TERM_DEFAULT_COLOR, 1);
+}
+
+static void term_emit(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(term.out + term.out_len, sizeof(term.out) - (size_t)term.out_len, fmt, args);
+    va_end(args);
+    if (n > 0 && term.out_len + n < (int)sizeof(term.out)) term.out_len += n;
+}
+
+static void term_flush(void) {
+    if (term.out_len == 0) return;
+    fwrite(term.out, 1, (size_t)term.out_len, stdout);
+    fflush(stdout);
+    term.out_len = 0;
+}
+
+// Writes the cells that differ from what is on screen. The cursor and the current
+// attributes are tracked so runs of changed cells need no repositioning or SGR.
+static void term_present(void) {
+    int cur_row = -1;
+    int cur_col = -1;
+    int have_attr = 0;
+    TermCell attr = {0};
+    for (int r = 0; r < TERM_ROWS; r++) {
+        for (int c = 0; c < TERM_COLS; c++) {
+            const TermCell *cell = &term.cells[r][c];
+            if (term.have_shown && memcmp(cell, &term.shown[r][c], sizeof(*cell)) == 0) continue;
+            if (r != cur_row || c != cur_col) term_emit("\x1b[%d;%dH", r + 1, c + 1);
+            if (!have_attr || cell->fg != attr.fg || cell->bg != attr.bg || cell->bold != attr.bold) {
+                term_emit("\x1b[0%s", cell->bold ? ";1" : "");
+                if (cell->fg != TERM_DEFAULT_COLOR) term_emit(";38;5;%u", (unsigned int)cell->fg);
+                if (cell->bg != TERM_DEFAULT_COLOR) term_emit(";48;5;%u", (unsigned int)cell->bg);
+                term_emit("m");
+                attr = *cell;
+                have_attr = 1;
+            }
+            term_emit("%c", cell->ch);
+            cur_row = r;
+            cur_col = c + 1;
+            // Leave headroom so a frame never overflows the buffer mid-sequence.
+            if (term.out_len > TERM_OUT_LEN - 64) term_flush();
+        }
+    }
+    if (have_attr) term_emit("\x1b[0m\x1b[%d;1H", TERM_ROWS + 1);
+    memcpy(term.shown, term.cells, sizeof(term.shown));
+    term.have_shown = 1;
+    term_flush();
+}
+
+static int term_open(void) {
+#ifdef _WIN32
+    HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode = 0;
+    if (!GetConsoleMode(out, &mode) ||
+        !SetConsoleMode(out, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING)) {
+        printf("This console does not support ANSI output\n");
+        return 0;
+    }
+    term.saved_mode = mode;
+#else
+    if (tcgetattr(STDIN_FILENO, &term.saved) == 0) {
+        struct termios raw = term.saved;
+        raw.c_lflag &= ~(tcflag_t)(ICANON | ECHO | ISIG);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+        term.have_saved = 1;
+    }
+#endif
+    term.have_shown = 0;
+    term_emit("\x1b[?25l\x1b[2J");
+    term_flush();
+    return 1;
+}
+
+static void term_close(void) {
+    term_emit("\x1b[0m\x1b[%d;1H\x1b[?25h\n", TERM_ROWS + 1);
+    term_flush();
+#ifdef _WIN32
+    SetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), term.saved_mode);
+#else
+    if (term.have_saved) tcsetattr(STDIN_FILENO, TCSANOW, &term.saved);
+#endif
+}
+
+static void term_push_key(SDL_Keycode key) {
+    SDL_Event e;
+    memset(&e, 0, sizeof(e));
+    e.type = SDL_KEYDOWN;
+    e.key.keysym.sym = key;
+    push_input_event(&viewers[0], &e);
+}
+
+// Turns pending keyboard bytes into key events for the first viewer. Arrow keys arrive
+// as ESC [ A..D; a lone ESC is the escape key. Ctrl-C quits since ISIG is off.
+static void term_poll_keys(void) {
+#ifdef _WIN32
+    while (_kbhit()) {
+        int ch = _getch();
+        if (ch == 0 || ch == 0xE0) {
+            int code = _getch();
+            if (code == 72) term_push_key(SDLK_UP);
+            else if (code == 80) term_push_key(SDLK_DOWN);
+            else if (code == 75) term_push_key(SDLK_LEFT);
+            else if (code == 77) term_push_key(SDLK_RIGHT);
+            continue;
+        }
+        if (ch == 3) {
+            request_quit_all();
+        } else if (ch == '\r') {
+            term_push_key(SDLK_RETURN);
+        } else {
+            term_push_key((SDL_Keycode)tolower(ch));
+        }
+    }
+#else
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN)) return;
+    unsigned char buf[64];
+    ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+    for (ssize_t i = 0; i < n; i++) {
+        unsigned char ch = buf[i];
+        if (ch == 27 && i + 2 < n && (buf[i + 1] == '[' || buf[i + 1] == 'O')) {
+            unsigned char code = buf[i + 2];
+            i += 2;
+            if (code == 'A') term_push_key(SDLK_UP);
+            else if (code == 'B') term_push_key(SDLK_DOWN);
+            else if (code == 'C') term_push_key(SDLK_RIGHT);
+            else if (code == 'D') term_push_key(SDLK_LEFT);
+            else if ((code == '5' || code == '6') && i + 1 < n && buf[i + 1] == '~') {
+                term_push_key(code == '5' ? SDLK_PAGEUP : SDLK_PAGEDOWN);
+                i++;
+            }
+        } else if (ch == 3) {
+            request_quit_all();
+        } else if (ch == '\r' || ch == '\n') {
+            term_push_key(SDLK_RETURN);
+        } else if (ch == 27) {
+            term_push_key(SDLK_ESCAPE);
+        } else if (ch >= 32 && ch < 127) {
+            term_push_key((SDL_Keycode)tolower(ch));
+        }
+    }
+#endif
+}
+
+// Main thread in terminal mode: stands in for render_loop with one viewer and no window.
+// The grid is recomposed every tick so timed labels expire on their own; only changed
+// cells are written.
+static void terminal_loop(void) {
+    Viewer *v = &viewers[0];
+    SDL_AtomicSet(&v->output_size, (SCREEN_SIZE << 16) | SCREEN_SIZE);
+    while (!SDL_AtomicGet(&v->logic_finished)) {
+        term_poll_keys();
+        control_poll();
+        if (take_latest_snapshot(&v->frame_buffer)) v->have_frame = 1;
+        if (v->have_frame) {
+            term_compose(&v->frame_buffer.slots[v->frame_buffer.front], SDL_GetTicks());
+            term_present();
+        }
+        SDL_Delay(TERM_TICK_MS);
+    }
+}
+
+static void viewer_init(Viewer *v, int index) {
+    memset(v, 0, sizeof(*v));
+    v->index = index;
+    v->rng_state = (unsigned int)time(NULL) ^ (0x9E3779B9u * (unsigned int)(index + 1));
+    v->view_size_cached = -1;
+    strcpy(v->current_white_name, "White");
+    strcpy(v->current_black_name, "Black");
+    v->view_from_white = 1;
+    v->move_delay_ms = MOVE_DELAY_MS;
+    v->turbo_mode = start_in_turbo;
+    v->turbo_delay_ms = TURBO_DELAY_MS;
+    v->highlights_mode = start_in_highlights;
+    v->turn_is_white = 1;
+    v->game_nav_request = GAME_NAV_NONE;
+    v->mark_drag_value = 1;
+    v->mark_last_r = -1;
+    v->mark_last_f = -1;
+    v->cursor_visible = 1;
+    v->refresh_ms = 1000 / 60;
+    v->frame_buffer.back = 0;
+    v->frame_buffer.front = 2;
+    SDL_AtomicSet(&v->frame_buffer.middle, 1);
+    SDL_AtomicSet(&v->cursor_wanted, 1);
+    SDL_AtomicSet(&v->frame_ms, v->refresh_ms);
+}
+
+static void viewer_destroy(Viewer *v) {
+    SDL_Event e;
+    while (poll_input_event(v, &e)) {
+        if (e.type == control_event_type) free(e.user.data1);
+    }
+    invalidate_render_cache(v, 1);
+    if (v->renderer) SDL_DestroyRenderer(v->renderer);
+    if (v->window) SDL_DestroyWindow(v->window);
+    v->renderer = NULL;
+    v->window = NULL;
+}
+
+int main(int argc, char *argv[]) {
+    const char *games_dir = DEFAULT_GAMES_DIR;
+    int windowed = 0;
+    int all_displays = 0;
+    int build_only = 0;
+    const char *slice_list = NULL;
+    char **merge_paths = NULL;
+    int merge_count = 0;
+    int mine_only = 0;
+    int top_positions = 0;
+    int interesting = 0;
+    const char *find_player = NULL;
+    const char *find_fen = NULL;
+    const char *vs_a = NULL;
+    const char *vs_b = NULL;
+    const char *top_in = NULL;
+    const char *control_path = NULL;
+    const char *shm_name = NULL;
+    int shm_frames = 0;
+    int terminal_mode = 0;
+    int syzygy_check = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--windowed") == 0) {
+            windowed = 1;
+        } else if (strcmp(argv[i], "--all-displays") == 0) {
+            all_displays = 1;
+        } else if (strcmp(argv[i], "--turbo") == 0) {
+            start_in_turbo = 1;
+        } else if (strcmp(argv[i], "--highlights") == 0) {
+            start_in_highlights = 1;
+        } else if (strcmp(argv[i], "--build-index") == 0) {
+            build_only = 1;
+        } else if (strcmp(argv[i], "--index-slice") == 0 && i + 1 < argc) {
+            slice_list = argv[++i];
+        } else if (strcmp(argv[i], "--merge-index") == 0 && i + 1 < argc) {
+            merge_paths = &argv[i + 1];
+            while (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                merge_count++;
+                i++;
+            }
+            if (merge_count == 0) {
+                printf("--merge-index needs the .slice files written by --index-slice\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--control") == 0 && i + 1 < argc) {
+            control_path = argv[++i];
+        } else if (strcmp(argv[i], "--terminal") == 0) {
+            terminal_mode = 1;
+        } else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+            shm_name = argv[++i];
+        } else if (strcmp(argv[i], "--shm-frames") == 0) {
+            shm_frames = 1;
+        } else if (strcmp(argv[i], "--syzygy") == 0 && i + 1 < argc) {
+            if (!tb_init(argv[++i])) {
+                printf("--syzygy needs at least one directory\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--syzygy-check") == 0) {
+            syzygy_check = 1;
+        } else if (strcmp(argv[i], "--mine-puzzles") == 0) {
+            mine_only = 1;
+        } else if (strcmp(argv[i], "--top-positions") == 0 && i + 1 < argc) {
+            top_positions = atoi(argv[++i]);
+            if (top_positions < 1) top_positions = 1;
+        } else if (strcmp(argv[i], "--top-in") == 0 && i + 1 < argc) {
+            top_in = argv[++i];
+        } else if (strcmp(argv[i], "--interesting") == 0) {
+            interesting = 1;
+        } else if (strcmp(argv[i], "--interest-weights") == 0 && i + 1 < argc) {
+            InterestWeights *w = &interest_weights;
+            if (sscanf(argv[++i], "%f,%f,%f,%f", &w->decisive, &w->length, &w->volatility, &w->rating) != 4) {
+                printf("--interest-weights needs four numbers: decisive,length,volatility,rating\n");
+                return 1;
+            }
+            interesting = 1;
+        } else if (strcmp(argv[i], "--find-player") == 0 && i + 1 < argc) {
+            find_player = argv[++i];
+        } else if (strcmp(argv[i], "--find-fen") == 0 && i + 1 < argc) {
+            find_fen = argv[++i];
+        } else if (strcmp(argv[i], "--vs") == 0 && i + 2 < argc) {
+            vs_a = argv[++i];
+            vs_b = argv[++i];
+        } else if (strcmp(argv[i], "--puzzles") == 0) {
+            puzzle_mode = 1;
+        } else if (strcmp(argv[i], "--eval") == 0) {
+            eval_enabled = 1;
+        } else if (strcmp(argv[i], "--shm-client") == 0 && i + 1 < argc) {
+            return run_shm_client(argv[++i]);
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            printf("Usage: %s [--windowed] [--all-displays] [--turbo] [--highlights] [--build-index] [--index-slice LIST] [--merge-index SLICE...] [--terminal] [--control PATH] [--shm NAME [--shm-frames]] [--shm-client NAME] [--syzygy PATHS [--syzygy-check]] [--eval] [--mine-puzzles] [--puzzles] [--top-positions N [--top-in PATH]] [--vs PLAYER PLAYER] [--interesting] [--interest-weights D,L,V,R] [--find-player NAME] [--find-fen FEN]\n", argv[0]);
+            return 1;
+        }
+    }
+    games_dir_root = games_dir;
+    if (syzygy_check) {
+        if (!tb.active) {
+            printf("--syzygy-check needs --syzygy PATHS\n");
+            return 1;
+        }
+        int passed = tb_check_known();
+        tb_free();
+        return passed ? 0 : 1;
+    }
+    if (build_only) {
+        return build_index(games_dir) ? 0 : 1;
+    }
+    if (slice_list) {
+        return index_slice(games_dir, slice_list) ? 0 : 1;
+    }
+    if (merge_count > 0) {
+        return merge_slices(games_dir, merge_paths, merge_count) ? 0 : 1;
+    }
+    index_load(games_dir);
+    if (mine_only) {
+        int mined = mine_puzzles(games_dir);
+        index_free();
+        scid_cache_free();
+        return mined ? 0 : 1;
+    }
+    if (find_player || find_fen) {
+        int searched = find_games(games_dir, find_player, find_fen);
+        index_free();
+        scid_cache_free();
+        return searched ? 0 : 1;
+    }
+    if (top_positions) {
+        int reported = report_top_positions(games_dir, top_positions, top_in);
+        index_free();
+        scid_cache_free();
+        return reported ? 0 : 1;
+    }
+    if (vs_a) {
+        CorpusIndex *ix = index_acquire();
+        int found = head_to_head(ix, vs_a, vs_b);
+        index_release(ix);
+        if (found < 0) {
+            printf("--vs needs the index; build it first with --build-index\n");
+            return 1;
+        }
+        if (found == 0) {
+            printf("No games between %s and %s in the index\n", vs_a, vs_b);
+            return 1;
+        }
+        printf("%d games between %s and %s\n", found, vs_a, vs_b);
+        matchup_players[0] = vs_a;
+        matchup_players[1] = vs_b;
+    }
+    if (interesting) {
+        CorpusIndex *ix = index_acquire();
+        int built = interest_build(ix, &interest_weights);
+        index_release(ix);
+        if (!built) {
+            printf("--interesting needs the index; build it first with --build-index\n");
+            return 1;
+        }
+        interest_mode = 1;
+    }
+    if (puzzle_mode && puzzle_load(games_dir) == 0) {
+        printf("No puzzles for %s; mine them with --mine-puzzles\n", games_dir);
+        return 1;
+    }
+    if (eval_enabled) eval_cache_open(games_dir);
+
+    // Initialize SDL; the terminal renderer only needs timers and threads, no video.
+    if (SDL_Init(terminal_mode ? SDL_INIT_TIMER : SDL_INIT_VIDEO) < 0 ||
+        (!terminal_mode && !(IMG_Init(IMG_INIT_PNG) & IMG_INIT_PNG))) {
+        printf("SDL init error: %s\n", SDL_GetError());
+        return 1;
+    }
+
+    int window_count = all_displays ? SDL_GetNumVideoDisplays() : 1;
+    if (window_count < 1) window_count = 1;
+    if (window_count > MAX_VIEWERS) window_count = MAX_VIEWERS;
+    if (terminal_mode) {
+        window_count = 0;
+        viewer_init(&viewers[0], 0);
+        viewer_count = 1;
+    }
+    Uint32 window_flags = SDL_WINDOW_SHOWN | (windowed ? SDL_WINDOW_RESIZABLE : SDL_WINDOW_FULLSCREEN_DESKTOP);
+    Uint32 renderer_flags = SDL_RENDERER_ACCELERATED;
+    if (window_count == 1) renderer_flags |= SDL_RENDERER_PRESENTVSYNC;
+    for (int i = 0; i < window_count; i++) {
+        Viewer *v = &viewers[i];
+        viewer_init(v, i);
+        v->window = SDL_CreateWindow("Chess Viewer", SDL_WINDOWPOS_CENTERED_DISPLAY(i), SDL_WINDOWPOS_CENTERED_DISPLAY(i),
+                                     SCREEN_SIZE, SCREEN_SIZE, window_flags);
+        v->renderer = v->window ? SDL_CreateRenderer(v->window, -1, renderer_flags) : NULL;
+        if (!v->window || !v->renderer) {
+            printf("SDL window/renderer error: %s\n", SDL_GetError());
+            viewer_destroy(v);
+            for (int j = 0; j < viewer_count; j++) viewer_destroy(&viewers[j]);
+            SDL_Quit();
+            return 1;
+        }
+        v->window_id = SDL_GetWindowID(v->window);
+        SDL_RendererInfo info;
+        v->has_vsync = (SDL_GetRendererInfo(v->renderer, &info) == 0 &&
+                        (info.flags & SDL_RENDERER_PRESENTVSYNC));
+        v->render_cache.can_target = (SDL_RenderTargetSupported(v->renderer) == SDL_TRUE);
+        v->refresh_ms = display_refresh_ms(v);
+        SDL_AtomicSet(&v->frame_ms, v->refresh_ms);
+        note_mouse_activity(v, SDL_GetTicks());
+        viewer_count++;
+    }
+    if (!terminal_mode) {
+        analysis_cursor = create_analysis_cursor();
+        if (!analysis_cursor) {
+            analysis_cursor = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_CROSSHAIR);
+        }
+    }
+
+    srand((unsigned int)time(NULL));
+
+    int status = 0;
+    if (control_path && !control_open(control_path)) {
+        status = 1;
+    }
+    if (shm_frames && !shm_name) {
+        printf("--shm-frames needs --shm NAME\n");
+        status = 1;
+    } else if (shm_name && !shm_create(shm_name, shm_frames)) {
+        status = 1;
+    }
+    int term_opened = 0;
+    if (terminal_mode && status == 0) {
+        term_opened = term_open();
+        if (!term_opened) status = 1;
+    }
+    if (!prefetch_start(viewer_count)) {
+        printf("SDL thread error: %s\n", SDL_GetError());
+        status = 1;
+    }
+    if (status == 0 && eval_enabled && !eval_start()) {
+        printf("SDL thread error: %s\n", SDL_GetError());
+        status = 1;
+    }
+    if (status == 0) index_watch_start(games_dir);
+    for (int i = 0; i < viewer_count && status == 0; i++) {
+        Viewer *v = &viewers[i];
+        v->logic_thread = SDL_CreateThread(logic_thread_main, "logic", v);
+        if (!v->logic_thread) {
+            printf("SDL thread error: %s\n", SDL_GetError());
+            status = 1;
+        }
+    }
+    if (status != 0) {
+        // Let whatever did start wind down before tearing the windows away.
+        for (int i = 0; i < viewer_count; i++) {
+            if (!viewers[i].logic_thread) SDL_AtomicSet(&viewers[i].logic_finished, 1);
+        }
+        request_quit_all();
+    }
+    if (terminal_mode) {
+        terminal_loop();
+    } else {
+        render_loop();
+    }
+    for (int i = 0; i < viewer_count; i++) {
+        if (viewers[i].logic_thread) SDL_WaitThread(viewers[i].logic_thread, NULL);
+    }
+    index_watch_stop();
+    eval_stop();
+    prefetch_shutdown();
+    control_close();
+    shm_destroy();
+    if (term_opened) term_close();
 
     // Cleanup
+    for (int i = 0; i < viewer_count; i++) {
+        viewer_destroy(&viewers[i]);
+    }
     for (int i = 0; i < 256; i++) {
-        if (piece_textures[i]) SDL_DestroyTexture(piece_textures[i]);
+        if (piece_surfaces[i]) SDL_FreeSurface(piece_surfaces[i]);
     }
     if (analysis_cursor) {
         SDL_FreeCursor(analysis_cursor);
         analysis_cursor = NULL;
     }
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
+    puzzle_free();
+    index_free();
+    scid_cache_free();
+    tb_free();
+    eval_cache_close();
     IMG_Quit();
     SDL_Quit();
 
-    return 0;
+    return status;
 }